@@ -65,6 +65,15 @@ extern void kmem_cache_free(kmem_cache_t *, void *);
 #define kmem_debugging() 0
 #define kmem_cache_reap_now(c)
 
-extern uint64_t get_real_memusage();
+/*
+ * Memory available to the process and host memory pressure.
+ */
+typedef struct kmem_memstat {
+	uint64_t	km_avail;	/* bytes allocatable until a limit hits */
+	uint64_t	km_limit;	/* smallest of cgroup and host limits */
+	uint32_t	km_pressure;	/* PSI memory "some" avg10, 1/100 % */
+} kmem_memstat_t;
+
+extern void kmem_memstat(kmem_memstat_t *ms);
 
 #endif
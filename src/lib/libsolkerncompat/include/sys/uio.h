@@ -184,6 +184,24 @@ typedef enum uio_rw { UIO_READ, UIO_WRITE } uio_rw_t;
 #define	UIO_COPY_CACHED		0x0001	/* copy should not bypass caches */
 
 #define	UIO_ASYNC		0x0002	/* uio_t is really a uioa_t */
+#define	UIO_XUIO		0x0004	/* uio_t is really a xuio_t */
+
+/*
+ * Extended uio_t xuio_t used for zero copy writes: the data of
+ * whole records is held in arc buffers loaned from the DMU, which the
+ * filesystem assigns to the file instead of copying. xu_bufs[i] covers
+ * the record starting at xu_offset + i * xu_blksz; consumed buffers are
+ * set to NULL, the rest must be returned by the owner of the xuio_t.
+ */
+struct arc_buf;
+
+typedef struct xuio {
+	uio_t		xu_uio;		/* embedded uio_t, must be first */
+	offset_t	xu_offset;	/* file offset of first loaned buffer */
+	size_t		xu_blksz;	/* size of every loaned buffer */
+	int		xu_nbufs;	/* number of loaned buffers */
+	struct arc_buf	**xu_bufs;	/* loaned buffers */
+} xuio_t;
 
 /*
  * Global uioasync capability shadow state.
@@ -24,53 +24,173 @@
  */
 
 #include <sys/kmem.h>
+#include <sys/sysmacros.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <errno.h>
+#include <limits.h>
+#include <inttypes.h>
+#include <pthread.h>
 
-/* This really sucks but we have no choice since getrusage() doesn't work.. */
-uint64_t get_real_memusage()
+/*
+ * Memory available to us is bounded by the host (MemAvailable in
+ * /proc/meminfo) and by the cgroup v2 limits of our cgroup.  Pressure is
+ * taken from PSI, of the cgroup when it has one, otherwise of the host.
+ */
+
+#define	CGROUP_ROOT	"/sys/fs/cgroup"
+
+static pthread_once_t kmem_cgroup_once = PTHREAD_ONCE_INIT;
+static char kmem_cgroup_dir[PATH_MAX];
+
+/* Find directory of our cgroup v2, left empty if there is none. */
+static void
+kmem_cgroup_init(void)
 {
-	int error_n = -1;
+	char buf[PATH_MAX];
+	char path[PATH_MAX];
+	FILE *f = fopen("/proc/self/cgroup", "r");
 
-	FILE *f = fopen("/proc/self/status", "r");
+	if (f == NULL)
+		return;
 
-	if(f == NULL) {
-		error_n = errno;
-		goto error;
+	while (fgets(buf, sizeof (buf), f) != NULL) {
+		if (strncmp(buf, "0::", 3) != 0)
+			continue;
+		buf[strcspn(buf, "\n")] = '\0';
+		(void) snprintf(path, sizeof (path), "%s%s/memory.current",
+		    CGROUP_ROOT, strcmp(buf + 3, "/") == 0 ? "" : buf + 3);
+		if (access(path, R_OK) == 0)
+			*strrchr(path, '/') = '\0';
+		else
+			path[0] = '\0';
+		(void) strlcpy(kmem_cgroup_dir, path, sizeof (kmem_cgroup_dir));
+		break;
 	}
+	fclose(f);
+}
 
-	uint64_t memusage = 0;
+/*
+ * Read "<key> <value>" lines of file, like memory.stat or /proc/meminfo,
+ * values of keys not found are left untouched.
+ */
+static void
+kmem_read_keys(const char *path, const char **keys, uint64_t *vals, int n)
+{
+	char buf[256];
+	char key[64];
+	u_longlong_t val;
+	int i;
+	FILE *f = fopen(path, "r");
+
+	if (f == NULL)
+		return;
 
-	for(;;) {
-		char buf[512];
-		char key[100];
-		u_longlong_t val;
+	while (fgets(buf, sizeof (buf), f) != NULL) {
+		if (sscanf(buf, "%63[^: ]%*[: ] %Lu", key, &val) != 2)
+			continue;
+		for (i = 0; i < n; i++) {
+			if (strcmp(key, keys[i]) == 0)
+				vals[i] = val;
+		}
+	}
+	fclose(f);
+}
 
-		if(fgets(buf, sizeof(buf), f) == NULL)
-			goto error;
- 
-		int res = sscanf(buf, "%99[^:]: %Lu", key, &val);
+/* Read single number of cgroup file, "max" reads as UINT64_MAX. */
+static int
+kmem_cgroup_read(const char *name, uint64_t *val)
+{
+	char path[PATH_MAX];
+	char buf[32];
+	FILE *f;
+	int ret = -1;
 
-		if(res == 2 && strcmp(key, "VmRSS") == 0) {
-			memusage = val << 10;
-			break;
+	(void) snprintf(path, sizeof (path), "%s/%s", kmem_cgroup_dir, name);
+	if ((f = fopen(path, "r")) == NULL)
+		return (-1);
+
+	if (fgets(buf, sizeof (buf), f) != NULL) {
+		if (strncmp(buf, "max", 3) == 0) {
+			*val = UINT64_MAX;
+			ret = 0;
+		} else if (sscanf(buf, "%" SCNu64, val) == 1) {
+			ret = 0;
 		}
 	}
+	fclose(f);
+	return (ret);
+}
+
+/* Read "some avg10=" of PSI memory file, in hundredths of percent. */
+static int
+kmem_pressure_read(const char *path, uint32_t *pressure)
+{
+	char buf[256];
+	unsigned int whole, frac;
+	FILE *f = fopen(path, "r");
+	int ret = -1;
 
+	if (f == NULL)
+		return (-1);
+
+	while (fgets(buf, sizeof (buf), f) != NULL) {
+		if (sscanf(buf, "some avg10=%u.%2u", &whole, &frac) == 2) {
+			*pressure = whole * 100 + frac;
+			ret = 0;
+			break;
+		}
+	}
 	fclose(f);
+	return (ret);
+}
+
+void
+kmem_memstat(kmem_memstat_t *ms)
+{
+	static const char *meminfo_keys[] = { "MemTotal", "MemAvailable" };
+	static const char *stat_keys[] = { "inactive_file" };
+	uint64_t meminfo[2] = { 0, UINT64_MAX >> 10 };
+	uint64_t inactive_file = 0;
+	uint64_t current, max, high;
+	char path[PATH_MAX];
+
+	(void) pthread_once(&kmem_cgroup_once, kmem_cgroup_init);
 
-	return memusage;
+	kmem_read_keys("/proc/meminfo", meminfo_keys, meminfo, 2);
+	ms->km_limit = meminfo[0] != 0 ? meminfo[0] << 10 : UINT64_MAX;
+	ms->km_avail = meminfo[1] << 10;
+	ms->km_pressure = 0;
+
+	if (kmem_cgroup_dir[0] != '\0' &&
+	    kmem_cgroup_read("memory.current", &current) == 0) {
+		if (kmem_cgroup_read("memory.max", &max) != 0)
+			max = UINT64_MAX;
+		if (kmem_cgroup_read("memory.high", &high) == 0)
+			max = MIN(max, high);
+
+		/*
+		 * Inactive page cache, mostly of vdev files, is reclaimed by
+		 * the kernel before it counts against the limit.
+		 */
+		(void) snprintf(path, sizeof (path), "%s/memory.stat",
+		    kmem_cgroup_dir);
+		kmem_read_keys(path, stat_keys, &inactive_file, 1);
+		current -= MIN(current, inactive_file);
+
+		if (max != UINT64_MAX) {
+			ms->km_limit = MIN(ms->km_limit, max);
+			ms->km_avail = MIN(ms->km_avail,
+			    max > current ? max - current : 0);
+		}
 
-error:
-	if(f == NULL)
-		fprintf(stderr, "Error: unable to open /proc/self/status (error %i)\nMake sure you have the proc filesystem mounted.\n", error_n);
-	else {
-		fprintf(stderr, "Error: unable to read /proc/self/status (error %i)\n", error_n);
-		fclose(f);
+		(void) snprintf(path, sizeof (path), "%s/memory.pressure",
+		    kmem_cgroup_dir);
+		if (kmem_pressure_read(path, &ms->km_pressure) == 0)
+			return;
 	}
 
-	exit(1);
+	(void) kmem_pressure_read("/proc/pressure/memory", &ms->km_pressure);
 }
@@ -438,6 +438,16 @@ zpool_valid_proplist(libzfs_handle_t *hdl, const char *poolname,
 			zpool_close(zhp);
 			break;
 
+		case ZPOOL_PROP_READONLY:
+			if (!create_or_import) {
+				zfs_error_aux(hdl, dgettext(TEXT_DOMAIN,
+				    "property '%s' can only be set at "
+				    "import time"), propname);
+				(void) zfs_error(hdl, EZFS_BADPROP, errbuf);
+				goto error;
+			}
+			break;
+
 		case ZPOOL_PROP_ALTROOT:
 			if (!create_or_import) {
 				zfs_error_aux(hdl, dgettext(TEXT_DOMAIN,
@@ -910,7 +920,7 @@ zpool_create(libzfs_handle_t *hdl, const char *pool, nvlist_t *nvroot,
 
 		case ENOTBLK:
 			zfs_error_aux(hdl, dgettext(TEXT_DOMAIN,
-			    "cache device must be a disk or disk slice"));
+			    "cache device must be a disk, disk slice or file"));
 			return (zfs_error(hdl, EZFS_BADDEV, msg));
 
 		default:
@@ -1074,7 +1084,7 @@ zpool_add(zpool_handle_t *zhp, nvlist_t *nvroot)
 
 		case ENOTBLK:
 			zfs_error_aux(hdl, dgettext(TEXT_DOMAIN,
-			    "cache device must be a disk or disk slice"));
+			    "cache device must be a disk, disk slice or file"));
 			(void) zfs_error(hdl, EZFS_BADDEV, msg);
 			break;
 
@@ -226,13 +226,35 @@ typedef struct dmu_buf_impl {
 	uint8_t db_dirtycnt;
 } dmu_buf_impl_t;
 
-/* Note: the dbuf hash table is exposed only for the mdb module */
-#define	DBUF_MUTEXES 256
-#define	DBUF_HASH_MUTEX(h, idx) (&(h)->hash_mutexes[(idx) & (DBUF_MUTEXES-1)])
+/*
+ * Note: the dbuf hash table is exposed only for the mdb module
+ *
+ * ZFSFUSE: mutexes are picked by the hash value above its
+ * DBUF_HASH_LINE_SHIFT lowest bits and the table has at least
+ * DBUF_HASH_MIN buckets, so that all dbufs of a bucket, in either table
+ * while the table is grown, and all bucket heads of a cache line share
+ * a mutex.
+ */
+#define	DBUF_MUTEXES 4096
+#define	DBUF_HASH_LINE_SHIFT 3
+#define	DBUF_HASH_MIN (DBUF_MUTEXES << DBUF_HASH_LINE_SHIFT)
+#define	DBUF_HASH_MUTEX(h, hv) (&(h)->hash_mutexes[((hv) >> \
+	DBUF_HASH_LINE_SHIFT) & (DBUF_MUTEXES-1)].dhm_mtx)
+
+#define	DBUF_HASH_MUTEX_PAD 64
+struct dbuf_hash_mutex {
+	kmutex_t	dhm_mtx;
+#ifdef _KERNEL
+	unsigned char	pad[(DBUF_HASH_MUTEX_PAD - sizeof (kmutex_t))];
+#endif
+};
+
 typedef struct dbuf_hash_table {
 	uint64_t hash_table_mask;
 	dmu_buf_impl_t **hash_table;
-	kmutex_t hash_mutexes[DBUF_MUTEXES];
+	uint64_t hash_newmask;		/* table being grown into */
+	dmu_buf_impl_t **hash_newtable;
+	struct dbuf_hash_mutex hash_mutexes[DBUF_MUTEXES];
 } dbuf_hash_table_t;
 
 
@@ -260,6 +282,7 @@ int dbuf_read(dmu_buf_impl_t *db, zio_t *zio, uint32_t flags);
 void dbuf_will_dirty(dmu_buf_impl_t *db, dmu_tx_t *tx);
 void dmu_buf_will_fill(dmu_buf_t *db, dmu_tx_t *tx);
 void dbuf_fill_done(dmu_buf_impl_t *db, dmu_tx_t *tx);
+void dbuf_assign_arcbuf(dmu_buf_impl_t *db, arc_buf_t *buf, dmu_tx_t *tx);
 void dmu_buf_will_fill(dmu_buf_t *db, dmu_tx_t *tx);
 void dmu_buf_fill_done(dmu_buf_t *db, dmu_tx_t *tx);
 dbuf_dirty_record_t *dbuf_dirty(dmu_buf_impl_t *db, dmu_tx_t *tx);
@@ -340,6 +340,8 @@ extern void spa_async_request(spa_t *spa, int flag);
 extern void spa_async_unrequest(spa_t *spa, int flag);
 extern void spa_async_suspend(spa_t *spa);
 extern void spa_async_resume(spa_t *spa);
+extern void spa_async_defer(void);
+extern void spa_async_undefer(void);
 extern spa_t *spa_inject_addref(char *pool);
 extern void spa_inject_delref(spa_t *spa);
 
@@ -413,6 +415,7 @@ extern boolean_t spa_refcount_zero(spa_t *spa);
 
 /* Pool configuration lock */
 extern void spa_config_enter(spa_t *spa, krw_t rw, void *tag);
+extern boolean_t spa_config_tryenter(spa_t *spa, krw_t rw, void *tag);
 extern void spa_config_exit(spa_t *spa, void *tag);
 extern boolean_t spa_config_held(spa_t *spa, krw_t rw);
 
@@ -443,6 +446,7 @@ extern uint64_t spa_version(spa_t *spa);
 extern int spa_max_replication(spa_t *spa);
 extern int spa_busy(void);
 extern uint8_t spa_get_failmode(spa_t *spa);
+extern boolean_t spa_writeable(spa_t *spa);
 
 /* Miscellaneous support routines */
 extern int spa_rename(const char *oldname, const char *newname);
@@ -168,6 +168,7 @@ struct spa {
 	struct zio_aio_ctx *spa_aio_ctx;	/* asynchronous I/O context */
 	boolean_t	spa_import_faulted;	/* allow faulted vdevs */
 	boolean_t	spa_is_root;		/* pool is root */
+	boolean_t	spa_readonly;		/* imported read-only, no txgs */
 	int		spa_minref;		/* num refs when first opened */
 	spa_log_state_t spa_log_state;		/* log state */
 	/*
@@ -149,6 +149,8 @@ enum zio_compress {
 #define	ZIO_FLAG_METADATA		0x40000
 #define	ZIO_FLAG_WRITE_RETRY		0x80000
 
+#define	ZIO_FLAG_RAW			0x100000	/* read without decompress */
+
 #define	ZIO_FLAG_GANG_INHERIT		\
 	(ZIO_FLAG_CANFAIL |		\
 	ZIO_FLAG_FAILFAST |		\
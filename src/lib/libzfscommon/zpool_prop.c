@@ -96,6 +96,8 @@ zpool_prop_init(void)
 	    ZFS_TYPE_POOL, "on | off", "DELEGATION", boolean_table);
 	register_index(ZPOOL_PROP_AUTOREPLACE, "autoreplace", 0, PROP_DEFAULT,
 	    ZFS_TYPE_POOL, "on | off", "REPLACE", boolean_table);
+	register_index(ZPOOL_PROP_READONLY, "readonly", 0, PROP_DEFAULT,
+	    ZFS_TYPE_POOL, "on | off", "RDONLY", boolean_table);
 
 	/* default index properties */
 	register_index(ZPOOL_PROP_FAILUREMODE, "failmode",
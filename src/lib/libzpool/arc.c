@@ -120,10 +120,12 @@
 #include <sys/spa.h>
 #include <sys/zio.h>
 #include <sys/zio_checksum.h>
+#include <sys/zio_compress.h>
 #include <sys/zfs_context.h>
 #include <sys/arc.h>
 #include <sys/refcount.h>
 #include <sys/vdev.h>
+#include <sys/vdev_impl.h>
 #ifdef _KERNEL
 #include <sys/vmsystm.h>
 #include <vm/anon.h>
@@ -172,6 +174,25 @@ static boolean_t arc_warm;
 uint64_t zfs_arc_max;
 uint64_t zfs_arc_min;
 uint64_t zfs_arc_meta_limit = 0;
+/*
+ * ZFSFUSE: memory kept free for the rest of the process, 0 means 1/64 of
+ * the memory limit but at least 32MB, and PSI memory pressure (in 1/100
+ * of percent of time stalled) at which the arc is shrunk.
+ */
+uint64_t zfs_arc_free_target = 0;
+uint32_t zfs_arc_pressure_threshold = 1000;
+/*
+ * ZFSFUSE: cache compressed blocks in their on-disk form and decompress
+ * them when a buffer is handed out.  Decompressed copies of compressed
+ * blocks are trimmed down to 1/2^zfs_arc_decompressed_shift of arc_c.
+ */
+int zfs_arc_compressed = 1;
+int zfs_arc_decompressed_shift = 3;
+/*
+ * ZFSFUSE: number of sublists per arc state, read by arc_init().  Setting
+ * it to 1 gives back the single list and lock per state.
+ */
+int zfs_arc_num_sublists = 8;
 int zfs_mdcomp_disable = 0;
 
 /*
@@ -206,11 +227,23 @@ int zfs_mdcomp_disable = 0;
  * second level ARC benefit from these fast lookups.
  */
 
+/*
+ * ZFSFUSE: the evictable buffers of a state are spread by their hash over
+ * arc_num_sublists lists, each with its own lock, so that accesses to
+ * different blocks don't serialize on a single state mutex.  Eviction
+ * takes an even share from each sublist, starting from a different one
+ * every time, which keeps the state in approximately LRU order.
+ */
+typedef struct arc_sublist {
+	kmutex_t	asl_mtx;
+	list_t		asl_list;
+} arc_sublist_t;
+
 typedef struct arc_state {
-	list_t	arcs_list[ARC_BUFC_NUMTYPES];	/* list of evictable buffers */
+	arc_sublist_t *arcs_sublists[ARC_BUFC_NUMTYPES]; /* evictable bufs */
 	uint64_t arcs_lsize[ARC_BUFC_NUMTYPES];	/* amount of evictable data */
 	uint64_t arcs_size;	/* total amount of data in this state */
-	kmutex_t arcs_mtx;
+	uint32_t arcs_evict_next[ARC_BUFC_NUMTYPES]; /* first sublist */
 } arc_state_t;
 
 /* The 6 states: */
@@ -245,18 +278,26 @@ typedef struct arc_stats {
 	kstat_named_t arcstat_hash_collisions;
 	kstat_named_t arcstat_hash_chains;
 	kstat_named_t arcstat_hash_chain_max;
+	kstat_named_t arcstat_hash_buckets;
 	kstat_named_t arcstat_p;
 	kstat_named_t arcstat_c;
 	kstat_named_t arcstat_c_min;
 	kstat_named_t arcstat_c_max;
 	kstat_named_t arcstat_size;
 	kstat_named_t arcstat_hdr_size;
+	kstat_named_t arcstat_compressed_size;
+	kstat_named_t arcstat_uncompressed_size;
+	kstat_named_t arcstat_decompressed_size;
+	kstat_named_t arcstat_decompress_hits;
+	kstat_named_t arcstat_sublist_lock_waits;
+	kstat_named_t arcstat_sublist_lock_wait_ns;
 	kstat_named_t arcstat_l2_hits;
 	kstat_named_t arcstat_l2_misses;
 	kstat_named_t arcstat_l2_feeds;
 	kstat_named_t arcstat_l2_rw_clash;
 	kstat_named_t arcstat_l2_writes_sent;
 	kstat_named_t arcstat_l2_writes_done;
+	kstat_named_t arcstat_l2_write_bytes;
 	kstat_named_t arcstat_l2_writes_error;
 	kstat_named_t arcstat_l2_writes_hdr_miss;
 	kstat_named_t arcstat_l2_evict_lock_retry;
@@ -267,6 +308,13 @@ typedef struct arc_stats {
 	kstat_named_t arcstat_l2_io_error;
 	kstat_named_t arcstat_l2_size;
 	kstat_named_t arcstat_l2_hdr_size;
+	kstat_named_t arcstat_l2_log_blk_writes;
+	kstat_named_t arcstat_l2_dev_hdr_errors;
+	kstat_named_t arcstat_l2_rebuild_success;
+	kstat_named_t arcstat_l2_rebuild_abort;
+	kstat_named_t arcstat_l2_rebuild_log_blks;
+	kstat_named_t arcstat_l2_rebuild_bufs;
+	kstat_named_t arcstat_l2_rebuild_bufs_present;
 	kstat_named_t arcstat_memory_throttle_count;
 } arc_stats_t;
 
@@ -294,18 +342,26 @@ static arc_stats_t arc_stats = {
 	{ "hash_collisions",		KSTAT_DATA_UINT64 },
 	{ "hash_chains",		KSTAT_DATA_UINT64 },
 	{ "hash_chain_max",		KSTAT_DATA_UINT64 },
+	{ "hash_buckets",		KSTAT_DATA_UINT64 },
 	{ "p",				KSTAT_DATA_UINT64 },
 	{ "c",				KSTAT_DATA_UINT64 },
 	{ "c_min",			KSTAT_DATA_UINT64 },
 	{ "c_max",			KSTAT_DATA_UINT64 },
 	{ "size",			KSTAT_DATA_UINT64 },
 	{ "hdr_size",			KSTAT_DATA_UINT64 },
+	{ "compressed_size",		KSTAT_DATA_UINT64 },
+	{ "uncompressed_size",		KSTAT_DATA_UINT64 },
+	{ "decompressed_size",		KSTAT_DATA_UINT64 },
+	{ "decompress_hits",		KSTAT_DATA_UINT64 },
+	{ "sublist_lock_waits",		KSTAT_DATA_UINT64 },
+	{ "sublist_lock_wait_ns",	KSTAT_DATA_UINT64 },
 	{ "l2_hits",			KSTAT_DATA_UINT64 },
 	{ "l2_misses",			KSTAT_DATA_UINT64 },
 	{ "l2_feeds",			KSTAT_DATA_UINT64 },
 	{ "l2_rw_clash",		KSTAT_DATA_UINT64 },
 	{ "l2_writes_sent",		KSTAT_DATA_UINT64 },
 	{ "l2_writes_done",		KSTAT_DATA_UINT64 },
+	{ "l2_write_bytes",		KSTAT_DATA_UINT64 },
 	{ "l2_writes_error",		KSTAT_DATA_UINT64 },
 	{ "l2_writes_hdr_miss",		KSTAT_DATA_UINT64 },
 	{ "l2_evict_lock_retry",	KSTAT_DATA_UINT64 },
@@ -316,6 +372,13 @@ static arc_stats_t arc_stats = {
 	{ "l2_io_error",		KSTAT_DATA_UINT64 },
 	{ "l2_size",			KSTAT_DATA_UINT64 },
 	{ "l2_hdr_size",		KSTAT_DATA_UINT64 },
+	{ "l2_log_blk_writes",		KSTAT_DATA_UINT64 },
+	{ "l2_dev_hdr_errors",		KSTAT_DATA_UINT64 },
+	{ "l2_rebuild_success",		KSTAT_DATA_UINT64 },
+	{ "l2_rebuild_abort",		KSTAT_DATA_UINT64 },
+	{ "l2_rebuild_log_blks",	KSTAT_DATA_UINT64 },
+	{ "l2_rebuild_bufs",		KSTAT_DATA_UINT64 },
+	{ "l2_rebuild_bufs_present",	KSTAT_DATA_UINT64 },
 	{ "memory_throttle_count",	KSTAT_DATA_UINT64 }
 };
 
@@ -364,6 +427,7 @@ static arc_state_t	*arc_mru_ghost;
 static arc_state_t	*arc_mfu;
 static arc_state_t	*arc_mfu_ghost;
 static arc_state_t	*arc_l2c_only;
+static int		arc_num_sublists;
 
 /*
  * There are several ARC variables that are critical to export as kstats --
@@ -378,9 +442,14 @@ static arc_state_t	*arc_l2c_only;
 #define	arc_c		ARCSTAT(arcstat_c)	/* target size of cache */
 #define	arc_c_min	ARCSTAT(arcstat_c_min)	/* min target cache size */
 #define	arc_c_max	ARCSTAT(arcstat_c_max)	/* max target cache size */
+#define	arc_decompressed_size	ARCSTAT(arcstat_decompressed_size)
 
 static int		arc_no_grow;	/* Don't try to grow cache size */
+static int		arc_memory_low;	/* memory monitor wants reclaim */
+static uint64_t		arc_need_free;	/* bytes missing to free target */
+static uint64_t		arc_c_max_conf;	/* arc_c_max as configured */
 static uint64_t		arc_tempreserve;
+static uint64_t		arc_loaned_bytes;
 static uint64_t		arc_meta_used;
 static uint64_t		arc_meta_limit;
 static uint64_t		arc_meta_max = 0;
@@ -428,6 +497,11 @@ struct arc_buf_hdr {
 	uint64_t		b_size;
 	spa_t			*b_spa;
 
+	/* compressed copy of the block, protected by hash lock */
+	void			*b_cdata;
+	uint32_t		b_psize;
+	uint8_t			b_comp;
+
 	/* protected by arc state mutex */
 	arc_state_t		*b_state;
 	list_node_t		b_arc_node;
@@ -497,6 +571,13 @@ static void arc_evict_ghost(arc_state_t *state, spa_t *spa, int64_t bytes);
  */
 
 #define	HDR_SIZE ((int64_t)sizeof (arc_buf_hdr_t))
+
+/*
+ * Bytes of data held by a hdr: its buffers and the compressed copy.
+ */
+#define	HDR_DATA_SIZE(hdr)	\
+	((hdr)->b_datacnt * (hdr)->b_size +	\
+	((hdr)->b_cdata != NULL ? (hdr)->b_psize : 0))
 #define	L2HDR_SIZE ((int64_t)sizeof (l2arc_buf_hdr_t))
 
 /*
@@ -512,21 +593,44 @@ struct ht_lock {
 #endif
 };
 
-#define	BUF_LOCKS 256
+/*
+ * ZFSFUSE: the hash table starts small and doubles when it holds on
+ * average more than BUF_HASH_LOAD hdrs per bucket.  The reclaim thread
+ * grows it one bucket at a time while lookups go on: while a new table
+ * exists lookups search both tables and inserts go into the new one.
+ *
+ * A lock is picked by the hash bits above the BUF_HASH_LINE_SHIFT lowest
+ * ones, and tables have at least BUF_LOCKS << BUF_HASH_LINE_SHIFT
+ * buckets.  So all hdrs of a bucket, in either table, share a lock, and
+ * so do the bucket heads sharing a cache line.  Switching tables takes
+ * all locks.
+ */
+#define	BUF_LOCKS		4096
+#define	BUF_HASH_LINE_SHIFT	3	/* log2(heads per line) */
+#define	BUF_HASH_MIN		(BUF_LOCKS << BUF_HASH_LINE_SHIFT)
+#define	BUF_HASH_LOAD		2
+
 typedef struct buf_hash_table {
 	uint64_t ht_mask;
 	arc_buf_hdr_t **ht_table;
+	uint64_t ht_newmask;		/* table being grown into */
+	arc_buf_hdr_t **ht_newtable;
 	struct ht_lock ht_locks[BUF_LOCKS];
 } buf_hash_table_t;
 
 static buf_hash_table_t buf_hash_table;
 
-#define	BUF_HASH_INDEX(spa, dva, birth) \
-	(buf_hash(spa, dva, birth) & buf_hash_table.ht_mask)
-#define	BUF_HASH_LOCK_NTRY(idx) (buf_hash_table.ht_locks[idx & (BUF_LOCKS-1)])
-#define	BUF_HASH_LOCK(idx)	(&(BUF_HASH_LOCK_NTRY(idx).ht_lock))
-#define	HDR_LOCK(buf) \
-	(BUF_HASH_LOCK(BUF_HASH_INDEX(buf->b_spa, &buf->b_dva, buf->b_birth)))
+#define	BUF_HASH_LOCK_NTRY(hv) \
+	(buf_hash_table.ht_locks[((hv) >> BUF_HASH_LINE_SHIFT) & (BUF_LOCKS-1)])
+#define	BUF_HASH_LOCK(hv)	(&(BUF_HASH_LOCK_NTRY(hv).ht_lock))
+#define	HDR_HASH(buf) \
+	buf_hash((buf)->b_spa, &(buf)->b_dva, (buf)->b_birth)
+#define	HDR_LOCK(buf)	(BUF_HASH_LOCK(HDR_HASH(buf)))
+
+/* the sublist of a state a hdr is kept on while evictable */
+#define	ARC_SUBLIST(state, hdr)	\
+	(&(state)->arcs_sublists[(hdr)->b_type] \
+	[HDR_HASH(hdr) % arc_num_sublists])
 
 uint64_t zfs_crc64_table[256];
 
@@ -549,6 +653,78 @@ uint64_t l2arc_write_boost = L2ARC_WRITE_SIZE;	/* extra write during warmup */
 uint64_t l2arc_headroom = L2ARC_HEADROOM;	/* number of dev writes */
 uint64_t l2arc_feed_secs = L2ARC_FEED_SECS;	/* interval seconds */
 boolean_t l2arc_noprefetch = B_TRUE;		/* don't cache prefetch bufs */
+boolean_t l2arc_rebuild_enabled = B_TRUE;	/* rebuild l2arc at import */
+uint64_t l2arc_log_secs = 30;			/* max age of a log block */
+
+/*
+ * ZFSFUSE: on-device format of the persistent L2ARC.  The device header
+ * is kept in the first L2ARC_DEV_HDR_SIZE bytes after the labels, the
+ * log blocks are written along with the buffers they describe.  Both
+ * are self-checksummed like vdev labels, with their address as the
+ * checksum verifier.
+ */
+#define	L2ARC_DEV_HDR_MAGIC	0x6c3261726368647aULL	/* "l2archdz" */
+#define	L2ARC_LOG_BLK_MAGIC	0x6c3261726c6f677aULL	/* "l2arlogz" */
+#define	L2ARC_PERSIST_VERSION	2ULL
+#define	L2ARC_DEV_HDR_SIZE	SPA_MINBLOCKSIZE
+#define	L2ARC_LOG_BLK_ENTRIES	1022	/* makes a log block 80K */
+#define	L2ARC_LOG_BLK_SIZE	(sizeof (l2arc_log_blk_phys_t))
+
+#define	L2ARC_DEV_HDR_WRAPPED	(1ULL << 0)	/* past first sweep */
+#define	L2ARC_LE_INDIRECT	(1 << 0)	/* ARC_INDIRECT */
+
+typedef struct l2arc_log_blkptr {
+	uint64_t	lbp_daddr;		/* device address, 0 if none */
+	uint64_t	lbp_seq;		/* sequence number of block */
+} l2arc_log_blkptr_t;
+
+typedef struct l2arc_log_ent_phys {
+	dva_t		le_dva;
+	uint64_t	le_birth;
+	uint64_t	le_cksum0;
+	zio_cksum_t	le_freeze_cksum;	/* checksum of the data */
+	uint64_t	le_daddr;		/* device address of data */
+	uint32_t	le_size;
+	uint8_t		le_type;		/* arc_buf_contents_t */
+	uint8_t		le_flags;		/* L2ARC_LE_* */
+	uint16_t	le_pad;
+} l2arc_log_ent_phys_t;
+
+typedef struct l2arc_log_blk_phys {
+	uint64_t		lb_magic;
+	uint64_t		lb_seq;
+	l2arc_log_blkptr_t	lb_prev;	/* next older log block */
+	uint64_t		lb_nentries;
+	uint64_t		lb_start;	/* daddr of the first entry */
+	l2arc_log_ent_phys_t	lb_entries[L2ARC_LOG_BLK_ENTRIES];
+	uint64_t		lb_pad[9];
+	zio_block_tail_t	lb_tail;
+} l2arc_log_blk_phys_t;
+
+typedef struct l2arc_dev_hdr_phys {
+	uint64_t		dh_magic;
+	uint64_t		dh_version;
+	uint64_t		dh_spa_guid;
+	uint64_t		dh_vdev_guid;
+	uint64_t		dh_start;	/* l2ad_start */
+	uint64_t		dh_end;		/* l2ad_end */
+	uint64_t		dh_hand;	/* l2ad_hand */
+	uint64_t		dh_evict;	/* l2ad_evict */
+	uint64_t		dh_flags;	/* L2ARC_DEV_HDR_* */
+	l2arc_log_blkptr_t	dh_log_head;	/* newest log block */
+	uint64_t		dh_pad[48];
+	zio_block_tail_t	dh_tail;
+} l2arc_dev_hdr_phys_t;
+
+/*
+ * ZFSFUSE: there is no CTASSERT here, a negative array size fails the
+ * build if the on-device structures don't fit the sizes they are read
+ * and written with.
+ */
+typedef char l2arc_dev_hdr_size_check
+	[sizeof (l2arc_dev_hdr_phys_t) == L2ARC_DEV_HDR_SIZE ? 1 : -1];
+typedef char l2arc_log_blk_size_check
+	[P2PHASE(L2ARC_LOG_BLK_SIZE, SPA_MINBLOCKSIZE) == 0 ? 1 : -1];
 
 /*
  * L2ARC Internals
@@ -565,8 +741,19 @@ typedef struct l2arc_dev {
 	boolean_t		l2ad_first;	/* first sweep through */
 	list_t			*l2ad_buflist;	/* buffer list */
 	list_node_t		l2ad_node;	/* device list node */
+	l2arc_log_blk_phys_t	*l2ad_log;	/* log block being filled */
+	uint64_t		l2ad_log_ents;	/* entries in l2ad_log */
+	clock_t			l2ad_log_lbolt;	/* when its first was added */
+	l2arc_log_blkptr_t	l2ad_log_head;	/* newest log block written */
+	l2arc_dev_hdr_phys_t	*l2ad_dev_hdr;	/* device header buffer */
+	uint64_t		l2ad_hdr_evict;	/* l2ad_evict in dev header */
+	uint64_t		l2ad_hdr_seq;	/* log head seq in dev header */
+	boolean_t		l2ad_rebuild;	/* being rebuilt, not fed */
+	boolean_t		l2ad_rebuild_cancel; /* device being removed */
 } l2arc_dev_t;
 
+#define	L2ARC_DEV_HDR_ADDR(dev)	((dev)->l2ad_start - L2ARC_DEV_HDR_SIZE)
+
 static list_t L2ARC_dev_list;			/* device list */
 static list_t *l2arc_dev_list;			/* device list pointer */
 static kmutex_t l2arc_dev_mtx;			/* device list mutex */
@@ -576,6 +763,8 @@ static list_t L2ARC_free_on_write;		/* free after write buf list */
 static list_t *l2arc_free_on_write;		/* free after write list ptr */
 static kmutex_t l2arc_free_on_write_mtx;	/* mutex for list */
 static uint64_t l2arc_ndev;			/* number of devices */
+static uint32_t l2arc_sublist_next;		/* sublist to feed from */
+static kcondvar_t l2arc_rebuild_cv;		/* a rebuild has ended */
 
 typedef struct l2arc_read_callback {
 	arc_buf_t	*l2rcb_buf;		/* read buffer */
@@ -612,22 +801,20 @@ static void l2arc_read_done(zio_t *zio);
 static void l2arc_hdr_stat_add(void);
 static void l2arc_hdr_stat_remove(void);
 
+/*
+ * Multiply-xorshift mix of the block identity, all bits of the result
+ * depend on all bits of the input.
+ */
+#define	BUF_HASH_MULT	0x9e3779b97f4a7c15ULL
+
 static uint64_t
 buf_hash(spa_t *spa, const dva_t *dva, uint64_t birth)
 {
-	uintptr_t spav = (uintptr_t)spa;
-	uint8_t *vdva = (uint8_t *)dva;
-	uint64_t crc = -1ULL;
-	int i;
-
-	ASSERT(zfs_crc64_table[128] == ZFS_CRC64_POLY);
-
-	for (i = 0; i < sizeof (dva_t); i++)
-		crc = (crc >> 8) ^ zfs_crc64_table[(crc ^ vdva[i]) & 0xFF];
-
-	crc ^= (spav>>8) ^ birth;
+	uint64_t h = ((uintptr_t)spa >> 6) ^ birth;
 
-	return (crc);
+	h = (h ^ dva->dva_word[0]) * BUF_HASH_MULT;
+	h = (h ^ (h >> 29) ^ dva->dva_word[1]) * BUF_HASH_MULT;
+	return (h ^ (h >> 32));
 }
 
 #define	BUF_EMPTY(buf)						\
@@ -640,21 +827,50 @@ buf_hash(spa_t *spa, const dva_t *dva, uint64_t birth)
 	((buf)->b_dva.dva_word[1] == (dva)->dva_word[1]) &&	\
 	((buf)->b_birth == birth) && ((buf)->b_spa == spa)
 
+/*
+ * Look up a hdr in the bucket for hv of both tables, the lock for hv
+ * must be held.
+ */
 static arc_buf_hdr_t *
-buf_hash_find(spa_t *spa, const dva_t *dva, uint64_t birth, kmutex_t **lockp)
+buf_hash_lookup(spa_t *spa, const dva_t *dva, uint64_t birth, uint64_t hv,
+    uint32_t *chainp)
 {
-	uint64_t idx = BUF_HASH_INDEX(spa, dva, birth);
-	kmutex_t *hash_lock = BUF_HASH_LOCK(idx);
+	buf_hash_table_t *ht = &buf_hash_table;
 	arc_buf_hdr_t *buf;
+	uint32_t i = 0;
 
-	mutex_enter(hash_lock);
-	for (buf = buf_hash_table.ht_table[idx]; buf != NULL;
-	    buf = buf->b_hash_next) {
-		if (BUF_EQUAL(spa, dva, birth, buf)) {
-			*lockp = hash_lock;
+	ASSERT(MUTEX_HELD(BUF_HASH_LOCK(hv)));
+
+	for (buf = ht->ht_table[hv & ht->ht_mask]; buf != NULL;
+	    buf = buf->b_hash_next, i++) {
+		if (BUF_EQUAL(spa, dva, birth, buf))
 			return (buf);
+	}
+	if (ht->ht_newtable != NULL) {
+		for (buf = ht->ht_newtable[hv & ht->ht_newmask]; buf != NULL;
+		    buf = buf->b_hash_next, i++) {
+			if (BUF_EQUAL(spa, dva, birth, buf))
+				return (buf);
 		}
 	}
+	if (chainp != NULL)
+		*chainp = i;
+	return (NULL);
+}
+
+static arc_buf_hdr_t *
+buf_hash_find(spa_t *spa, const dva_t *dva, uint64_t birth, kmutex_t **lockp)
+{
+	uint64_t hv = buf_hash(spa, dva, birth);
+	kmutex_t *hash_lock = BUF_HASH_LOCK(hv);
+	arc_buf_hdr_t *buf;
+
+	mutex_enter(hash_lock);
+	buf = buf_hash_lookup(spa, dva, birth, hv, NULL);
+	if (buf != NULL) {
+		*lockp = hash_lock;
+		return (buf);
+	}
 	mutex_exit(hash_lock);
 	*lockp = NULL;
 	return (NULL);
@@ -669,22 +885,25 @@ buf_hash_find(spa_t *spa, const dva_t *dva, uint64_t birth, kmutex_t **lockp)
 static arc_buf_hdr_t *
 buf_hash_insert(arc_buf_hdr_t *buf, kmutex_t **lockp)
 {
-	uint64_t idx = BUF_HASH_INDEX(buf->b_spa, &buf->b_dva, buf->b_birth);
-	kmutex_t *hash_lock = BUF_HASH_LOCK(idx);
-	arc_buf_hdr_t *fbuf;
+	buf_hash_table_t *ht = &buf_hash_table;
+	uint64_t hv = HDR_HASH(buf);
+	kmutex_t *hash_lock = BUF_HASH_LOCK(hv);
+	arc_buf_hdr_t *fbuf, **bucket;
 	uint32_t i;
 
 	ASSERT(!HDR_IN_HASH_TABLE(buf));
 	*lockp = hash_lock;
 	mutex_enter(hash_lock);
-	for (fbuf = buf_hash_table.ht_table[idx], i = 0; fbuf != NULL;
-	    fbuf = fbuf->b_hash_next, i++) {
-		if (BUF_EQUAL(buf->b_spa, &buf->b_dva, buf->b_birth, fbuf))
-			return (fbuf);
-	}
+	fbuf = buf_hash_lookup(buf->b_spa, &buf->b_dva, buf->b_birth, hv, &i);
+	if (fbuf != NULL)
+		return (fbuf);
 
-	buf->b_hash_next = buf_hash_table.ht_table[idx];
-	buf_hash_table.ht_table[idx] = buf;
+	if (ht->ht_newtable != NULL)
+		bucket = &ht->ht_newtable[hv & ht->ht_newmask];
+	else
+		bucket = &ht->ht_table[hv & ht->ht_mask];
+	buf->b_hash_next = *bucket;
+	*bucket = buf;
 	buf->b_flags |= ARC_IN_HASH_TABLE;
 
 	/* collect some hash table performance data */
@@ -699,21 +918,32 @@ buf_hash_insert(arc_buf_hdr_t *buf, kmutex_t **lockp)
 	ARCSTAT_BUMP(arcstat_hash_elements);
 	ARCSTAT_MAXSTAT(arcstat_hash_elements);
 
+	if (ht->ht_newtable == NULL &&
+	    ARCSTAT(arcstat_hash_elements) > BUF_HASH_LOAD * (ht->ht_mask + 1))
+		cv_signal(&arc_reclaim_thr_cv);
+
 	return (NULL);
 }
 
 static void
 buf_hash_remove(arc_buf_hdr_t *buf)
 {
-	arc_buf_hdr_t *fbuf, **bufp;
-	uint64_t idx = BUF_HASH_INDEX(buf->b_spa, &buf->b_dva, buf->b_birth);
+	buf_hash_table_t *ht = &buf_hash_table;
+	arc_buf_hdr_t *fbuf, **bucket, **bufp;
+	uint64_t hv = HDR_HASH(buf);
 
-	ASSERT(MUTEX_HELD(BUF_HASH_LOCK(idx)));
+	ASSERT(MUTEX_HELD(BUF_HASH_LOCK(hv)));
 	ASSERT(HDR_IN_HASH_TABLE(buf));
 
-	bufp = &buf_hash_table.ht_table[idx];
+	bucket = bufp = &ht->ht_table[hv & ht->ht_mask];
 	while ((fbuf = *bufp) != buf) {
-		ASSERT(fbuf != NULL);
+		if (fbuf == NULL) {
+			/* not moved yet to the table being grown into */
+			ASSERT(ht->ht_newtable != NULL);
+			ASSERT(bucket == &ht->ht_table[hv & ht->ht_mask]);
+			bucket = bufp = &ht->ht_newtable[hv & ht->ht_newmask];
+			continue;
+		}
 		bufp = &fbuf->b_hash_next;
 	}
 	*bufp = buf->b_hash_next;
@@ -723,11 +953,63 @@ buf_hash_remove(arc_buf_hdr_t *buf)
 	/* collect some hash table performance data */
 	ARCSTAT_BUMPDOWN(arcstat_hash_elements);
 
-	if (buf_hash_table.ht_table[idx] &&
-	    buf_hash_table.ht_table[idx]->b_hash_next == NULL)
+	if (*bucket && (*bucket)->b_hash_next == NULL)
 		ARCSTAT_BUMPDOWN(arcstat_hash_chains);
 }
 
+/*
+ * Double the hash table, moving hdrs over one bucket at a time.  Only
+ * called from the reclaim thread.
+ */
+static void
+buf_hash_grow(void)
+{
+	buf_hash_table_t *ht = &buf_hash_table;
+	uint64_t hsize = ht->ht_mask + 1, idx;
+	arc_buf_hdr_t **table;
+	int i;
+
+	table = kmem_zalloc(2 * hsize * sizeof (void *), KM_NOSLEEP);
+	if (table == NULL)
+		return;
+
+	for (i = 0; i < BUF_LOCKS; i++)
+		mutex_enter(&ht->ht_locks[i].ht_lock);
+	ht->ht_newmask = 2 * hsize - 1;
+	ht->ht_newtable = table;
+	for (i = 0; i < BUF_LOCKS; i++)
+		mutex_exit(&ht->ht_locks[i].ht_lock);
+
+	for (idx = 0; idx < hsize; idx++) {
+		kmutex_t *hash_lock = BUF_HASH_LOCK(idx);
+		arc_buf_hdr_t *buf;
+
+		mutex_enter(hash_lock);
+		while ((buf = ht->ht_table[idx]) != NULL) {
+			arc_buf_hdr_t **bucket =
+			    &table[HDR_HASH(buf) & ht->ht_newmask];
+
+			ht->ht_table[idx] = buf->b_hash_next;
+			buf->b_hash_next = *bucket;
+			*bucket = buf;
+		}
+		mutex_exit(hash_lock);
+	}
+
+	for (i = 0; i < BUF_LOCKS; i++)
+		mutex_enter(&ht->ht_locks[i].ht_lock);
+	table = ht->ht_table;
+	ht->ht_table = ht->ht_newtable;
+	ht->ht_mask = ht->ht_newmask;
+	ht->ht_newtable = NULL;
+	ht->ht_newmask = 0;
+	for (i = 0; i < BUF_LOCKS; i++)
+		mutex_exit(&ht->ht_locks[i].ht_lock);
+
+	kmem_free(table, hsize * sizeof (void *));
+	ARCSTAT_INCR(arcstat_hash_buckets, hsize);
+}
+
 /*
  * Global data structures and functions for the buf kmem cache.
  */
@@ -805,25 +1087,18 @@ static void
 buf_init(void)
 {
 	uint64_t *ct;
-	uint64_t hsize = 1ULL << 12;
+	uint64_t hsize = BUF_HASH_MIN;
 	int i, j;
 
 	/*
-	 * The hash table is big enough to fill all of physical memory
-	 * with an average 64K block size.  The table will take up
-	 * totalmem*sizeof(void*)/64K (eg. 128KB/GB with 8-byte pointers).
+	 * The hash table starts at its minimal size and is grown by
+	 * buf_hash_grow() as hdrs are added.
 	 */
-	while (hsize * 65536 < physmem * PAGESIZE)
-		hsize <<= 1;
-retry:
 	buf_hash_table.ht_mask = hsize - 1;
 	buf_hash_table.ht_table =
-	    kmem_zalloc(hsize * sizeof (void*), KM_NOSLEEP);
-	if (buf_hash_table.ht_table == NULL) {
-		ASSERT(hsize > (1ULL << 8));
-		hsize >>= 1;
-		goto retry;
-	}
+	    kmem_zalloc(hsize * sizeof (void*), KM_SLEEP);
+	buf_hash_table.ht_newtable = NULL;
+	ARCSTAT_INCR(arcstat_hash_buckets, hsize);
 
 	hdr_cache = kmem_cache_create("arc_buf_hdr_t", sizeof (arc_buf_hdr_t),
 	    0, hdr_cons, hdr_dest, hdr_recl, NULL, NULL, 0);
@@ -923,6 +1198,35 @@ arc_buf_freeze(arc_buf_t *buf)
 	arc_cksum_compute(buf, B_FALSE);
 }
 
+/*
+ * Lock a sublist, accounting the time spent waiting for it.
+ */
+static void
+arc_sublist_enter(arc_sublist_t *sl)
+{
+	hrtime_t start;
+
+	if (mutex_tryenter(&sl->asl_mtx))
+		return;
+
+	start = gethrtime();
+	mutex_enter(&sl->asl_mtx);
+	ARCSTAT_BUMP(arcstat_sublist_lock_waits);
+	ARCSTAT_INCR(arcstat_sublist_lock_wait_ns, gethrtime() - start);
+}
+
+static boolean_t
+arc_state_evictable(arc_state_t *state, arc_buf_contents_t type)
+{
+	int i;
+
+	for (i = 0; i < arc_num_sublists; i++) {
+		if (!list_is_empty(&state->arcs_sublists[type][i].asl_list))
+			return (B_TRUE);
+	}
+	return (B_FALSE);
+}
+
 static void
 add_reference(arc_buf_hdr_t *ab, kmutex_t *hash_lock, void *tag)
 {
@@ -930,14 +1234,14 @@ add_reference(arc_buf_hdr_t *ab, kmutex_t *hash_lock, void *tag)
 
 	if ((refcount_add(&ab->b_refcnt, tag) == 1) &&
 	    (ab->b_state != arc_anon)) {
-		uint64_t delta = ab->b_size * ab->b_datacnt;
-		list_t *list = &ab->b_state->arcs_list[ab->b_type];
+		uint64_t delta = HDR_DATA_SIZE(ab);
+		arc_sublist_t *sl = ARC_SUBLIST(ab->b_state, ab);
 		uint64_t *size = &ab->b_state->arcs_lsize[ab->b_type];
 
-		ASSERT(!MUTEX_HELD(&ab->b_state->arcs_mtx));
-		mutex_enter(&ab->b_state->arcs_mtx);
+		ASSERT(!MUTEX_HELD(&sl->asl_mtx));
+		arc_sublist_enter(sl);
 		ASSERT(list_link_active(&ab->b_arc_node));
-		list_remove(list, ab);
+		list_remove(&sl->asl_list, ab);
 		if (GHOST_STATE(ab->b_state)) {
 			ASSERT3U(ab->b_datacnt, ==, 0);
 			ASSERT3P(ab->b_buf, ==, NULL);
@@ -946,7 +1250,7 @@ add_reference(arc_buf_hdr_t *ab, kmutex_t *hash_lock, void *tag)
 		ASSERT(delta > 0);
 		ASSERT3U(*size, >=, delta);
 		atomic_add_64(size, -delta);
-		mutex_exit(&ab->b_state->arcs_mtx);
+		mutex_exit(&sl->asl_mtx);
 		/* remove the prefetch flag if we get a reference */
 		if (ab->b_flags & ARC_PREFETCH)
 			ab->b_flags &= ~ARC_PREFETCH;
@@ -964,15 +1268,16 @@ remove_reference(arc_buf_hdr_t *ab, kmutex_t *hash_lock, void *tag)
 
 	if (((cnt = refcount_remove(&ab->b_refcnt, tag)) == 0) &&
 	    (state != arc_anon)) {
+		arc_sublist_t *sl = ARC_SUBLIST(state, ab);
 		uint64_t *size = &state->arcs_lsize[ab->b_type];
 
-		ASSERT(!MUTEX_HELD(&state->arcs_mtx));
-		mutex_enter(&state->arcs_mtx);
+		ASSERT(!MUTEX_HELD(&sl->asl_mtx));
+		arc_sublist_enter(sl);
 		ASSERT(!list_link_active(&ab->b_arc_node));
-		list_insert_head(&state->arcs_list[ab->b_type], ab);
+		list_insert_head(&sl->asl_list, ab);
 		ASSERT(ab->b_datacnt > 0);
-		atomic_add_64(size, ab->b_size * ab->b_datacnt);
-		mutex_exit(&state->arcs_mtx);
+		atomic_add_64(size, HDR_DATA_SIZE(ab));
+		mutex_exit(&sl->asl_mtx);
 	}
 	return (cnt);
 }
@@ -992,8 +1297,9 @@ arc_change_state(arc_state_t *new_state, arc_buf_hdr_t *ab, kmutex_t *hash_lock)
 	ASSERT(new_state != old_state);
 	ASSERT(refcnt == 0 || ab->b_datacnt > 0);
 	ASSERT(ab->b_datacnt == 0 || !GHOST_STATE(new_state));
+	ASSERT(ab->b_cdata == NULL || !GHOST_STATE(new_state));
 
-	from_delta = to_delta = ab->b_datacnt * ab->b_size;
+	from_delta = to_delta = HDR_DATA_SIZE(ab);
 
 	/*
 	 * If this buffer is evictable, transfer it from the
@@ -1001,14 +1307,15 @@ arc_change_state(arc_state_t *new_state, arc_buf_hdr_t *ab, kmutex_t *hash_lock)
 	 */
 	if (refcnt == 0) {
 		if (old_state != arc_anon) {
-			int use_mutex = !MUTEX_HELD(&old_state->arcs_mtx);
+			arc_sublist_t *sl = ARC_SUBLIST(old_state, ab);
+			int use_mutex = !MUTEX_HELD(&sl->asl_mtx);
 			uint64_t *size = &old_state->arcs_lsize[ab->b_type];
 
 			if (use_mutex)
-				mutex_enter(&old_state->arcs_mtx);
+				arc_sublist_enter(sl);
 
 			ASSERT(list_link_active(&ab->b_arc_node));
-			list_remove(&old_state->arcs_list[ab->b_type], ab);
+			list_remove(&sl->asl_list, ab);
 
 			/*
 			 * If prefetching out of the ghost cache,
@@ -1023,16 +1330,17 @@ arc_change_state(arc_state_t *new_state, arc_buf_hdr_t *ab, kmutex_t *hash_lock)
 			atomic_add_64(size, -from_delta);
 
 			if (use_mutex)
-				mutex_exit(&old_state->arcs_mtx);
+				mutex_exit(&sl->asl_mtx);
 		}
 		if (new_state != arc_anon) {
-			int use_mutex = !MUTEX_HELD(&new_state->arcs_mtx);
+			arc_sublist_t *sl = ARC_SUBLIST(new_state, ab);
+			int use_mutex = !MUTEX_HELD(&sl->asl_mtx);
 			uint64_t *size = &new_state->arcs_lsize[ab->b_type];
 
 			if (use_mutex)
-				mutex_enter(&new_state->arcs_mtx);
+				arc_sublist_enter(sl);
 
-			list_insert_head(&new_state->arcs_list[ab->b_type], ab);
+			list_insert_head(&sl->asl_list, ab);
 
 			/* ghost elements have a ghost size */
 			if (GHOST_STATE(new_state)) {
@@ -1044,7 +1352,7 @@ arc_change_state(arc_state_t *new_state, arc_buf_hdr_t *ab, kmutex_t *hash_lock)
 			atomic_add_64(&new_state->arcs_size, to_delta);
 
 			if (use_mutex)
-				mutex_exit(&new_state->arcs_mtx);
+				mutex_exit(&sl->asl_mtx);
 		}
 	}
 
@@ -1104,6 +1412,74 @@ arc_data_buf_free(void *buf, uint64_t size)
 	atomic_add_64(&arc_size, -size);
 }
 
+/*
+ * Attach a buffer for the compressed form of the block to the hdr.  It
+ * is charged to the hdr's state like the data buffers are.
+ */
+static void
+arc_hdr_alloc_cdata(arc_buf_hdr_t *hdr, uint64_t psize, int comp)
+{
+	arc_state_t *state = hdr->b_state;
+
+	ASSERT(hdr->b_cdata == NULL);
+	ASSERT(!GHOST_STATE(state));
+	ASSERT3U(psize, <, hdr->b_size);
+
+	if (arc_evict_needed(hdr->b_type))
+		cv_signal(&arc_reclaim_thr_cv);
+	if (hdr->b_type == ARC_BUFC_METADATA) {
+		hdr->b_cdata = zio_buf_alloc(psize);
+		arc_space_consume(psize);
+	} else {
+		hdr->b_cdata = zio_data_buf_alloc(psize);
+		atomic_add_64(&arc_size, psize);
+	}
+	hdr->b_psize = psize;
+	hdr->b_comp = comp;
+
+	atomic_add_64(&state->arcs_size, psize);
+	if (list_link_active(&hdr->b_arc_node)) {
+		ASSERT(refcount_is_zero(&hdr->b_refcnt));
+		atomic_add_64(&state->arcs_lsize[hdr->b_type], psize);
+	}
+	ARCSTAT_INCR(arcstat_compressed_size, psize);
+	ARCSTAT_INCR(arcstat_uncompressed_size, hdr->b_size);
+	ARCSTAT_INCR(arcstat_decompressed_size, hdr->b_datacnt * hdr->b_size);
+}
+
+static void
+arc_hdr_free_cdata(arc_buf_hdr_t *hdr)
+{
+	arc_state_t *state = hdr->b_state;
+	uint64_t psize = hdr->b_psize;
+
+	ASSERT(hdr->b_cdata != NULL);
+
+	if (hdr->b_type == ARC_BUFC_METADATA) {
+		zio_buf_free(hdr->b_cdata, psize);
+		arc_space_return(psize);
+	} else {
+		zio_data_buf_free(hdr->b_cdata, psize);
+		ASSERT(arc_size >= psize);
+		atomic_add_64(&arc_size, -psize);
+	}
+	hdr->b_cdata = NULL;
+
+	if (list_link_active(&hdr->b_arc_node)) {
+		uint64_t *cnt = &state->arcs_lsize[hdr->b_type];
+
+		ASSERT(refcount_is_zero(&hdr->b_refcnt));
+		ASSERT3U(*cnt, >=, psize);
+		atomic_add_64(cnt, -psize);
+	}
+	ASSERT3U(state->arcs_size, >=, psize);
+	atomic_add_64(&state->arcs_size, -psize);
+	ARCSTAT_INCR(arcstat_compressed_size, -psize);
+	ARCSTAT_INCR(arcstat_uncompressed_size, -hdr->b_size);
+	ARCSTAT_INCR(arcstat_decompressed_size,
+	    -(hdr->b_datacnt * hdr->b_size));
+}
+
 arc_buf_t *
 arc_buf_alloc(spa_t *spa, int size, void *tag, arc_buf_contents_t type)
 {
@@ -1154,6 +1530,34 @@ arc_buf_clone(arc_buf_t *from)
 	return (buf);
 }
 
+/*
+ * Give a hdr that only holds the compressed form of its block a data
+ * buffer again.  The caller holds the hash lock and a reference.
+ */
+static arc_buf_t *
+arc_buf_decompress(arc_buf_hdr_t *hdr)
+{
+	arc_buf_t *buf;
+
+	ASSERT(hdr->b_cdata != NULL);
+	ASSERT(hdr->b_datacnt == 0 && hdr->b_buf == NULL);
+	ASSERT(!refcount_is_zero(&hdr->b_refcnt));
+
+	buf = kmem_cache_alloc(buf_cache, KM_PUSHPAGE);
+	buf->b_hdr = hdr;
+	buf->b_data = NULL;
+	buf->b_efunc = NULL;
+	buf->b_private = NULL;
+	buf->b_next = NULL;
+	hdr->b_buf = buf;
+	arc_get_data_buf(buf);
+	hdr->b_datacnt = 1;
+	VERIFY(zio_decompress_data(hdr->b_comp, hdr->b_cdata, hdr->b_psize,
+	    buf->b_data, hdr->b_size) == 0);
+	arc_cksum_compute(buf, B_FALSE);
+	return (buf);
+}
+
 void
 arc_buf_add_ref(arc_buf_t *buf, void* tag)
 {
@@ -1251,6 +1655,8 @@ arc_buf_destroy(arc_buf_t *buf, boolean_t recycle, boolean_t all)
 		}
 		ASSERT3U(state->arcs_size, >=, size);
 		atomic_add_64(&state->arcs_size, -size);
+		if (buf->b_hdr->b_cdata != NULL)
+			ARCSTAT_INCR(arcstat_decompressed_size, -size);
 		buf->b_data = NULL;
 		ASSERT(buf->b_hdr->b_datacnt > 0);
 		buf->b_hdr->b_datacnt -= 1;
@@ -1330,6 +1736,8 @@ arc_hdr_destroy(arc_buf_hdr_t *hdr)
 			arc_buf_destroy(hdr->b_buf, FALSE, TRUE);
 		}
 	}
+	if (hdr->b_cdata != NULL)
+		arc_hdr_free_cdata(hdr);
 	if (hdr->b_freeze_cksum != NULL) {
 		kmem_free(hdr->b_freeze_cksum, sizeof (zio_cksum_t));
 		hdr->b_freeze_cksum = NULL;
@@ -1420,38 +1828,96 @@ arc_buf_size(arc_buf_t *buf)
 	return (buf->b_hdr->b_size);
 }
 
+static char *arc_onloan_tag = "onloan";
+
 /*
- * Evict buffers from list until we've removed the specified number of
- * bytes.  Move the removed buffers to the appropriate evict state.
- * If the recycle flag is set, then attempt to "recycle" a buffer:
- * - look for a buffer to evict that is `bytes' long.
- * - return the data block from this buffer rather than freeing it.
- * This flag is used by callers that are trying to make space for a
- * new buffer in a full arc cache.
- *
- * This function makes a "best effort".  It skips over any buffers
- * it can't get a hash_lock on, and so may not catch all candidates.
- * It may also return without evicting as much space as requested.
+ * Loan out an anonymous arc buffer. Loaned buffers are not counted as in
+ * flight data by arc_tempreserve_space() until they are returned. Used
+ * to fill a buffer which is later assigned to a dbuf without copying.
  */
-static void *
-arc_evict(arc_state_t *state, spa_t *spa, int64_t bytes, boolean_t recycle,
-    arc_buf_contents_t type)
+arc_buf_t *
+arc_loan_buf(spa_t *spa, int size)
 {
-	arc_state_t *evicted_state;
-	uint64_t bytes_evicted = 0, skipped = 0, missed = 0;
-	arc_buf_hdr_t *ab, *ab_prev = NULL;
-	list_t *list = &state->arcs_list[type];
-	kmutex_t *hash_lock;
-	boolean_t have_lock;
+	arc_buf_t *buf;
+
+	buf = arc_buf_alloc(spa, size, arc_onloan_tag, ARC_BUFC_DATA);
+
+	atomic_add_64(&arc_loaned_bytes, size);
+	return (buf);
+}
+
+/*
+ * Return a loaned arc buffer to the arc.
+ */
+void
+arc_return_buf(arc_buf_t *buf, void *tag)
+{
+	arc_buf_hdr_t *hdr = buf->b_hdr;
+
+	ASSERT(buf->b_data != NULL);
+	(void) refcount_add(&hdr->b_refcnt, tag);
+	(void) refcount_remove(&hdr->b_refcnt, arc_onloan_tag);
+
+	atomic_add_64(&arc_loaned_bytes, -hdr->b_size);
+}
+
+/*
+ * Free the data buffers of an unreferenced hdr, buffers with an evict
+ * callback are handed to arc_do_user_evicts().  If stolenp is not NULL
+ * the data block of the first buffer is returned there instead of being
+ * freed.  Returns the number of bytes evicted.
+ */
+static uint64_t
+arc_hdr_evict_bufs(arc_buf_hdr_t *ab, void **stolenp)
+{
+	uint64_t bytes_evicted = 0;
 	void *stolen = NULL;
 
-	ASSERT(state == arc_mru || state == arc_mfu);
+	ASSERT(MUTEX_HELD(HDR_LOCK(ab)));
+	ASSERT3U(refcount_count(&ab->b_refcnt), ==, 0);
 
-	evicted_state = (state == arc_mru) ? arc_mru_ghost : arc_mfu_ghost;
+	while (ab->b_buf) {
+		arc_buf_t *buf = ab->b_buf;
+		if (buf->b_data) {
+			bytes_evicted += ab->b_size;
+			if (stolenp != NULL && stolen == NULL)
+				stolen = buf->b_data;
+		}
+		if (buf->b_efunc) {
+			mutex_enter(&arc_eviction_mtx);
+			arc_buf_destroy(buf, buf->b_data == stolen, FALSE);
+			ab->b_buf = buf->b_next;
+			buf->b_hdr = &arc_eviction_hdr;
+			buf->b_next = arc_eviction_list;
+			arc_eviction_list = buf;
+			mutex_exit(&arc_eviction_mtx);
+		} else {
+			arc_buf_destroy(buf, buf->b_data == stolen, TRUE);
+		}
+	}
+	ASSERT(ab->b_datacnt == 0);
+	ab->b_flags &= ~ARC_BUF_AVAILABLE;
+	if (stolenp != NULL)
+		*stolenp = stolen;
+	return (bytes_evicted);
+}
 
-	mutex_enter(&state->arcs_mtx);
-	mutex_enter(&evicted_state->arcs_mtx);
+/*
+ * Evict up to `target' bytes in total from one sublist of a state, see
+ * arc_evict() for the meaning of the other arguments.
+ */
+static void
+arc_evict_sublist(arc_sublist_t *sl, arc_state_t *evicted_state, spa_t *spa,
+    int64_t bytes, uint64_t target, boolean_t *recyclep,
+    arc_buf_contents_t type, void **stolenp, uint64_t *bytes_evicted,
+    uint64_t *skipped, uint64_t *missed)
+{
+	list_t *list = &sl->asl_list;
+	arc_buf_hdr_t *ab, *ab_prev = NULL;
+	kmutex_t *hash_lock;
+	boolean_t have_lock;
 
+	arc_sublist_enter(sl);
 	for (ab = list_tail(list); ab; ab = ab_prev) {
 		ab_prev = list_prev(list, ab);
 		/* prefetch buffers have a minimum lifespan */
@@ -1459,60 +1925,106 @@ arc_evict(arc_state_t *state, spa_t *spa, int64_t bytes, boolean_t recycle,
 		    (spa && ab->b_spa != spa) ||
 		    (ab->b_flags & (ARC_PREFETCH|ARC_INDIRECT) &&
 		    lbolt - ab->b_arc_access < arc_min_prefetch_lifespan)) {
-			skipped++;
+			(*skipped)++;
 			continue;
 		}
 		/* "lookahead" for better eviction candidate */
-		if (recycle && ab->b_size != bytes &&
+		if (*recyclep && ab->b_size != bytes &&
 		    ab_prev && ab_prev->b_size == bytes)
 			continue;
 		hash_lock = HDR_LOCK(ab);
 		have_lock = MUTEX_HELD(hash_lock);
 		if (have_lock || mutex_tryenter(hash_lock)) {
 			ASSERT3U(refcount_count(&ab->b_refcnt), ==, 0);
-			ASSERT(ab->b_datacnt > 0);
-			while (ab->b_buf) {
-				arc_buf_t *buf = ab->b_buf;
-				if (buf->b_data) {
-					bytes_evicted += ab->b_size;
-					if (recycle && ab->b_type == type &&
-					    ab->b_size == bytes &&
-					    !HDR_L2_WRITING(ab)) {
-						stolen = buf->b_data;
-						recycle = FALSE;
-					}
-				}
-				if (buf->b_efunc) {
-					mutex_enter(&arc_eviction_mtx);
-					arc_buf_destroy(buf,
-					    buf->b_data == stolen, FALSE);
-					ab->b_buf = buf->b_next;
-					buf->b_hdr = &arc_eviction_hdr;
-					buf->b_next = arc_eviction_list;
-					arc_eviction_list = buf;
-					mutex_exit(&arc_eviction_mtx);
-				} else {
-					arc_buf_destroy(buf,
-					    buf->b_data == stolen, TRUE);
+			ASSERT(ab->b_datacnt > 0 || ab->b_cdata != NULL);
+			if (ab->b_datacnt > 0) {
+				boolean_t steal = *recyclep &&
+				    ab->b_type == type && ab->b_size == bytes &&
+				    !HDR_L2_WRITING(ab);
+
+				*bytes_evicted += arc_hdr_evict_bufs(ab,
+				    steal ? stolenp : NULL);
+				if (*stolenp != NULL)
+					*recyclep = FALSE;
+
+				/*
+				 * Keep the compressed copy around unless
+				 * we are flushing, it goes on the next pass.
+				 */
+				if (ab->b_cdata != NULL && bytes >= 0) {
+					if (!have_lock)
+						mutex_exit(hash_lock);
+					if (*bytes_evicted >= target)
+						break;
+					continue;
 				}
 			}
-			ASSERT(ab->b_datacnt == 0);
+			if (ab->b_cdata != NULL) {
+				*bytes_evicted += ab->b_psize;
+				arc_hdr_free_cdata(ab);
+			}
 			arc_change_state(evicted_state, ab, hash_lock);
 			ASSERT(HDR_IN_HASH_TABLE(ab));
 			ab->b_flags |= ARC_IN_HASH_TABLE;
-			ab->b_flags &= ~ARC_BUF_AVAILABLE;
 			DTRACE_PROBE1(arc__evict, arc_buf_hdr_t *, ab);
 			if (!have_lock)
 				mutex_exit(hash_lock);
-			if (bytes >= 0 && bytes_evicted >= bytes)
+			if (bytes >= 0 && *bytes_evicted >= target)
 				break;
 		} else {
-			missed += 1;
+			(*missed)++;
 		}
 	}
+	mutex_exit(&sl->asl_mtx);
+}
+
+/*
+ * Evict buffers from list until we've removed the specified number of
+ * bytes.  Move the removed buffers to the appropriate evict state.
+ * If the recycle flag is set, then attempt to "recycle" a buffer:
+ * - look for a buffer to evict that is `bytes' long.
+ * - return the data block from this buffer rather than freeing it.
+ * This flag is used by callers that are trying to make space for a
+ * new buffer in a full arc cache.
+ *
+ * This function makes a "best effort".  It skips over any buffers
+ * it can't get a hash_lock on, and so may not catch all candidates.
+ * It may also return without evicting as much space as requested.
+ */
+static void *
+arc_evict(arc_state_t *state, spa_t *spa, int64_t bytes, boolean_t recycle,
+    arc_buf_contents_t type)
+{
+	arc_state_t *evicted_state;
+	uint64_t bytes_evicted = 0, skipped = 0, missed = 0;
+	void *stolen = NULL;
+	uint32_t idx;
+	int n;
+
+	ASSERT(state == arc_mru || state == arc_mfu);
+
+	evicted_state = (state == arc_mru) ? arc_mru_ghost : arc_mfu_ghost;
 
-	mutex_exit(&evicted_state->arcs_mtx);
-	mutex_exit(&state->arcs_mtx);
+	/*
+	 * Each sublist gives an even share of what is still missing, a
+	 * buffer to recycle is looked for in all of them.
+	 */
+	idx = state->arcs_evict_next[type]++;
+	for (n = 0; n < arc_num_sublists; n++) {
+		int left = arc_num_sublists - n;
+		uint64_t target = bytes;
+
+		if (bytes >= 0 && !recycle) {
+			target = bytes_evicted +
+			    (bytes - bytes_evicted + left - 1) / left;
+		}
+		arc_evict_sublist(
+		    &state->arcs_sublists[type][(idx + n) % arc_num_sublists],
+		    evicted_state, spa, bytes, target, &recycle, type, &stolen,
+		    &bytes_evicted, &skipped, &missed);
+		if (bytes >= 0 && bytes_evicted >= bytes)
+			break;
+	}
 
 	if (bytes_evicted < bytes)
 		dprintf("only evicted %lld bytes from %x",
@@ -1556,14 +2068,28 @@ static void
 arc_evict_ghost(arc_state_t *state, spa_t *spa, int64_t bytes)
 {
 	arc_buf_hdr_t *ab, *ab_prev;
-	list_t *list = &state->arcs_list[ARC_BUFC_DATA];
+	arc_buf_contents_t type = ARC_BUFC_DATA;
+	arc_sublist_t *sl;
+	list_t *list;
 	kmutex_t *hash_lock;
-	uint64_t bytes_deleted = 0;
+	uint64_t bytes_deleted = 0, target = bytes;
 	uint64_t bufs_skipped = 0;
+	uint32_t idx;
+	int n = 0;
 
 	ASSERT(GHOST_STATE(state));
+	idx = state->arcs_evict_next[type]++;
+next:
+	sl = &state->arcs_sublists[type][(idx + n) % arc_num_sublists];
+	list = &sl->asl_list;
+	if (bytes >= 0) {
+		int left = arc_num_sublists - n;
+
+		target = bytes_deleted +
+		    (bytes - bytes_deleted + left - 1) / left;
+	}
 top:
-	mutex_enter(&state->arcs_mtx);
+	arc_sublist_enter(sl);
 	for (ab = list_tail(list); ab; ab = ab_prev) {
 		ab_prev = list_prev(list, ab);
 		if (spa && ab->b_spa != spa)
@@ -1572,6 +2098,7 @@ top:
 		if (mutex_tryenter(hash_lock)) {
 			ASSERT(!HDR_IO_IN_PROGRESS(ab));
 			ASSERT(ab->b_buf == NULL);
+			ASSERT(ab->b_cdata == NULL);
 			ARCSTAT_BUMP(arcstat_deleted);
 			bytes_deleted += ab->b_size;
 
@@ -1589,11 +2116,11 @@ top:
 			}
 
 			DTRACE_PROBE1(arc__delete, arc_buf_hdr_t *, ab);
-			if (bytes >= 0 && bytes_deleted >= bytes)
+			if (bytes >= 0 && bytes_deleted >= target)
 				break;
 		} else {
 			if (bytes < 0) {
-				mutex_exit(&state->arcs_mtx);
+				mutex_exit(&sl->asl_mtx);
 				mutex_enter(hash_lock);
 				mutex_exit(hash_lock);
 				goto top;
@@ -1601,12 +2128,17 @@ top:
 			bufs_skipped += 1;
 		}
 	}
-	mutex_exit(&state->arcs_mtx);
-
-	if (list == &state->arcs_list[ARC_BUFC_DATA] &&
-	    (bytes < 0 || bytes_deleted < bytes)) {
-		list = &state->arcs_list[ARC_BUFC_METADATA];
-		goto top;
+	mutex_exit(&sl->asl_mtx);
+
+	if (bytes < 0 || bytes_deleted < bytes) {
+		if (++n < arc_num_sublists)
+			goto next;
+		if (type == ARC_BUFC_DATA) {
+			type = ARC_BUFC_METADATA;
+			idx = state->arcs_evict_next[type]++;
+			n = 0;
+			goto next;
+		}
 	}
 
 	if (bufs_skipped) {
@@ -1619,6 +2151,52 @@ top:
 		    (longlong_t)bytes_deleted, state);
 }
 
+/*
+ * Free decompressed copies of unreferenced compressed blocks, starting
+ * with the least recently used ones.  The hdrs keep their compressed
+ * copy and stay in their state.
+ */
+static uint64_t
+arc_evict_decompressed(arc_state_t *state, int64_t bytes)
+{
+	uint64_t bytes_evicted = 0, missed = 0;
+	int i;
+
+	for (i = 0; i < ARC_BUFC_NUMTYPES * arc_num_sublists; i++) {
+		arc_sublist_t *sl = &state->arcs_sublists
+		    [i / arc_num_sublists][i % arc_num_sublists];
+		list_t *list = &sl->asl_list;
+		arc_buf_hdr_t *ab, *ab_prev;
+
+		arc_sublist_enter(sl);
+		for (ab = list_tail(list); ab; ab = ab_prev) {
+			kmutex_t *hash_lock = HDR_LOCK(ab);
+
+			ab_prev = list_prev(list, ab);
+			if (ab->b_cdata == NULL || ab->b_datacnt == 0 ||
+			    HDR_IO_IN_PROGRESS(ab))
+				continue;
+			if (!mutex_tryenter(hash_lock)) {
+				missed += 1;
+				continue;
+			}
+			if (ab->b_cdata != NULL && ab->b_datacnt > 0)
+				bytes_evicted += arc_hdr_evict_bufs(ab, NULL);
+			mutex_exit(hash_lock);
+			if (bytes_evicted >= bytes)
+				break;
+		}
+		mutex_exit(&sl->asl_mtx);
+		if (bytes_evicted >= bytes)
+			break;
+	}
+
+	if (missed)
+		ARCSTAT_INCR(arcstat_mutex_miss, missed);
+
+	return (bytes_evicted);
+}
+
 static void
 arc_adjust(void)
 {
@@ -1678,6 +2256,14 @@ arc_adjust(void)
 			arc_evict_ghost(arc_mfu_ghost, NULL, todelete);
 		}
 	}
+
+	todelete = arc_decompressed_size -
+	    (arc_c >> zfs_arc_decompressed_shift);
+	if (todelete > 0) {
+		todelete -= arc_evict_decompressed(arc_mru, todelete);
+		if (todelete > 0)
+			(void) arc_evict_decompressed(arc_mfu, todelete);
+	}
 }
 
 static void
@@ -1708,22 +2294,22 @@ arc_do_user_evicts(void)
 void
 arc_flush(spa_t *spa)
 {
-	while (list_head(&arc_mru->arcs_list[ARC_BUFC_DATA])) {
+	while (arc_state_evictable(arc_mru, ARC_BUFC_DATA)) {
 		(void) arc_evict(arc_mru, spa, -1, FALSE, ARC_BUFC_DATA);
 		if (spa)
 			break;
 	}
-	while (list_head(&arc_mru->arcs_list[ARC_BUFC_METADATA])) {
+	while (arc_state_evictable(arc_mru, ARC_BUFC_METADATA)) {
 		(void) arc_evict(arc_mru, spa, -1, FALSE, ARC_BUFC_METADATA);
 		if (spa)
 			break;
 	}
-	while (list_head(&arc_mfu->arcs_list[ARC_BUFC_DATA])) {
+	while (arc_state_evictable(arc_mfu, ARC_BUFC_DATA)) {
 		(void) arc_evict(arc_mfu, spa, -1, FALSE, ARC_BUFC_DATA);
 		if (spa)
 			break;
 	}
-	while (list_head(&arc_mfu->arcs_list[ARC_BUFC_METADATA])) {
+	while (arc_state_evictable(arc_mfu, ARC_BUFC_METADATA)) {
 		(void) arc_evict(arc_mfu, spa, -1, FALSE, ARC_BUFC_METADATA);
 		if (spa)
 			break;
@@ -1746,11 +2332,7 @@ arc_shrink(void)
 	if (arc_c > arc_c_min) {
 		uint64_t to_free;
 
-#if 0
-		to_free = MAX(arc_c >> arc_shrink_shift, ptob(needfree));
-#else
-		to_free = arc_c >> arc_shrink_shift;
-#endif
+		to_free = MAX(arc_c >> arc_shrink_shift, arc_need_free);
 		if (arc_c > arc_c_min + to_free)
 			atomic_add_64(&arc_c, -to_free);
 		else
@@ -1769,65 +2351,55 @@ arc_shrink(void)
 		arc_adjust();
 }
 
-static int
-arc_reclaim_needed(void)
-{
-#if 0
-	uint64_t extra;
-
 #ifdef _KERNEL
+/*
+ * ZFSFUSE: sample memory of the process, called at most once a second by
+ * the reclaim thread.  Memory is low when less than the free target is left
+ * before hitting host or cgroup limit, or when tasks stall on memory.
+ * The arc ceiling configured at arc_init is kept under half of the
+ * memory limit, which is what adjusts it at runtime: lowering cgroup
+ * memory.max or memory.high shrinks the arc within a second, and
+ * raising them lets it grow back up to the configured ceiling.
+ */
+static void
+arc_memstat_update(void)
+{
+	kmem_memstat_t ms;
+	uint64_t target, max;
+
+	kmem_memstat(&ms);
+
+	target = zfs_arc_free_target;
+	if (target == 0)
+		target = MAX(ms.km_limit >> 6, 32ULL << 20);
+	arc_need_free = ms.km_avail < target ? target - ms.km_avail : 0;
+	arc_memory_low = (arc_need_free != 0 ||
+	    ms.km_pressure >= zfs_arc_pressure_threshold);
+
+	max = arc_c_max_conf;
+	if (ms.km_limit != UINT64_MAX)
+		max = MIN(max, ms.km_limit / 2);
+	max = MAX(max, arc_c_min);
+	if (max == arc_c_max)
+		return;
 
-	if (needfree)
-		return (1);
-
-	/*
-	 * take 'desfree' extra pages, so we reclaim sooner, rather than later
-	 */
-	extra = desfree;
-
-	/*
-	 * check that we're out of range of the pageout scanner.  It starts to
-	 * schedule paging if freemem is less than lotsfree and needfree.
-	 * lotsfree is the high-water mark for pageout, and needfree is the
-	 * number of needed free pages.  We add extra pages here to make sure
-	 * the scanner doesn't start up while we're freeing memory.
-	 */
-	if (freemem < lotsfree + needfree + extra)
-		return (1);
-
-	/*
-	 * check to make sure that swapfs has enough space so that anon
-	 * reservations can still succeed. anon_resvmem() checks that the
-	 * availrmem is greater than swapfs_minfree, and the number of reserved
-	 * swap pages.  We also add a bit of extra here just to prevent
-	 * circumstances from getting really dire.
-	 */
-	if (availrmem < swapfs_minfree + swapfs_reserve + extra)
-		return (1);
-
-#if defined(__i386)
-	/*
-	 * If we're on an i386 platform, it's possible that we'll exhaust the
-	 * kernel heap space before we ever run out of available physical
-	 * memory.  Most checks of the size of the heap_area compare against
-	 * tune.t_minarmem, which is the minimum available real memory that we
-	 * can have in the system.  However, this is generally fixed at 25 pages
-	 * which is so low that it's useless.  In this comparison, we seek to
-	 * calculate the total heap-size, and reclaim if more than 3/4ths of the
-	 * heap is allocated.  (Or, in the calculation, if less than 1/4th is
-	 * free)
-	 */
-	if (btop(vmem_size(heap_arena, VMEM_FREE)) <
-	    (btop(vmem_size(heap_arena, VMEM_FREE | VMEM_ALLOC)) >> 2))
-		return (1);
+	arc_c_max = max;
+	if (zfs_arc_meta_limit == 0 || zfs_arc_meta_limit > arc_c_max)
+		arc_meta_limit = arc_c_max / 4;
+	if (arc_c > arc_c_max) {
+		arc_c = arc_c_max;
+		if (arc_p > arc_c)
+			arc_p = (arc_c >> 1);
+	}
+	if (arc_size > arc_c)
+		arc_adjust();
+}
 #endif
 
-#else
-	if (spa_get_random(100) == 0)
-		return (1);
-#endif
-#endif
-	return (0);
+static int
+arc_reclaim_needed(void)
+{
+	return (arc_memory_low);
 }
 
 static void
@@ -1882,11 +2454,24 @@ arc_reclaim_thread(void)
 	int64_t			growtime = 0;
 	arc_reclaim_strategy_t	last_reclaim = ARC_RECLAIM_CONS;
 	callb_cpr_t		cpr;
+#ifdef _KERNEL
+	clock_t			memstat_time = lbolt - hz;
+#endif
 
 	CALLB_CPR_INIT(&cpr, &arc_reclaim_thr_lock, callb_generic_cpr, FTAG);
 
 	mutex_enter(&arc_reclaim_thr_lock);
 	while (arc_thread_exit == 0) {
+#ifdef _KERNEL
+		/*
+		 * ZFSFUSE: the thread is also woken early by allocations
+		 * signalling it, sample memory at most once a second.
+		 */
+		if (lbolt - memstat_time >= hz) {
+			memstat_time = lbolt;
+			arc_memstat_update();
+		}
+#endif
 		if (arc_reclaim_needed()) {
 
 			if (arc_no_grow) {
@@ -1915,6 +2500,10 @@ arc_reclaim_thread(void)
 		    arc_mru_ghost->arcs_size + arc_mfu_ghost->arcs_size)
 			arc_adjust();
 
+		if (ARCSTAT(arcstat_hash_elements) >
+		    BUF_HASH_LOAD * (buf_hash_table.ht_mask + 1))
+			buf_hash_grow();
+
 		if (arc_eviction_list != NULL)
 			arc_do_user_evicts();
 
@@ -2113,6 +2702,8 @@ out:
 			ASSERT(refcount_is_zero(&hdr->b_refcnt));
 			atomic_add_64(&hdr->b_state->arcs_lsize[type], size);
 		}
+		if (hdr->b_cdata != NULL)
+			ARCSTAT_INCR(arcstat_decompressed_size, size);
 		/*
 		 * If we are growing the cache, and we are adding anonymous
 		 * data, and we have outgrown arc_p, update arc_p
@@ -2307,6 +2898,12 @@ arc_read_done(zio_t *zio)
 	if (l2arc_noprefetch && (hdr->b_flags & ARC_PREFETCH))
 		hdr->b_flags &= ~ARC_L2CACHE;
 
+	/* the block was read in compressed form, keep it that way */
+	if (hdr->b_cdata != NULL && zio->io_error == 0 &&
+	    zio_decompress_data(hdr->b_comp, hdr->b_cdata, hdr->b_psize,
+	    buf->b_data, hdr->b_size) != 0)
+		zio->io_error = EIO;
+
 	/* byteswap if necessary */
 	callback_list = hdr->b_acb;
 	ASSERT(callback_list != NULL);
@@ -2339,6 +2936,8 @@ arc_read_done(zio_t *zio)
 
 	if (zio->io_error != 0) {
 		hdr->b_flags |= ARC_IO_ERROR;
+		if (hdr->b_cdata != NULL)
+			arc_hdr_free_cdata(hdr);
 		if (hdr->b_state != arc_anon)
 			arc_change_state(arc_anon, hdr, hash_lock);
 		if (HDR_IN_HASH_TABLE(hdr))
@@ -2371,6 +2970,8 @@ arc_read_done(zio_t *zio)
 		 * in the cache).
 		 */
 		ASSERT3P(hdr->b_state, ==, arc_anon);
+		if (hdr->b_cdata != NULL)
+			arc_hdr_free_cdata(hdr);
 		freeable = refcount_is_zero(&hdr->b_refcnt);
 	}
 
@@ -2446,7 +3047,7 @@ arc_read_nolock(zio_t *pio, spa_t *spa, blkptr_t *bp,
 
 top:
 	hdr = buf_hash_find(spa, BP_IDENTITY(bp), bp->blk_birth, &hash_lock);
-	if (hdr && hdr->b_datacnt > 0) {
+	if (hdr && (hdr->b_datacnt > 0 || hdr->b_cdata != NULL)) {
 
 		*arc_flags |= ARC_CACHED;
 
@@ -2488,12 +3089,15 @@ top:
 			/*
 			 * If this block is already in use, create a new
 			 * copy of the data so that we will be guaranteed
-			 * that arc_release() will always succeed.
+			 * that arc_release() will always succeed.  If only
+			 * the compressed copy is cached, decompress it.
 			 */
 			buf = hdr->b_buf;
-			ASSERT(buf);
-			ASSERT(buf->b_data);
-			if (HDR_BUF_AVAILABLE(hdr)) {
+			if (buf == NULL) {
+				buf = arc_buf_decompress(hdr);
+				ARCSTAT_BUMP(arcstat_decompress_hits);
+			} else if (HDR_BUF_AVAILABLE(hdr)) {
+				ASSERT(buf->b_data);
 				ASSERT(buf->b_efunc == NULL);
 				hdr->b_flags &= ~ARC_BUF_AVAILABLE;
 			} else {
@@ -2520,6 +3124,7 @@ top:
 		arc_callback_t	*acb;
 		vdev_t *vd = NULL;
 		daddr_t addr;
+		void *cdata;
 
 		if (hdr == NULL) {
 			/* this block is not in the cache */
@@ -2599,7 +3204,13 @@ top:
 		if (hdr->b_l2hdr != NULL) {
 			vd = hdr->b_l2hdr->b_dev->l2ad_vdev;
 			addr = hdr->b_l2hdr->b_daddr;
+		} else if (zfs_arc_compressed &&
+		    BP_GET_COMPRESS(bp) != ZIO_COMPRESS_OFF &&
+		    !BP_IS_GANG(bp) && !BP_SHOULD_BYTESWAP(bp)) {
+			arc_hdr_alloc_cdata(hdr, BP_GET_PSIZE(bp),
+			    BP_GET_COMPRESS(bp));
 		}
+		cdata = hdr->b_cdata;
 
 		mutex_exit(hash_lock);
 
@@ -2676,8 +3287,14 @@ l2skip:
 			}
 		}
 
-		rzio = zio_read(pio, spa, bp, buf->b_data, size,
-		    arc_read_done, buf, priority, zio_flags, zb);
+		if (cdata != NULL) {
+			rzio = zio_read(pio, spa, bp, cdata, BP_GET_PSIZE(bp),
+			    arc_read_done, buf, priority,
+			    zio_flags | ZIO_FLAG_RAW, zb);
+		} else {
+			rzio = zio_read(pio, spa, bp, buf->b_data, size,
+			    arc_read_done, buf, priority, zio_flags, zb);
+		}
 
 		if (*arc_flags & ARC_WAIT)
 			return (zio_wait(rzio));
@@ -2712,6 +3329,10 @@ arc_tryread(spa_t *spa, blkptr_t *bp, void *data)
 			ASSERT(buf);
 		}
 		bcopy(buf->b_data, data, hdr->b_size);
+	} else if (hdr && hdr->b_cdata != NULL && !HDR_IO_IN_PROGRESS(hdr)) {
+		if (zio_decompress_data(hdr->b_comp, hdr->b_cdata,
+		    hdr->b_psize, data, hdr->b_size) != 0)
+			rc = ENOENT;
 	} else {
 		rc = ENOENT;
 	}
@@ -2799,7 +3420,10 @@ arc_buf_evict(arc_buf_t *buf)
 	ASSERT(buf->b_data != NULL);
 	arc_buf_destroy(buf, FALSE, FALSE);
 
-	if (hdr->b_datacnt == 0) {
+	if (hdr->b_datacnt == 0 && hdr->b_cdata != NULL) {
+		/* only the compressed copy stays cached */
+		hdr->b_flags &= ~ARC_BUF_AVAILABLE;
+	} else if (hdr->b_datacnt == 0) {
 		arc_state_t *old_state = hdr->b_state;
 		arc_state_t *evicted_state;
 
@@ -2808,16 +3432,10 @@ arc_buf_evict(arc_buf_t *buf)
 		evicted_state =
 		    (old_state == arc_mru) ? arc_mru_ghost : arc_mfu_ghost;
 
-		mutex_enter(&old_state->arcs_mtx);
-		mutex_enter(&evicted_state->arcs_mtx);
-
 		arc_change_state(evicted_state, hdr, hash_lock);
 		ASSERT(HDR_IN_HASH_TABLE(hdr));
 		hdr->b_flags |= ARC_IN_HASH_TABLE;
 		hdr->b_flags &= ~ARC_BUF_AVAILABLE;
-
-		mutex_exit(&evicted_state->arcs_mtx);
-		mutex_exit(&old_state->arcs_mtx);
 	}
 	mutex_exit(hash_lock);
 
@@ -2883,6 +3501,8 @@ arc_release(arc_buf_t *buf, void *tag)
 
 		ASSERT3U(hdr->b_state->arcs_size, >=, hdr->b_size);
 		atomic_add_64(&hdr->b_state->arcs_size, -hdr->b_size);
+		if (hdr->b_cdata != NULL)
+			ARCSTAT_INCR(arcstat_decompressed_size, -hdr->b_size);
 		if (refcount_is_zero(&hdr->b_refcnt)) {
 			uint64_t *size = &hdr->b_state->arcs_lsize[hdr->b_type];
 			ASSERT3U(*size, >=, hdr->b_size);
@@ -2917,6 +3537,8 @@ arc_release(arc_buf_t *buf, void *tag)
 		ASSERT(refcount_count(&hdr->b_refcnt) == 1);
 		ASSERT(!list_link_active(&hdr->b_arc_node));
 		ASSERT(!HDR_IO_IN_PROGRESS(hdr));
+		if (hdr->b_cdata != NULL)
+			arc_hdr_free_cdata(hdr);
 		arc_change_state(arc_anon, hdr, hash_lock);
 		hdr->b_arc_access = 0;
 		if (hdr->b_l2hdr != NULL) {
@@ -3283,6 +3905,7 @@ int
 arc_tempreserve_space(uint64_t reserve, uint64_t txg)
 {
 	int error;
+	uint64_t anon_size;
 
 #ifdef ZFS_DEBUG
 	/*
@@ -3313,8 +3936,9 @@ arc_tempreserve_space(uint64_t reserve, uint64_t txg)
 	 * Note: if two requests come in concurrently, we might let them
 	 * both succeed, when one of them should fail.  Not a huge deal.
 	 */
-	if (reserve + arc_tempreserve + arc_anon->arcs_size > arc_c / 2 &&
-	    arc_anon->arcs_size > arc_c / 4) {
+	anon_size = MAX((int64_t)(arc_anon->arcs_size - arc_loaned_bytes), 0);
+	if (reserve + arc_tempreserve + anon_size > arc_c / 2 &&
+	    anon_size > arc_c / 4) {
 		dprintf("failing, arc_tempreserve=%lluK anon_meta=%lluK "
 		    "anon_data=%lluK tempreserve=%lluK arc_c=%lluK\n",
 		    arc_tempreserve>>10,
@@ -3327,6 +3951,42 @@ arc_tempreserve_space(uint64_t reserve, uint64_t txg)
 	return (0);
 }
 
+static void
+arc_state_init(arc_state_t *state)
+{
+	int type, i;
+
+	for (type = 0; type < ARC_BUFC_NUMTYPES; type++) {
+		state->arcs_sublists[type] = kmem_zalloc(arc_num_sublists *
+		    sizeof (arc_sublist_t), KM_SLEEP);
+		for (i = 0; i < arc_num_sublists; i++) {
+			arc_sublist_t *sl = &state->arcs_sublists[type][i];
+
+			mutex_init(&sl->asl_mtx, NULL, MUTEX_DEFAULT, NULL);
+			list_create(&sl->asl_list, sizeof (arc_buf_hdr_t),
+			    offsetof(arc_buf_hdr_t, b_arc_node));
+		}
+	}
+}
+
+static void
+arc_state_fini(arc_state_t *state)
+{
+	int type, i;
+
+	for (type = 0; type < ARC_BUFC_NUMTYPES; type++) {
+		for (i = 0; i < arc_num_sublists; i++) {
+			arc_sublist_t *sl = &state->arcs_sublists[type][i];
+
+			list_destroy(&sl->asl_list);
+			mutex_destroy(&sl->asl_mtx);
+		}
+		kmem_free(state->arcs_sublists[type],
+		    arc_num_sublists * sizeof (arc_sublist_t));
+		state->arcs_sublists[type] = NULL;
+	}
+}
+
 void
 arc_init(void)
 {
@@ -3385,6 +4045,8 @@ arc_init(void)
 	if (arc_c < arc_c_min)
 		arc_c = arc_c_min;
 
+	arc_c_max_conf = arc_c_max;
+
 	arc_anon = &ARC_anon;
 	arc_mru = &ARC_mru;
 	arc_mru_ghost = &ARC_mru_ghost;
@@ -3393,33 +4055,12 @@ arc_init(void)
 	arc_l2c_only = &ARC_l2c_only;
 	arc_size = 0;
 
-	mutex_init(&arc_anon->arcs_mtx, NULL, MUTEX_DEFAULT, NULL);
-	mutex_init(&arc_mru->arcs_mtx, NULL, MUTEX_DEFAULT, NULL);
-	mutex_init(&arc_mru_ghost->arcs_mtx, NULL, MUTEX_DEFAULT, NULL);
-	mutex_init(&arc_mfu->arcs_mtx, NULL, MUTEX_DEFAULT, NULL);
-	mutex_init(&arc_mfu_ghost->arcs_mtx, NULL, MUTEX_DEFAULT, NULL);
-	mutex_init(&arc_l2c_only->arcs_mtx, NULL, MUTEX_DEFAULT, NULL);
-
-	list_create(&arc_mru->arcs_list[ARC_BUFC_METADATA],
-	    sizeof (arc_buf_hdr_t), offsetof(arc_buf_hdr_t, b_arc_node));
-	list_create(&arc_mru->arcs_list[ARC_BUFC_DATA],
-	    sizeof (arc_buf_hdr_t), offsetof(arc_buf_hdr_t, b_arc_node));
-	list_create(&arc_mru_ghost->arcs_list[ARC_BUFC_METADATA],
-	    sizeof (arc_buf_hdr_t), offsetof(arc_buf_hdr_t, b_arc_node));
-	list_create(&arc_mru_ghost->arcs_list[ARC_BUFC_DATA],
-	    sizeof (arc_buf_hdr_t), offsetof(arc_buf_hdr_t, b_arc_node));
-	list_create(&arc_mfu->arcs_list[ARC_BUFC_METADATA],
-	    sizeof (arc_buf_hdr_t), offsetof(arc_buf_hdr_t, b_arc_node));
-	list_create(&arc_mfu->arcs_list[ARC_BUFC_DATA],
-	    sizeof (arc_buf_hdr_t), offsetof(arc_buf_hdr_t, b_arc_node));
-	list_create(&arc_mfu_ghost->arcs_list[ARC_BUFC_METADATA],
-	    sizeof (arc_buf_hdr_t), offsetof(arc_buf_hdr_t, b_arc_node));
-	list_create(&arc_mfu_ghost->arcs_list[ARC_BUFC_DATA],
-	    sizeof (arc_buf_hdr_t), offsetof(arc_buf_hdr_t, b_arc_node));
-	list_create(&arc_l2c_only->arcs_list[ARC_BUFC_METADATA],
-	    sizeof (arc_buf_hdr_t), offsetof(arc_buf_hdr_t, b_arc_node));
-	list_create(&arc_l2c_only->arcs_list[ARC_BUFC_DATA],
-	    sizeof (arc_buf_hdr_t), offsetof(arc_buf_hdr_t, b_arc_node));
+	arc_num_sublists = MAX(zfs_arc_num_sublists, 1);
+	arc_state_init(arc_mru);
+	arc_state_init(arc_mru_ghost);
+	arc_state_init(arc_mfu);
+	arc_state_init(arc_mfu_ghost);
+	arc_state_init(arc_l2c_only);
 
 	buf_init();
 
@@ -3471,26 +4112,34 @@ arc_fini(void)
 	mutex_destroy(&arc_reclaim_thr_lock);
 	cv_destroy(&arc_reclaim_thr_cv);
 
-	list_destroy(&arc_mru->arcs_list[ARC_BUFC_METADATA]);
-	list_destroy(&arc_mru_ghost->arcs_list[ARC_BUFC_METADATA]);
-	list_destroy(&arc_mfu->arcs_list[ARC_BUFC_METADATA]);
-	list_destroy(&arc_mfu_ghost->arcs_list[ARC_BUFC_METADATA]);
-	list_destroy(&arc_mru->arcs_list[ARC_BUFC_DATA]);
-	list_destroy(&arc_mru_ghost->arcs_list[ARC_BUFC_DATA]);
-	list_destroy(&arc_mfu->arcs_list[ARC_BUFC_DATA]);
-	list_destroy(&arc_mfu_ghost->arcs_list[ARC_BUFC_DATA]);
-
-	mutex_destroy(&arc_anon->arcs_mtx);
-	mutex_destroy(&arc_mru->arcs_mtx);
-	mutex_destroy(&arc_mru_ghost->arcs_mtx);
-	mutex_destroy(&arc_mfu->arcs_mtx);
-	mutex_destroy(&arc_mfu_ghost->arcs_mtx);
+	arc_state_fini(arc_mru);
+	arc_state_fini(arc_mru_ghost);
+	arc_state_fini(arc_mfu);
+	arc_state_fini(arc_mfu_ghost);
+	arc_state_fini(arc_l2c_only);
 
 	mutex_destroy(&zfs_write_limit_lock);
 
 	buf_fini();
 }
 
+/*
+ * ZFSFUSE: kstats are not installed by this port, so the statistics are
+ * looked up by their kstat name.  Returns 0 for an unknown name.
+ */
+uint64_t
+arc_stat_get(const char *name)
+{
+	kstat_named_t *ksn = (kstat_named_t *)&arc_stats;
+	int i;
+
+	for (i = 0; i < sizeof (arc_stats) / sizeof (kstat_named_t); i++) {
+		if (strcmp(ksn[i].name, name) == 0)
+			return (ksn[i].value.ui64);
+	}
+	return (0);
+}
+
 /*
  * Level 2 ARC
  *
@@ -3605,6 +4254,22 @@ arc_fini(void)
  * 8. If an ARC buffer is written (and dirtied) which also exists in the
  * L2ARC, the now stale L2ARC buffer is immediately dropped.
  *
+ * 9. ZFSFUSE: the L2ARC survives restarts.  Next to the buffers, the feed
+ * writes log blocks holding the identity, device address and checksum
+ * of the buffers written before them.  A log block is written once it
+ * is full or l2arc_log_secs old, and points back to the one before it.
+ * The device header points to the newest log block and records the
+ * write hand and the eviction target.  The header is rewritten before
+ * any write goes past the target it records, so at import every region
+ * it calls valid still holds what the log blocks say.  A log block
+ * records where its buffers start and never spans the end of a sweep, so
+ * the rebuild knows which of them are left.  When the pool is
+ * imported, l2arc_dev_rebuild() walks the log blocks back from the
+ * newest and restores the headers of buffers still on the device into
+ * the arc_l2c_only state, as if they had just been evicted from the ARC.
+ * The device isn't fed until the rebuild is done.  A restored buffer is
+ * checked against its checksum when read, like any L2ARC buffer.
+ *
  * The performance of the L2ARC can be tweaked by a number of tunables, which
  * may be necessary for different workloads:
  *
@@ -3613,6 +4278,8 @@ arc_fini(void)
  *	l2arc_noprefetch	skip caching prefetched buffers
  *	l2arc_headroom		number of max device writes to precache
  *	l2arc_feed_secs		seconds between L2ARC writing
+ *	l2arc_rebuild_enabled	restore L2ARC contents at import
+ *	l2arc_log_secs		max seconds buffers wait for their log block
  *
  * Tunables may be removed or added as future performance improvements are
  * integrated, and also may become zpool properties.
@@ -3671,10 +4338,10 @@ l2arc_dev_get_next(void)
 		else if (next == first)
 			break;
 
-	} while (vdev_is_dead(next->l2ad_vdev));
+	} while (vdev_is_dead(next->l2ad_vdev) || next->l2ad_rebuild);
 
 	/* if we were unable to find any usable vdevs, return NULL */
-	if (vdev_is_dead(next->l2ad_vdev))
+	if (vdev_is_dead(next->l2ad_vdev) || next->l2ad_rebuild)
 		next = NULL;
 
 	l2arc_dev_last = next;
@@ -3865,38 +4532,37 @@ l2arc_read_done(zio_t *zio)
  * performance.
  *
  * Currently the metadata lists are hit first, MFU then MRU, followed by
- * the data lists.  This function returns a locked list, and also returns
- * the lock pointer.
+ * the data lists.  Each feed looks at one sublist of them, the next feed
+ * moves on to the next sublist.  This function returns a locked list,
+ * and also returns the lock pointer.
  */
 static list_t *
-l2arc_list_locked(int list_num, kmutex_t **lock)
+l2arc_list_locked(int list_num, int sublist, kmutex_t **lock)
 {
-	list_t *list;
+	arc_sublist_t *sl;
 
 	ASSERT(list_num >= 0 && list_num <= 3);
+	ASSERT(sublist >= 0 && sublist < arc_num_sublists);
 
 	switch (list_num) {
 	case 0:
-		list = &arc_mfu->arcs_list[ARC_BUFC_METADATA];
-		*lock = &arc_mfu->arcs_mtx;
+		sl = &arc_mfu->arcs_sublists[ARC_BUFC_METADATA][sublist];
 		break;
 	case 1:
-		list = &arc_mru->arcs_list[ARC_BUFC_METADATA];
-		*lock = &arc_mru->arcs_mtx;
+		sl = &arc_mru->arcs_sublists[ARC_BUFC_METADATA][sublist];
 		break;
 	case 2:
-		list = &arc_mfu->arcs_list[ARC_BUFC_DATA];
-		*lock = &arc_mfu->arcs_mtx;
+		sl = &arc_mfu->arcs_sublists[ARC_BUFC_DATA][sublist];
 		break;
 	case 3:
-		list = &arc_mru->arcs_list[ARC_BUFC_DATA];
-		*lock = &arc_mru->arcs_mtx;
+		sl = &arc_mru->arcs_sublists[ARC_BUFC_DATA][sublist];
 		break;
 	}
 
+	*lock = &sl->asl_mtx;
 	ASSERT(!(MUTEX_HELD(*lock)));
-	mutex_enter(*lock);
-	return (list);
+	arc_sublist_enter(sl);
+	return (&sl->asl_list);
 }
 
 /*
@@ -4030,6 +4696,133 @@ top:
 	dev->l2ad_evict = taddr;
 }
 
+/*
+ * Is [daddr, daddr + size) a region of the device which holds what was
+ * last written there?  Outside of the first sweep, the valid regions are
+ * the ones behind the write hand and beyond the eviction target.
+ */
+static boolean_t
+l2arc_addr_valid(l2arc_dev_t *dev, uint64_t daddr, uint64_t size)
+{
+	if (P2PHASE(daddr, SPA_MINBLOCKSIZE) != 0 ||
+	    daddr < dev->l2ad_start || daddr + size > dev->l2ad_end)
+		return (B_FALSE);
+	if (daddr + size <= dev->l2ad_hand)
+		return (B_TRUE);
+	return (!dev->l2ad_first && daddr >= dev->l2ad_evict);
+}
+
+/*
+ * Add a buffer just given an L2ARC header to the log block being filled.
+ */
+static void
+l2arc_log_blk_add(l2arc_dev_t *dev, arc_buf_hdr_t *ab)
+{
+	l2arc_log_ent_phys_t *le;
+
+	ASSERT(MUTEX_HELD(HDR_LOCK(ab)));
+	ASSERT(ab->b_freeze_cksum != NULL);
+	ASSERT3U(dev->l2ad_log_ents, <, L2ARC_LOG_BLK_ENTRIES);
+
+	if (dev->l2ad_log_ents == 0) {
+		dev->l2ad_log_lbolt = lbolt;
+		dev->l2ad_log->lb_start = ab->b_l2hdr->b_daddr;
+	}
+	le = &dev->l2ad_log->lb_entries[dev->l2ad_log_ents++];
+	le->le_dva = ab->b_dva;
+	le->le_birth = ab->b_birth;
+	le->le_cksum0 = ab->b_cksum0;
+	le->le_freeze_cksum = *ab->b_freeze_cksum;
+	le->le_daddr = ab->b_l2hdr->b_daddr;
+	le->le_size = ab->b_size;
+	le->le_type = ab->b_type;
+	le->le_flags = (ab->b_flags & ARC_INDIRECT) ? L2ARC_LE_INDIRECT : 0;
+}
+
+static void
+l2arc_log_blk_write_done(zio_t *zio)
+{
+	if (zio->io_error != 0)
+		ARCSTAT_BUMP(arcstat_l2_writes_error);
+	kmem_free(zio->io_private, L2ARC_LOG_BLK_SIZE);
+}
+
+/*
+ * Write the log block being filled at the write hand, as a child of pio
+ * or synchronously if there is none, and start a new one.  The device
+ * header is pointed to it by the next l2arc_dev_hdr_update(), after the
+ * write has completed.
+ */
+static void
+l2arc_log_blk_commit(l2arc_dev_t *dev, zio_t *pio)
+{
+	l2arc_log_blk_phys_t *lb = dev->l2ad_log;
+	zio_t *wzio;
+
+	ASSERT(dev->l2ad_log_ents != 0);
+	ASSERT3U(dev->l2ad_hand + L2ARC_LOG_BLK_SIZE, <=, dev->l2ad_end);
+
+	lb->lb_magic = L2ARC_LOG_BLK_MAGIC;
+	lb->lb_seq = dev->l2ad_log_head.lbp_seq + 1;
+	lb->lb_prev = dev->l2ad_log_head;
+	lb->lb_nentries = dev->l2ad_log_ents;
+
+	wzio = zio_write_phys(pio, dev->l2ad_vdev, dev->l2ad_hand,
+	    L2ARC_LOG_BLK_SIZE, lb, ZIO_CHECKSUM_LABEL,
+	    l2arc_log_blk_write_done, lb, ZIO_PRIORITY_ASYNC_WRITE,
+	    ZIO_FLAG_CANFAIL, B_FALSE);
+	/* lb is freed by the write */
+	dev->l2ad_log_head.lbp_daddr = dev->l2ad_hand;
+	dev->l2ad_log_head.lbp_seq = lb->lb_seq;
+	if (pio == NULL)
+		(void) zio_wait(wzio);
+	else
+		(void) zio_nowait(wzio);
+	ARCSTAT_BUMP(arcstat_l2_log_blk_writes);
+
+	dev->l2ad_hand += L2ARC_LOG_BLK_SIZE;
+	dev->l2ad_log = kmem_zalloc(L2ARC_LOG_BLK_SIZE, KM_SLEEP);
+	dev->l2ad_log_ents = 0;
+}
+
+/*
+ * Persist the device state which lets the next import rebuild the
+ * L2ARC.  The config lock must be held.
+ */
+static int
+l2arc_dev_hdr_update(l2arc_dev_t *dev)
+{
+	l2arc_dev_hdr_phys_t *dh = dev->l2ad_dev_hdr;
+	int err;
+
+	ASSERT(spa_config_held(dev->l2ad_spa, RW_READER));
+
+	bzero(dh, L2ARC_DEV_HDR_SIZE);
+	dh->dh_magic = L2ARC_DEV_HDR_MAGIC;
+	dh->dh_version = L2ARC_PERSIST_VERSION;
+	dh->dh_spa_guid = spa_guid(dev->l2ad_spa);
+	dh->dh_vdev_guid = dev->l2ad_vdev->vdev_guid;
+	dh->dh_start = dev->l2ad_start;
+	dh->dh_end = dev->l2ad_end;
+	dh->dh_hand = dev->l2ad_hand;
+	dh->dh_evict = dev->l2ad_evict;
+	dh->dh_flags = dev->l2ad_first ? 0 : L2ARC_DEV_HDR_WRAPPED;
+	dh->dh_log_head = dev->l2ad_log_head;
+
+	err = zio_wait(zio_write_phys(NULL, dev->l2ad_vdev,
+	    L2ARC_DEV_HDR_ADDR(dev), L2ARC_DEV_HDR_SIZE, dh,
+	    ZIO_CHECKSUM_LABEL, NULL, NULL, ZIO_PRIORITY_SYNC_WRITE,
+	    ZIO_FLAG_CONFIG_HELD | ZIO_FLAG_CANFAIL, B_FALSE));
+	if (err != 0) {
+		ARCSTAT_BUMP(arcstat_l2_dev_hdr_errors);
+		return (err);
+	}
+
+	dev->l2ad_hdr_evict = dev->l2ad_evict;
+	dev->l2ad_hdr_seq = dev->l2ad_log_head.lbp_seq;
+	return (0);
+}
+
 /*
  * Find and write ARC buffers to the L2ARC device.
  *
@@ -4042,17 +4835,19 @@ l2arc_write_buffers(spa_t *spa, l2arc_dev_t *dev, uint64_t target_sz)
 	arc_buf_hdr_t *ab, *ab_prev, *head;
 	l2arc_buf_hdr_t *hdrl2;
 	list_t *list;
-	uint64_t passed_sz, write_sz, buf_sz, headroom;
+	uint64_t passed_sz, write_sz, log_sz, buf_sz, headroom;
 	void *buf_data;
 	kmutex_t *hash_lock, *list_lock;
-	boolean_t have_lock, full;
+	boolean_t have_lock, full, wrap;
 	l2arc_write_callback_t *cb;
 	zio_t *pio, *wzio;
+	int sublist;
 
 	ASSERT(dev->l2ad_vdev != NULL);
 
 	pio = NULL;
 	write_sz = 0;
+	log_sz = 0;
 	full = B_FALSE;
 	head = kmem_cache_alloc(hdr_cache, KM_PUSHPAGE);
 	head->b_flags |= ARC_L2_WRITE_HEAD;
@@ -4060,9 +4855,10 @@ l2arc_write_buffers(spa_t *spa, l2arc_dev_t *dev, uint64_t target_sz)
 	/*
 	 * Copy buffers for L2ARC writing.
 	 */
+	sublist = l2arc_sublist_next++ % arc_num_sublists;
 	mutex_enter(&l2arc_buflist_mtx);
 	for (int try = 0; try <= 3; try++) {
-		list = l2arc_list_locked(try, &list_lock);
+		list = l2arc_list_locked(try, sublist, &list_lock);
 		passed_sz = 0;
 
 		/*
@@ -4119,7 +4915,12 @@ l2arc_write_buffers(spa_t *spa, l2arc_dev_t *dev, uint64_t target_sz)
 				continue;
 			}
 
-			if ((write_sz + ab->b_size) > target_sz) {
+			/*
+			 * ZFSFUSE: leave room for the log block of the
+			 * entries this write adds.
+			 */
+			if ((write_sz + log_sz + ab->b_size +
+			    L2ARC_LOG_BLK_SIZE) > target_sz) {
 				full = B_TRUE;
 				mutex_exit(hash_lock);
 				break;
@@ -4166,6 +4967,7 @@ l2arc_write_buffers(spa_t *spa, l2arc_dev_t *dev, uint64_t target_sz)
 			 */
 			arc_cksum_verify(ab->b_buf);
 			arc_cksum_compute(ab->b_buf, B_TRUE);
+			l2arc_log_blk_add(dev, ab);
 
 			mutex_exit(hash_lock);
 
@@ -4180,6 +4982,11 @@ l2arc_write_buffers(spa_t *spa, l2arc_dev_t *dev, uint64_t target_sz)
 
 			write_sz += buf_sz;
 			dev->l2ad_hand += buf_sz;
+
+			if (dev->l2ad_log_ents == L2ARC_LOG_BLK_ENTRIES) {
+				l2arc_log_blk_commit(dev, pio);
+				log_sz += L2ARC_LOG_BLK_SIZE;
+			}
 		}
 
 		mutex_exit(list_lock);
@@ -4189,22 +4996,35 @@ l2arc_write_buffers(spa_t *spa, l2arc_dev_t *dev, uint64_t target_sz)
 	}
 	mutex_exit(&l2arc_buflist_mtx);
 
+	/*
+	 * ZFSFUSE: entries not yet in a log block are lost by a restart,
+	 * don't keep them waiting for a full one for long.  Nor past the
+	 * end of the sweep: the buffers of a log block all lie between its
+	 * lb_start and itself, which l2arc_dev_rebuild() relies on.
+	 */
+	wrap = (dev->l2ad_hand >= dev->l2ad_end - target_sz);
+	if (dev->l2ad_log_ents != 0 && (wrap ||
+	    lbolt - dev->l2ad_log_lbolt >= hz * l2arc_log_secs)) {
+		l2arc_log_blk_commit(dev, pio);
+		log_sz += L2ARC_LOG_BLK_SIZE;
+	}
+
 	if (pio == NULL) {
 		ASSERT3U(write_sz, ==, 0);
 		kmem_cache_free(hdr_cache, head);
-		return;
+	} else {
+		ASSERT3U(write_sz + log_sz, <=, target_sz);
+		ARCSTAT_BUMP(arcstat_l2_writes_sent);
+		ARCSTAT_INCR(arcstat_l2_write_bytes, write_sz + log_sz);
+		ARCSTAT_INCR(arcstat_l2_size, write_sz);
 	}
-
-	ASSERT3U(write_sz, <=, target_sz);
-	ARCSTAT_BUMP(arcstat_l2_writes_sent);
-	ARCSTAT_INCR(arcstat_l2_size, write_sz);
-	spa_l2cache_space_update(dev->l2ad_vdev, 0, write_sz);
+	spa_l2cache_space_update(dev->l2ad_vdev, 0, write_sz + log_sz);
 
 	/*
 	 * Bump device hand to the device start if it is approaching the end.
 	 * l2arc_evict() will already have evicted ahead for this case.
 	 */
-	if (dev->l2ad_hand >= (dev->l2ad_end - target_sz)) {
+	if (wrap) {
 		spa_l2cache_space_update(dev->l2ad_vdev, 0,
 		    dev->l2ad_end - dev->l2ad_hand);
 		dev->l2ad_hand = dev->l2ad_start;
@@ -4212,7 +5032,8 @@ l2arc_write_buffers(spa_t *spa, l2arc_dev_t *dev, uint64_t target_sz)
 		dev->l2ad_first = B_FALSE;
 	}
 
-	(void) zio_wait(pio);
+	if (pio != NULL)
+		(void) zio_wait(pio);
 }
 
 /*
@@ -4282,9 +5103,29 @@ l2arc_feed_thread(void)
 			size += dev->l2ad_boost;
 
 		/*
-		 * Evict L2ARC buffers that will be overwritten.
+		 * ZFSFUSE: the hand a rebuild restored was left short of
+		 * the end by the write size of the last life, which may
+		 * have been smaller.
+		 */
+		size = MIN(size, dev->l2ad_end - dev->l2ad_hand);
+
+		/*
+		 * Evict L2ARC buffers that will be overwritten, making room
+		 * for a log block too.
 		 */
-		l2arc_evict(dev, size, B_FALSE);
+		l2arc_evict(dev, size + L2ARC_LOG_BLK_SIZE, B_FALSE);
+
+		/*
+		 * ZFSFUSE: the device header must cover the evicted region
+		 * before it is written over.  It also gets pointed to the
+		 * log blocks written by the last feed.
+		 */
+		if ((dev->l2ad_evict != dev->l2ad_hdr_evict ||
+		    dev->l2ad_log_head.lbp_seq != dev->l2ad_hdr_seq) &&
+		    l2arc_dev_hdr_update(dev) != 0) {
+			spa_config_exit(spa, dev);
+			continue;
+		}
 
 		/*
 		 * Write ARC buffers.
@@ -4299,6 +5140,251 @@ l2arc_feed_thread(void)
 	thread_exit();
 }
 
+/*
+ * ZFSFUSE: L2ARC rebuild.
+ *
+ * The rebuild thread takes the config lock for each of its i/os, but
+ * without waiting for a writer: l2arc_remove_vdev() may be called by
+ * the writer and wait for the rebuild to end.
+ */
+static int
+l2arc_rebuild_enter(l2arc_dev_t *dev)
+{
+	while (!spa_config_tryenter(dev->l2ad_spa, RW_READER, dev)) {
+		if (dev->l2ad_rebuild_cancel)
+			return (ECANCELED);
+		delay(1);
+	}
+	return (0);
+}
+
+static int
+l2arc_rebuild_read(l2arc_dev_t *dev, uint64_t daddr, uint64_t size,
+    void *buf)
+{
+	int err;
+
+	if ((err = l2arc_rebuild_enter(dev)) != 0)
+		return (err);
+	err = zio_wait(zio_read_phys(NULL, dev->l2ad_vdev, daddr, size, buf,
+	    ZIO_CHECKSUM_LABEL, NULL, NULL, ZIO_PRIORITY_ASYNC_READ,
+	    ZIO_FLAG_CONFIG_HELD | ZIO_FLAG_CANFAIL | ZIO_FLAG_SPECULATIVE,
+	    B_FALSE));
+	spa_config_exit(dev->l2ad_spa, dev);
+	return (err);
+}
+
+static boolean_t
+l2arc_dev_hdr_valid(l2arc_dev_t *dev, const l2arc_dev_hdr_phys_t *dh)
+{
+	return (dh->dh_magic == L2ARC_DEV_HDR_MAGIC &&
+	    dh->dh_version == L2ARC_PERSIST_VERSION &&
+	    dh->dh_spa_guid == spa_guid(dev->l2ad_spa) &&
+	    dh->dh_vdev_guid == dev->l2ad_vdev->vdev_guid &&
+	    dh->dh_start == dev->l2ad_start &&
+	    dh->dh_end == dev->l2ad_end &&
+	    dh->dh_hand >= dh->dh_start && dh->dh_hand <= dh->dh_end &&
+	    dh->dh_evict >= dh->dh_start && dh->dh_evict <= dh->dh_end &&
+	    (!(dh->dh_flags & L2ARC_DEV_HDR_WRAPPED) ||
+	    dh->dh_evict >= dh->dh_hand) &&
+	    P2PHASE(dh->dh_hand, SPA_MINBLOCKSIZE) == 0);
+}
+
+/*
+ * May the rebuild go on from the log block at daddr, or from the device
+ * header if it is 0, to the older one at prev?  Log blocks are written at
+ * rising addresses, so going back the walk goes down through the current
+ * sweep, may jump once to the end of the previous one and goes down to
+ * the eviction target.  Anything else has been written over.
+ */
+static boolean_t
+l2arc_log_blk_follows(l2arc_dev_t *dev, uint64_t daddr, uint64_t prev)
+{
+	if (prev == 0 || !l2arc_addr_valid(dev, prev, L2ARC_LOG_BLK_SIZE))
+		return (B_FALSE);
+	if (daddr == 0)
+		return (B_TRUE);
+	if (daddr < dev->l2ad_hand)
+		return (prev + L2ARC_LOG_BLK_SIZE <= daddr ||
+		    prev >= dev->l2ad_evict);
+	return (prev >= dev->l2ad_evict &&
+	    prev + L2ARC_LOG_BLK_SIZE <= daddr);
+}
+
+/*
+ * Restore the header of a buffer on the device into arc_l2c_only,
+ * unless the ARC already knows the block.  Only a buffer within
+ * [lo, hi) is still there.
+ */
+static void
+l2arc_hdr_restore(l2arc_dev_t *dev, const l2arc_log_ent_phys_t *le,
+    uint64_t lo, uint64_t hi)
+{
+	arc_buf_hdr_t *hdr, *exists;
+	l2arc_buf_hdr_t *abl2;
+	kmutex_t *hash_lock;
+
+	if (le->le_size == 0 || le->le_size > SPA_MAXBLOCKSIZE ||
+	    P2PHASE(le->le_size, SPA_MINBLOCKSIZE) != 0 ||
+	    le->le_type >= ARC_BUFC_NUMTYPES ||
+	    le->le_daddr < lo || le->le_daddr + le->le_size > hi ||
+	    !l2arc_addr_valid(dev, le->le_daddr, le->le_size))
+		return;
+
+	hdr = kmem_cache_alloc(hdr_cache, KM_SLEEP);
+	ASSERT(BUF_EMPTY(hdr));
+	hdr->b_dva = le->le_dva;
+	hdr->b_birth = le->le_birth;
+	hdr->b_cksum0 = le->le_cksum0;
+	hdr->b_size = le->le_size;
+	hdr->b_type = le->le_type;
+	hdr->b_spa = dev->l2ad_spa;
+	hdr->b_state = arc_anon;
+	hdr->b_arc_access = lbolt;
+	hdr->b_buf = NULL;
+	hdr->b_datacnt = 0;
+	hdr->b_flags = ARC_L2CACHE;
+	if (le->le_flags & L2ARC_LE_INDIRECT)
+		hdr->b_flags |= ARC_INDIRECT;
+
+	exists = buf_hash_insert(hdr, &hash_lock);
+	if (exists) {
+		mutex_exit(hash_lock);
+		bzero(&hdr->b_dva, sizeof (dva_t));
+		hdr->b_birth = 0;
+		hdr->b_cksum0 = 0;
+		kmem_cache_free(hdr_cache, hdr);
+		ARCSTAT_BUMP(arcstat_l2_rebuild_bufs_present);
+		return;
+	}
+
+	hdr->b_freeze_cksum = kmem_alloc(sizeof (zio_cksum_t), KM_SLEEP);
+	*hdr->b_freeze_cksum = le->le_freeze_cksum;
+
+	abl2 = kmem_zalloc(sizeof (l2arc_buf_hdr_t), KM_SLEEP);
+	abl2->b_dev = dev;
+	abl2->b_daddr = le->le_daddr;
+	hdr->b_l2hdr = abl2;
+	arc_change_state(arc_l2c_only, hdr, hash_lock);
+
+	/*
+	 * Restored from newest to oldest, the buflist is kept in the order
+	 * of the writes, as l2arc_evict() expects.
+	 */
+	mutex_enter(&l2arc_buflist_mtx);
+	list_insert_tail(dev->l2ad_buflist, hdr);
+	mutex_exit(&l2arc_buflist_mtx);
+	ARCSTAT_INCR(arcstat_l2_size, hdr->b_size);
+	ARCSTAT_BUMP(arcstat_l2_rebuild_bufs);
+
+	mutex_exit(hash_lock);
+}
+
+/*
+ * Started for each device added to the L2ARC.  Reads the device header,
+ * restores the buffers of the log blocks it leads to when it belongs to
+ * this device, and then writes the header for the device's new life.
+ */
+static void
+l2arc_dev_rebuild(l2arc_dev_t *dev)
+{
+	l2arc_dev_hdr_phys_t *dh = dev->l2ad_dev_hdr;
+	l2arc_log_blk_phys_t *lb;
+	l2arc_log_blkptr_t lbp;
+	uint64_t used, lo;
+	int err, i;
+
+	err = l2arc_rebuild_read(dev, L2ARC_DEV_HDR_ADDR(dev),
+	    L2ARC_DEV_HDR_SIZE, dh);
+	if (err == ECANCELED)
+		goto out;
+
+	/* otherwise a new device, or one of another pool */
+	lbp.lbp_daddr = 0;
+	if (err == 0 && l2arc_dev_hdr_valid(dev, dh)) {
+		/* new log blocks must not be taken for the old ones */
+		dev->l2ad_log_head.lbp_seq = dh->dh_log_head.lbp_seq;
+		if (l2arc_rebuild_enabled) {
+			dev->l2ad_hand = dh->dh_hand;
+			dev->l2ad_evict = dh->dh_evict;
+			dev->l2ad_first =
+			    !(dh->dh_flags & L2ARC_DEV_HDR_WRAPPED);
+			dev->l2ad_log_head = dh->dh_log_head;
+			lbp = dh->dh_log_head;
+		}
+	}
+
+	err = 0;
+	lb = kmem_alloc(L2ARC_LOG_BLK_SIZE, KM_SLEEP);
+	if (!l2arc_log_blk_follows(dev, 0, lbp.lbp_daddr))
+		lbp.lbp_daddr = 0;
+	while (lbp.lbp_daddr != 0) {
+		if (dev->l2ad_rebuild_cancel) {
+			err = ECANCELED;
+			break;
+		}
+		if (arc_reclaim_needed()) {
+			err = ENOMEM;
+			break;
+		}
+		err = l2arc_rebuild_read(dev, lbp.lbp_daddr,
+		    L2ARC_LOG_BLK_SIZE, lb);
+		if (err != 0)
+			break;
+		if (lb->lb_magic != L2ARC_LOG_BLK_MAGIC ||
+		    lb->lb_seq != lbp.lbp_seq ||
+		    lb->lb_nentries > L2ARC_LOG_BLK_ENTRIES) {
+			err = ECKSUM;
+			break;
+		}
+
+		/*
+		 * Its buffers were written from lb_start up to it.  In the
+		 * previous sweep, those before the eviction target are gone.
+		 */
+		lo = lb->lb_start;
+		if (lbp.lbp_daddr >= dev->l2ad_hand)
+			lo = MAX(lo, dev->l2ad_evict);
+		for (i = lb->lb_nentries - 1; i >= 0; i--) {
+			l2arc_hdr_restore(dev, &lb->lb_entries[i], lo,
+			    lbp.lbp_daddr);
+		}
+		ARCSTAT_BUMP(arcstat_l2_rebuild_log_blks);
+
+		if (!l2arc_log_blk_follows(dev, lbp.lbp_daddr,
+		    lb->lb_prev.lbp_daddr))
+			break;
+		lbp = lb->lb_prev;
+	}
+	kmem_free(lb, L2ARC_LOG_BLK_SIZE);
+
+	/* a device removed meanwhile, as import does, didn't fail it */
+	if (dev->l2ad_log_head.lbp_daddr != 0 && err != ECANCELED) {
+		if (err == 0) {
+			ARCSTAT_BUMP(arcstat_l2_rebuild_success);
+		} else {
+			ARCSTAT_BUMP(arcstat_l2_rebuild_abort);
+		}
+	}
+
+	used = dev->l2ad_hand - dev->l2ad_start;
+	if (!dev->l2ad_first)
+		used += dev->l2ad_end - dev->l2ad_evict;
+	spa_l2cache_space_update(dev->l2ad_vdev, 0, used);
+
+	if (l2arc_rebuild_enter(dev) == 0) {
+		(void) l2arc_dev_hdr_update(dev);
+		spa_config_exit(dev->l2ad_spa, dev);
+	}
+out:
+	mutex_enter(&l2arc_dev_mtx);
+	dev->l2ad_rebuild = B_FALSE;
+	cv_broadcast(&l2arc_rebuild_cv);
+	mutex_exit(&l2arc_dev_mtx);
+
+	thread_exit();
+}
+
 boolean_t
 l2arc_vdev_present(vdev_t *vd)
 {
@@ -4334,13 +5420,22 @@ l2arc_add_vdev(spa_t *spa, vdev_t *vd, uint64_t start, uint64_t end)
 	adddev->l2ad_vdev = vd;
 	adddev->l2ad_write = l2arc_write_max;
 	adddev->l2ad_boost = l2arc_write_boost;
-	adddev->l2ad_start = start;
+	adddev->l2ad_start = start + L2ARC_DEV_HDR_SIZE;
 	adddev->l2ad_end = end;
 	adddev->l2ad_hand = adddev->l2ad_start;
 	adddev->l2ad_evict = adddev->l2ad_start;
 	adddev->l2ad_first = B_TRUE;
 	ASSERT3U(adddev->l2ad_write, >, 0);
 
+	/*
+	 * ZFSFUSE: buffers for the persistent state, which is read by
+	 * l2arc_dev_rebuild() before the device is fed.
+	 */
+	adddev->l2ad_log = kmem_zalloc(L2ARC_LOG_BLK_SIZE, KM_SLEEP);
+	adddev->l2ad_dev_hdr = kmem_zalloc(L2ARC_DEV_HDR_SIZE, KM_SLEEP);
+	adddev->l2ad_hdr_evict = -1ULL;		/* header not written yet */
+	adddev->l2ad_rebuild = B_TRUE;
+
 	/*
 	 * This is a list of all ARC buffers that are still valid on the
 	 * device.
@@ -4358,6 +5453,9 @@ l2arc_add_vdev(spa_t *spa, vdev_t *vd, uint64_t start, uint64_t end)
 	list_insert_head(l2arc_dev_list, adddev);
 	atomic_inc_64(&l2arc_ndev);
 	mutex_exit(&l2arc_dev_mtx);
+
+	(void) thread_create(NULL, 0, l2arc_dev_rebuild, adddev, 0, &p0,
+	    TS_RUN, minclsyspri);
 }
 
 /*
@@ -4387,6 +5485,13 @@ l2arc_remove_vdev(vdev_t *vd)
 	list_remove(l2arc_dev_list, remdev);
 	l2arc_dev_last = NULL;		/* may have been invalidated */
 	atomic_dec_64(&l2arc_ndev);
+
+	/*
+	 * Stop the rebuild, if still running.
+	 */
+	remdev->l2ad_rebuild_cancel = B_TRUE;
+	while (remdev->l2ad_rebuild)
+		cv_wait(&l2arc_rebuild_cv, &l2arc_dev_mtx);
 	mutex_exit(&l2arc_dev_mtx);
 
 	/*
@@ -4395,6 +5500,8 @@ l2arc_remove_vdev(vdev_t *vd)
 	l2arc_evict(remdev, 0, B_TRUE);
 	list_destroy(remdev->l2ad_buflist);
 	kmem_free(remdev->l2ad_buflist, sizeof (list_t));
+	kmem_free(remdev->l2ad_log, L2ARC_LOG_BLK_SIZE);
+	kmem_free(remdev->l2ad_dev_hdr, L2ARC_DEV_HDR_SIZE);
 	kmem_free(remdev, sizeof (l2arc_dev_t));
 }
 
@@ -4411,6 +5518,7 @@ l2arc_init()
 	mutex_init(&l2arc_dev_mtx, NULL, MUTEX_DEFAULT, NULL);
 	mutex_init(&l2arc_buflist_mtx, NULL, MUTEX_DEFAULT, NULL);
 	mutex_init(&l2arc_free_on_write_mtx, NULL, MUTEX_DEFAULT, NULL);
+	cv_init(&l2arc_rebuild_cv, NULL, CV_DEFAULT, NULL);
 
 	l2arc_dev_list = &L2ARC_dev_list;
 	l2arc_free_on_write = &L2ARC_free_on_write;
@@ -4446,6 +5554,7 @@ l2arc_fini()
 	mutex_destroy(&l2arc_dev_mtx);
 	mutex_destroy(&l2arc_buflist_mtx);
 	mutex_destroy(&l2arc_free_on_write_mtx);
+	cv_destroy(&l2arc_rebuild_cv);
 
 	list_destroy(l2arc_dev_list);
 	list_destroy(l2arc_free_on_write);
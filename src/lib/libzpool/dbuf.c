@@ -36,6 +36,7 @@
 #include <sys/dmu_zfetch.h>
 
 static void dbuf_destroy(dmu_buf_impl_t *db);
+static void dbuf_hash_grow(void *unused);
 static int dbuf_undirty(dmu_buf_impl_t *db, dmu_tx_t *tx);
 static void dbuf_write(dbuf_dirty_record_t *dr, arc_buf_t *data, dmu_tx_t *tx);
 static arc_done_func_t dbuf_write_ready;
@@ -76,23 +77,26 @@ static dbuf_hash_table_t dbuf_hash_table;
 
 static uint64_t dbuf_hash_count;
 
+/*
+ * ZFSFUSE: the hash table starts at DBUF_HASH_MIN buckets and is doubled
+ * by dbuf_hash_grow() on dbuf_grow_taskq when it holds on average more
+ * than DBUF_HASH_LOAD dbufs per bucket.
+ */
+#define	DBUF_HASH_LOAD	2
+
+static taskq_t *dbuf_grow_taskq;
+static uint32_t dbuf_hash_growing;
+
+#define	DBUF_HASH_MULT	0x9e3779b97f4a7c15ULL
+
 static uint64_t
 dbuf_hash(void *os, uint64_t obj, uint8_t lvl, uint64_t blkid)
 {
-	uintptr_t osv = (uintptr_t)os;
-	uint64_t crc = -1ULL;
-
-	ASSERT(zfs_crc64_table[128] == ZFS_CRC64_POLY);
-	crc = (crc >> 8) ^ zfs_crc64_table[(crc ^ (lvl)) & 0xFF];
-	crc = (crc >> 8) ^ zfs_crc64_table[(crc ^ (osv >> 6)) & 0xFF];
-	crc = (crc >> 8) ^ zfs_crc64_table[(crc ^ (obj >> 0)) & 0xFF];
-	crc = (crc >> 8) ^ zfs_crc64_table[(crc ^ (obj >> 8)) & 0xFF];
-	crc = (crc >> 8) ^ zfs_crc64_table[(crc ^ (blkid >> 0)) & 0xFF];
-	crc = (crc >> 8) ^ zfs_crc64_table[(crc ^ (blkid >> 8)) & 0xFF];
-
-	crc ^= (osv>>14) ^ (obj>>16) ^ (blkid>>16);
+	uint64_t h = ((uintptr_t)os >> 6) ^ lvl;
 
-	return (crc);
+	h = (h ^ obj) * DBUF_HASH_MULT;
+	h = (h ^ (h >> 29) ^ blkid) * DBUF_HASH_MULT;
+	return (h ^ (h >> 32));
 }
 
 #define	DBUF_HASH(os, obj, level, blkid) dbuf_hash(os, obj, level, blkid);
@@ -103,31 +107,51 @@ dbuf_hash(void *os, uint64_t obj, uint8_t lvl, uint64_t blkid)
 	(dbuf)->db_level == (level) &&			\
 	(dbuf)->db_blkid == (blkid))
 
-dmu_buf_impl_t *
-dbuf_find(dnode_t *dn, uint8_t level, uint64_t blkid)
+/*
+ * Look up a dbuf which is not being evicted in both tables, the hash
+ * mutex for hv must be held.  Returns the dbuf with db_mtx held.
+ */
+static dmu_buf_impl_t *
+dbuf_hash_lookup(objset_impl_t *os, uint64_t obj, uint8_t level,
+    uint64_t blkid, uint64_t hv)
 {
 	dbuf_hash_table_t *h = &dbuf_hash_table;
-	objset_impl_t *os = dn->dn_objset;
-	uint64_t obj = dn->dn_object;
-	uint64_t hv = DBUF_HASH(os, obj, level, blkid);
-	uint64_t idx = hv & h->hash_table_mask;
-	dmu_buf_impl_t *db;
+	dmu_buf_impl_t *buckets[2], *db;
+	int i;
+
+	ASSERT(MUTEX_HELD(DBUF_HASH_MUTEX(h, hv)));
 
-	mutex_enter(DBUF_HASH_MUTEX(h, idx));
-	for (db = h->hash_table[idx]; db != NULL; db = db->db_hash_next) {
-		if (DBUF_EQUAL(db, os, obj, level, blkid)) {
+	buckets[0] = h->hash_table[hv & h->hash_table_mask];
+	buckets[1] = h->hash_newtable != NULL ?
+	    h->hash_newtable[hv & h->hash_newmask] : NULL;
+	for (i = 0; i < 2; i++) {
+		for (db = buckets[i]; db != NULL; db = db->db_hash_next) {
+			if (!DBUF_EQUAL(db, os, obj, level, blkid))
+				continue;
 			mutex_enter(&db->db_mtx);
-			if (db->db_state != DB_EVICTING) {
-				mutex_exit(DBUF_HASH_MUTEX(h, idx));
+			if (db->db_state != DB_EVICTING)
 				return (db);
-			}
 			mutex_exit(&db->db_mtx);
 		}
 	}
-	mutex_exit(DBUF_HASH_MUTEX(h, idx));
 	return (NULL);
 }
 
+dmu_buf_impl_t *
+dbuf_find(dnode_t *dn, uint8_t level, uint64_t blkid)
+{
+	dbuf_hash_table_t *h = &dbuf_hash_table;
+	objset_impl_t *os = dn->dn_objset;
+	uint64_t obj = dn->dn_object;
+	uint64_t hv = DBUF_HASH(os, obj, level, blkid);
+	dmu_buf_impl_t *db;
+
+	mutex_enter(DBUF_HASH_MUTEX(h, hv));
+	db = dbuf_hash_lookup(os, obj, level, blkid, hv);
+	mutex_exit(DBUF_HASH_MUTEX(h, hv));
+	return (db);
+}
+
 /*
  * Insert an entry into the hash table.  If there is already an element
  * equal to elem in the hash table, then the already existing element
@@ -143,29 +167,30 @@ dbuf_hash_insert(dmu_buf_impl_t *db)
 	int level = db->db_level;
 	uint64_t blkid = db->db_blkid;
 	uint64_t hv = DBUF_HASH(os, obj, level, blkid);
-	uint64_t idx = hv & h->hash_table_mask;
-	dmu_buf_impl_t *dbf;
-
-	mutex_enter(DBUF_HASH_MUTEX(h, idx));
-	for (dbf = h->hash_table[idx]; dbf != NULL; dbf = dbf->db_hash_next) {
-#ifdef DEBUG
-	printf("dbuf_hash_insert::h->hash_table[idx=%d]\n", idx, h->hash_table[idx] );
-#endif //DEBUG
-		if (DBUF_EQUAL(dbf, os, obj, level, blkid)) {
-			mutex_enter(&dbf->db_mtx);
-			if (dbf->db_state != DB_EVICTING) {
-				mutex_exit(DBUF_HASH_MUTEX(h, idx));
-				return (dbf);
-			}
-			mutex_exit(&dbf->db_mtx);
-		}
+	dmu_buf_impl_t *dbf, **bucket;
+
+	mutex_enter(DBUF_HASH_MUTEX(h, hv));
+	dbf = dbuf_hash_lookup(os, obj, level, blkid, hv);
+	if (dbf != NULL) {
+		mutex_exit(DBUF_HASH_MUTEX(h, hv));
+		return (dbf);
 	}
 
+	if (h->hash_newtable != NULL)
+		bucket = &h->hash_newtable[hv & h->hash_newmask];
+	else
+		bucket = &h->hash_table[hv & h->hash_table_mask];
 	mutex_enter(&db->db_mtx);
-	db->db_hash_next = h->hash_table[idx];
-	h->hash_table[idx] = db;
-	mutex_exit(DBUF_HASH_MUTEX(h, idx));
-	atomic_add_64(&dbuf_hash_count, 1);
+	db->db_hash_next = *bucket;
+	*bucket = db;
+	mutex_exit(DBUF_HASH_MUTEX(h, hv));
+
+	if (atomic_add_64_nv(&dbuf_hash_count, 1) >
+	    DBUF_HASH_LOAD * (h->hash_table_mask + 1) &&
+	    atomic_cas_32(&dbuf_hash_growing, 0, 1) == 0 &&
+	    taskq_dispatch(dbuf_grow_taskq, dbuf_hash_grow, NULL,
+	    TQ_NOSLEEP) == 0)
+		dbuf_hash_growing = 0;
 
 	return (NULL);
 }
@@ -180,7 +205,6 @@ dbuf_hash_remove(dmu_buf_impl_t *db)
 	dbuf_hash_table_t *h = &dbuf_hash_table;
 	uint64_t hv = DBUF_HASH(db->db_objset, db->db.db_object,
 	    db->db_level, db->db_blkid);
-	uint64_t idx = hv & h->hash_table_mask;
 	dmu_buf_impl_t *dbf, **dbp;
 
 	/*
@@ -191,18 +215,78 @@ dbuf_hash_remove(dmu_buf_impl_t *db)
 	ASSERT(db->db_state == DB_EVICTING);
 	ASSERT(!MUTEX_HELD(&db->db_mtx));
 
-	mutex_enter(DBUF_HASH_MUTEX(h, idx));
-	dbp = &h->hash_table[idx];
+	mutex_enter(DBUF_HASH_MUTEX(h, hv));
+	dbp = &h->hash_table[hv & h->hash_table_mask];
 	while ((dbf = *dbp) != db) {
+		if (dbf == NULL) {
+			/* not moved yet to the table being grown into */
+			ASSERT(h->hash_newtable != NULL);
+			dbp = &h->hash_newtable[hv & h->hash_newmask];
+			continue;
+		}
 		dbp = &dbf->db_hash_next;
-		ASSERT(dbf != NULL);
 	}
 	*dbp = db->db_hash_next;
 	db->db_hash_next = NULL;
-	mutex_exit(DBUF_HASH_MUTEX(h, idx));
+	mutex_exit(DBUF_HASH_MUTEX(h, hv));
 	atomic_add_64(&dbuf_hash_count, -1);
 }
 
+/*
+ * Double the hash table, moving dbufs over one bucket at a time so that
+ * lookups only wait for the bucket being moved.
+ */
+/* ARGSUSED */
+static void
+dbuf_hash_grow(void *unused)
+{
+	dbuf_hash_table_t *h = &dbuf_hash_table;
+	uint64_t hsize = h->hash_table_mask + 1, idx;
+	dmu_buf_impl_t **table;
+	int i;
+
+	table = kmem_zalloc(2 * hsize * sizeof (void *), KM_NOSLEEP);
+	if (table == NULL)
+		goto out;
+
+	for (i = 0; i < DBUF_MUTEXES; i++)
+		mutex_enter(&h->hash_mutexes[i].dhm_mtx);
+	h->hash_newmask = 2 * hsize - 1;
+	h->hash_newtable = table;
+	for (i = 0; i < DBUF_MUTEXES; i++)
+		mutex_exit(&h->hash_mutexes[i].dhm_mtx);
+
+	for (idx = 0; idx < hsize; idx++) {
+		dmu_buf_impl_t *db;
+
+		mutex_enter(DBUF_HASH_MUTEX(h, idx));
+		while ((db = h->hash_table[idx]) != NULL) {
+			uint64_t hv = DBUF_HASH(db->db_objset,
+			    db->db.db_object, db->db_level, db->db_blkid);
+			dmu_buf_impl_t **bucket = &table[hv & h->hash_newmask];
+
+			h->hash_table[idx] = db->db_hash_next;
+			db->db_hash_next = *bucket;
+			*bucket = db;
+		}
+		mutex_exit(DBUF_HASH_MUTEX(h, idx));
+	}
+
+	for (i = 0; i < DBUF_MUTEXES; i++)
+		mutex_enter(&h->hash_mutexes[i].dhm_mtx);
+	table = h->hash_table;
+	h->hash_table = h->hash_newtable;
+	h->hash_table_mask = h->hash_newmask;
+	h->hash_newtable = NULL;
+	h->hash_newmask = 0;
+	for (i = 0; i < DBUF_MUTEXES; i++)
+		mutex_exit(&h->hash_mutexes[i].dhm_mtx);
+
+	kmem_free(table, hsize * sizeof (void *));
+out:
+	dbuf_hash_growing = 0;
+}
+
 static arc_evict_func_t dbuf_do_evict;
 
 static void
@@ -235,34 +319,27 @@ dbuf_evict(dmu_buf_impl_t *db)
 void
 dbuf_init(void)
 {
-	uint64_t hsize = 1ULL << 16;
+	uint64_t hsize = DBUF_HASH_MIN;
 	dbuf_hash_table_t *h = &dbuf_hash_table;
 	int i;
 
 	/*
-	 * The hash table is big enough to fill all of physical memory
-	 * with an average 4K block size.  The table will take up
-	 * totalmem*sizeof(void*)/4K (i.e. 2MB/GB with 8-byte pointers).
+	 * The hash table starts at its minimal size and is grown by
+	 * dbuf_hash_grow() as dbufs are added.
 	 */
-	while (hsize * 4096 < physmem * PAGESIZE)
-		hsize <<= 1;
-
-retry:
 	h->hash_table_mask = hsize - 1;
-	h->hash_table = kmem_zalloc(hsize * sizeof (void *), KM_NOSLEEP);
-	if (h->hash_table == NULL) {
-		/* XXX - we should really return an error instead of assert */
-		ASSERT(hsize > (1ULL << 10));
-		hsize >>= 1;
-		goto retry;
-	}
+	h->hash_table = kmem_zalloc(hsize * sizeof (void *), KM_SLEEP);
+	h->hash_newtable = NULL;
+	dbuf_grow_taskq = taskq_create("dbuf_hash_grow", 1, minclsyspri,
+	    1, 1, 0);
 
 	dbuf_cache = kmem_cache_create("dmu_buf_impl_t",
 	    sizeof (dmu_buf_impl_t),
 	    0, dbuf_cons, dbuf_dest, NULL, NULL, NULL, 0);
 
 	for (i = 0; i < DBUF_MUTEXES; i++)
-		mutex_init(&h->hash_mutexes[i], NULL, MUTEX_DEFAULT, NULL);
+		mutex_init(&h->hash_mutexes[i].dhm_mtx, NULL, MUTEX_DEFAULT,
+		    NULL);
 }
 
 void
@@ -271,8 +348,11 @@ dbuf_fini(void)
 	dbuf_hash_table_t *h = &dbuf_hash_table;
 	int i;
 
+	/* waits for a grow in progress */
+	taskq_destroy(dbuf_grow_taskq);
+	ASSERT(h->hash_newtable == NULL);
 	for (i = 0; i < DBUF_MUTEXES; i++)
-		mutex_destroy(&h->hash_mutexes[i]);
+		mutex_destroy(&h->hash_mutexes[i].dhm_mtx);
 	kmem_free(h->hash_table, (h->hash_table_mask + 1) * sizeof (void *));
 	kmem_cache_destroy(dbuf_cache);
 }
@@ -1289,6 +1369,68 @@ dbuf_fill_done(dmu_buf_impl_t *db, dmu_tx_t *tx)
 	mutex_exit(&db->db_mtx);
 }
 
+/*
+ * Directly assign a provided arc buf to a given dbuf if it's not referenced
+ * by anybody except our caller. Otherwise copy arcbuf's contents to dbuf.
+ */
+void
+dbuf_assign_arcbuf(dmu_buf_impl_t *db, arc_buf_t *buf, dmu_tx_t *tx)
+{
+	ASSERT(!refcount_is_zero(&db->db_holds));
+	ASSERT(db->db_dnode->dn_object != DMU_META_DNODE_OBJECT);
+	ASSERT(db->db_blkid != DB_BONUS_BLKID);
+	ASSERT(db->db_level == 0);
+	ASSERT(DBUF_GET_BUFC_TYPE(db) == ARC_BUFC_DATA);
+	ASSERT(buf != NULL);
+	ASSERT(arc_buf_size(buf) == db->db.db_size);
+	ASSERT(tx->tx_txg != 0);
+
+	arc_return_buf(buf, db);
+	ASSERT(arc_released(buf));
+
+	mutex_enter(&db->db_mtx);
+
+	while (db->db_state == DB_READ || db->db_state == DB_FILL)
+		cv_wait(&db->db_changed, &db->db_mtx);
+
+	ASSERT(db->db_state == DB_CACHED || db->db_state == DB_UNCACHED);
+
+	if (db->db_state == DB_CACHED &&
+	    refcount_count(&db->db_holds) - 1 > db->db_dirtycnt) {
+		mutex_exit(&db->db_mtx);
+		(void) dbuf_dirty(db, tx);
+		bcopy(buf->b_data, db->db.db_data, db->db.db_size);
+		VERIFY(arc_buf_remove_ref(buf, db) == 1);
+		return;
+	}
+
+	if (db->db_state == DB_CACHED) {
+		dbuf_dirty_record_t *dr = db->db_last_dirty;
+
+		ASSERT(db->db_buf != NULL);
+		if (dr != NULL && dr->dr_txg == tx->tx_txg) {
+			ASSERT(dr->dt.dl.dr_data == db->db_buf);
+			if (!arc_released(db->db_buf)) {
+				ASSERT(dr->dt.dl.dr_override_state ==
+				    DR_OVERRIDDEN);
+				arc_release(db->db_buf, db);
+			}
+			dr->dt.dl.dr_data = buf;
+			VERIFY(arc_buf_remove_ref(db->db_buf, db) == 1);
+		} else if (dr == NULL || dr->dt.dl.dr_data != db->db_buf) {
+			arc_release(db->db_buf, db);
+			VERIFY(arc_buf_remove_ref(db->db_buf, db) == 1);
+		}
+		db->db_buf = NULL;
+	}
+	ASSERT(db->db_buf == NULL);
+	dbuf_set_data(db, buf);
+	db->db_state = DB_FILL;
+	mutex_exit(&db->db_mtx);
+	(void) dbuf_dirty(db, tx);
+	dbuf_fill_done(db, tx);
+}
+
 /*
  * "Clear" the contents of this dbuf.  This will mark the dbuf
  * EVICTING and clear *most* of its references.  Unfortunetely,
@@ -543,7 +543,7 @@ traverse_zil(traverse_handle_t *th, traverse_blk_cache_t *bc)
 	 * We only want to visit blocks that have been claimed but not yet
 	 * replayed (or, in read-only mode, blocks that *would* be claimed).
 	 */
-	if (claim_txg == 0 && (spa_mode & FWRITE))
+	if (claim_txg == 0 && spa_writeable(spa))
 		return;
 
 	th->th_zil_cache.bc_bookmark = bc->bc_bookmark;
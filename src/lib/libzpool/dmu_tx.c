@@ -934,6 +934,12 @@ dmu_tx_assign(dmu_tx_t *tx, uint64_t txg_how)
 	ASSERT(txg_how != 0);
 	ASSERT(!dsl_pool_sync_context(tx->tx_pool));
 
+	/*
+	 * Read-only pool has no open txg, nothing can be dirtied.
+	 */
+	if (!spa_writeable(tx->tx_pool->dp_spa))
+		return (EROFS);
+
 	while ((err = dmu_tx_try_assign(tx, txg_how)) != 0) {
 		dmu_tx_unassign(tx);
 
@@ -137,6 +137,10 @@ spa_prop_get_config(spa_t *spa, nvlist_t **nvp)
 		spa_prop_add_list(*nvp, ZPOOL_PROP_ALTROOT, spa->spa_root,
 		    0, ZPROP_SRC_LOCAL);
 
+	if (spa->spa_readonly)
+		spa_prop_add_list(*nvp, ZPOOL_PROP_READONLY, NULL,
+		    1, ZPROP_SRC_LOCAL);
+
 	if ((dp = list_head(&spa->spa_config_list)) != NULL) {
 		if (dp->scd_path == NULL) {
 			spa_prop_add_list(*nvp, ZPOOL_PROP_CACHEFILE,
@@ -288,6 +292,7 @@ spa_prop_validate(spa_t *spa, nvlist_t *props)
 
 		case ZPOOL_PROP_DELEGATION:
 		case ZPOOL_PROP_AUTOREPLACE:
+		case ZPOOL_PROP_READONLY:
 			error = nvpair_value_uint64(elem, &intval);
 			if (!error && intval > 1)
 				error = EINVAL;
@@ -870,7 +875,14 @@ spa_load_l2cache(spa_t *spa)
 
 			(void) vdev_validate_aux(vd);
 
-			if (!vdev_is_dead(vd)) {
+			/*
+			 * ZFSFUSE: a read-only pool can't feed its cache
+			 * devices, and doesn't remove them when unloaded.
+			 * Nor is a pool only probed by import worth the
+			 * L2ARC rebuild it would start.
+			 */
+			if (!vdev_is_dead(vd) && spa_writeable(spa) &&
+			    spa->spa_load_state != SPA_LOAD_TRYIMPORT) {
 				size = vdev_get_rsize(vd);
 				l2arc_add_vdev(spa, vd,
 				    VDEV_LABEL_START_SIZE,
@@ -887,7 +899,7 @@ spa_load_l2cache(spa_t *spa)
 
 		vd = oldvdevs[i];
 		if (vd != NULL) {
-			if (spa_mode & FWRITE &&
+			if (spa_writeable(spa) &&
 			    spa_l2cache_exists(vd->vdev_guid, &pool) &&
 			    pool != 0ULL &&
 			    l2arc_vdev_present(vd)) {
@@ -1374,7 +1386,11 @@ spa_load(spa_t *spa, nvlist_t *config, spa_load_state_t state, int mosconfig)
 		goto out;
 	}
 
-	if ((spa_mode & FWRITE) && state != SPA_LOAD_TRYIMPORT) {
+	/*
+	 * A read-only pool claims no log blocks and starts no sync threads,
+	 * nothing can be committed into it.
+	 */
+	if (spa_writeable(spa) && state != SPA_LOAD_TRYIMPORT) {
 		dmu_tx_t *tx;
 		int need_update = B_FALSE;
 		int c;
@@ -1760,10 +1776,11 @@ spa_validate_aux_devs(spa_t *spa, nvlist_t *nvroot, uint64_t crtxg, int mode,
 		}
 
 		/*
-		 * The L2ARC currently only supports disk devices.
+		 * ZFSFUSE: the L2ARC supports disk devices and plain files.
 		 */
 		if ((strcmp(config, ZPOOL_CONFIG_L2CACHE) == 0) &&
-		    strcmp(vd->vdev_ops->vdev_op_type, VDEV_TYPE_DISK) != 0) {
+		    strcmp(vd->vdev_ops->vdev_op_type, VDEV_TYPE_DISK) != 0 &&
+		    strcmp(vd->vdev_ops->vdev_op_type, VDEV_TYPE_FILE) != 0) {
 			error = ENOTBLK;
 			goto out;
 		}
@@ -1869,7 +1886,7 @@ spa_l2cache_drop(spa_t *spa)
 		vd = sav->sav_vdevs[i];
 		ASSERT(vd != NULL);
 
-		if (spa_mode & FWRITE &&
+		if (spa_writeable(spa) &&
 		    spa_l2cache_exists(vd->vdev_guid, &pool) && pool != 0ULL &&
 		    l2arc_vdev_present(vd)) {
 			l2arc_remove_vdev(vd);
@@ -1898,6 +1915,7 @@ spa_create(const char *pool, nvlist_t *nvroot, nvlist_t *props,
 	nvlist_t **spares, **l2cache;
 	uint_t nspares, nl2cache;
 	uint64_t version;
+	uint64_t readonly = 0;
 
 	/*
 	 * If this pool already exists, return failure.
@@ -1918,7 +1936,17 @@ spa_create(const char *pool, nvlist_t *nvroot, nvlist_t *props,
 
 	spa->spa_uberblock.ub_txg = txg - 1;
 
-	if (props && (error = spa_prop_validate(spa, props))) {
+	/*
+	 * A pool can't be created read-only, there is nothing to read yet.
+	 */
+	(void) nvlist_lookup_uint64(props,
+	    zpool_prop_to_name(ZPOOL_PROP_READONLY), &readonly);
+	if (readonly != 0)
+		error = EINVAL;
+	else if (props)
+		error = spa_prop_validate(spa, props);
+
+	if (error) {
 		spa_unload(spa);
 		spa_deactivate(spa);
 		spa_remove(spa);
@@ -2091,6 +2119,7 @@ spa_import_common(const char *pool, nvlist_t *config, nvlist_t *props,
 	nvlist_t *nvroot;
 	nvlist_t **spares, **l2cache;
 	uint_t nspares, nl2cache;
+	uint64_t readonly = 0;
 
 	/*
 	 * If a pool with this name exists, return failure.
@@ -2106,12 +2135,15 @@ spa_import_common(const char *pool, nvlist_t *config, nvlist_t *props,
 	 */
 	(void) nvlist_lookup_string(props,
 	    zpool_prop_to_name(ZPOOL_PROP_ALTROOT), &altroot);
+	(void) nvlist_lookup_uint64(props,
+	    zpool_prop_to_name(ZPOOL_PROP_READONLY), &readonly);
 	spa = spa_add(pool, altroot);
 	spa_activate(spa);
 
 	if (allowfaulted)
 		spa->spa_import_faulted = B_TRUE;
 	spa->spa_is_root = isroot;
+	spa->spa_readonly = (readonly != 0);
 
 	/*
 	 * Pass off the heavy lifting to spa_load().
@@ -2146,7 +2178,12 @@ spa_import_common(const char *pool, nvlist_t *config, nvlist_t *props,
 		    VDEV_ALLOC_L2CACHE);
 	spa_config_exit(spa, FTAG);
 
-	if (error != 0 || (props && (error = spa_prop_set(spa, props)))) {
+	/*
+	 * Properties of a read-only pool can't be stored, those meaningful
+	 * for it (altroot, readonly) are already applied.
+	 */
+	if (error != 0 || (props && spa_writeable(spa) &&
+	    (error = spa_prop_set(spa, props)))) {
 		if (loaderr != 0 && loaderr != EINVAL && allowfaulted) {
 			/*
 			 * If we failed to load the pool, but 'allowfaulted' is
@@ -2208,7 +2245,7 @@ spa_import_common(const char *pool, nvlist_t *config, nvlist_t *props,
 		spa->spa_l2cache.sav_sync = B_TRUE;
 	}
 
-	if (spa_mode & FWRITE) {
+	if (spa_writeable(spa)) {
 		/*
 		 * Update the config cache to include the newly-imported pool.
 		 */
@@ -3552,6 +3589,13 @@ spa_scrub(spa_t *spa, pool_scrub_type_t type)
  * ==========================================================================
  */
 
+/*
+ * ZFSFUSE: while nonzero, async tasks requested by pool load (config cache
+ * update, resilver, device removal) are queued but not dispatched, so they
+ * don't compete with the import and the first mount for the pool.
+ */
+static uint32_t spa_async_deferred = 0;
+
 static void
 spa_async_remove(spa_t *spa, vdev_t *vd)
 {
@@ -3655,6 +3699,7 @@ spa_async_dispatch(spa_t *spa)
 {
 	mutex_enter(&spa->spa_async_lock);
 	if (spa->spa_async_tasks && !spa->spa_async_suspended &&
+	    spa_async_deferred == 0 && spa_writeable(spa) &&
 	    spa->spa_async_thread == NULL &&
 	    rootdir != NULL && !vn_is_readonly(rootdir))
 		spa->spa_async_thread = thread_create(NULL, 0,
@@ -3670,6 +3715,37 @@ spa_async_request(spa_t *spa, int task)
 	mutex_exit(&spa->spa_async_lock);
 }
 
+/*
+ * Hold back dispatching of async tasks of all pools until the matching
+ * spa_async_undefer().  Tasks requested meanwhile are kept pending.
+ */
+void
+spa_async_defer(void)
+{
+	atomic_add_32(&spa_async_deferred, 1);
+}
+
+/*
+ * Drop a spa_async_defer() hold and dispatch tasks queued by active pools
+ * instead of waiting for their next sync.
+ */
+void
+spa_async_undefer(void)
+{
+	spa_t *spa = NULL;
+
+	ASSERT(spa_async_deferred != 0);
+	if (atomic_add_32_nv(&spa_async_deferred, -1) != 0)
+		return;
+
+	mutex_enter(&spa_namespace_lock);
+	while ((spa = spa_next(spa)) != NULL) {
+		if (spa->spa_state == POOL_STATE_ACTIVE)
+			spa_async_dispatch(spa);
+	}
+	mutex_exit(&spa_namespace_lock);
+}
+
 /*
  * ==========================================================================
  * SPA syncing routines
@@ -3837,6 +3913,13 @@ spa_sync_props(void *arg1, void *arg2, cred_t *cr, dmu_tx_t *tx)
 			ASSERT(spa->spa_root != NULL);
 			break;
 
+		case ZPOOL_PROP_READONLY:
+			/*
+			 * 'readonly' is a non-persistent property applied at
+			 * import time, only 'off' can get here.
+			 */
+			break;
+
 		case ZPOOL_PROP_CACHEFILE:
 			/*
 			 * 'cachefile' is a non-persistent property, but note
@@ -4118,7 +4201,8 @@ spa_sync_allpools(void)
 	spa_t *spa = NULL;
 	mutex_enter(&spa_namespace_lock);
 	while ((spa = spa_next(spa)) != NULL) {
-		if (spa_state(spa) != POOL_STATE_ACTIVE)
+		if (spa_state(spa) != POOL_STATE_ACTIVE ||
+		    !spa_writeable(spa))
 			continue;
 		spa_open_ref(spa, FTAG);
 		mutex_exit(&spa_namespace_lock);
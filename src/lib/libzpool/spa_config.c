@@ -225,6 +225,13 @@ spa_config_sync(spa_t *target, boolean_t removing, boolean_t postsysevent)
 			if (spa->spa_config == NULL || spa->spa_name == NULL)
 				continue;
 
+			/*
+			 * Read-only pools are imported explicitly every time,
+			 * cached config would open them writeable.
+			 */
+			if (spa->spa_readonly)
+				continue;
+
 			if (spa == target && removing)
 				continue;
 
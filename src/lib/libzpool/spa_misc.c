@@ -259,6 +259,36 @@ spa_config_exit(spa_t *spa, void *tag)
 	mutex_exit(&scl->scl_lock);
 }
 
+/*
+ * ZFSFUSE: like spa_config_enter(), but fails instead of waiting.  For
+ * background threads which a config lock writer may be waiting for.
+ */
+boolean_t
+spa_config_tryenter(spa_t *spa, krw_t rw, void *tag)
+{
+	spa_config_lock_t *scl = &spa->spa_config_lock;
+
+	mutex_enter(&scl->scl_lock);
+
+	if (scl->scl_writer != NULL && scl->scl_writer != curthread) {
+		mutex_exit(&scl->scl_lock);
+		return (B_FALSE);
+	}
+	if (rw == RW_WRITER) {
+		if (!refcount_is_zero(&scl->scl_count) &&
+		    scl->scl_writer != curthread) {
+			mutex_exit(&scl->scl_lock);
+			return (B_FALSE);
+		}
+		scl->scl_writer = curthread;
+	}
+
+	(void) refcount_add(&scl->scl_count, tag);
+
+	mutex_exit(&scl->scl_lock);
+	return (B_TRUE);
+}
+
 boolean_t
 spa_config_held(spa_t *spa, krw_t rw)
 {
@@ -1153,6 +1183,16 @@ spa_get_failmode(spa_t *spa)
 	return (spa->spa_failmode);
 }
 
+/*
+ * Return whether the pool can be written: spa_mode allows writing and the
+ * pool wasn't imported read-only.  A read-only pool runs no sync threads.
+ */
+boolean_t
+spa_writeable(spa_t *spa)
+{
+	return (!!(spa_mode & FWRITE) && !spa->spa_readonly);
+}
+
 uint64_t
 spa_version(spa_t *spa)
 {
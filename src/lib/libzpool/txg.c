@@ -420,6 +420,14 @@ txg_wait_synced(dsl_pool_t *dp, uint64_t txg)
 	tx_state_t *tx = &dp->dp_tx;
 
 	mutex_enter(&tx->tx_sync_lock);
+	/*
+	 * Read-only pool runs no sync threads and has nothing to sync.
+	 */
+	if (tx->tx_threads == 0) {
+		ASSERT(!spa_writeable(dp->dp_spa));
+		mutex_exit(&tx->tx_sync_lock);
+		return;
+	}
 	ASSERT(tx->tx_threads == 2);
 	if (txg == 0)
 		txg = tx->tx_open_txg;
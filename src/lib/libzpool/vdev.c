@@ -1425,18 +1425,22 @@ vdev_load(vdev_t *vd)
 		vdev_load(vd->vdev_child[c]);
 
 	/*
-	 * If this is a top-level vdev, initialize its metaslabs.
+	 * If this is a top-level vdev, initialize its metaslabs.  A read-only
+	 * pool never allocates, so its metaslabs and space maps aren't read
+	 * at all and the pool reports no free space.
 	 */
 	if (vd == vd->vdev_top &&
 	    (vd->vdev_ashift == 0 || vd->vdev_asize == 0 ||
-	    vdev_metaslab_init(vd, 0) != 0))
+	    (spa_writeable(vd->vdev_spa) && vdev_metaslab_init(vd, 0) != 0)))
 		vdev_set_state(vd, B_FALSE, VDEV_STATE_CANT_OPEN,
 		    VDEV_AUX_CORRUPT_DATA);
 
 	/*
-	 * If this is a leaf vdev, load its DTL.
+	 * If this is a leaf vdev, load its DTL.  Read-only pool doesn't
+	 * resilver, so it doesn't need DTLs either.
 	 */
-	if (vd->vdev_ops->vdev_op_leaf && vdev_dtl_load(vd) != 0)
+	if (vd->vdev_ops->vdev_op_leaf && spa_writeable(vd->vdev_spa) &&
+	    vdev_dtl_load(vd) != 0)
 		vdev_set_state(vd, B_FALSE, VDEV_STATE_CANT_OPEN,
 		    VDEV_AUX_CORRUPT_DATA);
 }
@@ -41,6 +41,15 @@
  * Virtual device vector for files.
  */
 
+/*
+ * Files of a read-only pool are opened without write access.
+ */
+static int
+vdev_file_mode(vdev_t *vd)
+{
+	return (spa_writeable(vd->vdev_spa) ? spa_mode : FREAD);
+}
+
 static int
 vdev_file_open_common(vdev_t *vd)
 {
@@ -66,7 +75,7 @@ vdev_file_open_common(vdev_t *vd)
 	 */
 	ASSERT(vd->vdev_path != NULL && vd->vdev_path[0] == '/');
 	error = vn_openat(vd->vdev_path + 1, UIO_SYSSPACE,
-	    spa_mode | FOFFMAX, 0, &vp, 0, 0, rootdir, -1);
+	    vdev_file_mode(vd) | FOFFMAX, 0, &vp, 0, 0, rootdir, -1);
 
 	if (error) {
 		dprintf("vn_openat() returned error %i\n", error);
@@ -128,7 +137,8 @@ vdev_file_close(vdev_t *vd)
 
 	if (vf->vf_vnode != NULL) {
 		(void) VOP_PUTPAGE(vf->vf_vnode, 0, 0, B_INVAL, kcred, NULL);
-		(void) VOP_CLOSE(vf->vf_vnode, spa_mode, 1, 0, kcred, NULL);
+		(void) VOP_CLOSE(vf->vf_vnode, vdev_file_mode(vd), 1, 0, kcred,
+		    NULL);
 		VN_RELE(vf->vf_vnode);
 	}
 
@@ -208,7 +218,7 @@ vdev_file_probe(vdev_t *vd)
 			break;
 	}
 
-	if ((spa_mode & FWRITE) && !error) {
+	if (spa_writeable(vd->vdev_spa) && !error) {
 		error = vdev_file_probe_io(nvd, vl_boot, VDEV_BOOT_HEADER_SIZE,
 		    offset, UIO_WRITE);
 	}
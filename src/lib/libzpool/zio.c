@@ -483,7 +483,9 @@ zio_read(zio_t *pio, spa_t *spa, const blkptr_t *bp, void *data,
 {
 	zio_t *zio;
 
-	ASSERT3U(size, ==, BP_GET_LSIZE(bp));
+	ASSERT3U(size, ==, (flags & ZIO_FLAG_RAW) ?
+	    BP_GET_PSIZE(bp) : BP_GET_LSIZE(bp));
+	ASSERT(!(flags & ZIO_FLAG_RAW) || !BP_IS_GANG(bp));
 
 	/*
 	 * If the user has specified that we allow I/Os to continue
@@ -968,7 +970,8 @@ zio_read_init(zio_t *zio)
 {
 	blkptr_t *bp = zio->io_bp;
 
-	if (BP_GET_COMPRESS(bp) != ZIO_COMPRESS_OFF) {
+	if (BP_GET_COMPRESS(bp) != ZIO_COMPRESS_OFF &&
+	    !(zio->io_flags & ZIO_FLAG_RAW)) {
 		uint64_t csize = BP_GET_PSIZE(bp);
 		void *cbuf = zio_buf_alloc(csize);
 
@@ -1834,7 +1837,7 @@ zio_vdev_io_start(zio_t *zio)
 	ASSERT(P2PHASE(zio->io_size, align) == 0);
 	ASSERT(bp == NULL ||
 	    P2ROUNDUP(ZIO_GET_IOSIZE(zio), align) == zio->io_size);
-	ASSERT(zio->io_type != ZIO_TYPE_WRITE || (spa_mode & FWRITE));
+	ASSERT(zio->io_type != ZIO_TYPE_WRITE || spa_writeable(zio->io_spa));
 
 	return (vd->vdev_ops->vdev_op_io_start(zio));
 }
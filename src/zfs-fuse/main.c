@@ -73,112 +73,62 @@
 #include "handle_allocator.h"
 #include "dirent_engine.h"
 #include "zfs_operations.h"
+#include "storage.h"
+#include "warmup.h"
 
 pthread_t storage_create_thread_id;
 //pthread_t listener_thread_id;
 
 #endif //NOIOCTL
 
+/*pool vdev file, directory of it is searched when pool is not in cache*/
+#define STORAGE_VDEV_ENV "ZFS_FUSE_VDEV"
+#define STORAGE_VDEV_DEFAULT "/home/zvm/zfs.cow"
+/*pool configuration cache file, lets restart open pool without scanning*/
+#define STORAGE_CACHEFILE_ENV "ZFS_FUSE_CACHEFILE"
+/*if set to 1 pool is always created anew, as it was before import support*/
+#define STORAGE_CREATE_ENV "ZFS_FUSE_CREATE"
+/*if set to 1 pool is imported read-only, as never written image*/
+#define STORAGE_READONLY_ENV "ZFS_FUSE_READONLY"
+/*warm-up manifest, prefetched after mount or recorded if doesn't exist*/
+#define WARMUP_MANIFEST_ENV "ZFS_FUSE_WARMUP"
+
+extern const char *spa_config_path;
+
 static const char *cf_pidfile = NULL;
 static int cf_daemonize = 1;
 
 extern char *optarg;
 extern int optind, opterr, optopt;
 
-extern vfsops_t *zfs_vfsops;
-extern vfs_t*  s_vfs;
 vfs_t*  s_vfs;
 
-static vfs_t* prepare_storage(zfs_handle_t *zfs_handle, char* name, char* mountdir){
-	char mountpoint[ZFS_MAXPROPLEN];
-
-	if (!zfs_is_mountable(zfs_handle, mountpoint, sizeof (mountpoint), NULL))
-	    return (0);
-
-	vfs_t *vfs = kmem_zalloc(sizeof(vfs_t), KM_SLEEP);
-	if(vfs == NULL){
-	    errno = ENOMEM;
-	    return NULL;
-	}
-
-	VFS_INIT(vfs, zfs_vfsops, 0);
-	VFS_HOLD(vfs);
-
-	struct mounta uap = {name, mountdir, MS_SYSSPACE, NULL, "", 0};
-	int ret;
-	if ((ret = VFS_MOUNT(vfs, rootdir, &uap, kcred)) != 0) {
-	    kmem_free(vfs, sizeof(vfs_t));
-	    return NULL;
-	}
-	return vfs;
-}
-
-static int create_storage(char* storage_path, char* name, char* mountdir){
-	int ret;
-	nvlist_t *nvroot;
-	nvlist_t *fsprops = NULL;
-	nvlist_t *props = NULL;
-	boolean_t force = B_FALSE;
-	boolean_t dryrun = B_FALSE;
-	char* mountpoint = NULL;
-
-	if ((g_zfs = libzfs_init()) == NULL) {
-		(void) fprintf(stderr, gettext("internal error: failed to "
-		    "initialize ZFS library\n"));
-		return (1);
-	}
-
-	/* pass off to get_vdev_spec for bulk processing */
-	nvroot = make_root_vdev(NULL, force, !force, B_FALSE, dryrun,
-	    1, &storage_path);
-	if (nvroot == NULL)
-		goto errout;
-
-	/* make_root_vdev() allows 0 toplevel children if there are spares */
-	if (!zfs_allocatable_devs(nvroot)) {
-		(void) fprintf(stderr, gettext("invalid vdev "
-		    "specification: at least one toplevel vdev must be "
-		    "specified\n"));
-		goto errout;
-	}
-
-	/*
-	 * Hand off to libzfs.
-	 */
-	if (zpool_create(g_zfs, name,
-			 nvroot, props, fsprops) == 0) {
-	    zfs_handle_t *pool = zfs_open(g_zfs, name,
-					  ZFS_TYPE_FILESYSTEM);
-	    if (pool != NULL) {
-		if (mountpoint != NULL)
-		    verify(zfs_prop_set(pool,
-					zfs_prop_to_name(
-							 ZFS_PROP_MOUNTPOINT),
-					mountpoint) == 0);
-		s_vfs = prepare_storage(pool, name, mountdir);
-		zfs_close(pool);
-	    }
-	} else if (libzfs_errno(g_zfs) == EZFS_INVALIDNAME) {
-	    (void) fprintf(stderr, gettext("pool name may have "
-					   "been omitted\n"));
-	}
-
-errout:
-	nvlist_free(nvroot);
-	nvlist_free(fsprops);
-	nvlist_free(props);
-	return (ret);
-}
-
 static void* storage_create_thread(void* obj){
 	(void)obj;
-	create_storage("/home/zvm/zfs.cow", "file", "/file");
+	char *vdev = getenv(STORAGE_VDEV_ENV);
+	char *create = getenv(STORAGE_CREATE_ENV);
+	char *readonly = getenv(STORAGE_READONLY_ENV);
+
+	if(vdev == NULL)
+		vdev = STORAGE_VDEV_DEFAULT;
+	if(create != NULL && strcmp(create, "1") == 0)
+		s_vfs = create_storage(vdev, "file", "/file");
+	else
+		s_vfs = open_storage(vdev, "file", "/file",
+		    readonly != NULL && strcmp(readonly, "1") == 0);
 	return NULL;
 }
 
 int main(int argc, char *argv[])
 {
 	int ret;
+	char *cachefile = getenv(STORAGE_CACHEFILE_ENV);
+
+	clock_gettime(CLOCK_MONOTONIC, &zfs_fuse_start_time);
+
+	/*must be set before do_init, it loads pools listed by cache file*/
+	if(cachefile != NULL)
+		spa_config_path = cachefile;
 
 	if(do_init() != 0) {
 		do_exit();
@@ -192,12 +142,20 @@ int main(int argc, char *argv[])
 	assert(0 == ret);
 
 	assert(s_vfs);
+	char *manifest = getenv(WARMUP_MANIFEST_ENV);
+	if(manifest != NULL && warmup_start(s_vfs, manifest) != 0)
+		fprintf(stderr, "zfs-fuse: can't read warm-up manifest %s\n",
+			manifest);
+
 	struct fuse_operations* fuse_op = CONSTRUCT_L(FUSE_OPERATIONS)(s_vfs);
 	assert(fuse_op);
 
 	//fusermount -u zfs-fuse/mountpoint; mkdir -p zfs-fuse/mountpoint; rm ~/zfs.cow -f; dd count=1024 bs=65536 if=/dev/zero of=~/zfs.cow &> /dev/null	
-	//gdb --annotate=3 --args zfs-fuse/zfs-fuse -s -odirect_io -d  /home/zvm/git/zfs-prezerovm/src/zfs-fuse/mountpoint
-	ret = fuse_main(argc, argv, fuse_op);
+	//operations are reentrant, so fuse can be run multithreaded, without -s
+	//gdb --annotate=3 --args zfs-fuse/zfs-fuse -odirect_io -d  /home/zvm/git/zfs-prezerovm/src/zfs-fuse/mountpoint
+	ret = fuse_main(argc, argv, fuse_op, NULL);
+
+	warmup_stop();
 
 	do_exit();
 
@@ -0,0 +1,240 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+/*
+ * Copyright 2006 Ricardo Correia.
+ * Use is subject to license terms.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <libgen.h>
+#include <libintl.h>
+#include <time.h>
+#include <sys/nvpair.h>
+#include <sys/fs/zfs.h>
+#include <sys/mount.h>
+#include <sys/systm.h>
+#include <sys/spa.h>
+
+#include <libzfs.h>
+
+#include "zfs_comutil.h"
+#include "new_zpool_util.h"
+#include "storage.h"
+
+extern vfsops_t *zfs_vfsops;
+extern const char *spa_config_path;
+
+static double elapsed_ms(const struct timespec *since){
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - since->tv_sec) * 1000.0 +
+	    (now.tv_nsec - since->tv_nsec) / 1000000.0;
+}
+
+static vfs_t* prepare_storage(zfs_handle_t *zfs_handle, char* name, char* mountdir){
+	char mountpoint[ZFS_MAXPROPLEN];
+
+	if (!zfs_is_mountable(zfs_handle, mountpoint, sizeof (mountpoint), NULL))
+	    return (0);
+
+	vfs_t *vfs = kmem_zalloc(sizeof(vfs_t), KM_SLEEP);
+	if(vfs == NULL){
+	    errno = ENOMEM;
+	    return NULL;
+	}
+
+	VFS_INIT(vfs, zfs_vfsops, 0);
+	VFS_HOLD(vfs);
+
+	struct mounta uap = {name, mountdir, MS_SYSSPACE, NULL, "", 0};
+	int ret;
+	if ((ret = VFS_MOUNT(vfs, rootdir, &uap, kcred)) != 0) {
+	    kmem_free(vfs, sizeof(vfs_t));
+	    return NULL;
+	}
+	return vfs;
+}
+
+static vfs_t* create_pool(char* storage_path, char* name, char* mountdir){
+	vfs_t* vfs = NULL;
+	nvlist_t *nvroot;
+	nvlist_t *fsprops = NULL;
+	nvlist_t *props = NULL;
+	boolean_t force = B_FALSE;
+	boolean_t dryrun = B_FALSE;
+	char* mountpoint = NULL;
+
+	/* pass off to get_vdev_spec for bulk processing */
+	nvroot = make_root_vdev(NULL, force, !force, B_FALSE, dryrun,
+	    1, &storage_path);
+	if (nvroot == NULL)
+		goto errout;
+
+	/* make_root_vdev() allows 0 toplevel children if there are spares */
+	if (!zfs_allocatable_devs(nvroot)) {
+		(void) fprintf(stderr, gettext("invalid vdev "
+		    "specification: at least one toplevel vdev must be "
+		    "specified\n"));
+		goto errout;
+	}
+
+	/*
+	 * Hand off to libzfs.
+	 */
+	if (zpool_create(g_zfs, name,
+			 nvroot, props, fsprops) == 0) {
+	    zfs_handle_t *pool = zfs_open(g_zfs, name,
+					  ZFS_TYPE_FILESYSTEM);
+	    if (pool != NULL) {
+		if (mountpoint != NULL)
+		    verify(zfs_prop_set(pool,
+					zfs_prop_to_name(
+							 ZFS_PROP_MOUNTPOINT),
+					mountpoint) == 0);
+		vfs = prepare_storage(pool, name, mountdir);
+		zfs_close(pool);
+	    }
+	} else if (libzfs_errno(g_zfs) == EZFS_INVALIDNAME) {
+	    (void) fprintf(stderr, gettext("pool name may have "
+					   "been omitted\n"));
+	}
+
+errout:
+	nvlist_free(nvroot);
+	nvlist_free(fsprops);
+	nvlist_free(props);
+	return (vfs);
+}
+
+vfs_t* create_storage(char* storage_path, char* name, char* mountdir){
+	if ((g_zfs = libzfs_init()) == NULL) {
+		(void) fprintf(stderr, gettext("internal error: failed to "
+		    "initialize ZFS library\n"));
+		return (NULL);
+	}
+	return create_pool(storage_path, name, mountdir);
+}
+
+/*
+ *Import pool by scanning labels of files residing in directory of
+ *storage_path, the import records pool into cache file so the next start
+ *can skip the scan. Read-only pool is not recorded, it's imported again
+ *by every start.
+ *@return 0 if imported, ENOENT if pool not found, or -1 if failed*/
+static int import_pool(char* storage_path, char* name, boolean_t readonly){
+	char dir[MAXPATHLEN];
+	char *searchdirs[1];
+	nvlist_t *pools;
+	nvlist_t *config = NULL;
+	nvlist_t *props = NULL;
+	nvpair_t *elem;
+	int ret;
+
+	(void) strlcpy(dir, storage_path, sizeof (dir));
+	searchdirs[0] = dirname(dir);
+
+	pools = zpool_find_import_byname(g_zfs, 1, searchdirs, name);
+	if (pools == NULL)
+		return (-1);
+
+	if ((elem = nvlist_next_nvpair(pools, NULL)) == NULL) {
+		nvlist_free(pools);
+		return (ENOENT);
+	}
+	verify(nvpair_value_nvlist(elem, &config) == 0);
+
+	if (readonly) {
+		verify(nvlist_alloc(&props, NV_UNIQUE_NAME, 0) == 0);
+		verify(nvlist_add_string(props,
+		    zpool_prop_to_name(ZPOOL_PROP_READONLY), "on") == 0);
+	}
+
+	ret = zpool_import_props(g_zfs, config, NULL, props, B_FALSE);
+	nvlist_free(props);
+	nvlist_free(pools);
+	return (ret == 0 ? 0 : -1);
+}
+
+vfs_t* open_storage(char* storage_path, char* name, char* mountdir,
+		    boolean_t readonly){
+	struct timespec start;
+	const char *how;
+	vfs_t* vfs = NULL;
+	zpool_handle_t *zhp;
+	zfs_handle_t *fs;
+	int ret;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	if ((g_zfs = libzfs_init()) == NULL) {
+		(void) fprintf(stderr, gettext("internal error: failed to "
+		    "initialize ZFS library\n"));
+		return (NULL);
+	}
+
+	/*keep config update and resilver off the path to the first mount*/
+	spa_async_defer();
+
+	/*pool listed by cache file is already in spa namespace, opening it
+	 *loads pool straight from cached config without labels discovery*/
+	if ((zhp = zpool_open_canfail(g_zfs, name)) != NULL) {
+		if (readonly) {
+			(void) fprintf(stderr, gettext("cannot open '%s' "
+			    "read-only: pool is listed by cache file %s\n"),
+			    name, spa_config_path);
+			zpool_close(zhp);
+			goto out;
+		}
+		if (zpool_get_state(zhp) == POOL_STATE_UNAVAIL) {
+			(void) fprintf(stderr, gettext("cannot open '%s': "
+			    "pool unavailable, remove stale entry from "
+			    "cache file %s\n"), name, spa_config_path);
+			zpool_close(zhp);
+			goto out;
+		}
+		zpool_close(zhp);
+		how = "cached";
+	} else if ((ret = import_pool(storage_path, name, readonly)) == 0) {
+		how = readonly ? "imported read-only" : "imported";
+	} else if (ret == ENOENT && !readonly) {
+		vfs = create_pool(storage_path, name, mountdir);
+		how = "created";
+		goto report;
+	} else {
+		goto out;
+	}
+
+	fs = zfs_open(g_zfs, name, ZFS_TYPE_FILESYSTEM);
+	if (fs != NULL) {
+		vfs = prepare_storage(fs, name, mountdir);
+		zfs_close(fs);
+	}
+
+report:
+	if (vfs != NULL)
+		(void) fprintf(stderr, "zfs-fuse: pool '%s' %s and mounted "
+		    "in %.1f ms\n", name, how, elapsed_ms(&start));
+out:
+	spa_async_undefer();
+	return (vfs);
+}
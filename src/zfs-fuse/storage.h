@@ -0,0 +1,48 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+/*
+ * Copyright 2006 Ricardo Correia.
+ * Use is subject to license terms.
+ */
+
+#ifndef ZFSFUSE_STORAGE_H
+#define ZFSFUSE_STORAGE_H
+
+#include <sys/vfs.h> //vfs_t
+
+/*create pool with single vdev storage_path and mount it's root
+ *filesystem, it's requires libzfs listener started by do_init
+ *@return mounted vfs, or NULL if failed*/
+extern vfs_t* create_storage(char* storage_path, char* name, char* mountdir);
+
+/*open existing pool and mount it's root filesystem: pool listed by
+ *spa_config_path cache file is opened from cached config, otherwise pool
+ *is searched in directory of storage_path and imported; pool is created
+ *if not found. Async pool tasks are deferred until mount is done. It's
+ *requires libzfs listener started by do_init
+ *@param readonly import pool read-only, as immutable image: no txg
+ *threads, no log replay, no metaslabs loading; it's never created nor
+ *recorded into cache file
+ *@return mounted vfs, or NULL if failed*/
+extern vfs_t* open_storage(char* storage_path, char* name, char* mountdir,
+			   boolean_t readonly);
+
+#endif
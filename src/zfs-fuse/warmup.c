@@ -0,0 +1,320 @@
+/*
+ *
+ * Copyright (c) 2014, LiteStack, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this_ file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <limits.h> //PATH_MAX
+#include <errno.h>
+#include <time.h>
+
+#include <sys/vnode.h>
+#include <sys/zfs_vfsops.h> //zfsvfs_t
+#include <sys/zfs_znode.h> //ZFS_ENTER
+#include <sys/dmu.h> //dmu_prefetch
+
+#include "warmup.h"
+
+/*threads prefetching paths of manifest*/
+#define WARMUP_THREADS 8
+/*max paths read from manifest or recorded*/
+#define WARMUP_MAX_PATHS 4096
+/*max bytes of single file data prefetched*/
+#define WARMUP_FILE_PREFETCH_MAX (16ULL << 20)
+/*seconds since start during which opened files are recorded*/
+#define WARMUP_RECORD_SECONDS 30
+
+struct WarmupList{
+    vfs_t *vfs;
+    char **paths;
+    int count;
+    int next;       /*index of next path to prefetch, taken atomically*/
+    int running;    /*threads not finished yet*/
+    int prefetched; /*paths resolved and prefetched*/
+    struct timespec start;
+};
+
+static struct{
+    pthread_mutex_t mutex;
+    int recording;
+    char *manifest;
+    char *paths[WARMUP_MAX_PATHS];
+    uint32_t hashes[WARMUP_MAX_PATHS];
+    int count;
+    struct timespec start;
+} s_record = {PTHREAD_MUTEX_INITIALIZER};
+
+/*prefetch in progress, kept here to be cancelled and waited by
+ *warmup_stop, pool must not be used by threads after it returns*/
+static struct{
+    pthread_mutex_t mutex;
+    pthread_cond_t done;
+    struct WarmupList *list; /*NULL when all threads finished*/
+    int cancel;
+} s_prefetch = {PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER};
+
+
+static double elapsed_ms(const struct timespec *since){
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - since->tv_sec) * 1000.0 +
+	(now.tv_nsec - since->tv_nsec) / 1000000.0;
+}
+
+static uint32_t path_hash(const char *path){
+    uint32_t hash = 2166136261u;
+    while ( *path ){
+	hash ^= (unsigned char)*path++;
+	hash *= 16777619u;
+    }
+    return hash;
+}
+
+/*Resolve path and issue prefetch of file data. Lookups bring dnodes of
+ *path components into cache synchronously, so metadata is warmed up by
+ *lookup itself, and data reads are issued asynchronously by dmu_prefetch.
+ *@return 0 if ok, or errno*/
+static int warmup_prefetch_path(vfs_t *vfs, const char *path){
+    zfsvfs_t *zfsvfs = vfs->vfs_data;
+    char name[MAXNAMELEN];
+    const char *p = path;
+    znode_t *zp;
+    vnode_t *dvp, *vp;
+    size_t len;
+    int error;
+
+    ZFS_ENTER(zfsvfs);
+
+    error = zfs_zget(zfsvfs, zfsvfs->z_root, &zp, B_FALSE);
+    if ( error ){
+	ZFS_EXIT(zfsvfs);
+	return error;
+    }
+    vp = ZTOV(zp);
+
+    while ( vp != NULL ){
+	p += strspn(p, "/");
+	if ( (len = strcspn(p, "/")) == 0 )
+	    break;
+	if ( len >= MAXNAMELEN ){
+	    error = ENAMETOOLONG;
+	    break;
+	}
+	memcpy(name, p, len);
+	name[len] = '\0';
+	p += len;
+
+	dvp = vp;
+	error = VOP_LOOKUP(dvp, name, &vp, NULL, 0, NULL, kcred, NULL, NULL, NULL);
+	VN_RELE(dvp);
+	if ( error )
+	    vp = NULL;
+    }
+
+    if ( vp != NULL ){
+	zp = VTOZ(vp);
+	if ( error == 0 && vp->v_type == VREG && zp->z_phys->zp_size > 0 )
+	    dmu_prefetch(zfsvfs->z_os, zp->z_id, 0, 
+			 MIN(zp->z_phys->zp_size, WARMUP_FILE_PREFETCH_MAX));
+	VN_RELE(vp);
+    }
+
+    ZFS_EXIT(zfsvfs);
+    return error;
+}
+
+static void warmup_list_free(struct WarmupList *list){
+    int i;
+    for ( i=0; i < list->count; i++ )
+	free(list->paths[i]);
+    free(list->paths);
+    free(list);
+}
+
+/*called by every prefetch thread when done, the last one frees list
+ *and wakes up warmup_stop*/
+static void warmup_thread_done(struct WarmupList *list){
+    pthread_mutex_lock(&s_prefetch.mutex);
+    if ( --list->running == 0 ){
+	fprintf(stderr, "zfs-fuse: warm-up %s %d of %d paths in %.1f ms\n",
+		s_prefetch.cancel ? "cancelled, prefetched" : "prefetched",
+		list->prefetched, list->count, elapsed_ms(&list->start));
+	warmup_list_free(list);
+	s_prefetch.list = NULL;
+	pthread_cond_broadcast(&s_prefetch.done);
+    }
+    pthread_mutex_unlock(&s_prefetch.mutex);
+}
+
+static void *warmup_thread(void *arg){
+    struct WarmupList *list = arg;
+    int i;
+
+    while ( !__sync_fetch_and_add(&s_prefetch.cancel, 0) &&
+	    (i = __sync_fetch_and_add(&list->next, 1)) < list->count ){
+	if ( warmup_prefetch_path(list->vfs, list->paths[i]) == 0 )
+	    __sync_fetch_and_add(&list->prefetched, 1);
+    }
+    warmup_thread_done(list);
+    return NULL;
+}
+
+/*@return list of paths read from manifest, or NULL if failed*/
+static struct WarmupList *warmup_list_read(FILE *f){
+    struct WarmupList *list = calloc(1, sizeof(struct WarmupList));
+    char *line = NULL;
+    size_t size = 0;
+    ssize_t len;
+
+    if ( list == NULL ||
+	 (list->paths = calloc(WARMUP_MAX_PATHS, sizeof(char*))) == NULL ){
+	free(list);
+	return NULL;
+    }
+    while ( list->count < WARMUP_MAX_PATHS && 
+	    (len = getline(&line, &size, f)) != -1 ){
+	while ( len > 0 && (line[len-1] == '\n' || line[len-1] == '\r') )
+	    line[--len] = '\0';
+	/*only absolute paths, empty lines and comments are skipped*/
+	if ( line[0] != '/' )
+	    continue;
+	if ( (list->paths[list->count] = strdup(line)) == NULL )
+	    break;
+	++list->count;
+    }
+    free(line);
+    return list;
+}
+
+static int warmup_prefetch_start(vfs_t *vfs, FILE *f){
+    struct WarmupList *list = warmup_list_read(f);
+    pthread_attr_t attr;
+    pthread_t thread;
+    int i;
+
+    if ( list == NULL )
+	return -1;
+    list->vfs = vfs;
+    list->running = WARMUP_THREADS;
+    clock_gettime(CLOCK_MONOTONIC, &list->start);
+    pthread_mutex_lock(&s_prefetch.mutex);
+    s_prefetch.list = list;
+    s_prefetch.cancel = 0;
+    pthread_mutex_unlock(&s_prefetch.mutex);
+
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    for ( i=0; i < WARMUP_THREADS; i++ ){
+	if ( pthread_create(&thread, &attr, warmup_thread, list) != 0 )
+	    warmup_thread_done(list);
+    }
+    pthread_attr_destroy(&attr);
+    return 0;
+}
+
+/*write recorded paths into manifest, must be called under mutex*/
+static void warmup_record_save(void){
+    char tmpname[PATH_MAX];
+    FILE *f;
+    int i;
+
+    s_record.recording = 0;
+    snprintf(tmpname, sizeof(tmpname), "%s.tmp", s_record.manifest);
+    if ( (f = fopen(tmpname, "w")) != NULL ){
+	for ( i=0; i < s_record.count; i++ )
+	    fprintf(f, "%s\n", s_record.paths[i]);
+	/*rename makes manifest visible only when completely written*/
+	if ( fclose(f) == 0 && rename(tmpname, s_record.manifest) == 0 )
+	    fprintf(stderr, "zfs-fuse: warm-up manifest %s recorded, %d paths\n",
+		    s_record.manifest, s_record.count);
+	else
+	    unlink(tmpname);
+    }
+    for ( i=0; i < s_record.count; i++ )
+	free(s_record.paths[i]);
+    s_record.count = 0;
+    free(s_record.manifest);
+    s_record.manifest = NULL;
+}
+
+int warmup_start(vfs_t *vfs, const char *manifest){
+    FILE *f = fopen(manifest, "r");
+    int ret;
+
+    if ( f != NULL ){
+	ret = warmup_prefetch_start(vfs, f);
+	fclose(f);
+	return ret;
+    }
+    else if ( errno != ENOENT )
+	return -1;
+
+    /*no manifest yet, record it by this run*/
+    pthread_mutex_lock(&s_record.mutex);
+    if ( (s_record.manifest = strdup(manifest)) != NULL ){
+	clock_gettime(CLOCK_MONOTONIC, &s_record.start);
+	s_record.recording = 1;
+    }
+    pthread_mutex_unlock(&s_record.mutex);
+    return s_record.manifest != NULL ? 0 : -1;
+}
+
+void warmup_record(const char *path){
+    uint32_t hash;
+    int i;
+
+    if ( !s_record.recording )
+	return;
+    hash = path_hash(path);
+
+    pthread_mutex_lock(&s_record.mutex);
+    if ( s_record.recording ){
+	if ( elapsed_ms(&s_record.start) > WARMUP_RECORD_SECONDS * 1000.0 ){
+	    warmup_record_save();
+	}
+	else{
+	    for ( i=0; i < s_record.count; i++ ){
+		if ( s_record.hashes[i] == hash && !strcmp(s_record.paths[i], path) )
+		    break;
+	    }
+	    if ( i == s_record.count && 
+		 (s_record.paths[i] = strdup(path)) != NULL ){
+		s_record.hashes[i] = hash;
+		++s_record.count;
+	    }
+	    if ( s_record.count == WARMUP_MAX_PATHS )
+		warmup_record_save();
+	}
+    }
+    pthread_mutex_unlock(&s_record.mutex);
+}
+
+void warmup_stop(void){
+    /*stop prefetch threads taking new paths and wait for current ones*/
+    pthread_mutex_lock(&s_prefetch.mutex);
+    __sync_fetch_and_or(&s_prefetch.cancel, 1);
+    while ( s_prefetch.list != NULL )
+	pthread_cond_wait(&s_prefetch.done, &s_prefetch.mutex);
+    pthread_mutex_unlock(&s_prefetch.mutex);
+
+    pthread_mutex_lock(&s_record.mutex);
+    if ( s_record.recording )
+	warmup_record_save();
+    pthread_mutex_unlock(&s_record.mutex);
+}
@@ -0,0 +1,39 @@
+/*
+ *
+ * Copyright (c) 2014, LiteStack, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this_ file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ZFSFUSE_WARMUP_H
+#define ZFSFUSE_WARMUP_H
+
+#include <sys/vfs.h> //vfs_t
+
+/*Manifest is text file with one absolute path of mounted filesystem per
+ *line. If manifest exists, warmup_start reads it and prefetches dnodes
+ *and data of listed files by WARMUP_THREADS background threads, the
+ *function returns right away. If manifest doesn't exist, paths passed
+ *to warmup_record are collected and saved into manifest when recording
+ *window is over, or by warmup_stop.
+ *@return 0 if started, -1 if manifest can't be read*/
+extern int warmup_start(vfs_t *vfs, const char *manifest);
+
+/*record path of opened regular file, does nothing unless recording*/
+extern void warmup_record(const char *path);
+
+/*cancel prefetch and wait until its threads exit, save manifest if
+ *still recording; must be called before pool is closed*/
+extern void warmup_stop(void);
+
+#endif
@@ -36,24 +36,56 @@
 #include <sys/mode.h>
 #include <sys/fcntl.h>
 
+#include <stdio.h>
 #include <string.h>
+#include <stdlib.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <time.h>
 
 #include "zfs_mounts.h"
+#include "hybrid_mounts.h" //HYBRID_MOUNTS_MAX_PREFIXES
 #include "util.h"
+#include "warmup.h"
 #include "fuse_listener.h"
 #include "dirent_engine.h"
 #include "mounts_interface.h" //struct MountsPublicInterface
 
+/*max entries returned by single getdents_plus call in readdir*/
+#define READDIR_STATS_COUNT 64
 
+/*max cache buffers lent by single write_loan call in write_buf*/
+#define WRITE_BUF_IOV_COUNT 32
 
+/*colon separated list of paths kept in memory, like "/tmp:/var/tmp"*/
+#define SCRATCH_PREFIXES_ENV "ZFS_FUSE_SCRATCH"
+/*megabytes of scratch files data kept in memory before spilling into zfs*/
+#define SCRATCH_MEM_LIMIT_ENV "ZFS_FUSE_SCRATCH_MB"
+#define SCRATCH_MEM_LIMIT_DEFAULT_MB 256
+
+
+/*it's set once at construction and stays readonly, all operations are
+  reentrant and can be called by multithreaded fuse loop*/
 static struct MountsPublicInterface* s_toplevelfs;
 
+struct timespec zfs_fuse_start_time;
+static int s_first_op_done;
+
+/*print time passed since zfs_fuse_start_time once, by first operation*/
+static void report_first_op(const char *opname){
+    struct timespec now;
+    if ( s_first_op_done || zfs_fuse_start_time.tv_sec == 0 ) return;
+    if ( !__sync_bool_compare_and_swap(&s_first_op_done, 0, 1) ) return;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    fprintf(stderr, "zfs-fuse: time to first op (%s) %.1f ms\n", opname,
+	    (now.tv_sec - zfs_fuse_start_time.tv_sec) * 1000.0 +
+	    (now.tv_nsec - zfs_fuse_start_time.tv_nsec) / 1000000.0);
+}
+
 /*the same as stat*/
 static int op_getattr(const char *path, struct stat *st){
     int ret = s_toplevelfs->stat(s_toplevelfs, path, st);
+    report_first_op("getattr");
     if ( ret == -1 ) return -errno;
     else return 0;
 }
@@ -116,6 +148,7 @@ static int op_open(const char *path, struct fuse_file_info *fi){
         return -errno;
     }
     fi->fh = fd;
+    warmup_record(path);
     return 0;
 }
  
@@ -127,12 +160,88 @@ static int op_read(const char *path, char *buf, size_t bufsize, off_t offset, st
  
 static int op_write(const char *path, const char *buf, size_t bufsize, off_t offset, struct fuse_file_info *fi){
     int ret = s_toplevelfs->pwrite(s_toplevelfs, fi->fh, buf, bufsize, offset);
-    if ( ret == 1 ) return -errno;
+    if ( ret == -1 ) return -errno;
     else return ret;
 }
+
+#if FUSE_VERSION >= 29
+/*for files of mount that can't lend buffers, like scratch files kept
+  in memory, request data is copied into temporary buffer and written*/
+static int op_write_buf_copy(struct fuse_bufvec *src, off_t offset, 
+			     struct fuse_file_info *fi){
+    size_t size = fuse_buf_size(src);
+    struct fuse_bufvec dst = FUSE_BUFVEC_INIT(size);
+    ssize_t ret;
+    void *buf = malloc(size);
+    if ( buf == NULL ) return -ENOMEM;
+    dst.buf[0].mem = buf;
+    ret = fuse_buf_copy(&dst, src, 0);
+    if ( ret >= 0 ){
+	ret = s_toplevelfs->pwrite(s_toplevelfs, fi->fh, buf, ret, offset);
+	if ( ret == -1 ) ret = -errno;
+    }
+    free(buf);
+    return ret;
+}
+
+/*request data is copied straight into file cache buffers lent by
+  write_loan, whole records become file data with no more copying; if
+  request was read from fuse device by splice, data is moved from pipe
+  into the buffers by fuse_buf_copy*/
+static int op_write_buf(const char *path, struct fuse_bufvec *src, off_t offset, 
+			struct fuse_file_info *fi){
+    size_t size = fuse_buf_size(src);
+    size_t written = 0;
+    while ( written < size ){
+	struct iovec iov[WRITE_BUF_IOV_COUNT];
+	int iovcnt = WRITE_BUF_IOV_COUNT;
+	ssize_t lent, copied = 0, ret;
+	void *loan;
+	int i;
+	lent = s_toplevelfs->write_loan(s_toplevelfs, fi->fh, size - written, 
+					offset + written, iov, &iovcnt, &loan);
+	if ( lent == -1 && errno == ENOSYS && written == 0 )
+	    return op_write_buf_copy(src, offset, fi);
+	if ( lent == -1 ) return written ? written : -errno;
+	for ( i=0; i < iovcnt; i++ ){
+	    struct fuse_bufvec dst = FUSE_BUFVEC_INIT(iov[i].iov_len);
+	    dst.buf[0].mem = iov[i].iov_base;
+	    ret = fuse_buf_copy(&dst, src, 0);
+	    if ( ret < 0 ){
+		s_toplevelfs->write_abort(s_toplevelfs, loan);
+		return written ? written : ret;
+	    }
+	    copied += ret;
+	    if ( ret < iov[i].iov_len ) break;
+	}
+	ret = s_toplevelfs->write_commit(s_toplevelfs, loan, copied);
+	if ( ret == -1 ) return written ? written : -errno;
+	written += ret;
+	if ( copied < lent ) break;
+    }
+    return written;
+}
+
+static int op_fallocate(const char *path, int mode, off_t offset, off_t length, 
+			struct fuse_file_info *fi){
+    int ret = s_toplevelfs->fallocate(s_toplevelfs, fi->fh, mode, offset, length);
+    if ( ret == -1 ) return -errno;
+    else return 0;
+}
+#endif //FUSE_VERSION >= 29
+
+static void *op_init(struct fuse_conn_info *conn){
+#ifdef FUSE_CAP_SPLICE_READ
+    /*let write requests come by splice, see op_write_buf*/
+    if ( conn->capable & FUSE_CAP_SPLICE_READ )
+	conn->want |= FUSE_CAP_SPLICE_READ;
+#endif
+    return NULL;
+}
  
 static int op_statvfs(const char *path, struct statvfs *buf){
     int ret = s_toplevelfs->statvfs(s_toplevelfs, path, buf);
+    report_first_op("statvfs");
     if ( ret == -1 ) return -errno;
     else return 0;
 }
@@ -162,24 +271,36 @@ static int op_release(const char *path, struct fuse_file_info *fi){
     else return 0;
 }
 
+static int op_fsync(const char *path, int datasync, struct fuse_file_info *fi){
+    int ret;
+    if ( datasync )
+	ret = s_toplevelfs->fdatasync(s_toplevelfs, fi->fh);
+    else
+	ret = s_toplevelfs->fsync(s_toplevelfs, fi->fh);
+    if ( ret == -1 ) return -errno;
+    else return 0;
+}
+
 static int op_readdir(const char *path, void *buf, fuse_fill_dir_t filler, off_t offset, struct fuse_file_info *fi){
-    static char temp_buf[PATH_MAX];
-    static int  temp_buf_off = sizeof(temp_buf);
-    static int  getdents_buf_len = 0;
+    /*state is kept on stack, so readdir is reentrant; it's reads
+      whole directory by single call and passes items to fuse together
+      with attributes obtained while reading directory*/
+    char temp_buf[PATH_MAX];
+    struct stat stats[READDIR_STATS_COUNT];
+    int  temp_buf_off;
+    int  getdents_buf_len;
+    int  index;
     unsigned long d_ino;
     unsigned long d_type;
     const char *d_name;
-    int ret=0;
     struct DirentEnginePublicInterface *dirent_engine = INSTANCE_L(DIRENT_ENGINE)();
 
-    /*handle already readed dirent in temp buffer OR read new by getdents call*/
-    while( temp_buf_off < getdents_buf_len ||  
-	   (getdents_buf_len=s_toplevelfs->getdents(s_toplevelfs, fi->fh, temp_buf, sizeof(temp_buf))) > 0 ){
+    while( (getdents_buf_len=s_toplevelfs->getdents_plus(s_toplevelfs, fi->fh, temp_buf, 
+							 sizeof(temp_buf), stats, 
+							 READDIR_STATS_COUNT)) > 0 ){
 	assert(getdents_buf_len<=sizeof(temp_buf));
-	/*check if all info handled in temp_buf*/
-	if ( temp_buf_off >= getdents_buf_len ){
-	    temp_buf_off=0;
-	}
+	temp_buf_off=0;
+	index=0;
 	//extract item from getdents's buffer
 	while( NULL != (d_name = dirent_engine
 			->get_next_item_from_dirent_buf( temp_buf, //buf
@@ -190,20 +311,16 @@ static int op_readdir(const char *path, void *buf, fuse_fill_dir_t filler, off_t
 			printf("-----dir=%s\n", d_name);fflush(0);
 #endif
 	    //add item to fuse buffer by filler function
-	    if ( filler(buf, d_name, NULL, 0) != 0 ){
+	    if ( filler(buf, d_name, stats[index].st_ino ? &stats[index] : NULL, 0) != 0 ){
 		return -ENOMEM;
 	    }
+	    ++index;
 	}
-	if ( d_name == NULL )
-	    temp_buf_off = sizeof(temp_buf);
     }
-    if ( getdents_buf_len == 0 ){
-	temp_buf_off = sizeof(temp_buf);
-    }
-    else if (getdents_buf_len < 0)
+    if (getdents_buf_len < 0)
 	return -errno;
 
-    return ret;
+    return 0;
 }
  
 /* void *(* 	init )(struct fuse_conn_info *conn){ */
@@ -281,7 +398,7 @@ struct fuse_operations s_zfs_operation = {
     .statfs   = op_statvfs,   //not needed
     //flush,    //not needed or NULL
     .release  = op_release,//FUSE function
-    //fsync,    //ZFS-FUSE has it, ZRT not
+    .fsync    = op_fsync,    //ok
     //setxattr, //not needed
     //getxattr, //not needed
     //listxattr,//not needed 
@@ -289,8 +406,8 @@ struct fuse_operations s_zfs_operation = {
     .opendir  = op_opendir,  //ZFS-FUSE has, ZRT not
     .readdir  = op_readdir,  //ZFS-FUSE has, ZRT has not
     .releasedir= op_releasedir,//FUSE function
-    //fsyncdir, //ZRT, ZFS-FUSE has not
-    //init,     //ZRT has not
+    .fsyncdir = op_fsync,    //directory is held by opendir as file
+    .init     = op_init,     //enables splice of write requests
     //destroy,  //ZFS-FUSE has, ZRT has not, not needed
     .access   = op_access,   //ZRT has not, now has
     .create   = op_create,   //ZRT has not, now has only fuse layer
@@ -301,16 +418,41 @@ struct fuse_operations s_zfs_operation = {
     //bmap,     //ZRT has not
     //ioctl,    //ZRT has not
     //poll,     //ZRT has not, not needed
-    //write_buf,//ZRT has not, not needed
+#if FUSE_VERSION >= 29
+    .write_buf= op_write_buf,//ZRT has write_loan
+#endif
     //read_buf, //ZRT has not, not needed
     //flock,    //ZRT has not
-    //fallocate //ZRT has not
+#if FUSE_VERSION >= 29
+    .fallocate= op_fallocate,//ZRT has
+#endif
 };
 
 
 struct fuse_operations* fuse_operations_construct(vfs_t *vfs){
-    struct MountsPublicInterface* zfs_mounts = CONSTRUCT_L(ZFS_MOUNTS)(vfs);
-    s_toplevelfs = zfs_mounts;
+    const char *prefixes[HYBRID_MOUNTS_MAX_PREFIXES];
+    int count = 0;
+    char *scratch = getenv(SCRATCH_PREFIXES_ENV);
+    char *limit = getenv(SCRATCH_MEM_LIMIT_ENV);
+    size_t mem_limit_mb = limit ? strtoul(limit, NULL, 10) : SCRATCH_MEM_LIMIT_DEFAULT_MB;
+    char *prefix, *saveptr;
+
+    /*scratch paths are parsed from copy of environment variable*/
+    if ( scratch != NULL && (scratch = strdup(scratch)) != NULL ){
+	for ( prefix = strtok_r(scratch, ":", &saveptr); 
+	      prefix != NULL && count < HYBRID_MOUNTS_MAX_PREFIXES;
+	      prefix = strtok_r(NULL, ":", &saveptr) ){
+	    /*only absolute paths other than root*/
+	    if ( prefix[0] == '/' && prefix[strspn(prefix, "/")] != '\0' )
+		prefixes[count++] = prefix;
+	}
+    }
+    if ( count > 0 )
+	s_toplevelfs = zfs_scratch_mounts_construct(vfs, prefixes, count, 
+						    mem_limit_mb << 20);
+    else
+	s_toplevelfs = CONSTRUCT_L(ZFS_MOUNTS)(vfs);
+    free(scratch);
     assert(s_toplevelfs);
     /*just get static array of functions, it is expected that them will be use
      s_toplevelfs object to provide implementation*/
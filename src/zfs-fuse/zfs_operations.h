@@ -49,11 +49,17 @@
 
 #include "sys/vfs.h" //vfs_t
 
+#include <time.h> //struct timespec
+
 /*name of constructor*/
 #define FUSE_OPERATIONS fuse_operations_construct 
 
 extern struct fuse_operations zfs_operations;
 
+/*monotonic time of process start, set by main; if set, time passed until
+ *first filesystem operation is printed to stderr*/
+extern struct timespec zfs_fuse_start_time;
+
 struct fuse_operations* fuse_operations_construct(vfs_t *vfs);
 
 
@@ -432,6 +432,13 @@ zfs_register_callbacks(vfs_t *vfsp)
 		readonly = B_FALSE;
 		do_readonly = B_TRUE;
 	}
+	/*
+	 * File systems of a read-only pool are always mounted read-only.
+	 */
+	if (!spa_writeable(dmu_objset_spa(os))) {
+		readonly = B_TRUE;
+		do_readonly = B_TRUE;
+	}
 	if (vfs_optionisset(vfsp, MNTOPT_NOSUID, NULL)) {
 		devices = B_FALSE;
 		setuid = B_FALSE;
@@ -590,9 +597,10 @@ zfsvfs_setup(zfsvfs_t *zfsvfs, boolean_t mounting)
 	/*
 	 * If we are not mounting (ie: online recv), then we don't
 	 * have to worry about replaying the log as we blocked all
-	 * operations out since we closed the ZIL.
+	 * operations out since we closed the ZIL.  Log of a read-only
+	 * pool is never replayed, it has no txgs to replay into.
 	 */
-	if (mounting) {
+	if (mounting && spa_writeable(dmu_objset_spa(zfsvfs->z_os))) {
 		/*
 		 * During replay we remove the read only flag to
 		 * allow replays to succeed.
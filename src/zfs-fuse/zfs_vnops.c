@@ -635,6 +635,28 @@ zfs_prefault_write(ssize_t n, struct uio *uio)
 }
 #endif
 
+/*
+ * Take the loaned arc buffer covering the record at offset woff out of
+ * xuio, if the record was loaned and the buffer has the record size.
+ */
+static arc_buf_t *
+zfs_xuio_take_arcbuf(xuio_t *xuio, offset_t woff, ssize_t nbytes)
+{
+	arc_buf_t *abuf;
+	offset_t i;
+
+	if (xuio->xu_nbufs == 0 || (size_t)nbytes != xuio->xu_blksz ||
+	    woff < xuio->xu_offset ||
+	    P2PHASE(woff - xuio->xu_offset, xuio->xu_blksz) != 0)
+		return (NULL);
+	i = (woff - xuio->xu_offset) / xuio->xu_blksz;
+	if (i >= xuio->xu_nbufs)
+		return (NULL);
+	abuf = xuio->xu_bufs[i];
+	xuio->xu_bufs[i] = NULL;
+	return (abuf);
+}
+
 /*
  * Write the bytes to a file.
  *
@@ -670,6 +692,7 @@ zfs_write(vnode_t *vp, uio_t *uio, int ioflag, cred_t *cr, caller_context_t *ct)
 	rl_t		*rl;
 	int		max_blksz = zfsvfs->z_max_blksz;
 	uint64_t	pflags;
+	arc_buf_t	*abuf;
 	int		error;
 
 	/*
@@ -813,8 +836,22 @@ zfs_write(vnode_t *vp, uio_t *uio, int ioflag, cred_t *cr, caller_context_t *ct)
 		nbytes = MIN(n, max_blksz - P2PHASE(woff, max_blksz));
 		rw_enter(&zp->z_map_lock, RW_READER);
 
+		/*
+		 * If the whole record is in a loaned arc buffer, give the
+		 * buffer to the dbuf instead of copying it.
+		 */
+		abuf = NULL;
+		if (uio->uio_extflg & UIO_XUIO &&
+		    nbytes == max_blksz && zp->z_blksz == max_blksz)
+			abuf = zfs_xuio_take_arcbuf((xuio_t *)uio, woff,
+			    nbytes);
+
 		tx_bytes = uio->uio_resid;
-		if (vn_has_cached_data(vp)) {
+		if (abuf != NULL) {
+			dmu_assign_arcbuf(zp->z_dbuf, woff, abuf, tx);
+			uioskip(uio, nbytes);
+			rw_exit(&zp->z_map_lock);
+		} else if (vn_has_cached_data(vp)) {
 			rw_exit(&zp->z_map_lock);
 			error = mappedwrite(vp, nbytes, uio, tx);
 		} else {
@@ -1608,6 +1645,425 @@ out:
 	return (error);
 }
 
+/*
+ * Upper bound of names handled by a single transaction of the batch
+ * operations below, it keeps the transaction holds within DMU limits.
+ */
+#define	ZFS_BATCH_MAX	128
+
+/*
+ * Order names[first .. first + n) lexically in ord[].  Batch operations
+ * lock the directory entries in this order, the same one zfs_rename()
+ * uses for two names of one directory, so batches can't deadlock with
+ * each other or with rename.  Repeated names become adjacent.
+ */
+static void
+zfs_batch_order(char **names, int first, int n, int *ord)
+{
+	int i, j, k;
+
+	for (i = 0; i < n; i++) {
+		k = first + i;
+		for (j = i; j > 0 && strcmp(names[ord[j - 1]], names[k]) > 0;
+		    j--)
+			ord[j] = ord[j - 1];
+		ord[j] = k;
+	}
+}
+
+/*
+ * Size of the next group of names.  With normalization a dirlock can
+ * cover several names (see zfs_dirent_lock()), so every name of such
+ * a file system gets its own transaction.
+ */
+static int
+zfs_batch_group(zfsvfs_t *zfsvfs, int left)
+{
+	if (zfsvfs->z_norm)
+		return (1);
+	return (MIN(left, ZFS_BATCH_MAX));
+}
+
+/*
+ * Create regular files for a batch of new names in one directory.  The
+ * names are created in groups of up to ZFS_BATCH_MAX; a group is a
+ * single transaction, so its intent log records are committed together.
+ * Unlike zfs_create(), an existing name is an error and isn't opened.
+ *
+ *	IN:	dvp	- vnode of directory to put new file entries in.
+ *		names	- names of new file entries.
+ *		count	- number of names.
+ *		vap	- attributes of new files.
+ *		cr	- credentials of caller.
+ *
+ *	OUT:	errors	- 0 or error code of every name.
+ *
+ *	RETURN:	0 if the batch was processed
+ *		error code if failure of whole batch
+ *
+ * Timestamps:
+ *	dvp - ctime|mtime updated if new entry created
+ *	 vp - ctime|mtime|atime
+ */
+int
+zfs_create_names(vnode_t *dvp, char **names, int count, vattr_t *vap,
+    cred_t *cr, int *errors)
+{
+	znode_t		*dzp = VTOZ(dvp);
+	zfsvfs_t	*zfsvfs = dzp->z_zfsvfs;
+	zilog_t		*zilog;
+	zfs_dirlock_t	*dl[ZFS_BATCH_MAX];
+	znode_t		*zp[ZFS_BATCH_MAX];
+	int		ord[ZFS_BATCH_MAX];
+	zfs_fuid_info_t *fuidp;
+	dmu_tx_t	*tx;
+	uint64_t	txtype;
+	char		*name;
+	int		first, n, i, k;
+	int		error;
+
+	if (zfsvfs->z_use_fuids == B_FALSE &&
+	    (IS_EPHEMERAL(crgetuid(cr)) || IS_EPHEMERAL(crgetgid(cr))))
+		return (EINVAL);
+
+	ZFS_ENTER(zfsvfs);
+	ZFS_VERIFY_ZP(dzp);
+	zilog = zfsvfs->z_log;
+
+	if ((vap->va_mode & VSVTX) && secpolicy_vnode_stky_modify(cr))
+		vap->va_mode &= ~VSVTX;
+
+	/*
+	 * All names have the same parent, so it's checked only once.
+	 */
+	if (error = zfs_zaccess(dzp, ACE_ADD_FILE, 0, B_FALSE, cr)) {
+		ZFS_EXIT(zfsvfs);
+		return (error);
+	}
+	if ((dzp->z_phys->zp_flags & ZFS_XATTR) && (vap->va_type != VREG)) {
+		ZFS_EXIT(zfsvfs);
+		return (EINVAL);
+	}
+	txtype = zfs_log_create_txtype(Z_FILE, NULL, vap);
+
+	for (first = 0; first < count; first += n) {
+		n = zfs_batch_group(zfsvfs, count - first);
+		zfs_batch_order(names, first, n, ord);
+top:
+		tx = dmu_tx_create(zfsvfs->z_os);
+		dmu_tx_hold_bonus(tx, dzp->z_id);
+		for (i = 0; i < n; i++) {
+			k = ord[i];
+			name = names[k];
+			dl[i] = NULL;
+			zp[i] = NULL;
+			if (*name == '\0')
+				error = ENOENT;
+			else if (strlen(name) >= MAXNAMELEN)
+				error = ENAMETOOLONG;
+			else if (i > 0 &&
+			    strcmp(names[ord[i - 1]], name) == 0)
+				error = EEXIST;
+			else if (zfsvfs->z_utf8 && u8_validate(name,
+			    strlen(name), NULL, U8_VALIDATE_ENTIRE, &error) < 0)
+				error = EILSEQ;
+			else
+				error = zfs_dirent_lock(&dl[i], dzp, name,
+				    &zp[i], ZNEW, NULL, NULL);
+			errors[k] = error;
+			if (error)
+				continue;
+			dmu_tx_hold_bonus(tx, DMU_NEW_OBJECT);
+			dmu_tx_hold_zap(tx, dzp->z_id, TRUE, name);
+			if (dzp->z_phys->zp_flags & ZFS_INHERIT_ACE) {
+				dmu_tx_hold_write(tx, DMU_NEW_OBJECT,
+				    0, SPA_MAXBLOCKSIZE);
+			}
+		}
+		if (IS_EPHEMERAL(crgetuid(cr)) ||
+		    IS_EPHEMERAL(crgetgid(cr))) {
+			if (zfsvfs->z_fuid_obj == 0) {
+				dmu_tx_hold_bonus(tx, DMU_NEW_OBJECT);
+				dmu_tx_hold_write(tx, DMU_NEW_OBJECT, 0,
+				    FUID_SIZE_ESTIMATE(zfsvfs));
+				dmu_tx_hold_zap(tx, MASTER_NODE_OBJ,
+				    FALSE, NULL);
+			} else {
+				dmu_tx_hold_bonus(tx, zfsvfs->z_fuid_obj);
+				dmu_tx_hold_write(tx, zfsvfs->z_fuid_obj, 0,
+				    FUID_SIZE_ESTIMATE(zfsvfs));
+			}
+		}
+		error = dmu_tx_assign(tx, zfsvfs->z_assign);
+		if (error) {
+			for (i = 0; i < n; i++) {
+				if (dl[i])
+					zfs_dirent_unlock(dl[i]);
+			}
+			if (error == ERESTART &&
+			    zfsvfs->z_assign == TXG_NOWAIT) {
+				dmu_tx_wait(tx);
+				dmu_tx_abort(tx);
+				goto top;
+			}
+			dmu_tx_abort(tx);
+			for (i = 0; i < n; i++) {
+				if (dl[i])
+					errors[ord[i]] = error;
+			}
+			for (k = first + n; k < count; k++)
+				errors[k] = error;
+			break;
+		}
+		for (i = 0; i < n; i++) {
+			if (dl[i] == NULL)
+				continue;
+			fuidp = NULL;
+			zfs_mknode(dzp, vap, tx, cr, 0, &zp[i], 0, NULL,
+			    &fuidp);
+			(void) zfs_link_create(dl[i], zp[i], tx, ZNEW);
+			zfs_log_create(zilog, tx, txtype, dzp, zp[i],
+			    names[ord[i]], NULL, fuidp, vap);
+			if (fuidp)
+				zfs_fuid_info_free(fuidp);
+		}
+		dmu_tx_commit(tx);
+
+		for (i = 0; i < n; i++) {
+			if (dl[i])
+				zfs_dirent_unlock(dl[i]);
+			if (zp[i])
+				VN_RELE(ZTOV(zp[i]));
+		}
+	}
+
+	ZFS_EXIT(zfsvfs);
+	return (0);
+}
+
+typedef struct zfs_batch_remove {
+	zfs_dirlock_t	*br_dl;
+	znode_t		*br_zp;
+	znode_t		*br_xzp;
+	uint64_t	br_acl_obj;
+	uint64_t	br_xattr_obj;
+	boolean_t	br_may_delete_now;
+	boolean_t	br_delete_now;
+	boolean_t	br_toobig;
+} zfs_batch_remove_t;
+
+/*
+ * Remove a batch of entries from one directory.  The entries are
+ * removed in groups of up to ZFS_BATCH_MAX, a group is a single
+ * transaction; every entry is handled the same way as by zfs_remove().
+ *
+ *	IN:	dvp	- vnode of directory to remove entries from.
+ *		names	- names of entries to remove.
+ *		count	- number of names.
+ *		cr	- credentials of caller.
+ *
+ *	OUT:	errors	- 0 or error code of every name.
+ *
+ *	RETURN:	0 if the batch was processed
+ *		error code if failure of whole batch
+ *
+ * Timestamps:
+ *	dvp - ctime|mtime
+ *	 vp - ctime (if nlink > 0)
+ */
+int
+zfs_remove_names(vnode_t *dvp, char **names, int count, cred_t *cr,
+    int *errors)
+{
+	znode_t		*dzp = VTOZ(dvp);
+	zfsvfs_t	*zfsvfs = dzp->z_zfsvfs;
+	zilog_t		*zilog;
+	zfs_batch_remove_t *ents, *br;
+	int		ord[ZFS_BATCH_MAX];
+	dmu_tx_t	*tx;
+	vnode_t		*vp;
+	znode_t		*zp;
+	boolean_t	unlinked;
+	char		*name;
+	int		first, n, i, k;
+	int		error;
+
+	ZFS_ENTER(zfsvfs);
+	ZFS_VERIFY_ZP(dzp);
+	zilog = zfsvfs->z_log;
+	ents = kmem_alloc(ZFS_BATCH_MAX * sizeof (zfs_batch_remove_t),
+	    KM_SLEEP);
+
+	for (first = 0; first < count; first += n) {
+		n = zfs_batch_group(zfsvfs, count - first);
+		zfs_batch_order(names, first, n, ord);
+top:
+		bzero(ents, n * sizeof (zfs_batch_remove_t));
+		tx = dmu_tx_create(zfsvfs->z_os);
+		for (i = 0; i < n; i++) {
+			br = &ents[i];
+			k = ord[i];
+			name = names[k];
+			if (strlen(name) >= MAXNAMELEN)
+				error = ENAMETOOLONG;
+			else if (i > 0 && strcmp(names[ord[i - 1]], name) == 0)
+				error = ENOENT;
+			else
+				error = zfs_dirent_lock(&br->br_dl, dzp, name,
+				    &br->br_zp, ZEXISTS, NULL, NULL);
+			if (error == 0) {
+				vp = ZTOV(br->br_zp);
+				error = zfs_zaccess_delete(dzp, br->br_zp, cr);
+				/*
+				 * Need to use rmdir for removing directories.
+				 */
+				if (error == 0 && vp->v_type == VDIR)
+					error = EPERM;
+				if (error) {
+					zfs_dirent_unlock(br->br_dl);
+					VN_RELE(vp);
+					br->br_dl = NULL;
+					br->br_zp = NULL;
+				}
+			}
+			errors[k] = error;
+			if (error)
+				continue;
+
+			zp = br->br_zp;
+			vnevent_remove(vp, dvp, name, NULL);
+			dnlc_remove(dvp, name);
+
+			mutex_enter(&vp->v_lock);
+			br->br_may_delete_now = vp->v_count == 1 &&
+			    !vn_has_cached_data(vp);
+			mutex_exit(&vp->v_lock);
+
+			dmu_tx_hold_zap(tx, dzp->z_id, FALSE, name);
+			dmu_tx_hold_bonus(tx, zp->z_id);
+			if (br->br_may_delete_now) {
+				br->br_toobig = zp->z_phys->zp_size >
+				    zp->z_blksz * DMU_MAX_DELETEBLKCNT;
+				/* if the file is too big, hold_free a token */
+				dmu_tx_hold_free(tx, zp->z_id, 0,
+				    (br->br_toobig ? DMU_MAX_ACCESS :
+				    DMU_OBJECT_END));
+			}
+			if ((br->br_xattr_obj = zp->z_phys->zp_xattr) != 0)
+				dmu_tx_hold_bonus(tx, br->br_xattr_obj);
+			if ((br->br_acl_obj =
+			    zp->z_phys->zp_acl.z_acl_extern_obj) != 0 &&
+			    br->br_may_delete_now)
+				dmu_tx_hold_free(tx, br->br_acl_obj, 0,
+				    DMU_OBJECT_END);
+		}
+		/* charge as an update -- would be nice not to charge at all */
+		dmu_tx_hold_zap(tx, zfsvfs->z_unlinkedobj, FALSE, NULL);
+
+		error = dmu_tx_assign(tx, zfsvfs->z_assign);
+		if (error) {
+			for (i = 0; i < n; i++) {
+				br = &ents[i];
+				if (br->br_dl == NULL)
+					continue;
+				zfs_dirent_unlock(br->br_dl);
+				VN_RELE(ZTOV(br->br_zp));
+			}
+			if (error == ERESTART &&
+			    zfsvfs->z_assign == TXG_NOWAIT) {
+				dmu_tx_wait(tx);
+				dmu_tx_abort(tx);
+				goto top;
+			}
+			dmu_tx_abort(tx);
+			for (i = 0; i < n; i++) {
+				if (ents[i].br_dl)
+					errors[ord[i]] = error;
+			}
+			for (k = first + n; k < count; k++)
+				errors[k] = error;
+			break;
+		}
+
+		for (i = 0; i < n; i++) {
+			br = &ents[i];
+			if (br->br_dl == NULL)
+				continue;
+			zp = br->br_zp;
+			vp = ZTOV(zp);
+
+			/*
+			 * Remove the directory entry.
+			 */
+			error = zfs_link_destroy(br->br_dl, zp, tx, ZEXISTS,
+			    &unlinked);
+			errors[ord[i]] = error;
+			if (error)
+				continue;
+
+			if (unlinked) {
+				mutex_enter(&vp->v_lock);
+				br->br_delete_now = br->br_may_delete_now &&
+				    !br->br_toobig && vp->v_count == 1 &&
+				    !vn_has_cached_data(vp) &&
+				    zp->z_phys->zp_xattr == br->br_xattr_obj &&
+				    zp->z_phys->zp_acl.z_acl_extern_obj ==
+				    br->br_acl_obj;
+				mutex_exit(&vp->v_lock);
+			}
+
+			if (br->br_delete_now) {
+				if (zp->z_phys->zp_xattr) {
+					error = zfs_zget(zfsvfs,
+					    zp->z_phys->zp_xattr, &br->br_xzp,
+					    B_FALSE);
+					ASSERT3U(error, ==, 0);
+					ASSERT3U(br->br_xzp->z_phys->zp_links,
+					    ==, 2);
+					dmu_buf_will_dirty(br->br_xzp->z_dbuf,
+					    tx);
+					mutex_enter(&br->br_xzp->z_lock);
+					br->br_xzp->z_unlinked = 1;
+					br->br_xzp->z_phys->zp_links = 0;
+					mutex_exit(&br->br_xzp->z_lock);
+					zfs_unlinked_add(br->br_xzp, tx);
+					zp->z_phys->zp_xattr = 0;
+				}
+				mutex_enter(&zp->z_lock);
+				mutex_enter(&vp->v_lock);
+				vp->v_count--;
+				ASSERT3U(vp->v_count, ==, 0);
+				mutex_exit(&vp->v_lock);
+				mutex_exit(&zp->z_lock);
+				zfs_znode_delete(zp, tx);
+			} else if (unlinked) {
+				zfs_unlinked_add(zp, tx);
+			}
+
+			zfs_log_remove(zilog, tx, TX_REMOVE, dzp,
+			    names[ord[i]]);
+		}
+		dmu_tx_commit(tx);
+
+		for (i = 0; i < n; i++) {
+			br = &ents[i];
+			if (br->br_dl == NULL)
+				continue;
+			zfs_dirent_unlock(br->br_dl);
+			if (!br->br_delete_now) {
+				VN_RELE(ZTOV(br->br_zp));
+			} else if (br->br_xzp) {
+				/* delayed to prevent nesting transactions */
+				VN_RELE(ZTOV(br->br_xzp));
+			}
+		}
+	}
+
+	kmem_free(ents, ZFS_BATCH_MAX * sizeof (zfs_batch_remove_t));
+	ZFS_EXIT(zfsvfs);
+	return (0);
+}
+
 /*
  * Create a new directory and insert it into dvp using the name
  * provided.  Return a pointer to the inserted directory.
@@ -2024,7 +2480,8 @@ zfs_readdir(vnode_t *vp, uio_t *uio, cred_t *cr, int *eofp,
 	while (outcount < bytes_wanted) {
 		ino64_t objnum;
 		ushort_t reclen;
-		off64_t *next;
+		off64_t *next = NULL;
+		DIRENT *dent = NULL;
 
 		/*
 		 * Special case `.', `..', and `.zfs'.
@@ -2112,8 +2569,10 @@ zfs_readdir(vnode_t *vp, uio_t *uio, cred_t *cr, int *eofp,
 			eodp = (edirent_t *)((intptr_t)eodp + reclen);
 		} else {
 			/*
-			 * Add normal entry:
+			 * Add normal entry, d_off is filled below
+			 * with the cookie of the *next* entry:
 			 */
+			dent = (DIRENT *)odp;
 			size_t reclen_in_fact = dirent_engine
 			    ->add_dirent_into_buf( (char *)odp, 
 						   reclen, 
@@ -2144,7 +2603,10 @@ zfs_readdir(vnode_t *vp, uio_t *uio, cred_t *cr, int *eofp,
 		} else {
 			offset += 1;
 		}
-		//*next = offset;
+		if (next != NULL)
+			*next = offset;
+		else
+			dent->d_off = offset;
 	}
 	zp->z_zn_prefetch = B_FALSE; /* a lookup will re-enable pre-fetching */
 
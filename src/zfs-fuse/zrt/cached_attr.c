@@ -0,0 +1,203 @@
+/*
+ *
+ * Copyright (c) 2014, LiteStack, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <string.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <pthread.h>
+
+#include "lowlevel_filesystem.h"
+#include "cached_attr.h"
+
+
+struct AttrItem{
+    ino_t inode;
+    struct stat st;
+    struct AttrItem* hash_next;
+    struct AttrItem* lru_prev; /*more recently used*/
+    struct AttrItem* lru_next; /*less recently used*/
+};
+
+struct CachedAttr{
+    struct CachedAttrPublicInterface public_;
+    struct LowLevelFilesystemPublicInterface* lowlevelfs;
+    struct AttrItem*  hash_table[CACHED_ATTR_HASH_SIZE];
+    struct AttrItem*  lru_head;
+    struct AttrItem*  lru_tail;
+    struct CachedAttrStats stats;
+    /*incremented by every forget, attributes that was obtained while
+     *forget happened can be stale and must not be cached*/
+    uint64_t forget_seq;
+    pthread_mutex_t mutex;
+};
+
+
+static uint32_t attr_bucket(ino_t inode){
+    /*inode numbers are mostly sequential, spread them by multiplier*/
+    return ((uint32_t)inode * 2654435761u) >> 16 & (CACHED_ATTR_HASH_SIZE-1);
+}
+
+static void lru_unlink(struct CachedAttr* this_, struct AttrItem* item){
+    if ( item->lru_prev ) item->lru_prev->lru_next = item->lru_next;
+    else this_->lru_head = item->lru_next;
+    if ( item->lru_next ) item->lru_next->lru_prev = item->lru_prev;
+    else this_->lru_tail = item->lru_prev;
+    item->lru_prev = item->lru_next = NULL;
+}
+
+static void lru_push_head(struct CachedAttr* this_, struct AttrItem* item){
+    item->lru_prev = NULL;
+    item->lru_next = this_->lru_head;
+    if ( this_->lru_head ) this_->lru_head->lru_prev = item;
+    this_->lru_head = item;
+    if ( this_->lru_tail == NULL ) this_->lru_tail = item;
+}
+
+/*functions below must be called with mutex held*/
+
+static struct AttrItem** attr_locate(struct CachedAttr* this_, ino_t inode){
+    struct AttrItem** itemp = &this_->hash_table[attr_bucket(inode)];
+    for ( ; *itemp != NULL; itemp = &(*itemp)->hash_next ){
+	if ( (*itemp)->inode == inode )
+	    break;
+    }
+    return itemp;
+}
+
+/*unlink item from hash chain pointed by itemp and lru list, free it*/
+static void attr_remove(struct CachedAttr* this_, struct AttrItem** itemp){
+    struct AttrItem* item = *itemp;
+    *itemp = item->hash_next;
+    lru_unlink(this_, item);
+    free(item);
+    --this_->stats.entries;
+}
+
+static void attr_insert(struct CachedAttr* this_, ino_t inode, const struct stat *st){
+    struct AttrItem* item = *attr_locate(this_, inode);
+    /*the same inode can be inserted by concurrent stat*/
+    if ( item != NULL ){
+	item->st = *st;
+	return;
+    }
+    if ( this_->stats.entries >= CACHED_ATTR_MAX_ENTRIES ){
+	assert(this_->lru_tail != NULL);
+	attr_remove(this_, attr_locate(this_, this_->lru_tail->inode));
+	++this_->stats.evictions;
+    }
+    item = malloc(sizeof(struct AttrItem));
+    if ( item == NULL ) return; /*caching is optional*/
+
+    item->inode = inode;
+    item->st = *st;
+    struct AttrItem** bucket = &this_->hash_table[attr_bucket(inode)];
+    item->hash_next = *bucket;
+    *bucket = item;
+    lru_push_head(this_, item);
+    ++this_->stats.entries;
+}
+
+
+static int cached_attr_stat(struct CachedAttrPublicInterface* cached_attr, 
+			    ino_t inode, struct stat *buf){
+    struct CachedAttr* this_ = (struct CachedAttr*)cached_attr;
+    struct AttrItem* item;
+    uint64_t forget_seq;
+    int ret;
+
+    pthread_mutex_lock(&this_->mutex);
+    if ( (item = *attr_locate(this_, inode)) != NULL ){
+	++this_->stats.hits;
+	if ( this_->lru_head != item ){
+	    lru_unlink(this_, item);
+	    lru_push_head(this_, item);
+	}
+	*buf = item->st;
+	pthread_mutex_unlock(&this_->mutex);
+	return 0;
+    }
+    ++this_->stats.misses;
+    forget_seq = this_->forget_seq;
+    pthread_mutex_unlock(&this_->mutex);
+
+    /*do not hold mutex while lowlevel fs is working*/
+    if ( (ret = this_->lowlevelfs->stat(this_->lowlevelfs, inode, buf)) < 0 )
+	return ret;
+
+    pthread_mutex_lock(&this_->mutex);
+    if ( forget_seq == this_->forget_seq )
+	attr_insert(this_, inode, buf);
+    pthread_mutex_unlock(&this_->mutex);
+    return 0;
+}
+
+static void cached_attr_forget(struct CachedAttrPublicInterface* cached_attr, 
+			       ino_t inode){
+    struct CachedAttr* this_ = (struct CachedAttr*)cached_attr;
+    struct AttrItem** itemp;
+    pthread_mutex_lock(&this_->mutex);
+    ++this_->forget_seq;
+    itemp = attr_locate(this_, inode);
+    if ( *itemp != NULL ){
+	attr_remove(this_, itemp);
+	++this_->stats.invalidations;
+    }
+    pthread_mutex_unlock(&this_->mutex);
+}
+
+static void cached_attr_forget_all(struct CachedAttrPublicInterface* cached_attr){
+    struct CachedAttr* this_ = (struct CachedAttr*)cached_attr;
+    pthread_mutex_lock(&this_->mutex);
+    ++this_->forget_seq;
+    while ( this_->lru_head != NULL ){
+	attr_remove(this_, attr_locate(this_, this_->lru_head->inode));
+	++this_->stats.invalidations;
+    }
+    pthread_mutex_unlock(&this_->mutex);
+}
+
+static void cached_attr_stats(struct CachedAttrPublicInterface* cached_attr, 
+			      struct CachedAttrStats* stats){
+    struct CachedAttr* this_ = (struct CachedAttr*)cached_attr;
+    pthread_mutex_lock(&this_->mutex);
+    *stats = this_->stats;
+    pthread_mutex_unlock(&this_->mutex);
+}
+
+
+static struct CachedAttrPublicInterface KCachedAttr = {
+    cached_attr_stat,
+    cached_attr_forget,
+    cached_attr_forget_all,
+    cached_attr_stats
+};
+
+
+struct CachedAttrPublicInterface* 
+cached_attr_construct( struct LowLevelFilesystemPublicInterface* lowlevelfs ){
+    /*use malloc and not new, because it's external c object*/
+    struct CachedAttr* this_ = (struct CachedAttr*)malloc( sizeof(struct CachedAttr) );
+    memset(this_, 0, sizeof(struct CachedAttr));
+    this_->public_ = KCachedAttr;
+    this_->lowlevelfs = lowlevelfs;
+    pthread_mutex_init(&this_->mutex, NULL);
+    return (struct CachedAttrPublicInterface*)this_;
+}
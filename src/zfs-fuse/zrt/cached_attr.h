@@ -0,0 +1,63 @@
+/*
+ *
+ * Copyright (c) 2014, LiteStack, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "zrt_defines.h" //CONSTRUCT_L
+
+/*name of constructor*/
+#define CACHED_ATTR cached_attr_construct
+
+struct LowLevelFilesystemPublicInterface;
+struct stat;
+
+/*attributes cache size, least recently used entries are evicted*/
+#define CACHED_ATTR_MAX_ENTRIES 32768
+#define CACHED_ATTR_HASH_SIZE   8192 /*must be power of 2*/
+
+struct CachedAttrStats{
+    uint64_t hits;          /*attributes located in cache*/
+    uint64_t misses;        /*stats passed to lowlevel fs*/
+    uint64_t invalidations; /*entries dropped by forget*/
+    uint64_t evictions;     /*entries evicted due to cache size limit*/
+    uint32_t entries;       /*currently cached entries*/
+};
+
+/*interface, all functions are thread safe. Atime updated by reads is
+ *not tracked, cached attributes keep atime of moment they were cached*/
+struct CachedAttrPublicInterface{
+    /*get attributes of inode
+     *@return 0 if ok, -errcode on error*/
+    int (*stat)(struct CachedAttrPublicInterface* cached_attr, 
+		ino_t inode, struct stat *buf);
+    /*drop cached attributes of inode, must be called by every operation
+     *that changes size, times, mode, owner or links count of inode,
+     *and by operation that removes inode, because inode number can be
+     *reused*/
+    void (*forget)(struct CachedAttrPublicInterface* cached_attr, 
+		   ino_t inode);
+    /*drop all cached attributes, for operations that affect inodes
+     *not known by caller*/
+    void (*forget_all)(struct CachedAttrPublicInterface* cached_attr);
+    void (*stats)(struct CachedAttrPublicInterface* cached_attr, 
+		  struct CachedAttrStats* stats);
+};
+
+
+struct CachedAttrPublicInterface* 
+cached_attr_construct (struct LowLevelFilesystemPublicInterface* lowlevelfs);
@@ -20,77 +20,342 @@
 #include <sys/stat.h>
 #include <sys/statvfs.h>
 #include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <assert.h>
 #include <alloca.h>
+#include <pthread.h>
 
 #include "path_utils.h"
 #include "lowlevel_filesystem.h"
 #include "cached_lookup.h"
 
 
+/*dentry, it's keeps result of lookup name in parent directory, for
+ *negative entry inode is -ENOENT*/
+#define INVERT_SIGN_ENOENT -ENOENT
+
+struct DentryItem{
+    int   parent_inode;
+    int   inode;
+    char *name;
+    uint32_t hash;
+    struct DentryItem* hash_next;
+    struct DentryItem* lru_prev; /*more recently used*/
+    struct DentryItem* lru_next; /*less recently used*/
+};
+
 struct CachedLookup{
     struct CachedLookupPublicInterface public_;
     struct LowLevelFilesystemPublicInterface* lowlevelfs;
+    struct DentryItem*  hash_table[CACHED_LOOKUP_HASH_SIZE];
+    struct DentryItem*  lru_head;
+    struct DentryItem*  lru_tail;
+    struct CachedLookupStats stats;
+    /*incremented by every forget, lookup result that was obtained
+     *while forget happened can be stale and must not be cached*/
+    uint64_t forget_seq;
+    pthread_mutex_t mutex;
 };
 
 
-static int cached_lookup_inode_by_path(struct CachedLookupPublicInterface* cached_lookup, 
-				       const char *path){
-    int component_len;
-    const char *component; 
-    int temp_cursor;
-    int inode=-1;
-    int proceed=1;
+static uint32_t dentry_hash(int parent_inode, const char *name){
+    /*FNV-1a over name, seeded by parent inode*/
+    uint32_t hash = 2166136261u ^ (uint32_t)parent_inode;
+    hash *= 16777619u;
+    while( *name ){
+	hash ^= (unsigned char)*name++;
+	hash *= 16777619u;
+    }
+    return hash;
+}
+
+static void lru_unlink(struct CachedLookup* this_, struct DentryItem* item){
+    if ( item->lru_prev ) item->lru_prev->lru_next = item->lru_next;
+    else this_->lru_head = item->lru_next;
+    if ( item->lru_next ) item->lru_next->lru_prev = item->lru_prev;
+    else this_->lru_tail = item->lru_prev;
+    item->lru_prev = item->lru_next = NULL;
+}
+
+static void lru_push_head(struct CachedLookup* this_, struct DentryItem* item){
+    item->lru_prev = NULL;
+    item->lru_next = this_->lru_head;
+    if ( this_->lru_head ) this_->lru_head->lru_prev = item;
+    this_->lru_head = item;
+    if ( this_->lru_tail == NULL ) this_->lru_tail = item;
+}
+
+static struct DentryItem** dentry_locate(struct CachedLookup* this_, uint32_t hash,
+					 int parent_inode, const char *name){
+    struct DentryItem** itemp = &this_->hash_table[hash & (CACHED_LOOKUP_HASH_SIZE-1)];
+    for ( ; *itemp != NULL; itemp = &(*itemp)->hash_next ){
+	if ( (*itemp)->hash == hash && (*itemp)->parent_inode == parent_inode && 
+	     !strcmp((*itemp)->name, name) )
+	    break;
+    }
+    return itemp;
+}
+
+/*unlink item from hash chain pointed by itemp and lru list, free it*/
+static void dentry_remove(struct CachedLookup* this_, struct DentryItem** itemp){
+    struct DentryItem* item = *itemp;
+    *itemp = item->hash_next;
+    lru_unlink(this_, item);
+    free(item->name);
+    free(item);
+    --this_->stats.entries;
+}
+
+static void dentry_evict_lru(struct CachedLookup* this_){
+    struct DentryItem* victim = this_->lru_tail;
+    assert(victim != NULL);
+    struct DentryItem** itemp = dentry_locate(this_, victim->hash, 
+					      victim->parent_inode, victim->name);
+    assert(*itemp == victim);
+    dentry_remove(this_, itemp);
+    ++this_->stats.evictions;
+}
+
+/*functions below must be called with mutex held*/
+
+static void dentry_insert(struct CachedLookup* this_, uint32_t hash,
+			  int parent_inode, const char *name, int inode){
+    struct DentryItem* item = *dentry_locate(this_, hash, parent_inode, name);
+    /*the same name can be inserted by concurrent lookup*/
+    if ( item != NULL ){
+	item->inode = inode;
+	return;
+    }
+    item = malloc(sizeof(struct DentryItem));
+    if ( item == NULL ) return; /*caching is optional*/
+    if ( (item->name = strdup(name)) == NULL ){
+	free(item);
+	return;
+    }
+    if ( this_->stats.entries >= CACHED_LOOKUP_MAX_ENTRIES )
+	dentry_evict_lru(this_);
+
+    item->parent_inode = parent_inode;
+    item->inode = inode;
+    item->hash = hash;
+    struct DentryItem** bucket = &this_->hash_table[hash & (CACHED_LOOKUP_HASH_SIZE-1)];
+    item->hash_next = *bucket;
+    *bucket = item;
+    lru_push_head(this_, item);
+    ++this_->stats.entries;
+}
+
+
+/*locate cached dentry and move it to lru head, must be called with
+ *mutex held
+ *@return 1 if located, 0 if not*/
+static int dentry_get(struct CachedLookup* this_, uint32_t hash,
+		      int parent_inode, const char *name, int *inode){
+    struct DentryItem* item = *dentry_locate(this_, hash, parent_inode, name);
+    if ( item == NULL )
+	return 0;
+    if ( item->inode >= 0 ) ++this_->stats.hits;
+    else ++this_->stats.negative_hits;
+    if ( this_->lru_head != item ){
+	lru_unlink(this_, item);
+	lru_push_head(this_, item);
+    }
+    *inode = item->inode;
+    return 1;
+}
+
+/*walk path through dentries cache; path part starting from first
+ *component that isn't cached is resolved by single lowlevel lookup_path
+ *call, then dentries of resolved components are cached.
+ *@param parent_inode returns inode of pre-last component, -1 for root
+ *path, or -errcode if pre-last component can't be resolved
+ *@return inode of last component, -1 for path not beginning from root, or
+ *-errcode of component on which walk stopped*/
+static int walk_path(struct CachedLookup* this_, const char *path, int *parent_inode){
+    /*every component except root takes at least 2 chars*/
+    int maxcount = strlen(path)/2 + 1;
+    const char **names = alloca(maxcount * sizeof(const char*));
+    int *lens = alloca(maxcount * sizeof(int));
+    int *inodes = alloca(maxcount * sizeof(int));
+    const char *component;
+    char *name;
+    uint64_t forget_seq;
+    int component_len, temp_cursor;
+    int count=0, inode=-1, i, j, n, parent;
+
+    *parent_inode = -1;
     INIT_TEMP_CURSOR(&temp_cursor);
-    while ( proceed && 
-	   (component = path_component_forward( &temp_cursor, path, &component_len)) != NULL ){
-	/*root inode=3*/
+    while ( (component = path_component_forward( &temp_cursor, path, &component_len)) != NULL ){
+	/*root inode=3, next slashes are just separators*/
 	if ( component_len ==1 && component[0] == '/' ){
-	    inode = 3;
+	    if ( count == 0 ) inode = 3;
 	}
+	else if ( inode == -1 )
+	    return -1;
 	else{
-	    assert(inode>=3);
-	    inode = cached_lookup->inode_by_name(cached_lookup, 
-						 inode, 
-						 strndupa( component, component_len ) );
-	    
+	    assert(count < maxcount);
+	    names[count] = component;
+	    lens[count++] = component_len;
 	}
     }
-    return inode;
+    if ( inode == -1 )
+	return -1;
+
+    /*cached part of path*/
+    pthread_mutex_lock(&this_->mutex);
+    for ( i=0; i < count; i++ ){
+	name = strndupa( names[i], lens[i] );
+	*parent_inode = inode;
+	if ( !dentry_get(this_, dentry_hash(inode, name), inode, name, &inode) )
+	    break;
+	if ( inode < 0 ){
+	    pthread_mutex_unlock(&this_->mutex);
+	    /*nonexistent parent*/
+	    if ( i < count-1 ) *parent_inode = inode;
+	    return inode;
+	}
+    }
+    if ( i == count ){
+	pthread_mutex_unlock(&this_->mutex);
+	return inode;
+    }
+    ++this_->stats.misses;
+    forget_seq = this_->forget_seq;
+    pthread_mutex_unlock(&this_->mutex);
+
+    /*do not hold mutex while lowlevel fs is working, rest of path
+      starts from missed component*/
+    n = this_->lowlevelfs->lookup_path(this_->lowlevelfs, inode, names[i], 
+				       inodes+i, count-i);
+    if ( n < 0 ){
+	if ( i < count-1 ) *parent_inode = n;
+	return n;
+    }
+    n += i;
+
+    /*cache only valid inodes and nonexistent names, skip other errors*/
+    pthread_mutex_lock(&this_->mutex);
+    if ( forget_seq == this_->forget_seq ){
+	parent = inode;
+	/*components before n are valid, n itself is cached only if
+	  nonexistent, and nothing after it was looked up*/
+	for ( j=i; j < count && j <= n; j++ ){
+	    if ( j == n && inodes[j] != INVERT_SIGN_ENOENT ) break;
+	    name = strndupa( names[j], lens[j] );
+	    dentry_insert(this_, dentry_hash(parent, name), parent, name, inodes[j]);
+	    if ( inodes[j] == INVERT_SIGN_ENOENT ) break;
+	    parent = inodes[j];
+	}
+    }
+    pthread_mutex_unlock(&this_->mutex);
+
+    if ( n == count ){
+	if ( count > 1 && n-2 >= i ) *parent_inode = inodes[n-2];
+	return inodes[n-1];
+    }
+    /*walk stopped at component n*/
+    if ( n > i ) *parent_inode = inodes[n-1];
+    if ( n < count-1 ) *parent_inode = inodes[n];
+    return inodes[n];
+}
+
+static int cached_lookup_inode_by_path(struct CachedLookupPublicInterface* cached_lookup, 
+				       const char *path){
+    int parent_inode;
+    return walk_path((struct CachedLookup*)cached_lookup, path, &parent_inode);
 }
 
 static int cached_lookup_parent_inode_by_path(struct CachedLookupPublicInterface* cached_lookup, 
 					      const char *path){
-    int temp_cursor;
-    int result_len;
-    const char *res;
-    INIT_TEMP_CURSOR(&temp_cursor);
-    res = path_subpath_backward(&temp_cursor, path, &result_len); /*rewind to last component*/
-    /*if path not root*/
-    if ( strcmp("/", path) ){
-	res = path_subpath_backward(&temp_cursor, path, &result_len); /*rewind to pre-last component*/
-    }
+    int parent_inode;
+    walk_path((struct CachedLookup*)cached_lookup, path, &parent_inode);
+    return parent_inode;
+}
 
-    /*if no parent - root path was passed*/
-    if ( res == NULL )
-	return -1;
-    else{
-	return cached_lookup->inode_by_path(cached_lookup, 
-					    strndupa( res, result_len ) );
-    }
+static int cached_lookup_inode_and_parent_by_path(struct CachedLookupPublicInterface* cached_lookup, 
+						  const char *path, int *parent_inode){
+    return walk_path((struct CachedLookup*)cached_lookup, path, parent_inode);
 }
 
 static int cached_lookup_inode_by_name(struct CachedLookupPublicInterface* cached_lookup, 
 				       int parent_inode, const char *name){
-    struct CachedLookup* cached_lookup_impl = (struct CachedLookup*)cached_lookup;
-    return cached_lookup_impl->lowlevelfs->
-	lookup(cached_lookup_impl->lowlevelfs, parent_inode, name);
+    struct CachedLookup* this_ = (struct CachedLookup*)cached_lookup;
+    uint32_t hash = dentry_hash(parent_inode, name);
+    uint64_t forget_seq;
+    int inode;
+
+    pthread_mutex_lock(&this_->mutex);
+    if ( dentry_get(this_, hash, parent_inode, name, &inode) ){
+	pthread_mutex_unlock(&this_->mutex);
+	return inode;
+    }
+    ++this_->stats.misses;
+    forget_seq = this_->forget_seq;
+    pthread_mutex_unlock(&this_->mutex);
+
+    /*do not hold mutex while lowlevel fs is working*/
+    inode = this_->lowlevelfs->lookup(this_->lowlevelfs, parent_inode, name);
+
+    /*cache only valid inodes and nonexistent names, skip other errors*/
+    if ( inode >= 0 || inode == INVERT_SIGN_ENOENT ){
+	pthread_mutex_lock(&this_->mutex);
+	if ( forget_seq == this_->forget_seq )
+	    dentry_insert(this_, hash, parent_inode, name, inode);
+	pthread_mutex_unlock(&this_->mutex);
+    }
+    return inode;
+}
+
+static void cached_lookup_forget_name(struct CachedLookupPublicInterface* cached_lookup, 
+				      int parent_inode, const char *name){
+    struct CachedLookup* this_ = (struct CachedLookup*)cached_lookup;
+    struct DentryItem** itemp;
+    pthread_mutex_lock(&this_->mutex);
+    ++this_->forget_seq;
+    itemp = dentry_locate(this_, dentry_hash(parent_inode, name), parent_inode, name);
+    if ( *itemp != NULL )
+	dentry_remove(this_, itemp);
+    pthread_mutex_unlock(&this_->mutex);
+}
+
+static void cached_lookup_forget_dir(struct CachedLookupPublicInterface* cached_lookup, 
+				     int dir_inode){
+    struct CachedLookup* this_ = (struct CachedLookup*)cached_lookup;
+    struct DentryItem** itemp;
+    int i;
+    pthread_mutex_lock(&this_->mutex);
+    ++this_->forget_seq;
+    /*entries are hashed by name, so directory items can be anywhere*/
+    for ( i=0; i < CACHED_LOOKUP_HASH_SIZE && this_->stats.entries; i++ ){
+	itemp = &this_->hash_table[i];
+	while( *itemp != NULL ){
+	    if ( (*itemp)->parent_inode == dir_inode || (*itemp)->inode == dir_inode )
+		dentry_remove(this_, itemp);
+	    else
+		itemp = &(*itemp)->hash_next;
+	}
+    }
+    pthread_mutex_unlock(&this_->mutex);
+}
+
+static void cached_lookup_stats(struct CachedLookupPublicInterface* cached_lookup, 
+				struct CachedLookupStats* stats){
+    struct CachedLookup* this_ = (struct CachedLookup*)cached_lookup;
+    pthread_mutex_lock(&this_->mutex);
+    *stats = this_->stats;
+    pthread_mutex_unlock(&this_->mutex);
 }
 
 
 static struct CachedLookupPublicInterface KCachedLookup = {
     cached_lookup_inode_by_path,
     cached_lookup_parent_inode_by_path,
-    cached_lookup_inode_by_name
+    cached_lookup_inode_and_parent_by_path,
+    cached_lookup_inode_by_name,
+    cached_lookup_forget_name,
+    cached_lookup_forget_dir,
+    cached_lookup_stats
 };
 
 
@@ -98,8 +363,10 @@ struct CachedLookupPublicInterface*
 cached_lookup_construct( struct LowLevelFilesystemPublicInterface* lowlevelfs ){
     /*use malloc and not new, because it's external c object*/
     struct CachedLookup* this_ = (struct CachedLookup*)malloc( sizeof(struct CachedLookup) );
+    memset(this_, 0, sizeof(struct CachedLookup));
     this_->public_ = KCachedLookup;
     this_->lowlevelfs = lowlevelfs;
+    pthread_mutex_init(&this_->mutex, NULL);
     test_path_utils();
     return (struct CachedLookupPublicInterface*)this_;
 }
@@ -15,6 +15,8 @@
  * limitations under the License.
  */
 
+#include <stdint.h>
+
 #include "zrt_defines.h" //CONSTRUCT_L
 
 /*name of constructor*/
@@ -22,14 +24,41 @@
 
 struct LowLevelFilesystemPublicInterface* lowlevelfs;
 
+/*dentries cache size, least recently used entries are evicted*/
+#define CACHED_LOOKUP_MAX_ENTRIES 65536
+#define CACHED_LOOKUP_HASH_SIZE   16384 /*must be power of 2*/
+
+struct CachedLookupStats{
+    uint64_t hits;          /*positive entries located in cache*/
+    uint64_t negative_hits; /*negative entries located in cache*/
+    uint64_t misses;        /*lookups passed to lowlevel fs*/
+    uint64_t evictions;     /*entries evicted due to cache size limit*/
+    uint32_t entries;       /*currently cached entries*/
+};
+
+/*interface, all functions are thread safe*/
 struct CachedLookupPublicInterface{
     /*get inode, -1 not located*/
     int (*inode_by_path)(struct CachedLookupPublicInterface* cached_lookup, 
 			 const char *path);
     int (*parent_inode_by_path)(struct CachedLookupPublicInterface* cached_lookup, 
 				const char *path);
+    /*get inode and parent inode by single walk through path
+     *@param parent_inode returns parent inode, -1 for root path*/
+    int (*inode_and_parent_by_path)(struct CachedLookupPublicInterface* cached_lookup, 
+				    const char *path, int *parent_inode);
     int (*inode_by_name)(struct CachedLookupPublicInterface* cached_lookup, 
 			 int parent_inode, const char *name);
+    /*drop cached entry for name residing in parent directory, must be
+     *called by every operation that adds, removes or renames name*/
+    void (*forget_name)(struct CachedLookupPublicInterface* cached_lookup, 
+			int parent_inode, const char *name);
+    /*drop all cached entries of directory, must be called when
+     *directory removed, because inode number can be reused*/
+    void (*forget_dir)(struct CachedLookupPublicInterface* cached_lookup, 
+		       int dir_inode);
+    void (*stats)(struct CachedLookupPublicInterface* cached_lookup, 
+		  struct CachedLookupStats* stats);
 };
 
 
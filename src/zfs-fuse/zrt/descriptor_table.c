@@ -0,0 +1,146 @@
+/*
+ *
+ * Copyright (c) 2014, LiteStack, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdlib.h>
+#include <assert.h>
+
+#include "descriptor_table.h"
+
+enum { EDescriptorAvailable=0, EDescriptorUsed=1, EDescriptorReserved=2 };
+
+#define CHUNK_INDEX(id) ((id)>>DESCRIPTOR_TABLE_CHUNK_SHIFT)
+#define ITEM_INDEX(id)  ((id)&(DESCRIPTOR_TABLE_CHUNK_SIZE-1))
+
+static struct DescriptorTableItem* item_by_id(struct DescriptorTable* table,
+					      char* chunk, int id){
+    return (struct DescriptorTableItem*)(chunk + ITEM_INDEX(id)*table->item_size);
+}
+
+/*must be called with table mutex held and only for allocated chunks*/
+static struct DescriptorTableItem* locked_item(struct DescriptorTable* table, int id){
+    return item_by_id(table, table->chunks[CHUNK_INDEX(id)], id);
+}
+
+static void free_list_push(struct DescriptorTable* table, int id){
+    struct DescriptorTableItem* item = locked_item(table, id);
+    item->prev_free = -1;
+    item->next_free = table->free_head;
+    if ( table->free_head != -1 )
+	locked_item(table, table->free_head)->prev_free = id;
+    table->free_head = id;
+}
+
+static void free_list_remove(struct DescriptorTable* table, int id){
+    struct DescriptorTableItem* item = locked_item(table, id);
+    if ( item->prev_free != -1 )
+	locked_item(table, item->prev_free)->next_free = item->next_free;
+    else
+	table->free_head = item->next_free;
+    if ( item->next_free != -1 )
+	locked_item(table, item->next_free)->prev_free = item->prev_free;
+}
+
+/*allocate next chunk and put all it's items into free list
+ *@return 0 if ok, -1 if table can't grow*/
+static int grow_table(struct DescriptorTable* table){
+    int first_id, id;
+    char* chunk;
+    if ( table->chunks_count == DESCRIPTOR_TABLE_MAX_CHUNKS )
+	return -1;
+    chunk = calloc(DESCRIPTOR_TABLE_CHUNK_SIZE, table->item_size);
+    if ( chunk == NULL )
+	return -1;
+    /*lookup can see chunk only after it's initialized*/
+    __atomic_store_n(&table->chunks[table->chunks_count], chunk, __ATOMIC_RELEASE);
+    first_id = table->chunks_count << DESCRIPTOR_TABLE_CHUNK_SHIFT;
+    ++table->chunks_count;
+    /*lowest ids will be at free list head*/
+    for ( id=first_id+DESCRIPTOR_TABLE_CHUNK_SIZE-1; id >= first_id; id-- )
+	free_list_push(table, id);
+    return 0;
+}
+
+void* descriptor_table_lookup(struct DescriptorTable* table, int id){
+    char* chunk;
+    struct DescriptorTableItem* item;
+    if ( id < 0 || id >= DESCRIPTOR_TABLE_MAX_ITEMS )
+	return NULL;
+    chunk = __atomic_load_n(&table->chunks[CHUNK_INDEX(id)], __ATOMIC_ACQUIRE);
+    if ( chunk == NULL )
+	return NULL;
+    item = item_by_id(table, chunk, id);
+    if ( __atomic_load_n(&item->used, __ATOMIC_ACQUIRE) != EDescriptorUsed )
+	return NULL;
+    return item;
+}
+
+int descriptor_table_reserve(struct DescriptorTable* table, int id, void** item){
+    struct DescriptorTableItem* table_item;
+    if ( id >= DESCRIPTOR_TABLE_MAX_ITEMS )
+	return -1;
+
+    pthread_mutex_lock(&table->mutex);
+    if ( id < 0 ){
+	if ( table->free_head == -1 && grow_table(table) != 0 ){
+	    pthread_mutex_unlock(&table->mutex);
+	    return -1;
+	}
+	id = table->free_head;
+    }
+    else{
+	while ( CHUNK_INDEX(id) >= table->chunks_count ){
+	    if ( grow_table(table) != 0 ){
+		pthread_mutex_unlock(&table->mutex);
+		return -1;
+	    }
+	}
+	if ( locked_item(table, id)->used != EDescriptorAvailable ){
+	    pthread_mutex_unlock(&table->mutex);
+	    return -1;
+	}
+    }
+    free_list_remove(table, id);
+    table_item = locked_item(table, id);
+    table_item->used = EDescriptorReserved;
+    pthread_mutex_unlock(&table->mutex);
+
+    *item = table_item;
+    return id;
+}
+
+void descriptor_table_publish(struct DescriptorTable* table, void* item){
+    struct DescriptorTableItem* table_item = (struct DescriptorTableItem*)item;
+    assert(table_item->used == EDescriptorReserved);
+    __atomic_store_n(&table_item->used, EDescriptorUsed, __ATOMIC_RELEASE);
+}
+
+int descriptor_table_free(struct DescriptorTable* table, int id){
+    struct DescriptorTableItem* item;
+    if ( id < 0 || id >= DESCRIPTOR_TABLE_MAX_ITEMS )
+	return -1;
+
+    pthread_mutex_lock(&table->mutex);
+    if ( CHUNK_INDEX(id) >= table->chunks_count ||
+	 (item=locked_item(table, id))->used == EDescriptorAvailable ){
+	pthread_mutex_unlock(&table->mutex);
+	return -1;
+    }
+    __atomic_store_n(&item->used, EDescriptorAvailable, __ATOMIC_RELEASE);
+    free_list_push(table, id);
+    pthread_mutex_unlock(&table->mutex);
+    return 0;
+}
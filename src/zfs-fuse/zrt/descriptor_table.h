@@ -0,0 +1,70 @@
+/*
+ *
+ * Copyright (c) 2014, LiteStack, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __DESCRIPTOR_TABLE_H__
+#define __DESCRIPTOR_TABLE_H__
+
+#include <stddef.h> //size_t
+#include <pthread.h>
+
+/*Growable table of descriptors. Items are stored in chunks that are
+ *allocated on demand and never freed, so pointer to item remains valid
+ *while table exists. Lookup is lock free, allocation and freeing are
+ *serialized by table mutex, free items are kept in doubly linked list,
+ *so both allocation of any item and of specified item are O(1).*/
+
+#define DESCRIPTOR_TABLE_CHUNK_SHIFT 8
+#define DESCRIPTOR_TABLE_CHUNK_SIZE  (1<<DESCRIPTOR_TABLE_CHUNK_SHIFT)
+#define DESCRIPTOR_TABLE_MAX_CHUNKS  4096
+#define DESCRIPTOR_TABLE_MAX_ITEMS   (DESCRIPTOR_TABLE_MAX_CHUNKS*DESCRIPTOR_TABLE_CHUNK_SIZE)
+
+/*every table item must begin with this header*/
+struct DescriptorTableItem{
+    int used;       /*EDescriptorAvailable, EDescriptorUsed; read without lock*/
+    int prev_free;  /*free list links, valid only for available item*/
+    int next_free;
+};
+
+struct DescriptorTable{
+    pthread_mutex_t mutex;
+    size_t item_size;
+    int    chunks_count;
+    int    free_head;   /*-1 if no free items in allocated chunks*/
+    char*  chunks[DESCRIPTOR_TABLE_MAX_CHUNKS];
+};
+
+#define DESCRIPTOR_TABLE_INITIALIZER(item_size)			\
+    { PTHREAD_MUTEX_INITIALIZER, (item_size), 0, -1, {NULL} }
+
+/*@return used item, or NULL if id is not valid or item not used*/
+void* descriptor_table_lookup(struct DescriptorTable* table, int id);
+
+/*take available item from table, item is not visible for lookup until
+ *descriptor_table_publish will be called for it.
+ *@param id required item id, or -1 for any available item
+ *@param item returns item pointer
+ *@return id, or -1 if table is full or required id is used*/
+int descriptor_table_reserve(struct DescriptorTable* table, int id, void** item);
+
+/*make reserved item visible for lookup*/
+void descriptor_table_publish(struct DescriptorTable* table, void* item);
+
+/*return used item into table
+ *@return 0 if ok, -1 if item not used*/
+int descriptor_table_free(struct DescriptorTable* table, int id);
+
+#endif //__DESCRIPTOR_TABLE_H__
@@ -26,90 +26,66 @@
 #define ZRT_LOG(v_123, fmt_123, ...)
 #endif
 #include "handle_allocator.h"
+#include "descriptor_table.h"
 
-#define VERIFY_HANDLE(handle, state)					\
-    ((handle<0 || handle>=MAX_HANDLES_COUNT)? 0 : (s_handle_slots[handle].used == state)) 
-
-
-enum { EHandleAvailable=0, EHandleUsed=1  };
 
 struct HandleItemInternal{
+    struct DescriptorTableItem header; /*must be first*/
     struct HandleItem public_;
-    int used; /*EHandleAvailable, EHandleUsed*/
 };
 
 
-
-static int s_first_unused_slot = 0;
-static struct HandleItemInternal s_handle_slots[MAX_HANDLES_COUNT];
-
-static int seek_unused_slot( int starting_from ){
-    int i;
-    starting_from = starting_from<0 ?0 :starting_from;
-    for ( i=starting_from; i < MAX_HANDLES_COUNT; i++ ){
-        if ( s_handle_slots[i].used == EHandleAvailable ){
-	    /*found closest unusable slot*/
-            ZRT_LOG( L_INFO, "slot index=%d, EHandleAvailable", i );
-            s_first_unused_slot = i;
-            return s_first_unused_slot;
-        }
-    }
-    return -1;
-}
+static struct DescriptorTable s_handle_table = 
+    DESCRIPTOR_TABLE_INITIALIZER(sizeof(struct HandleItemInternal));
 
 
-static int allocate_handle(struct MountsPublicInterface* mount_fs, ino_t inode, int open_file_desc_id){
-    s_first_unused_slot = seek_unused_slot( s_first_unused_slot );
-    if ( s_first_unused_slot == -1 ) return -1;
-    s_handle_slots[s_first_unused_slot].used = EHandleUsed;
-    s_handle_slots[s_first_unused_slot].public_.mount_fs = mount_fs;
-    s_handle_slots[s_first_unused_slot].public_.open_file_description_id = open_file_desc_id;
-    s_handle_slots[s_first_unused_slot].public_.inode = inode;
-    return s_first_unused_slot;
+static int allocate_handle2(struct MountsPublicInterface* mount_fs, ino_t inode, void* node,
+			    int open_file_desc_id, int handle){
+    struct HandleItemInternal* item;
+    if ( (handle=descriptor_table_reserve(&s_handle_table, handle, (void**)&item)) == -1 )
+	return -1;
+    ZRT_LOG( L_INFO, "handle=%d", handle );
+    item->public_.mount_fs = mount_fs;
+    item->public_.open_file_description_id = open_file_desc_id;
+    item->public_.inode = inode;
+    item->public_.node = node;
+    descriptor_table_publish(&s_handle_table, item);
+    return handle;
 }
 
-static int allocate_handle2(struct MountsPublicInterface* mount_fs, ino_t inode, int open_file_desc_id, int handle){
-    if ( !VERIFY_HANDLE(handle, EHandleAvailable) ) return -1;
-    s_handle_slots[handle].used = EHandleUsed;
-    s_handle_slots[handle].public_.mount_fs = mount_fs;
-    s_handle_slots[handle].public_.open_file_description_id = open_file_desc_id;
-    s_handle_slots[handle].public_.inode = inode;
-    return handle;
+static int allocate_handle(struct MountsPublicInterface* mount_fs, ino_t inode, void* node,
+			   int open_file_desc_id){
+    return allocate_handle2(mount_fs, inode, node, open_file_desc_id, -1);
 }
 
 static int free_handle(int handle){
-    if ( !VERIFY_HANDLE(handle, EHandleUsed) ) return -1;
-    s_handle_slots[handle].used = EHandleAvailable;
-    s_handle_slots[handle].public_.mount_fs = NULL;
-    s_handle_slots[handle].public_.open_file_description_id = 0;
-    s_handle_slots[handle].public_.inode = 0;
-    /*set lowest available slot*/
-    if ( handle < s_first_unused_slot ) s_first_unused_slot = handle;
-    return 0; //ok
-
+    return descriptor_table_free(&s_handle_table, handle);
 }
 
 static int check_handle_is_related_to_filesystem(int handle, struct MountsPublicInterface* fs){
-    if ( !VERIFY_HANDLE(handle, EHandleUsed) ) return -1;
-    if ( s_handle_slots[handle].public_.mount_fs == fs )
+    struct HandleItemInternal* item = descriptor_table_lookup(&s_handle_table, handle);
+    if ( item != NULL && item->public_.mount_fs == fs )
         return 0; //ok
     else
 	return -1;
 }
 
 struct MountsPublicInterface* mount_interface(int handle){
-    if ( !VERIFY_HANDLE(handle, EHandleUsed) ) return NULL;
-    return s_handle_slots[handle].public_.mount_fs;
+    struct HandleItemInternal* item = descriptor_table_lookup(&s_handle_table, handle);
+    if ( item == NULL ) return NULL;
+    return item->public_.mount_fs;
 }
 
 static const struct HandleItem* entry(int handle){
-    if ( !VERIFY_HANDLE(handle, EHandleUsed) ) return NULL;
-    return &s_handle_slots[handle].public_;
+    struct HandleItemInternal* item = descriptor_table_lookup(&s_handle_table, handle);
+    if ( item == NULL ) return NULL;
+    return &item->public_;
 }
 
 static const struct OpenFileDescription* ofd(int handle){
-    if ( !VERIFY_HANDLE(handle, EHandleUsed) ) return NULL;
-    return get_open_files_pool()->ofd( s_handle_slots[handle].public_.open_file_description_id );
+    struct HandleItemInternal* item = descriptor_table_lookup(&s_handle_table, handle);
+    if ( item == NULL ) return NULL;
+    return get_open_files_pool()->ofd( item->public_.open_file_description_id );
 }
 
 
@@ -22,8 +22,9 @@
 #include <stdint.h>
 
 #include "open_file_description.h" //const struct OpenFileDescription
+#include "descriptor_table.h" //DESCRIPTOR_TABLE_MAX_ITEMS
 
-#define MAX_HANDLES_COUNT 1000
+#define MAX_HANDLES_COUNT DESCRIPTOR_TABLE_MAX_ITEMS
 
 #include "zrt_defines.h" //INSTANCE_L
 
@@ -34,16 +35,19 @@ struct MountsPublicInterface;
 
 struct HandleItem{
     ino_t inode;
+    void* node; /*lowlevel fs object held while file is opened*/
     int   open_file_description_id;
     struct MountsPublicInterface* mount_fs;
 };
 
 
-/*interface*/
+/*interface, all functions are thread safe*/
 struct HandleAllocator{
     /**/
-    int (*allocate_handle)(struct MountsPublicInterface* mount_fs, ino_t inode, int open_file_desc_id);
-    int (*allocate_handle2)(struct MountsPublicInterface* mount_fs, ino_t inode, int open_file_desc_id, int handle);
+    int (*allocate_handle)(struct MountsPublicInterface* mount_fs, ino_t inode, void* node,
+			   int open_file_desc_id);
+    int (*allocate_handle2)(struct MountsPublicInterface* mount_fs, ino_t inode, void* node,
+			    int open_file_desc_id, int handle);
     int (*free_handle)(int handle);
 
     /*Check if handle is related to the specified fs
@@ -0,0 +1,488 @@
+/*
+ *
+ * Copyright (c) 2014, LiteStack, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this_ file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+
+#include "zrtlog.h"
+#include "zrt_helper_macros.h"
+#include "mounts_interface.h"
+#include "handle_allocator.h" //struct HandleAllocator
+#include "hybrid_mounts.h"
+
+/*path_match results*/
+#define PATH_NOT_MATCHED 0
+#define PATH_IS_PREFIX   1
+#define PATH_UNDER_PREFIX 2
+
+struct HybridMounts{
+    struct MountsPublicInterface public_;
+    struct HandleAllocator* handle_allocator;
+    struct MountsPublicInterface* main_mounts;
+    struct MountsPublicInterface* scratch_mounts;
+    char *prefixes[HYBRID_MOUNTS_MAX_PREFIXES];
+    int   prefixes_count;
+};
+
+/*compare path with prefix, repeated slashes are allowed in path*/
+static int path_match(const char *prefix, const char *path){
+    while ( *prefix ){
+	if ( *prefix == '/' ){
+	    if ( *path != '/' )
+		return PATH_NOT_MATCHED;
+	    while ( *prefix == '/' ) ++prefix;
+	    while ( *path == '/' ) ++path;
+	}
+	else if ( *prefix++ != *path++ )
+	    return PATH_NOT_MATCHED;
+    }
+    if ( *path == '\0' )
+	return PATH_IS_PREFIX;
+    if ( *path != '/' )
+	return PATH_NOT_MATCHED;
+    while ( *path == '/' ) ++path;
+    return *path == '\0' ? PATH_IS_PREFIX : PATH_UNDER_PREFIX;
+}
+
+/*@param match returns how path matched scratch prefix, can be NULL*/
+static struct MountsPublicInterface* mounts_by_path(struct HybridMounts* this_,
+						    const char *path, int *match){
+    int i, ret;
+    if ( path != NULL ){
+	for ( i=0; i < this_->prefixes_count; i++ ){
+	    if ( (ret=path_match(this_->prefixes[i], path)) != PATH_NOT_MATCHED ){
+		if ( match ) *match = ret;
+		return this_->scratch_mounts;
+	    }
+	}
+    }
+    if ( match ) *match = PATH_NOT_MATCHED;
+    return this_->main_mounts;
+}
+
+#define MOUNTS_BY_PATH(this_, path)					\
+    mounts_by_path((struct HybridMounts*)this_, path, NULL)
+
+/*get mount that opened descriptor, set EBADF and return err_ret
+ *from calling function if descriptor is not opened*/
+#define MOUNTS_BY_FD_ENSURE_EXIST(this_, fd, mounts, err_ret)		\
+    mounts = ((struct HybridMounts*)this_)->handle_allocator->mount_interface(fd); \
+    if ( mounts == NULL ){						\
+	SET_ERRNO(EBADF);						\
+	return err_ret;							\
+    }
+
+/*wrapper implementation*/
+
+static ssize_t hybrid_readlink(struct MountsPublicInterface* this_,
+			       const char *path, char *buf, size_t bufsize){
+    struct MountsPublicInterface* mounts = MOUNTS_BY_PATH(this_, path);
+    return mounts->readlink(mounts, path, buf, bufsize);
+}
+
+static int hybrid_symlink(struct MountsPublicInterface* this_,
+			  const char *oldpath, const char *newpath){
+    /*link contents are not resolved here, only new name matters*/
+    struct MountsPublicInterface* mounts = MOUNTS_BY_PATH(this_, newpath);
+    return mounts->symlink(mounts, oldpath, newpath);
+}
+
+static int hybrid_chown(struct MountsPublicInterface* this_, const char* path,
+			uid_t owner, gid_t group){
+    struct MountsPublicInterface* mounts = MOUNTS_BY_PATH(this_, path);
+    return mounts->chown(mounts, path, owner, group);
+}
+
+static int hybrid_chmod(struct MountsPublicInterface* this_, const char* path, uint32_t mode){
+    struct MountsPublicInterface* mounts = MOUNTS_BY_PATH(this_, path);
+    return mounts->chmod(mounts, path, mode);
+}
+
+static int hybrid_statvfs(struct MountsPublicInterface* this_, const char* path,
+			  struct statvfs *buf){
+    struct MountsPublicInterface* mounts = MOUNTS_BY_PATH(this_, path);
+    return mounts->statvfs(mounts, path, buf);
+}
+
+static int hybrid_stat(struct MountsPublicInterface* this_, const char* path, struct stat *buf){
+    struct MountsPublicInterface* mounts = MOUNTS_BY_PATH(this_, path);
+    return mounts->stat(mounts, path, buf);
+}
+
+static int hybrid_mkdir(struct MountsPublicInterface* this_, const char* path, uint32_t mode){
+    struct MountsPublicInterface* mounts = MOUNTS_BY_PATH(this_, path);
+    return mounts->mkdir(mounts, path, mode);
+}
+
+static int hybrid_rmdir(struct MountsPublicInterface* this_, const char* path){
+    int match;
+    struct MountsPublicInterface* mounts =
+	mounts_by_path((struct HybridMounts*)this_, path, &match);
+    if ( match == PATH_IS_PREFIX ){
+	SET_ERRNO(EBUSY);
+	return -1;
+    }
+    return mounts->rmdir(mounts, path);
+}
+
+static int hybrid_create_batch(struct MountsPublicInterface* this_, const char* dirpath,
+			       const char **names, int count, uint32_t mode, int *errors){
+    struct MountsPublicInterface* mounts = MOUNTS_BY_PATH(this_, dirpath);
+    return mounts->create_batch(mounts, dirpath, names, count, mode, errors);
+}
+
+static int hybrid_unlink_batch(struct MountsPublicInterface* this_, const char* dirpath,
+			       const char **names, int count, int *errors){
+    struct MountsPublicInterface* mounts = MOUNTS_BY_PATH(this_, dirpath);
+    return mounts->unlink_batch(mounts, dirpath, names, count, errors);
+}
+
+static ssize_t hybrid_read(struct MountsPublicInterface* this_, int fd, void *buf, size_t nbyte){
+    struct MountsPublicInterface* mounts;
+    MOUNTS_BY_FD_ENSURE_EXIST(this_, fd, mounts, -1);
+    return mounts->read(mounts, fd, buf, nbyte);
+}
+
+static ssize_t hybrid_write(struct MountsPublicInterface* this_, int fd,
+			    const void *buf, size_t nbyte){
+    struct MountsPublicInterface* mounts;
+    MOUNTS_BY_FD_ENSURE_EXIST(this_, fd, mounts, -1);
+    return mounts->write(mounts, fd, buf, nbyte);
+}
+
+static ssize_t hybrid_pread(struct MountsPublicInterface* this_,
+			    int fd, void *buf, size_t nbyte, off_t offset){
+    struct MountsPublicInterface* mounts;
+    MOUNTS_BY_FD_ENSURE_EXIST(this_, fd, mounts, -1);
+    return mounts->pread(mounts, fd, buf, nbyte, offset);
+}
+
+static ssize_t hybrid_pwrite(struct MountsPublicInterface* this_,
+			     int fd, const void *buf, size_t nbyte, off_t offset){
+    struct MountsPublicInterface* mounts;
+    MOUNTS_BY_FD_ENSURE_EXIST(this_, fd, mounts, -1);
+    return mounts->pwrite(mounts, fd, buf, nbyte, offset);
+}
+
+static ssize_t hybrid_preadv(struct MountsPublicInterface* this_,
+			     int fd, const struct iovec *iov, int iovcnt, off_t offset){
+    struct MountsPublicInterface* mounts;
+    MOUNTS_BY_FD_ENSURE_EXIST(this_, fd, mounts, -1);
+    return mounts->preadv(mounts, fd, iov, iovcnt, offset);
+}
+
+static ssize_t hybrid_pwritev(struct MountsPublicInterface* this_,
+			      int fd, const struct iovec *iov, int iovcnt, off_t offset){
+    struct MountsPublicInterface* mounts;
+    MOUNTS_BY_FD_ENSURE_EXIST(this_, fd, mounts, -1);
+    return mounts->pwritev(mounts, fd, iov, iovcnt, offset);
+}
+
+static ssize_t hybrid_read_borrow(struct MountsPublicInterface* this_, int fd, size_t nbyte,
+				  off_t offset, struct iovec *iov, int *iovcnt, void **loan){
+    struct MountsPublicInterface* mounts;
+    MOUNTS_BY_FD_ENSURE_EXIST(this_, fd, mounts, -1);
+    return mounts->read_borrow(mounts, fd, nbyte, offset, iov, iovcnt, loan);
+}
+
+/*loans are made only by main mount, scratch mount has no loaning*/
+static void hybrid_read_return(struct MountsPublicInterface* this_, void *loan){
+    struct MountsPublicInterface* mounts = ((struct HybridMounts*)this_)->main_mounts;
+    mounts->read_return(mounts, loan);
+}
+
+static ssize_t hybrid_write_loan(struct MountsPublicInterface* this_, int fd, size_t nbyte,
+				 off_t offset, struct iovec *iov, int *iovcnt, void **loan){
+    struct MountsPublicInterface* mounts;
+    MOUNTS_BY_FD_ENSURE_EXIST(this_, fd, mounts, -1);
+    return mounts->write_loan(mounts, fd, nbyte, offset, iov, iovcnt, loan);
+}
+
+static ssize_t hybrid_write_commit(struct MountsPublicInterface* this_, void *loan, size_t nbyte){
+    struct MountsPublicInterface* mounts = ((struct HybridMounts*)this_)->main_mounts;
+    return mounts->write_commit(mounts, loan, nbyte);
+}
+
+static void hybrid_write_abort(struct MountsPublicInterface* this_, void *loan){
+    struct MountsPublicInterface* mounts = ((struct HybridMounts*)this_)->main_mounts;
+    mounts->write_abort(mounts, loan);
+}
+
+static int hybrid_fchown(struct MountsPublicInterface* this_, int fd, uid_t owner, gid_t group){
+    struct MountsPublicInterface* mounts;
+    MOUNTS_BY_FD_ENSURE_EXIST(this_, fd, mounts, -1);
+    return mounts->fchown(mounts, fd, owner, group);
+}
+
+static int hybrid_fchmod(struct MountsPublicInterface* this_, int fd, uint32_t mode){
+    struct MountsPublicInterface* mounts;
+    MOUNTS_BY_FD_ENSURE_EXIST(this_, fd, mounts, -1);
+    return mounts->fchmod(mounts, fd, mode);
+}
+
+static int hybrid_fstat(struct MountsPublicInterface* this_, int fd, struct stat *buf){
+    struct MountsPublicInterface* mounts;
+    MOUNTS_BY_FD_ENSURE_EXIST(this_, fd, mounts, -1);
+    return mounts->fstat(mounts, fd, buf);
+}
+
+static int hybrid_getdents(struct MountsPublicInterface* this_, int fd, void *buf,
+			   unsigned int count){
+    struct MountsPublicInterface* mounts;
+    MOUNTS_BY_FD_ENSURE_EXIST(this_, fd, mounts, -1);
+    return mounts->getdents(mounts, fd, buf, count);
+}
+
+static int hybrid_getdents_plus(struct MountsPublicInterface* this_, int fd, void *buf,
+				unsigned int count, struct stat *stats, int stats_count){
+    struct MountsPublicInterface* mounts;
+    MOUNTS_BY_FD_ENSURE_EXIST(this_, fd, mounts, -1);
+    return mounts->getdents_plus(mounts, fd, buf, count, stats, stats_count);
+}
+
+static int hybrid_fsync(struct MountsPublicInterface* this_, int fd){
+    struct MountsPublicInterface* mounts;
+    MOUNTS_BY_FD_ENSURE_EXIST(this_, fd, mounts, -1);
+    return mounts->fsync(mounts, fd);
+}
+
+static int hybrid_fdatasync(struct MountsPublicInterface* this_, int fd){
+    struct MountsPublicInterface* mounts;
+    MOUNTS_BY_FD_ENSURE_EXIST(this_, fd, mounts, -1);
+    return mounts->fdatasync(mounts, fd);
+}
+
+static int hybrid_close(struct MountsPublicInterface* this_, int fd){
+    struct MountsPublicInterface* mounts;
+    MOUNTS_BY_FD_ENSURE_EXIST(this_, fd, mounts, -1);
+    return mounts->close(mounts, fd);
+}
+
+static off_t hybrid_lseek(struct MountsPublicInterface* this_, int fd, off_t offset, int whence){
+    struct MountsPublicInterface* mounts;
+    MOUNTS_BY_FD_ENSURE_EXIST(this_, fd, mounts, -1);
+    return mounts->lseek(mounts, fd, offset, whence);
+}
+
+static int hybrid_open(struct MountsPublicInterface* this_, const char* path, int oflag,
+		       uint32_t mode){
+    struct MountsPublicInterface* mounts = MOUNTS_BY_PATH(this_, path);
+    return mounts->open(mounts, path, oflag, mode);
+}
+
+static int hybrid_fcntl(struct MountsPublicInterface* this_, int fd, int cmd, ...){
+    /*not supported by mounts, so there is nothing to route*/
+    SET_ERRNO(ENOSYS);
+    return -1;
+}
+
+static int hybrid_remove(struct MountsPublicInterface* this_, const char* path){
+    int match;
+    struct MountsPublicInterface* mounts =
+	mounts_by_path((struct HybridMounts*)this_, path, &match);
+    if ( match == PATH_IS_PREFIX ){
+	SET_ERRNO(EBUSY);
+	return -1;
+    }
+    return mounts->remove(mounts, path);
+}
+
+static int hybrid_unlink(struct MountsPublicInterface* this_, const char* path){
+    int match;
+    struct MountsPublicInterface* mounts =
+	mounts_by_path((struct HybridMounts*)this_, path, &match);
+    if ( match == PATH_IS_PREFIX ){
+	SET_ERRNO(EBUSY);
+	return -1;
+    }
+    return mounts->unlink(mounts, path);
+}
+
+/*get mount serving both paths, set errno and return NULL if paths are
+ *on different mounts or one of them is prefix*/
+static struct MountsPublicInterface* mounts_by_paths(struct HybridMounts* this_,
+						     const char *oldpath,
+						     const char *newpath){
+    int old_match, new_match;
+    struct MountsPublicInterface* mounts = mounts_by_path(this_, oldpath, &old_match);
+    if ( mounts != mounts_by_path(this_, newpath, &new_match) ){
+	SET_ERRNO(EXDEV);
+	return NULL;
+    }
+    if ( old_match == PATH_IS_PREFIX || new_match == PATH_IS_PREFIX ){
+	SET_ERRNO(EBUSY);
+	return NULL;
+    }
+    return mounts;
+}
+
+#ifndef __native_client__
+static int hybrid_rename(struct MountsPublicInterface* this_, const char *oldpath,
+			 const char *newpath){
+    struct MountsPublicInterface* mounts =
+	mounts_by_paths((struct HybridMounts*)this_, oldpath, newpath);
+    if ( mounts == NULL )
+	return -1;
+    return mounts->rename(mounts, oldpath, newpath);
+}
+#endif //__native_client__
+
+static int hybrid_access(struct MountsPublicInterface* this_, const char* path, int amode){
+    struct MountsPublicInterface* mounts = MOUNTS_BY_PATH(this_, path);
+    return mounts->access(mounts, path, amode);
+}
+
+static int hybrid_ftruncate_size(struct MountsPublicInterface* this_, int fd, off_t length){
+    struct MountsPublicInterface* mounts;
+    MOUNTS_BY_FD_ENSURE_EXIST(this_, fd, mounts, -1);
+    return mounts->ftruncate_size(mounts, fd, length);
+}
+
+static int hybrid_truncate_size(struct MountsPublicInterface* this_, const char* path,
+				off_t length){
+    struct MountsPublicInterface* mounts = MOUNTS_BY_PATH(this_, path);
+    return mounts->truncate_size(mounts, path, length);
+}
+
+static int hybrid_fallocate(struct MountsPublicInterface* this_, int fd, int mode,
+			    off_t offset, off_t length){
+    struct MountsPublicInterface* mounts;
+    MOUNTS_BY_FD_ENSURE_EXIST(this_, fd, mounts, -1);
+    return mounts->fallocate(mounts, fd, mode, offset, length);
+}
+
+static ssize_t hybrid_copy_range(struct MountsPublicInterface* this_, int fd_in,
+				 off_t offset_in, int fd_out, off_t offset_out, size_t size){
+    struct MountsPublicInterface* mounts;
+    struct MountsPublicInterface* out_mounts;
+    MOUNTS_BY_FD_ENSURE_EXIST(this_, fd_in, mounts, -1);
+    MOUNTS_BY_FD_ENSURE_EXIST(this_, fd_out, out_mounts, -1);
+    if ( mounts != out_mounts ){
+	SET_ERRNO(EXDEV);
+	return -1;
+    }
+    return mounts->copy_range(mounts, fd_in, offset_in, fd_out, offset_out, size);
+}
+
+static int hybrid_isatty(struct MountsPublicInterface* this_, int fd){
+    struct MountsPublicInterface* mounts;
+    MOUNTS_BY_FD_ENSURE_EXIST(this_, fd, mounts, -1);
+    return mounts->isatty(mounts, fd);
+}
+
+static int hybrid_dup(struct MountsPublicInterface* this_, int oldfd){
+    struct MountsPublicInterface* mounts;
+    MOUNTS_BY_FD_ENSURE_EXIST(this_, oldfd, mounts, -1);
+    return mounts->dup(mounts, oldfd);
+}
+
+static int hybrid_dup2(struct MountsPublicInterface* this_, int oldfd, int newfd){
+    struct MountsPublicInterface* mounts;
+    MOUNTS_BY_FD_ENSURE_EXIST(this_, oldfd, mounts, -1);
+    return mounts->dup2(mounts, oldfd, newfd);
+}
+
+static int hybrid_link(struct MountsPublicInterface* this_, const char *oldpath,
+		       const char *newpath){
+    struct MountsPublicInterface* mounts =
+	mounts_by_paths((struct HybridMounts*)this_, oldpath, newpath);
+    if ( mounts == NULL )
+	return -1;
+    return mounts->link(mounts, oldpath, newpath);
+}
+
+static struct MountsPublicInterface s_hybrid_mounts_interface = {
+    hybrid_readlink,
+    hybrid_symlink,
+    hybrid_chown,
+    hybrid_chmod,
+    hybrid_statvfs,
+    hybrid_stat,
+    hybrid_mkdir,
+    hybrid_rmdir,
+    hybrid_create_batch,
+    hybrid_unlink_batch,
+    hybrid_read,
+    hybrid_write,
+    hybrid_pread,
+    hybrid_pwrite,
+    hybrid_preadv,
+    hybrid_pwritev,
+    hybrid_read_borrow,
+    hybrid_read_return,
+    hybrid_write_loan,
+    hybrid_write_commit,
+    hybrid_write_abort,
+    hybrid_fchown,
+    hybrid_fchmod,
+    hybrid_fstat,
+    hybrid_getdents,
+    hybrid_getdents_plus,
+    hybrid_fsync,
+    hybrid_fdatasync,
+    hybrid_close,
+    hybrid_lseek,
+    hybrid_open,
+    hybrid_fcntl,
+    hybrid_remove,
+    hybrid_unlink,
+#ifndef __native_client__
+    hybrid_rename,
+#endif //__native_client__
+    hybrid_access,
+    hybrid_ftruncate_size,
+    hybrid_truncate_size,
+    hybrid_fallocate,
+    hybrid_copy_range,
+    hybrid_isatty,
+    hybrid_dup,
+    hybrid_dup2,
+    hybrid_link,
+    EMemMountId
+};
+
+struct MountsPublicInterface*
+CONSTRUCT_L(HYBRID_MOUNTS)( struct HandleAllocator* handle_allocator,
+			    struct MountsPublicInterface* main_mounts,
+			    struct MountsPublicInterface* scratch_mounts,
+			    const char **prefixes, int count ){
+    struct HybridMounts* this_ = calloc(1, sizeof(struct HybridMounts));
+    size_t len;
+    int i;
+    assert(this_ != NULL);
+    assert(count <= HYBRID_MOUNTS_MAX_PREFIXES);
+    this_->public_ = s_hybrid_mounts_interface;
+    this_->handle_allocator = handle_allocator;
+    this_->main_mounts = main_mounts;
+    this_->scratch_mounts = scratch_mounts;
+    for ( i=0; i < count; i++ ){
+	/*root can't be scratch prefix*/
+	assert(prefixes[i][0] == '/' && prefixes[i][strspn(prefixes[i], "/")] != '\0');
+	this_->prefixes[i] = strdup(prefixes[i]);
+	/*trailing slashes would require them in paths*/
+	len = strlen(this_->prefixes[i]);
+	while ( this_->prefixes[i][len-1] == '/' )
+	    this_->prefixes[i][--len] = '\0';
+    }
+    this_->prefixes_count = count;
+    return &this_->public_;
+}
@@ -0,0 +1,44 @@
+/*
+ *
+ * Copyright (c) 2014, LiteStack, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this_ file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __HYBRID_MOUNTS_H__
+#define __HYBRID_MOUNTS_H__
+
+#include "mounts_interface.h" //struct MountsPublicInterface
+
+#include "zrt_defines.h" //CONSTRUCT_L
+
+/*name of constructor*/
+#define HYBRID_MOUNTS hybrid_mounts_construct
+
+#define HYBRID_MOUNTS_MAX_PREFIXES 8
+
+struct HandleAllocator;
+
+/*Mounts routing paths residing under one of scratch prefixes (and
+ *prefixes itself) into scratch mount, and all other paths into main
+ *mount. Operations on descriptors are routed into mount that opened
+ *descriptor. Rename and link between mounts fail with EXDEV, prefix
+ *directories can't be removed or renamed.
+ *@param prefixes absolute paths, copied by constructor*/
+struct MountsPublicInterface*
+hybrid_mounts_construct( struct HandleAllocator* handle_allocator,
+			 struct MountsPublicInterface* main_mounts,
+			 struct MountsPublicInterface* scratch_mounts,
+			 const char **prefixes, int count );
+
+#endif //__HYBRID_MOUNTS_H__
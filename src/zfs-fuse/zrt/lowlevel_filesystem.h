@@ -25,10 +25,38 @@
 
 struct stat;
 struct statvfs;
+struct iovec;
 
+/*fallocate modes and lseek whence values as in linux, for the case
+ *headers of host doesn't provide them*/
+#ifndef FALLOC_FL_KEEP_SIZE
+#define FALLOC_FL_KEEP_SIZE  0x01
+#endif
+#ifndef FALLOC_FL_PUNCH_HOLE
+#define FALLOC_FL_PUNCH_HOLE 0x02
+#endif
+#ifndef SEEK_DATA
+#define SEEK_DATA 3
+#endif
+#ifndef SEEK_HOLE
+#define SEEK_HOLE 4
+#endif
+
+/*Functions that accepts 'node' argument are working with opaque lowlevel
+ *object that was obtained by open and stays held until close, so it's
+ *no need to locate object by inode for every call.*/
 struct LowLevelFilesystemPublicInterface{
     int (*lookup)(struct LowLevelFilesystemPublicInterface* this_,
 		  int parent_inode, const char *name);
+    /*resolve relative path by single walk from directory dir_inode,
+     *every directory is held until its entry is looked up
+     *@param inodes returns inode of every path component; if walk stops
+     *at component, its item is -errcode
+     *@param count components count in path, size of inodes array
+     *@return count of resolved components, or -errcode if dir_inode
+     *can't be got*/
+    int (*lookup_path)(struct LowLevelFilesystemPublicInterface* this_,
+		       int dir_inode, const char *path, int *inodes, int count);
     ssize_t (*readlink)(struct LowLevelFilesystemPublicInterface* this_,
 			ino_t inode, char *buf, size_t bufsize);
     int (*symlink)(struct LowLevelFilesystemPublicInterface* this_, 
@@ -47,18 +75,78 @@ struct LowLevelFilesystemPublicInterface{
 		 ino_t parent_inode, const char* name, uint32_t mode);
     int (*rmdir)(struct LowLevelFilesystemPublicInterface* this_, 
 		 ino_t parent_inode, const char* name);
+    /*create regular files / remove names in one directory, groups of
+     *names are done by single transaction
+     *@param errors returns 0 or errno of every name
+     *@return count of names created / removed, or -errcode if
+     *directory is not usable*/
+    int (*create_batch)(struct LowLevelFilesystemPublicInterface* this_, 
+			ino_t parent_inode, const char **names, int count, 
+			uint32_t mode, int *errors);
+    int (*unlink_batch)(struct LowLevelFilesystemPublicInterface* this_, 
+			ino_t parent_inode, const char **names, int count, 
+			int *errors);
     ssize_t (*pread)(struct LowLevelFilesystemPublicInterface* this_,
-		     ino_t inode, void *buf, size_t nbyte, off_t offset);
+		     void *node, void *buf, size_t nbyte, off_t offset);
     ssize_t (*pwrite)(struct LowLevelFilesystemPublicInterface* this_,
-		      ino_t inode, const void *buf, size_t nbyte, off_t offset);
+		      void *node, const void *buf, size_t nbyte, off_t offset);
+    /*scatter/gather versions of pread, pwrite done by single file
+     *operation; iov array is not modified*/
+    ssize_t (*preadv)(struct LowLevelFilesystemPublicInterface* this_,
+		      void *node, const struct iovec *iov, int iovcnt, off_t offset);
+    ssize_t (*pwritev)(struct LowLevelFilesystemPublicInterface* this_,
+		       void *node, const struct iovec *iov, int iovcnt, off_t offset);
+    /*read without copying: iov items are pointed directly to cache
+     *buffers, which are held and can't be changed until read_return
+     *@param iovcnt in: iov array size, out: used items count
+     *@param loan returns value for read_return, NULL if nothing lent
+     *@return bytes count, it's less than nbyte at eof or if iov array is
+     *too short for whole range, or -errcode*/
+    ssize_t (*read_borrow)(struct LowLevelFilesystemPublicInterface* this_,
+			   void *node, size_t nbyte, off_t offset,
+			   struct iovec *iov, int *iovcnt, void **loan);
+    /*release buffers lent by read_borrow*/
+    void (*read_return)(struct LowLevelFilesystemPublicInterface* this_, void *loan);
+    /*write without copying: iov items are pointed to buffers that
+     *caller fills and passes to write_commit; whole records of range
+     *are cache buffers which become file data without copy
+     *@param iovcnt in: iov array size, out: used items count
+     *@param loan returns value for write_commit or write_abort
+     *@return bytes count, it's less than nbyte if iov array is too
+     *short for whole range, or -errcode*/
+    ssize_t (*write_loan)(struct LowLevelFilesystemPublicInterface* this_,
+			  void *node, size_t nbyte, off_t offset,
+			  struct iovec *iov, int *iovcnt, void **loan);
+    /*write first nbyte bytes of buffers lent by write_loan and release them
+     *@return written bytes count, or -errcode*/
+    ssize_t (*write_commit)(struct LowLevelFilesystemPublicInterface* this_,
+			    void *loan, size_t nbyte);
+    /*release buffers lent by write_loan without writing*/
+    void (*write_abort)(struct LowLevelFilesystemPublicInterface* this_, void *loan);
+    /*@param cookie in: position to read from, 0 for directory beginning;
+     *out: position of next entry, it's opaque value good for seekdir
+     *@return bytes count, 0 if no more entries, or -errcode*/
     int (*getdents)(struct LowLevelFilesystemPublicInterface* this_, 
-		    ino_t inode, void *buf, unsigned int count, off_t offset,
-		    int *lastcall_workaround);
+		    void *node, void *buf, unsigned int count, off_t *cookie);
+    /*same as getdents, but also returns attributes of every entry taken
+     *while directory is held, so caller needn't to lookup entries by name
+     *@param stats array of stats_count items, i-th item is filled for
+     *i-th returned entry, and st_ino of it is 0 if attributes are not
+     *available; returned entries count is limited by stats_count*/
+    int (*getdents_plus)(struct LowLevelFilesystemPublicInterface* this_, 
+			 void *node, void *buf, unsigned int count, off_t *cookie,
+			 struct stat *stats, int stats_count);
+    /*flush file data, and also metadata if datasync is 0, to stable
+     *storage; concurrent calls can be served by single log write*/
     int (*fsync)(struct LowLevelFilesystemPublicInterface* this_, 
-		 ino_t inode);
-    int (*close)(struct LowLevelFilesystemPublicInterface* this_, ino_t inode, int flags);
+		 void *node, int datasync);
+    /*release node obtained by open*/
+    int (*close)(struct LowLevelFilesystemPublicInterface* this_, void *node, int flags);
+    /*@param node returns held node of opened file, it's valid until close
+     *@return inode if file created, 0 if opened, or -errcode*/
     int (*open)(struct LowLevelFilesystemPublicInterface* this_, 
-		ino_t parent_inode, const char* name, int oflag, uint32_t mode);
+		ino_t parent_inode, const char* name, int oflag, uint32_t mode,
+		void **node);
     //int (*opendir)(struct LowLevelFilesystemPublicInterface* this_, ino_t inode);
     int (*unlink)(struct LowLevelFilesystemPublicInterface* this_, 
 		  ino_t parent_inode, const char* name);
@@ -69,8 +157,28 @@ struct LowLevelFilesystemPublicInterface{
 		      ino_t parent, const char *name,
 		      ino_t new_parent, const char *newname);
 #endif //__native_client__
+    /*node can be NULL, in this case file located by inode*/
     int (*ftruncate_size)(struct LowLevelFilesystemPublicInterface* this_, 
-			  ino_t inode, off_t length);
+			  ino_t inode, void *node, off_t length);
+    /*mode 0 extends file up to offset+length, file space is not
+     *reserved because of copy-on-write; FALLOC_FL_KEEP_SIZE alone does
+     *nothing; FALLOC_FL_PUNCH_HOLE|FALLOC_FL_KEEP_SIZE frees range, it
+     *reads as zeros then
+     *@return 0 if ok, -errcode*/
+    int (*fallocate)(struct LowLevelFilesystemPublicInterface* this_, 
+		     void *node, int mode, off_t offset, off_t length);
+    /*locate start of data or hole at or after offset, whence is
+     *SEEK_DATA or SEEK_HOLE; end of file is hole
+     *@return found offset, -ENXIO if offset is not less than file size,
+     *or -errcode*/
+    off_t (*seek_data)(struct LowLevelFilesystemPublicInterface* this_, 
+		       void *node, off_t offset, int whence);
+    /*copy data between files inside of filesystem, ranges of the same
+     *file can't overlap; copying stops at end of source file
+     *@return copied bytes, or -errcode if nothing copied*/
+    ssize_t (*copy_range)(struct LowLevelFilesystemPublicInterface* this_, 
+			  void *src_node, off_t src_offset,
+			  void *dst_node, off_t dst_offset, size_t size);
     struct DirentEnginePublicInterface* dirent_engine;
 };
 
@@ -0,0 +1,1218 @@
+/*
+ *
+ * Copyright (c) 2014, LiteStack, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <sys/uio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h> //NAME_MAX
+#include <time.h>
+#include <unistd.h>
+#include <assert.h>
+#include <pthread.h>
+
+#include "zrtlog.h"
+#include "zrt_helper_macros.h" //MIN, MAX
+#include "lowlevel_filesystem.h"
+#include "dirent_engine.h"
+#include "mem_filesystem.h"
+
+
+#define MEM_ROOT_INODE       3    /*cached lookup expects root inode 3*/
+#define MEM_DIRENT_HASH_SIZE 4096 /*must be power of 2*/
+#define MEM_MIN_CAPACITY     4096
+#define MEM_COPY_CHUNK       (1<<20) /*buffer of copy_range for spilled files*/
+#define MEM_DEV              0x6d656d
+#define MEM_SPILL_ROOT_INODE 3
+
+/*directory entry, entries are hashed by parent inode and name, and also
+ *linked into list of directory in order of creation*/
+struct MemDirent{
+    ino_t    parent;
+    ino_t    inode;
+    uint64_t id;    /*directory position, getdents cookie is id+2*/
+    uint32_t hash;
+    struct MemDirent* hash_next;
+    struct MemDirent* dir_prev;
+    struct MemDirent* dir_next;
+    char     name[];
+};
+
+struct MemInode{
+    ino_t    inode;
+    mode_t   mode;
+    uid_t    uid;
+    gid_t    gid;
+    nlink_t  nlink;
+    int      open_count;
+    off_t    size;       /*for spilled file real size is in spill fs*/
+    char    *data;       /*file data or symlink target*/
+    size_t   capacity;   /*allocated data bytes, data beyond it is zero*/
+    void    *spill_node; /*held node of spilled file, NULL if data in memory*/
+    int      spill_inode;
+    /*directory only*/
+    ino_t    parent;
+    uint64_t next_id;
+    int      entries;
+    struct MemDirent* first;
+    struct MemDirent* last;
+    struct timespec atime, mtime, ctime;
+};
+
+struct MemFilesystem{
+    struct LowLevelFilesystemPublicInterface public_;
+    struct LowLevelFilesystemPublicInterface* spillfs;
+    struct MemInode** inodes;     /*indexed by inode*/
+    ino_t*   free_inodes;         /*stack of released inode numbers*/
+    int      free_count;
+    ino_t    inodes_count;        /*size of inodes array*/
+    ino_t    next_inode;          /*lowest never used inode*/
+    struct MemDirent* hash_table[MEM_DIRENT_HASH_SIZE];
+    int      spill_dir;           /*inode of spill directory, 0 if not created*/
+    uint64_t spill_seq;
+    struct MemFilesystemStats stats;
+    /*serializes all operations, i/o of spilled files is done
+      without it*/
+    pthread_mutex_t mutex;
+};
+
+
+static void mem_time_now(struct timespec *ts){
+    clock_gettime(CLOCK_REALTIME, ts);
+}
+
+static void mem_touch(struct MemInode* in){
+    mem_time_now(&in->mtime);
+    in->ctime = in->mtime;
+}
+
+static uint32_t mem_dirent_hash(ino_t parent, const char *name){
+    /*FNV-1a over name, seeded by parent inode*/
+    uint32_t hash = 2166136261u ^ (uint32_t)parent;
+    hash *= 16777619u;
+    while( *name ){
+	hash ^= (unsigned char)*name++;
+	hash *= 16777619u;
+    }
+    return hash;
+}
+
+/*functions below must be called with mutex held*/
+
+static struct MemInode* mem_inode(struct MemFilesystem* this_, ino_t inode){
+    if ( inode >= this_->inodes_count )
+	return NULL;
+    return this_->inodes[inode];
+}
+
+static struct MemInode* mem_inode_alloc(struct MemFilesystem* this_, mode_t mode){
+    struct MemInode* in;
+    ino_t inode;
+
+    if ( this_->free_count == 0 && this_->next_inode == this_->inodes_count ){
+	ino_t count = this_->inodes_count*2;
+	struct MemInode** inodes = realloc(this_->inodes, count*sizeof(struct MemInode*));
+	if ( inodes == NULL )
+	    return NULL;
+	this_->inodes = inodes;
+	ino_t* free_inodes = realloc(this_->free_inodes, count*sizeof(ino_t));
+	if ( free_inodes == NULL )
+	    return NULL;
+	this_->free_inodes = free_inodes;
+	memset(inodes+this_->inodes_count, 0,
+	       (count-this_->inodes_count)*sizeof(struct MemInode*));
+	this_->inodes_count = count;
+    }
+    if ( (in = calloc(1, sizeof(struct MemInode))) == NULL )
+	return NULL;
+    if ( this_->free_count > 0 )
+	inode = this_->free_inodes[--this_->free_count];
+    else
+	inode = this_->next_inode++;
+
+    in->inode = inode;
+    in->mode = mode;
+    in->nlink = S_ISDIR(mode) ? 2 : 1;
+    in->parent = inode;
+    mem_time_now(&in->atime);
+    in->mtime = in->ctime = in->atime;
+    this_->inodes[inode] = in;
+    return in;
+}
+
+/*free inode if it has no links and it's not opened*/
+static void mem_inode_put(struct MemFilesystem* this_, struct MemInode* in){
+    if ( in->nlink > 0 || in->open_count > 0 )
+	return;
+    if ( in->spill_node != NULL )
+	this_->spillfs->close(this_->spillfs, in->spill_node, O_RDWR);
+    this_->stats.mem_used -= in->capacity;
+    free(in->data);
+    this_->inodes[in->inode] = NULL;
+    this_->free_inodes[this_->free_count++] = in->inode;
+    free(in);
+}
+
+static struct MemDirent** mem_dirent_locate(struct MemFilesystem* this_,
+					    ino_t parent, const char *name){
+    uint32_t hash = mem_dirent_hash(parent, name);
+    struct MemDirent** itemp = &this_->hash_table[hash & (MEM_DIRENT_HASH_SIZE-1)];
+    for ( ; *itemp != NULL; itemp = &(*itemp)->hash_next ){
+	if ( (*itemp)->hash == hash && (*itemp)->parent == parent &&
+	     !strcmp((*itemp)->name, name) )
+	    break;
+    }
+    return itemp;
+}
+
+static struct MemDirent* mem_dirent_new(const char *name){
+    size_t len = strlen(name);
+    struct MemDirent* de = malloc(sizeof(struct MemDirent)+len+1);
+    if ( de != NULL )
+	memcpy(de->name, name, len+1);
+    return de;
+}
+
+/*link allocated entry into directory, name must not exist*/
+static void mem_dirent_link(struct MemFilesystem* this_, struct MemInode* dir,
+			    struct MemDirent* de, ino_t inode){
+    de->parent = dir->inode;
+    de->inode = inode;
+    de->id = dir->next_id++;
+    de->hash = mem_dirent_hash(dir->inode, de->name);
+    struct MemDirent** bucket = &this_->hash_table[de->hash & (MEM_DIRENT_HASH_SIZE-1)];
+    de->hash_next = *bucket;
+    *bucket = de;
+    de->dir_next = NULL;
+    de->dir_prev = dir->last;
+    if ( dir->last ) dir->last->dir_next = de;
+    else dir->first = de;
+    dir->last = de;
+    ++dir->entries;
+    mem_touch(dir);
+}
+
+/*unlink entry pointed by itemp from hash chain and directory, free it*/
+static void mem_dirent_remove(struct MemFilesystem* this_, struct MemInode* dir,
+			      struct MemDirent** itemp){
+    struct MemDirent* de = *itemp;
+    *itemp = de->hash_next;
+    if ( de->dir_prev ) de->dir_prev->dir_next = de->dir_next;
+    else dir->first = de->dir_next;
+    if ( de->dir_next ) de->dir_next->dir_prev = de->dir_prev;
+    else dir->last = de->dir_prev;
+    --dir->entries;
+    mem_touch(dir);
+    free(de);
+}
+
+/*@return directory, or NULL and errcode*/
+static struct MemInode* mem_dir(struct MemFilesystem* this_, ino_t inode, int *error){
+    struct MemInode* dir = mem_inode(this_, inode);
+    if ( dir == NULL )
+	*error = -ENOENT;
+    else if ( !S_ISDIR(dir->mode) ){
+	*error = -ENOTDIR;
+	dir = NULL;
+    }
+    return dir;
+}
+
+static int mem_check_name(const char *name){
+    if ( strlen(name) > NAME_MAX )
+	return -ENAMETOOLONG;
+    if ( name[0] == '\0' || strchr(name, '/') != NULL )
+	return -EINVAL;
+    return 0;
+}
+
+static int mem_is_dot(const char *name){
+    return !strcmp(name, ".") || !strcmp(name, "..");
+}
+
+static int mem_lookup_locked(struct MemFilesystem* this_, ino_t parent_inode,
+			     const char *name){
+    struct MemDirent* de;
+    int ret = 0;
+    struct MemInode* dir = mem_dir(this_, parent_inode, &ret);
+    if ( dir == NULL )
+	return ret;
+    if ( strlen(name) > NAME_MAX )
+	return -ENAMETOOLONG;
+    if ( !strcmp(name, ".") )
+	return dir->inode;
+    if ( !strcmp(name, "..") )
+	return dir->parent;
+    de = *mem_dirent_locate(this_, dir->inode, name);
+    return de != NULL ? (int)de->inode : -ENOENT;
+}
+
+/*create inode and its entry in directory
+ *@param created returns new inode
+ *@return 0 if ok, -errcode*/
+static int mem_create_locked(struct MemFilesystem* this_, ino_t parent_inode,
+			     const char *name, mode_t mode, struct MemInode** created){
+    struct MemInode* in;
+    struct MemDirent* de;
+    int ret = 0;
+    struct MemInode* dir = mem_dir(this_, parent_inode, &ret);
+    if ( dir == NULL )
+	return ret;
+    if ( (ret=mem_check_name(name)) != 0 )
+	return ret;
+    if ( mem_is_dot(name) || *mem_dirent_locate(this_, dir->inode, name) != NULL )
+	return -EEXIST;
+    if ( (de = mem_dirent_new(name)) == NULL )
+	return -ENOMEM;
+    if ( (in = mem_inode_alloc(this_, mode)) == NULL ){
+	free(de);
+	return -ENOMEM;
+    }
+    mem_dirent_link(this_, dir, de, in->inode);
+    if ( S_ISDIR(mode) ){
+	in->parent = dir->inode;
+	++dir->nlink;
+    }
+    *created = in;
+    return 0;
+}
+
+static int mem_unlink_locked(struct MemFilesystem* this_, ino_t parent_inode,
+			     const char *name){
+    struct MemDirent** itemp;
+    struct MemInode* in;
+    int ret = 0;
+    struct MemInode* dir = mem_dir(this_, parent_inode, &ret);
+    if ( dir == NULL )
+	return ret;
+    if ( mem_is_dot(name) )
+	return -EISDIR;
+    itemp = mem_dirent_locate(this_, dir->inode, name);
+    if ( *itemp == NULL )
+	return -ENOENT;
+    in = mem_inode(this_, (*itemp)->inode);
+    if ( S_ISDIR(in->mode) )
+	return -EISDIR;
+    mem_dirent_remove(this_, dir, itemp);
+    --in->nlink;
+    mem_time_now(&in->ctime);
+    mem_inode_put(this_, in);
+    return 0;
+}
+
+/*make room for length bytes of in-memory data
+ *@return 0 if ok, -ENOSPC if data doesn't fit into memory limit*/
+static int mem_reserve(struct MemFilesystem* this_, struct MemInode* in, off_t length){
+    uint64_t others = this_->stats.mem_used - in->capacity;
+    size_t capacity;
+    char *data;
+
+    if ( length <= (off_t)in->capacity )
+	return 0;
+    if ( (uint64_t)length > this_->stats.mem_limit - others ||
+	 others > this_->stats.mem_limit )
+	return -ENOSPC;
+    capacity = in->capacity ? in->capacity : MEM_MIN_CAPACITY;
+    while ( capacity < (size_t)length )
+	capacity *= 2;
+    /*exact size if doubled capacity doesn't fit*/
+    if ( capacity > this_->stats.mem_limit - others )
+	capacity = length;
+    /*file that can't grow in memory is spilled*/
+    if ( (data = realloc(in->data, capacity)) == NULL )
+	return -ENOSPC;
+    memset(data+in->capacity, 0, capacity-in->capacity);
+    this_->stats.mem_used += capacity - in->capacity;
+    in->data = data;
+    in->capacity = capacity;
+    return 0;
+}
+
+/*move in-memory data of file into new unlinked file of spill fs, and
+ *free memory. Spill fs i/o is done with mutex held, it's rare*/
+static int mem_spill(struct MemFilesystem* this_, struct MemInode* in){
+    struct LowLevelFilesystemPublicInterface* spillfs = this_->spillfs;
+    char name[48];
+    void *node = NULL;
+    size_t copy = in->size < (off_t)in->capacity ? in->size : in->capacity;
+    int inode, ret;
+
+    if ( this_->spill_dir == 0 ){
+	ret = spillfs->mkdir(spillfs, MEM_SPILL_ROOT_INODE, MEM_SPILL_DIR, 0700);
+	if ( ret < 0 && ret != -EEXIST )
+	    return ret;
+	if ( (ret=spillfs->lookup(spillfs, MEM_SPILL_ROOT_INODE, MEM_SPILL_DIR)) < 0 )
+	    return ret;
+	this_->spill_dir = ret;
+    }
+    snprintf(name, sizeof(name), "%d.%d.%llu", (int)getpid(), (int)in->inode,
+	     (unsigned long long)++this_->spill_seq);
+    inode = spillfs->open(spillfs, this_->spill_dir, name, O_CREAT|O_EXCL|O_RDWR,
+			  0600, &node);
+    if ( inode < 0 )
+	return inode;
+    spillfs->unlink(spillfs, this_->spill_dir, name);
+
+    ret = 0;
+    if ( copy > 0 && (ret=spillfs->pwrite(spillfs, node, in->data, copy, 0)) >= 0 )
+	ret = ret == copy ? 0 : -EIO;
+    if ( ret == 0 && in->size > (off_t)copy )
+	ret = spillfs->ftruncate_size(spillfs, inode, node, in->size);
+    if ( ret < 0 ){
+	spillfs->close(spillfs, node, O_RDWR);
+	return ret;
+    }
+
+    this_->stats.mem_used -= in->capacity;
+    this_->stats.spilled_bytes += copy;
+    ++this_->stats.spilled_files;
+    free(in->data);
+    in->data = NULL;
+    in->capacity = 0;
+    in->spill_node = node;
+    in->spill_inode = inode;
+    return 0;
+}
+
+static int mem_truncate_locked(struct MemFilesystem* this_, struct MemInode* in,
+			       off_t length){
+    int ret;
+    if ( S_ISDIR(in->mode) )
+	return -EISDIR;
+    if ( !S_ISREG(in->mode) || length < 0 )
+	return -EINVAL;
+    if ( in->spill_node != NULL ){
+	ret = this_->spillfs->ftruncate_size(this_->spillfs, in->spill_inode,
+					     in->spill_node, length);
+	if ( ret < 0 )
+	    return ret;
+    }
+    else if ( length < in->size && length < (off_t)in->capacity ){
+	/*cut off data must be read as zeros if file grows again*/
+	off_t end = in->size < (off_t)in->capacity ? in->size : in->capacity;
+	memset(in->data+length, 0, end-length);
+    }
+    /*extended part beyond capacity is a hole*/
+    in->size = length;
+    mem_touch(in);
+    return 0;
+}
+
+static void mem_stat_locked(struct MemFilesystem* this_, struct MemInode* in,
+			    struct stat *buf){
+    struct stat spill_st;
+    memset(buf, 0, sizeof(struct stat));
+    buf->st_dev = MEM_DEV;
+    buf->st_ino = in->inode;
+    buf->st_mode = in->mode;
+    buf->st_nlink = in->nlink;
+    buf->st_uid = in->uid;
+    buf->st_gid = in->gid;
+    buf->st_size = S_ISDIR(in->mode) ? in->entries+2 : in->size;
+    buf->st_blksize = MEM_MIN_CAPACITY;
+    buf->st_blocks = (in->capacity+511)/512;
+    buf->st_atim = in->atime;
+    buf->st_mtim = in->mtime;
+    buf->st_ctim = in->ctime;
+    if ( in->spill_node != NULL &&
+	 this_->spillfs->stat(this_->spillfs, in->spill_inode, &spill_st) == 0 ){
+	buf->st_size = spill_st.st_size;
+	buf->st_blocks = spill_st.st_blocks;
+    }
+}
+
+/*copy in-memory data, bytes beyond capacity are zeros*/
+static size_t mem_read_locked(struct MemInode* in, char *buf, size_t nbyte, off_t offset){
+    size_t count, data;
+    if ( offset >= in->size )
+	return 0;
+    count = in->size - offset < (off_t)nbyte ? in->size - offset : nbyte;
+    data = offset < (off_t)in->capacity ? in->capacity - offset : 0;
+    if ( data > count ) data = count;
+    memcpy(buf, in->data+offset, data);
+    memset(buf+data, 0, count-data);
+    return count;
+}
+
+/*wrappers implementation*/
+
+static int mem_lookup(struct LowLevelFilesystemPublicInterface* this_,
+		      int parent_inode, const char *name){
+    struct MemFilesystem* fs = (struct MemFilesystem*)this_;
+    int ret;
+    pthread_mutex_lock(&fs->mutex);
+    ret = mem_lookup_locked(fs, parent_inode, name);
+    pthread_mutex_unlock(&fs->mutex);
+    return ret;
+}
+
+static int mem_lookup_path(struct LowLevelFilesystemPublicInterface* this_,
+			   int dir_inode, const char *path, int *inodes, int count){
+    struct MemFilesystem* fs = (struct MemFilesystem*)this_;
+    char name[NAME_MAX+1];
+    size_t len;
+    int n = 0, ret = 0;
+    int inode = dir_inode;
+
+    pthread_mutex_lock(&fs->mutex);
+    if ( mem_inode(fs, dir_inode) == NULL ){
+	pthread_mutex_unlock(&fs->mutex);
+	return -ENOENT;
+    }
+    while ( n < count ){
+	while ( *path == '/' )
+	    ++path;
+	if ( *path == '\0' )
+	    break;
+	len = strcspn(path, "/");
+	if ( len > NAME_MAX ){
+	    ret = -ENAMETOOLONG;
+	    break;
+	}
+	memcpy(name, path, len);
+	name[len] = '\0';
+	path += len;
+	if ( (ret=mem_lookup_locked(fs, inode, name)) < 0 )
+	    break;
+	inodes[n++] = inode = ret;
+    }
+    if ( n < count )
+	inodes[n] = ret < 0 ? ret : -ENOENT;
+    pthread_mutex_unlock(&fs->mutex);
+    return n;
+}
+
+static ssize_t mem_readlink(struct LowLevelFilesystemPublicInterface* this_,
+			    ino_t inode, char *buf, size_t bufsize){
+    struct MemFilesystem* fs = (struct MemFilesystem*)this_;
+    struct MemInode* in;
+    ssize_t ret;
+    pthread_mutex_lock(&fs->mutex);
+    if ( (in = mem_inode(fs, inode)) == NULL )
+	ret = -ENOENT;
+    else if ( !S_ISLNK(in->mode) )
+	ret = -EINVAL;
+    else{
+	ret = in->size < (off_t)bufsize ? in->size : (ssize_t)bufsize-1;
+	memcpy(buf, in->data, ret);
+	buf[ret] = '\0';
+    }
+    pthread_mutex_unlock(&fs->mutex);
+    return ret;
+}
+
+static int mem_symlink(struct LowLevelFilesystemPublicInterface* this_,
+		       const char *link, ino_t parent_inode, const char *name){
+    struct MemFilesystem* fs = (struct MemFilesystem*)this_;
+    struct MemInode* in;
+    char *target;
+    int ret;
+    if ( (target = strdup(link)) == NULL )
+	return -ENOMEM;
+    pthread_mutex_lock(&fs->mutex);
+    if ( (ret=mem_create_locked(fs, parent_inode, name, S_IFLNK|0777, &in)) == 0 ){
+	in->data = target;
+	in->size = in->capacity = strlen(target);
+	fs->stats.mem_used += in->capacity;
+    }
+    else
+	free(target);
+    pthread_mutex_unlock(&fs->mutex);
+    return ret;
+}
+
+static int mem_chown(struct LowLevelFilesystemPublicInterface* this_,
+		     ino_t inode, uid_t owner, gid_t group){
+    struct MemFilesystem* fs = (struct MemFilesystem*)this_;
+    struct MemInode* in;
+    int ret = 0;
+    pthread_mutex_lock(&fs->mutex);
+    if ( (in = mem_inode(fs, inode)) == NULL )
+	ret = -ENOENT;
+    else{
+	if ( owner != (uid_t)-1 ) in->uid = owner;
+	if ( group != (gid_t)-1 ) in->gid = group;
+	mem_time_now(&in->ctime);
+    }
+    pthread_mutex_unlock(&fs->mutex);
+    return ret;
+}
+
+static int mem_chmod(struct LowLevelFilesystemPublicInterface* this_,
+		     ino_t inode, uint32_t mode){
+    struct MemFilesystem* fs = (struct MemFilesystem*)this_;
+    struct MemInode* in;
+    int ret = 0;
+    pthread_mutex_lock(&fs->mutex);
+    if ( (in = mem_inode(fs, inode)) == NULL )
+	ret = -ENOENT;
+    else{
+	in->mode = (in->mode & S_IFMT) | (mode & 07777);
+	mem_time_now(&in->ctime);
+    }
+    pthread_mutex_unlock(&fs->mutex);
+    return ret;
+}
+
+/*space available for files is space of spill fs*/
+static int mem_statvfs(struct LowLevelFilesystemPublicInterface* this_,
+		       struct statvfs *buf){
+    struct MemFilesystem* fs = (struct MemFilesystem*)this_;
+    return fs->spillfs->statvfs(fs->spillfs, buf);
+}
+
+static int mem_stat(struct LowLevelFilesystemPublicInterface* this_,
+		    ino_t inode, struct stat *buf){
+    struct MemFilesystem* fs = (struct MemFilesystem*)this_;
+    struct MemInode* in;
+    int ret = 0;
+    pthread_mutex_lock(&fs->mutex);
+    if ( (in = mem_inode(fs, inode)) == NULL )
+	ret = -ENOENT;
+    else
+	mem_stat_locked(fs, in, buf);
+    pthread_mutex_unlock(&fs->mutex);
+    return ret;
+}
+
+static int mem_mkdir(struct LowLevelFilesystemPublicInterface* this_,
+		     ino_t parent_inode, const char* name, uint32_t mode){
+    struct MemFilesystem* fs = (struct MemFilesystem*)this_;
+    struct MemInode* in;
+    int ret;
+    pthread_mutex_lock(&fs->mutex);
+    ret = mem_create_locked(fs, parent_inode, name, S_IFDIR|(mode & 07777), &in);
+    pthread_mutex_unlock(&fs->mutex);
+    return ret;
+}
+
+static int mem_rmdir(struct LowLevelFilesystemPublicInterface* this_,
+		     ino_t parent_inode, const char* name){
+    struct MemFilesystem* fs = (struct MemFilesystem*)this_;
+    struct MemDirent** itemp;
+    struct MemInode *dir, *in;
+    int ret = 0;
+
+    pthread_mutex_lock(&fs->mutex);
+    if ( (dir = mem_dir(fs, parent_inode, &ret)) == NULL )
+	goto out;
+    if ( mem_is_dot(name) ){
+	ret = !strcmp(name, ".") ? -EINVAL : -ENOTEMPTY;
+	goto out;
+    }
+    itemp = mem_dirent_locate(fs, dir->inode, name);
+    if ( *itemp == NULL ){
+	ret = -ENOENT;
+	goto out;
+    }
+    in = mem_inode(fs, (*itemp)->inode);
+    if ( !S_ISDIR(in->mode) )
+	ret = -ENOTDIR;
+    else if ( in->entries > 0 )
+	ret = -ENOTEMPTY;
+    else{
+	mem_dirent_remove(fs, dir, itemp);
+	--dir->nlink;
+	in->nlink = 0;
+	mem_inode_put(fs, in);
+    }
+out:
+    pthread_mutex_unlock(&fs->mutex);
+    return ret;
+}
+
+/*names of batch are done one by one, there are no transactions*/
+static int mem_create_batch(struct LowLevelFilesystemPublicInterface* this_,
+			    ino_t parent_inode, const char **names, int count,
+			    uint32_t mode, int *errors){
+    struct MemFilesystem* fs = (struct MemFilesystem*)this_;
+    struct MemInode* in;
+    int i, done = 0;
+    pthread_mutex_lock(&fs->mutex);
+    if ( mem_dir(fs, parent_inode, &done) == NULL ){
+	pthread_mutex_unlock(&fs->mutex);
+	return done;
+    }
+    for ( i=0; i < count; i++ ){
+	errors[i] = -mem_create_locked(fs, parent_inode, names[i],
+				       S_IFREG|(mode & 07777), &in);
+	if ( errors[i] == 0 ) ++done;
+    }
+    pthread_mutex_unlock(&fs->mutex);
+    return done;
+}
+
+static int mem_unlink_batch(struct LowLevelFilesystemPublicInterface* this_,
+			    ino_t parent_inode, const char **names, int count,
+			    int *errors){
+    struct MemFilesystem* fs = (struct MemFilesystem*)this_;
+    int i, done = 0;
+    pthread_mutex_lock(&fs->mutex);
+    if ( mem_dir(fs, parent_inode, &done) == NULL ){
+	pthread_mutex_unlock(&fs->mutex);
+	return done;
+    }
+    for ( i=0; i < count; i++ ){
+	errors[i] = -mem_unlink_locked(fs, parent_inode, names[i]);
+	if ( errors[i] == 0 ) ++done;
+    }
+    pthread_mutex_unlock(&fs->mutex);
+    return done;
+}
+
+static ssize_t mem_preadv(struct LowLevelFilesystemPublicInterface* this_,
+			  void *node, const struct iovec *iov, int iovcnt, off_t offset){
+    struct MemFilesystem* fs = (struct MemFilesystem*)this_;
+    struct MemInode* in = (struct MemInode*)node;
+    void *spill_node;
+    size_t ret = 0, n;
+    int i;
+
+    pthread_mutex_lock(&fs->mutex);
+    if ( S_ISDIR(in->mode) ){
+	pthread_mutex_unlock(&fs->mutex);
+	return -EISDIR;
+    }
+    mem_time_now(&in->atime);
+    if ( (spill_node = in->spill_node) == NULL ){
+	for ( i=0; i < iovcnt; i++ ){
+	    n = mem_read_locked(in, iov[i].iov_base, iov[i].iov_len, offset+ret);
+	    ret += n;
+	    if ( n < iov[i].iov_len )
+		break;
+	}
+	pthread_mutex_unlock(&fs->mutex);
+	return ret;
+    }
+    pthread_mutex_unlock(&fs->mutex);
+    /*spill node stays valid while file is opened*/
+    return fs->spillfs->preadv(fs->spillfs, spill_node, iov, iovcnt, offset);
+}
+
+static ssize_t mem_pread(struct LowLevelFilesystemPublicInterface* this_,
+			 void *node, void *buf, size_t nbyte, off_t offset){
+    struct iovec iov = { buf, nbyte };
+    return mem_preadv(this_, node, &iov, 1, offset);
+}
+
+static ssize_t mem_pwritev(struct LowLevelFilesystemPublicInterface* this_,
+			   void *node, const struct iovec *iov, int iovcnt, off_t offset){
+    struct MemFilesystem* fs = (struct MemFilesystem*)this_;
+    struct MemInode* in = (struct MemInode*)node;
+    void *spill_node;
+    size_t nbyte = 0;
+    int i, ret;
+
+    for ( i=0; i < iovcnt; i++ )
+	nbyte += iov[i].iov_len;
+    if ( offset < 0 || offset+(off_t)nbyte < offset )
+	return -EINVAL;
+
+    pthread_mutex_lock(&fs->mutex);
+    if ( S_ISDIR(in->mode) ){
+	pthread_mutex_unlock(&fs->mutex);
+	return -EISDIR;
+    }
+    if ( in->spill_node == NULL ){
+	if ( (ret=mem_reserve(fs, in, offset+nbyte)) == 0 ){
+	    off_t pos = offset;
+	    for ( i=0; i < iovcnt; i++ ){
+		memcpy(in->data+pos, iov[i].iov_base, iov[i].iov_len);
+		pos += iov[i].iov_len;
+	    }
+	    if ( pos > in->size )
+		in->size = pos;
+	    mem_touch(in);
+	    pthread_mutex_unlock(&fs->mutex);
+	    return nbyte;
+	}
+	/*memory limit is reached, file goes into spill fs*/
+	if ( (ret=mem_spill(fs, in)) < 0 ){
+	    pthread_mutex_unlock(&fs->mutex);
+	    return ret;
+	}
+    }
+    spill_node = in->spill_node;
+    mem_touch(in);
+    pthread_mutex_unlock(&fs->mutex);
+    return fs->spillfs->pwritev(fs->spillfs, spill_node, iov, iovcnt, offset);
+}
+
+static ssize_t mem_pwrite(struct LowLevelFilesystemPublicInterface* this_,
+			  void *node, const void *buf, size_t nbyte, off_t offset){
+    struct iovec iov = { (void*)buf, nbyte };
+    return mem_pwritev(this_, node, &iov, 1, offset);
+}
+
+/*add entry to getdents buffer, and its attributes to stats if any
+ *@return 0 if added, -1 if buffer is full*/
+static int mem_put_dirent(struct MemFilesystem* this_, char *buf, unsigned int count,
+			  int *len, struct MemInode* in, const char *name,
+			  off_t next, struct stat *stats, int *index){
+    ssize_t ret;
+    ret = this_->public_.dirent_engine->add_dirent_into_buf(buf+*len, count-*len,
+							      in->inode, next,
+							      in->mode, name);
+    if ( ret < 0 )
+	return -1;
+    *len += ret;
+    if ( stats != NULL )
+	mem_stat_locked(this_, in, &stats[(*index)++]);
+    return 0;
+}
+
+/*@param cookie 0 for '.', 1 for '..', id+2 for entry*/
+static int mem_readdir(struct MemFilesystem* fs, struct MemInode* dir,
+		       char *buf, unsigned int count, off_t *cookie,
+		       struct stat *stats, int stats_count){
+    struct MemDirent* de;
+    off_t pos = *cookie;
+    int len = 0, index = 0, full = 0;
+
+    if ( !S_ISDIR(dir->mode) )
+	return -ENOTDIR;
+    if ( pos == 0 && index < stats_count &&
+	 (full=mem_put_dirent(fs, buf, count, &len, dir, ".", 1,
+			      stats, &index)) == 0 )
+	pos = 1;
+    if ( !full && pos == 1 && index < stats_count &&
+	 (full=mem_put_dirent(fs, buf, count, &len, mem_inode(fs, dir->parent), "..", 2,
+			      stats, &index)) == 0 )
+	pos = 2;
+    for ( de = dir->first; de != NULL && !full && index < stats_count; de = de->dir_next ){
+	if ( (off_t)de->id+2 < pos )
+	    continue;
+	if ( (full=mem_put_dirent(fs, buf, count, &len, mem_inode(fs, de->inode), de->name,
+				  de->id+3, stats, &index)) == 0 )
+	    pos = de->id+3;
+    }
+    /*buffer or stats array is too small even for single entry*/
+    if ( len == 0 && (full || index >= stats_count) )
+	return -EINVAL;
+    *cookie = pos;
+    mem_time_now(&dir->atime);
+    return len;
+}
+
+static int mem_getdents(struct LowLevelFilesystemPublicInterface* this_,
+			void *node, void *buf, unsigned int count, off_t *cookie){
+    struct MemFilesystem* fs = (struct MemFilesystem*)this_;
+    int ret;
+    pthread_mutex_lock(&fs->mutex);
+    ret = mem_readdir(fs, (struct MemInode*)node, buf, count, cookie, NULL, INT_MAX);
+    pthread_mutex_unlock(&fs->mutex);
+    return ret;
+}
+
+static int mem_getdents_plus(struct LowLevelFilesystemPublicInterface* this_,
+			     void *node, void *buf, unsigned int count, off_t *cookie,
+			     struct stat *stats, int stats_count){
+    struct MemFilesystem* fs = (struct MemFilesystem*)this_;
+    int ret;
+    pthread_mutex_lock(&fs->mutex);
+    ret = mem_readdir(fs, (struct MemInode*)node, buf, count, cookie, stats, stats_count);
+    pthread_mutex_unlock(&fs->mutex);
+    return ret;
+}
+
+/*contents are not persistent, so there is nothing to flush*/
+static int mem_fsync(struct LowLevelFilesystemPublicInterface* this_,
+		     void *node, int datasync){
+    return 0;
+}
+
+static int mem_close(struct LowLevelFilesystemPublicInterface* this_, void *node, int flags){
+    struct MemFilesystem* fs = (struct MemFilesystem*)this_;
+    struct MemInode* in = (struct MemInode*)node;
+    pthread_mutex_lock(&fs->mutex);
+    assert(in->open_count > 0);
+    --in->open_count;
+    mem_inode_put(fs, in);
+    pthread_mutex_unlock(&fs->mutex);
+    return 0;
+}
+
+static int mem_open(struct LowLevelFilesystemPublicInterface* this_,
+		    ino_t parent_inode, const char* name, int oflag, uint32_t mode,
+		    void **node){
+    struct MemFilesystem* fs = (struct MemFilesystem*)this_;
+    struct MemInode* in = NULL;
+    int created = 0;
+    int ret = 0;
+
+    pthread_mutex_lock(&fs->mutex);
+    if ( name == NULL ){
+	/*open existing file by inode*/
+	if ( (in = mem_inode(fs, parent_inode)) == NULL )
+	    ret = -ENOENT;
+    }
+    else if ( (ret=mem_lookup_locked(fs, parent_inode, name)) >= 0 ){
+	if ( (oflag & (O_CREAT|O_EXCL)) == (O_CREAT|O_EXCL) )
+	    ret = -EEXIST;
+	else{
+	    in = mem_inode(fs, ret);
+	    ret = 0;
+	}
+    }
+    else if ( ret == -ENOENT && (oflag & O_CREAT) ){
+	ret = mem_create_locked(fs, parent_inode, name, S_IFREG|(mode & 07777), &in);
+	created = (ret == 0);
+    }
+    if ( ret < 0 )
+	goto out;
+
+    if ( (oflag & O_DIRECTORY) && !S_ISDIR(in->mode) )
+	ret = -ENOTDIR;
+    else if ( S_ISDIR(in->mode) && (oflag & O_ACCMODE) != O_RDONLY )
+	ret = -EISDIR;
+    else if ( S_ISLNK(in->mode) && (oflag & O_NOFOLLOW) )
+	ret = -ELOOP;
+    else if ( (oflag & O_TRUNC) && S_ISREG(in->mode) && (oflag & O_ACCMODE) != O_RDONLY )
+	ret = mem_truncate_locked(fs, in, 0);
+    if ( ret < 0 )
+	goto out;
+
+    ++in->open_count;
+    *node = in;
+    ret = created ? (int)in->inode : 0;
+out:
+    pthread_mutex_unlock(&fs->mutex);
+    return ret;
+}
+
+static int mem_unlink(struct LowLevelFilesystemPublicInterface* this_,
+		      ino_t parent_inode, const char* name){
+    struct MemFilesystem* fs = (struct MemFilesystem*)this_;
+    int ret;
+    pthread_mutex_lock(&fs->mutex);
+    ret = mem_unlink_locked(fs, parent_inode, name);
+    pthread_mutex_unlock(&fs->mutex);
+    return ret;
+}
+
+static int mem_link(struct LowLevelFilesystemPublicInterface* this_,
+		    ino_t inode, ino_t new_parent, const char *newname){
+    struct MemFilesystem* fs = (struct MemFilesystem*)this_;
+    struct MemInode *in, *dir;
+    struct MemDirent* de;
+    int ret = 0;
+
+    pthread_mutex_lock(&fs->mutex);
+    if ( (dir = mem_dir(fs, new_parent, &ret)) == NULL )
+	goto out;
+    if ( (in = mem_inode(fs, inode)) == NULL )
+	ret = -ENOENT;
+    else if ( S_ISDIR(in->mode) )
+	ret = -EPERM;
+    else if ( (ret=mem_check_name(newname)) != 0 )
+	;
+    else if ( mem_is_dot(newname) || *mem_dirent_locate(fs, dir->inode, newname) != NULL )
+	ret = -EEXIST;
+    else if ( (de = mem_dirent_new(newname)) == NULL )
+	ret = -ENOMEM;
+    else{
+	mem_dirent_link(fs, dir, de, in->inode);
+	++in->nlink;
+	mem_time_now(&in->ctime);
+    }
+out:
+    pthread_mutex_unlock(&fs->mutex);
+    return ret;
+}
+
+#ifndef __native_client__
+static int mem_rename(struct LowLevelFilesystemPublicInterface* this_,
+		      ino_t parent, const char *name,
+		      ino_t new_parent, const char *newname){
+    struct MemFilesystem* fs = (struct MemFilesystem*)this_;
+    struct MemInode *dir, *newdir, *in, *target = NULL, *up;
+    struct MemDirent **itemp, *de;
+    int ret = 0;
+
+    pthread_mutex_lock(&fs->mutex);
+    if ( (dir = mem_dir(fs, parent, &ret)) == NULL ||
+	 (newdir = mem_dir(fs, new_parent, &ret)) == NULL )
+	goto out;
+    if ( mem_is_dot(name) || mem_is_dot(newname) ){
+	ret = -EINVAL;
+	goto out;
+    }
+    if ( (ret=mem_check_name(newname)) != 0 )
+	goto out;
+    if ( (de = *mem_dirent_locate(fs, dir->inode, name)) == NULL ){
+	ret = -ENOENT;
+	goto out;
+    }
+    in = mem_inode(fs, de->inode);
+    if ( (de = *mem_dirent_locate(fs, newdir->inode, newname)) != NULL ){
+	target = mem_inode(fs, de->inode);
+	/*both names are links of the same file*/
+	if ( target == in )
+	    goto out;
+	if ( S_ISDIR(in->mode) && !S_ISDIR(target->mode) )
+	    ret = -ENOTDIR;
+	else if ( !S_ISDIR(in->mode) && S_ISDIR(target->mode) )
+	    ret = -EISDIR;
+	else if ( S_ISDIR(target->mode) && target->entries > 0 )
+	    ret = -ENOTEMPTY;
+	if ( ret < 0 )
+	    goto out;
+    }
+    /*directory can't be moved into itself*/
+    if ( S_ISDIR(in->mode) ){
+	for ( up = newdir; up->inode != MEM_ROOT_INODE; up = mem_inode(fs, up->parent) ){
+	    if ( up == in ){
+		ret = -EINVAL;
+		goto out;
+	    }
+	}
+	if ( newdir == in ){
+	    ret = -EINVAL;
+	    goto out;
+	}
+    }
+    if ( (de = mem_dirent_new(newname)) == NULL ){
+	ret = -ENOMEM;
+	goto out;
+    }
+
+    if ( target != NULL ){
+	mem_dirent_remove(fs, newdir, mem_dirent_locate(fs, newdir->inode, newname));
+	if ( S_ISDIR(target->mode) ){
+	    --newdir->nlink;
+	    target->nlink = 0;
+	}
+	else
+	    --target->nlink;
+	mem_time_now(&target->ctime);
+	mem_inode_put(fs, target);
+    }
+    itemp = mem_dirent_locate(fs, dir->inode, name);
+    mem_dirent_remove(fs, dir, itemp);
+    mem_dirent_link(fs, newdir, de, in->inode);
+    if ( S_ISDIR(in->mode) && dir != newdir ){
+	in->parent = newdir->inode;
+	--dir->nlink;
+	++newdir->nlink;
+    }
+    mem_time_now(&in->ctime);
+out:
+    pthread_mutex_unlock(&fs->mutex);
+    return ret;
+}
+#endif //__native_client__
+
+static int mem_ftruncate_size(struct LowLevelFilesystemPublicInterface* this_,
+			      ino_t inode, void *node, off_t length){
+    struct MemFilesystem* fs = (struct MemFilesystem*)this_;
+    struct MemInode* in = (struct MemInode*)node;
+    int ret;
+    pthread_mutex_lock(&fs->mutex);
+    if ( in == NULL && (in = mem_inode(fs, inode)) == NULL )
+	ret = -ENOENT;
+    else
+	ret = mem_truncate_locked(fs, in, length);
+    pthread_mutex_unlock(&fs->mutex);
+    return ret;
+}
+
+static int mem_fallocate(struct LowLevelFilesystemPublicInterface* this_, 
+			 void *node, int mode, off_t offset, off_t length){
+    struct MemFilesystem* fs = (struct MemFilesystem*)this_;
+    struct MemInode* in = (struct MemInode*)node;
+    off_t end;
+    int ret = 0;
+
+    if ( offset < 0 || length <= 0 || offset + length < offset )
+	return -EINVAL;
+    if ( mode != 0 && mode != FALLOC_FL_KEEP_SIZE &&
+	 mode != (FALLOC_FL_PUNCH_HOLE|FALLOC_FL_KEEP_SIZE) )
+	return -EOPNOTSUPP;
+
+    pthread_mutex_lock(&fs->mutex);
+    if ( !S_ISREG(in->mode) )
+	ret = -ENODEV;
+    else if ( in->spill_node != NULL )
+	ret = fs->spillfs->fallocate(fs->spillfs, in->spill_node, mode, offset, length);
+    else if ( mode & FALLOC_FL_PUNCH_HOLE ){
+	/*memory is kept, punched data just reads as zeros*/
+	end = MIN(offset + length, MIN(in->size, (off_t)in->capacity));
+	if ( offset < end )
+	    memset(in->data+offset, 0, end-offset);
+    }
+    else if ( mode == 0 && offset + length > in->size )
+	in->size = offset + length;
+    if ( ret == 0 && mode != FALLOC_FL_KEEP_SIZE )
+	mem_touch(in);
+    pthread_mutex_unlock(&fs->mutex);
+    return ret;
+}
+
+/*in-memory file data is allocated from start of file, so range
+  beyond allocated capacity is the only hole*/
+static off_t mem_seek_data(struct LowLevelFilesystemPublicInterface* this_, 
+			   void *node, off_t offset, int whence){
+    struct MemFilesystem* fs = (struct MemFilesystem*)this_;
+    struct MemInode* in = (struct MemInode*)node;
+    off_t ret;
+
+    if ( offset < 0 || (whence != SEEK_DATA && whence != SEEK_HOLE) )
+	return -EINVAL;
+    pthread_mutex_lock(&fs->mutex);
+    if ( in->spill_node != NULL )
+	ret = fs->spillfs->seek_data(fs->spillfs, in->spill_node, offset, whence);
+    else if ( offset >= in->size )
+	ret = -ENXIO;
+    else if ( whence == SEEK_DATA )
+	ret = offset < (off_t)in->capacity ? offset : -ENXIO;
+    else
+	ret = MAX(offset, MIN(in->size, (off_t)in->capacity));
+    pthread_mutex_unlock(&fs->mutex);
+    return ret;
+}
+
+/*in-memory data is copied at once, spilled files are copied through
+  temporary buffer*/
+static ssize_t mem_copy_range(struct LowLevelFilesystemPublicInterface* this_,
+			      void *src_node, off_t src_offset,
+			      void *dst_node, off_t dst_offset, size_t size){
+    struct MemFilesystem* fs = (struct MemFilesystem*)this_;
+    struct MemInode* src = (struct MemInode*)src_node;
+    struct MemInode* dst = (struct MemInode*)dst_node;
+    size_t done = 0, chunk;
+    ssize_t ret = 0;
+    char *buf;
+
+    if ( src_offset < 0 || dst_offset < 0 || size > SSIZE_MAX ||
+	 dst_offset + (off_t)size < dst_offset )
+	return -EINVAL;
+    if ( src == dst && src_offset < dst_offset + (off_t)size &&
+	 dst_offset < src_offset + (off_t)size )
+	return -EINVAL;
+
+    pthread_mutex_lock(&fs->mutex);
+    if ( S_ISDIR(src->mode) || S_ISDIR(dst->mode) )
+	ret = -EISDIR;
+    else if ( src->spill_node == NULL && dst->spill_node == NULL ){
+	size = src_offset < src->size ? MIN((off_t)size, src->size - src_offset) : 0;
+	if ( size > 0 && (ret=mem_reserve(fs, dst, dst_offset+size)) == 0 ){
+	    mem_read_locked(src, dst->data+dst_offset, size, src_offset);
+	    if ( dst_offset + (off_t)size > dst->size )
+		dst->size = dst_offset + size;
+	    mem_touch(dst);
+	    pthread_mutex_unlock(&fs->mutex);
+	    return size;
+	}
+	/*destination doesn't fit into memory, copy by writes that spill it*/
+	ret = 0;
+    }
+    pthread_mutex_unlock(&fs->mutex);
+    if ( ret < 0 || size == 0 )
+	return ret;
+
+    if ( (buf = malloc(MIN(size, MEM_COPY_CHUNK))) == NULL )
+	return -ENOMEM;
+    while ( done < size ){
+	chunk = MIN(size - done, MEM_COPY_CHUNK);
+	if ( (ret=mem_pread(this_, src, buf, chunk, src_offset + done)) <= 0 )
+	    break;
+	if ( (ret=mem_pwrite(this_, dst, buf, ret, dst_offset + done)) <= 0 )
+	    break;
+	done += ret;
+    }
+    free(buf);
+    if ( ret < 0 && done == 0 )
+	return ret;
+    return done;
+}
+
+
+static struct LowLevelFilesystemPublicInterface s_mem_filesystem_interface = {
+    mem_lookup,
+    mem_lookup_path,
+    mem_readlink,
+    mem_symlink,
+    mem_chown,
+    mem_chmod,
+    mem_statvfs,
+    mem_stat,
+    NULL, //access
+    mem_mkdir,
+    mem_rmdir,
+    mem_create_batch,
+    mem_unlink_batch,
+    mem_pread,
+    mem_pwrite,
+    mem_preadv,
+    mem_pwritev,
+    NULL, //read_borrow
+    NULL, //read_return
+    NULL, //write_loan
+    NULL, //write_commit
+    NULL, //write_abort
+    mem_getdents,
+    mem_getdents_plus,
+    mem_fsync,
+    mem_close,
+    mem_open,
+    mem_unlink,
+    mem_link,
+#ifndef __native_client__
+    mem_rename,
+#endif //__native_client__
+    mem_ftruncate_size,
+    mem_fallocate,
+    mem_seek_data,
+    mem_copy_range,
+    NULL
+};
+
+
+struct LowLevelFilesystemPublicInterface*
+CONSTRUCT_L(MEM_FILESYSTEM)(size_t mem_limit,
+			    struct LowLevelFilesystemPublicInterface* spillfs,
+			    struct DirentEnginePublicInterface* dirent_engine){
+    struct MemFilesystem* this_ = calloc(1, sizeof(struct MemFilesystem));
+    struct MemInode* root;
+    assert(this_ != NULL);
+    this_->public_ = s_mem_filesystem_interface;
+    this_->public_.dirent_engine = dirent_engine;
+    this_->spillfs = spillfs;
+    this_->stats.mem_limit = mem_limit;
+    this_->inodes_count = 256;
+    this_->inodes = calloc(this_->inodes_count, sizeof(struct MemInode*));
+    this_->free_inodes = malloc(this_->inodes_count*sizeof(ino_t));
+    this_->next_inode = MEM_ROOT_INODE;
+    pthread_mutex_init(&this_->mutex, NULL);
+    root = mem_inode_alloc(this_, S_IFDIR|0777);
+    assert(root != NULL && root->inode == MEM_ROOT_INODE);
+    return &this_->public_;
+}
+
+void mem_filesystem_stats(struct LowLevelFilesystemPublicInterface* memfs,
+			  struct MemFilesystemStats *stats){
+    struct MemFilesystem* fs = (struct MemFilesystem*)memfs;
+    pthread_mutex_lock(&fs->mutex);
+    *stats = fs->stats;
+    pthread_mutex_unlock(&fs->mutex);
+}
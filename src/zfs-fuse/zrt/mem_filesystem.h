@@ -0,0 +1,61 @@
+/*
+ *
+ * Copyright (c) 2014, LiteStack, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __MEM_FILESYSTEM_H__
+#define __MEM_FILESYSTEM_H__
+
+#include <stdint.h>
+#include <stddef.h> //size_t
+
+#include "zrt_defines.h" //CONSTRUCT_L
+
+/*name of constructor*/
+#define MEM_FILESYSTEM mem_filesystem_construct
+
+/*directory in root of spill filesystem keeping spilled files*/
+#define MEM_SPILL_DIR ".scratch"
+
+/*Lowlevel filesystem keeping names, attributes and data in memory. Data
+ *of all files is limited by mem_limit, file which data doesn't fit into
+ *limit is spilled: its data is moved into file of spill filesystem and
+ *all next i/o of file goes there. Spilled file is unlinked right after
+ *creation, so it's freed by spill filesystem when closed, or when pool
+ *is imported after crash. Contents are not persistent, fsync does
+ *nothing.*/
+
+struct MemFilesystemStats{
+    uint64_t mem_limit;     /*bytes of file data allowed in memory*/
+    uint64_t mem_used;      /*bytes of file data allocated in memory*/
+    uint64_t spilled_files; /*files moved into spill filesystem*/
+    uint64_t spilled_bytes; /*in-memory bytes copied by spilling*/
+};
+
+struct LowLevelFilesystemPublicInterface;
+struct DirentEnginePublicInterface;
+
+/*@param spillfs filesystem for spilled files, directory for them is
+ *created in its root by first spill*/
+struct LowLevelFilesystemPublicInterface*
+mem_filesystem_construct(size_t mem_limit,
+			 struct LowLevelFilesystemPublicInterface* spillfs,
+			 struct DirentEnginePublicInterface* dirent_engine);
+
+/*copy current statistics of memory filesystem*/
+void mem_filesystem_stats(struct LowLevelFilesystemPublicInterface* memfs,
+			  struct MemFilesystemStats *stats);
+
+#endif //__MEM_FILESYSTEM_H__
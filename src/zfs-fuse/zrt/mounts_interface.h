@@ -29,6 +29,7 @@
 /* #endif //FUSE */
 
 struct stat;
+struct iovec;
 
 typedef enum { EChannelsMountId=0, EMemMountId=1, EMountsCount } MountId;
 
@@ -48,6 +49,13 @@ struct MountsPublicInterface{
     /* 		 const char *path, mode_t mode, dev_t dev); */
     int (*mkdir)(struct MountsPublicInterface* this_,const char* path, uint32_t mode);
     int (*rmdir)(struct MountsPublicInterface* this_,const char* path);
+    //create regular files / remove names in directory dirpath, names
+    //are done by groups in single transaction each; errors returns 0 or
+    //errno of every name, function returns count of names done
+    int (*create_batch)(struct MountsPublicInterface* this_, const char* dirpath,
+			const char **names, int count, uint32_t mode, int *errors);
+    int (*unlink_batch)(struct MountsPublicInterface* this_, const char* dirpath,
+			const char **names, int count, int *errors);
 
     // System calls that take a file descriptor as an argument:
     // The kernel proxy will determine to which mount the file
@@ -59,17 +67,38 @@ struct MountsPublicInterface{
 		     int fd, void *buf, size_t nbyte, off_t offset);
     ssize_t (*pwrite)(struct MountsPublicInterface* this_,
 		      int fd, const void *buf, size_t nbyte, off_t offset);
+    ssize_t (*preadv)(struct MountsPublicInterface* this_,
+		      int fd, const struct iovec *iov, int iovcnt, off_t offset);
+    ssize_t (*pwritev)(struct MountsPublicInterface* this_,
+		       int fd, const struct iovec *iov, int iovcnt, off_t offset);
+    //read without copying, iov items point to filesystem cache buffers
+    //that stay valid and unchanged until read_return; see lowlevel fs
+    ssize_t (*read_borrow)(struct MountsPublicInterface* this_, int fd, size_t nbyte,
+			   off_t offset, struct iovec *iov, int *iovcnt, void **loan);
+    void (*read_return)(struct MountsPublicInterface* this_, void *loan);
+    //write without copying, caller fills iov items lent by write_loan and
+    //passes them to write_commit, or releases by write_abort; see lowlevel fs
+    ssize_t (*write_loan)(struct MountsPublicInterface* this_, int fd, size_t nbyte,
+			  off_t offset, struct iovec *iov, int *iovcnt, void **loan);
+    ssize_t (*write_commit)(struct MountsPublicInterface* this_, void *loan, size_t nbyte);
+    void (*write_abort)(struct MountsPublicInterface* this_, void *loan);
     int (*fchown)(struct MountsPublicInterface* this_,int fd, uid_t owner, gid_t group);
     int (*fchmod)(struct MountsPublicInterface* this_,int fd, uint32_t mode);
     int (*fstat)(struct MountsPublicInterface* this_,int fd, struct stat *buf);
     int (*getdents)(struct MountsPublicInterface* this_,int fd, void *buf, unsigned int count);
+    //getdents that also fills stats[i] for i-th returned entry, st_ino is 0
+    //if entry's attributes are not available; entries count <= stats_count
+    int (*getdents_plus)(struct MountsPublicInterface* this_,int fd, void *buf, unsigned int count,
+			 struct stat *stats, int stats_count);
     int (*fsync)(struct MountsPublicInterface* this_,int fd);
+    int (*fdatasync)(struct MountsPublicInterface* this_,int fd);
 
     // close() calls the mount's Unref() if the file handle corresponding to
     // fd was opened
     int (*close)(struct MountsPublicInterface* this_,int fd);
     // lseek() relies on the mount's Stat() to determine whether or not the
-    // file handle corresponding to fd is a directory
+    // file handle corresponding to fd is a directory; for regular file
+    // only SEEK_DATA and SEEK_HOLE are supported
     off_t (*lseek)(struct MountsPublicInterface* this_,int fd, off_t offset, int whence);
     // open() relies on the mount's Creat() if O_CREAT is specified.  open()
     // also relies on the mount's GetNode().
@@ -92,6 +121,15 @@ struct MountsPublicInterface{
     int (*ftruncate_size)(struct MountsPublicInterface* this_,int fd, off_t length);
     //only reduces file size, not padding it; posix
     int (*truncate_size)(struct MountsPublicInterface* this_,const char* path, off_t length);
+    //allocate space, or free it with FALLOC_FL_PUNCH_HOLE; modes are
+    //as in linux fallocate, see lowlevel fs for supported ones
+    int (*fallocate)(struct MountsPublicInterface* this_,int fd, int mode, 
+		     off_t offset, off_t length);
+    //copy data between opened files without passing it through caller,
+    //descriptor offsets are not used and not changed; both files must
+    //belong to this mount; returns copied bytes, 0 at end of source
+    ssize_t (*copy_range)(struct MountsPublicInterface* this_,int fd_in, off_t offset_in,
+			  int fd_out, off_t offset_out, size_t size);
 
     int (*isatty)(struct MountsPublicInterface* this_,int fd);
     int (*dup)(struct MountsPublicInterface* this_,int oldfd);
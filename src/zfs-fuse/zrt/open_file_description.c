@@ -15,85 +15,76 @@
  * limitations under the License.
  */
 
+#include <assert.h>
+
 #include "open_file_description.h"
-#include "handle_allocator.h" //MAX_HANDLES_COUNT
 
 
-#define VERIFY_OFD(id)							\
-    ((id<0 || id>=MAX_HANDLES_COUNT)? 0					\
-     : (s_open_files_array[id].refcount>0)) 
+#include "descriptor_table.h"
 
 
 struct OpenFileDescInternal{
+    struct DescriptorTableItem header; /*must be first*/
     struct OpenFileDescription public_;
     int refcount;
 };
 
-static int s_first_unused_slot;
-static struct OpenFileDescInternal s_open_files_array[MAX_HANDLES_COUNT];
-
-static int seek_unused_slot( int starting_from ){
-    int i;
-    starting_from = starting_from<0 ?0 :starting_from;
-    for ( i=starting_from; i < MAX_HANDLES_COUNT; i++ ){
-        if ( s_open_files_array[i].refcount == 0 ){
-            s_first_unused_slot = i;
-            return s_first_unused_slot;
-        }
-    }
-    return -1;
-}
+static struct DescriptorTable s_open_files_table = 
+    DESCRIPTOR_TABLE_INITIALIZER(sizeof(struct OpenFileDescInternal));
+
+#define GET_OFD_OR_FAIL(id, item_p)				\
+    if ( ((item_p)=descriptor_table_lookup(&s_open_files_table, (id))) == NULL ) \
+	return -1;
 
 
 static int getnew_ofd(int flags){
-    s_first_unused_slot = seek_unused_slot( s_first_unused_slot );
-    if ( s_first_unused_slot == -1 ) return -1;
-    ++s_open_files_array[s_first_unused_slot].refcount;
-    s_open_files_array[s_first_unused_slot].public_.offset=0;
-    s_open_files_array[s_first_unused_slot].public_.channel_sequential_offset=0;
-    s_open_files_array[s_first_unused_slot].public_.flags=flags;
-    return s_first_unused_slot;
+    struct OpenFileDescInternal* item;
+    int id = descriptor_table_reserve(&s_open_files_table, -1, (void**)&item);
+    if ( id == -1 ) return -1;
+    item->refcount = 1;
+    item->public_.offset=0;
+    item->public_.flags=flags;
+    descriptor_table_publish(&s_open_files_table, item);
+    return id;
 }
 
 
 static int refer_ofd(int id_ofd){
-    if ( !VERIFY_OFD(id_ofd) ) return -1;
-    ++s_open_files_array[id_ofd].refcount;
+    struct OpenFileDescInternal* item;
+    GET_OFD_OR_FAIL(id_ofd, item);
+    __atomic_add_fetch(&item->refcount, 1, __ATOMIC_ACQ_REL);
     return 0;
 }
 
 static int release_ofd(int id_ofd){
-    if ( !VERIFY_OFD(id_ofd) ) return -1;
-    if ( !--s_open_files_array[id_ofd].refcount ){
-	/*set lowest available slot*/
-	if ( id_ofd < s_first_unused_slot ) s_first_unused_slot = id_ofd;
+    struct OpenFileDescInternal* item;
+    GET_OFD_OR_FAIL(id_ofd, item);
+    if ( __atomic_sub_fetch(&item->refcount, 1, __ATOMIC_ACQ_REL) == 0 ){
+	int ret = descriptor_table_free(&s_open_files_table, id_ofd);
+	assert(ret==0);
     }
     return 0;
 }
 
 static const struct OpenFileDescription* entry(int id_ofd){
-    if ( !VERIFY_OFD(id_ofd) ) return NULL;
-    return &s_open_files_array[id_ofd].public_;
-}
-
-
-static int set_offset_sequential_channel(int id_ofd, off_t offset ){
-    if ( !VERIFY_OFD(id_ofd) ) return -1;
-    s_open_files_array[id_ofd].public_.channel_sequential_offset = offset;
-    return 0;
+    struct OpenFileDescInternal* item = descriptor_table_lookup(&s_open_files_table, id_ofd);
+    if ( item == NULL ) return NULL;
+    return &item->public_;
 }
 
 
 static int set_offset(int id_ofd, off_t offset ){
-    if ( !VERIFY_OFD(id_ofd) ) return -1;
-    s_open_files_array[id_ofd].public_.offset = offset;
+    struct OpenFileDescInternal* item;
+    GET_OFD_OR_FAIL(id_ofd, item);
+    item->public_.offset = offset;
     return 0;
 }
 
 
 static int set_flags(int id_ofd, int flags ){
-    if ( !VERIFY_OFD(id_ofd) ) return -1;
-    s_open_files_array[id_ofd].public_.flags = flags;
+    struct OpenFileDescInternal* item;
+    GET_OFD_OR_FAIL(id_ofd, item);
+    item->public_.flags = flags;
     return 0;
 }
 
@@ -103,7 +94,6 @@ static struct OpenFilesPool s_open_files_pool = {
     refer_ofd,
     release_ofd,    
     entry,
-    set_offset_sequential_channel,
     set_offset,
     set_flags
 };
@@ -29,12 +29,12 @@
 
 
 struct OpenFileDescription{
-    off_t channel_sequential_offset; /*sequential read, sequential write*/
-    off_t offset; /*used by read, write; also for channels random read, random write*/
+    off_t offset; /*used by read, write; for directory it's cookie of next entry*/
     int   flags; /*opened file's flags*/
 };
 
 
+/*interface, all functions are thread safe*/
 struct OpenFilesPool{
     /*increment refcount for new ofd, set flags
      *@return id, or -1 error*/
@@ -48,11 +48,6 @@ struct OpenFilesPool{
 
     const struct OpenFileDescription* (*ofd)(int id_ofd);
 
-    /* Use it only for DevicesFS, as second offset. 
-     * set offset for channels with sequential access. 
-     * @return errcode, 0 ok, -1 not found*/
-    int (*set_offset_sequential_channel)(int id_ofd, off_t offset );
-
     /* set offset
      * @return errcode, 0 ok, -1 not found*/
     int (*set_offset)(int id_ofd, off_t offset );
@@ -43,6 +43,7 @@
  */
 
 #include <string.h>
+#include <limits.h> //IOV_MAX
 
 #include "zfs_filesystem.h"
 #include "open_file_description.h"
@@ -56,16 +57,36 @@
 #include <sys/statvfs.h> //statvfs64
 #include <sys/cred_impl.h> //struct cred, cred_t
 #include <sys/cred.h> //cred_t
+#include <sys/zfs_rlock.h> //zfs_range_lock
+#include <sys/arc.h> //arc_buf_t
+#include <sys/dmu.h> //dmu_buf_hold_array_by_bonus
+#include <sys/dbuf.h> //dmu_buf_impl_t
 
 
 #define INVERT_SIGN( errcode ) -(errcode)
 
+/*max records of source borrowed by single step of copy_range*/
+#define COPY_RANGE_IOV_COUNT 32
+
 struct ZfsFilesystem{
     struct LowLevelFilesystemPublicInterface public_;
     vfs_t *vfs;
+    /*group commit: fsyncs that come while log write is in progress
+      are served together by next single log write*/
+    kmutex_t   fsync_lock;
+    kcondvar_t fsync_cv;
+    boolean_t  fsync_active;    /*log write in progress*/
+    int        fsync_waiting;   /*fsync calls waiting for log write*/
+    uint64_t   fsync_started;   /*log writes started*/
+    uint64_t   fsync_completed; /*log writes completed*/
 };
 
-static off_t s_zfs_dirent_off;
+int zrt_fsync_txg_wait = 0;
+
+/*updated by atomic operations*/
+static struct FsyncStats s_fsync_stats;
+
+/*readonly credentials shared by all threads*/
 static cred_t s_cred;
 
 static void get_zfs_flags_from_standard_open_flags_mode( int std_flags, 
@@ -139,7 +160,7 @@ static int zfs_lookup(struct LowLevelFilesystemPublicInterface* this_,
 {
 	if(strlen(name) >= MAXNAMELEN)
 	    return INVERT_SIGN(ENAMETOOLONG);
-	int retinode;
+	int retinode = 0;
 	struct ZfsFilesystem* zfs = (struct ZfsFilesystem*)this_;
 
 	vfs_t *vfs = zfs->vfs;
@@ -154,7 +175,7 @@ static int zfs_lookup(struct LowLevelFilesystemPublicInterface* this_,
 		ZFS_EXIT(zfsvfs);
 		/* If the inode we are trying to get was recently deleted
 		   dnode_hold_impl will return EEXIST instead of ENOENT */
-		return error == EEXIST ? ENOENT : error;
+		return INVERT_SIGN(error == EEXIST ? ENOENT : error);
 	}
 
 	ASSERT(znode != NULL);
@@ -165,24 +186,77 @@ static int zfs_lookup(struct LowLevelFilesystemPublicInterface* this_,
 	cred_t *cred = &s_cred;
 
 	error = VOP_LOOKUP(dvp, (char *) name, &vp, NULL, 0, NULL, cred, NULL, NULL, NULL);
+	if(error == 0 && vp != NULL) {
+		retinode = VTOZ(vp)->z_id;
+		VN_RELE(vp);
+	}
+
+	VN_RELE(dvp);
+	ZFS_EXIT(zfsvfs);
+
 	if(error)
-		goto out;
+		return INVERT_SIGN(error);
+	return retinode;
+}
 
-	if(vp == NULL)
-		goto out;
+static int zfs_lookup_path(struct LowLevelFilesystemPublicInterface* this_,
+			   int dir_inode, const char *path, int *inodes, int count)
+{
+	struct ZfsFilesystem* zfs = (struct ZfsFilesystem*)this_;
+	char name[MAXNAMELEN];
+	size_t len;
+	int n = 0;
 
-	retinode = VTOZ(vp)->z_id;
-	struct stat st;
-	error = internal_stat(vp, &st);
-	if ( error == 0 ) return retinode;
+	vfs_t *vfs = zfs->vfs;
+	zfsvfs_t *zfsvfs = vfs->vfs_data;
+
+	ZFS_ENTER(zfsvfs);
+
+	znode_t *znode;
+
+	int error = zfs_zget(zfsvfs, dir_inode, &znode, B_FALSE);
+	if(error) {
+		ZFS_EXIT(zfsvfs);
+		/* If the inode we are trying to get was recently deleted
+		   dnode_hold_impl will return EEXIST instead of ENOENT */
+		return INVERT_SIGN(error == EEXIST ? ENOENT : error);
+	}
+
+	vnode_t *dvp = ZTOV(znode);
+	vnode_t *vp;
+	cred_t *cred = &s_cred;
+
+	/*every directory stays held until vnode of its entry is got, so
+	  walk needn't to get vnodes by inode again*/
+	while ( n < count ){
+	    while ( *path == '/' )
+		++path;
+	    if ( *path == '\0' )
+		break;
+	    len = strcspn(path, "/");
+	    if ( len >= MAXNAMELEN ){
+		error = ENAMETOOLONG;
+		break;
+	    }
+	    memcpy(name, path, len);
+	    name[len] = '\0';
+	    path += len;
+
+	    vp = NULL;
+	    error = VOP_LOOKUP(dvp, name, &vp, NULL, 0, NULL, cred, NULL, NULL, NULL);
+	    if ( error )
+		break;
+	    ASSERT(vp != NULL);
+	    VN_RELE(dvp);
+	    dvp = vp;
+	    inodes[n++] = VTOZ(vp)->z_id;
+	}
+	if ( n < count )
+	    inodes[n] = INVERT_SIGN(error ? error : ENOENT);
 
-out:
-	if(vp != NULL)
-		VN_RELE(vp);
 	VN_RELE(dvp);
 	ZFS_EXIT(zfsvfs);
-
-	return INVERT_SIGN(error);
+	return n;
 }
 
 
@@ -341,48 +415,119 @@ static int zfs_rmdir(struct LowLevelFilesystemPublicInterface* this_,
 	return INVERT_SIGN(error);
 }
 
-static ssize_t zfs_pread(struct LowLevelFilesystemPublicInterface* this_,
-			 ino_t inode, void *buf, size_t size, off_t offset){
+/*common part of create_batch and unlink_batch, mode is used only by
+  create*/
+static int zfs_dir_batch(struct LowLevelFilesystemPublicInterface* this_, 
+			 ino_t parent_inode, const char **names, int count,
+			 uint32_t mode, int *errors, int create){
 	struct ZfsFilesystem* zfs = (struct ZfsFilesystem*)this_;
+	int i, done=0;
+
+	if ( count < 0 )
+	    return INVERT_SIGN(EINVAL);
+	if ( count == 0 )
+	    return 0;
 
 	vfs_t *vfs = zfs->vfs;
 	zfsvfs_t *zfsvfs = vfs->vfs_data;
 
 	ZFS_ENTER(zfsvfs);
+
 	znode_t *znode;
 
-	int error = zfs_zget(zfsvfs, inode, &znode, B_TRUE);
+	int error = zfs_zget(zfsvfs, parent_inode, &znode, B_FALSE);
 	if(error) {
 	    ZFS_EXIT(zfsvfs);
 	    /* If the inode we are trying to get was recently deleted
 	       dnode_hold_impl will return EEXIST instead of ENOENT */
-	    return error == EEXIST ? INVERT_SIGN(ENOENT) : INVERT_SIGN(error);
+	    return INVERT_SIGN(error == EEXIST ? ENOENT : error);
 	}
+
 	ASSERT(znode != NULL);
-	vnode_t *vp = ZTOV(znode);
+	vnode_t *dvp = ZTOV(znode);
+	ASSERT(dvp != NULL);
+
+	cred_t *cred = &s_cred;
+
+	/*parent is held once for all names, and every group of names is
+	  done by single transaction*/
+	if ( dvp->v_type != VDIR )
+	    error = ENOTDIR;
+	else if ( create ){
+	    vattr_t vattr = { 0 };
+	    vattr.va_type = VREG;
+	    vattr.va_mode = mode & PERMMASK;
+	    vattr.va_mask = AT_TYPE | AT_MODE;
+	    error = zfs_create_names(dvp, (char **) names, count, &vattr, cred, errors);
+	}
+	else
+	    error = zfs_remove_names(dvp, (char **) names, count, cred, errors);
+
+	VN_RELE(dvp);
+	ZFS_EXIT(zfsvfs);
+
+	if ( error )
+	    return INVERT_SIGN(error);
+	for ( i=0; i < count; i++ )
+	    if ( errors[i] == 0 ) ++done;
+	return done;
+}
+
+static int zfs_create_batch(struct LowLevelFilesystemPublicInterface* this_, 
+			    ino_t parent_inode, const char **names, int count,
+			    uint32_t mode, int *errors){
+	return zfs_dir_batch(this_, parent_inode, names, count, mode, errors, 1);
+}
+
+static int zfs_unlink_batch(struct LowLevelFilesystemPublicInterface* this_, 
+			    ino_t parent_inode, const char **names, int count,
+			    int *errors){
+	return zfs_dir_batch(this_, parent_inode, names, count, 0, errors, 0);
+}
+
+/*uio moves data by modifying iovecs, so it gets copy of caller's array
+ *@return total bytes count, or -1 if iovecs are not valid*/
+static ssize_t setup_uio(uio_t *uio, iovec_t *uio_iovs, 
+			 const struct iovec *iov, int iovcnt, off_t offset){
+	ssize_t total=0;
+	int i;
+	for ( i=0; i < iovcnt; i++ ){
+	    if ( iov[i].iov_len > SSIZE_MAX - total )
+		return -1;
+	    total += iov[i].iov_len;
+	    uio_iovs[i] = iov[i];
+	}
+	uio->uio_iov = uio_iovs;
+	uio->uio_iovcnt = iovcnt;
+	uio->uio_segflg = UIO_SYSSPACE;
+	uio->uio_fmode = 0;
+	uio->uio_extflg = 0;
+	uio->uio_llimit = RLIM64_INFINITY;
+	uio->uio_resid = total;
+	uio->uio_loffset = offset;
+	return total;
+}
+
+static ssize_t zfs_preadv(struct LowLevelFilesystemPublicInterface* this_,
+			  void *node, const struct iovec *iov, int iovcnt, off_t offset){
+	vnode_t *vp = (vnode_t *)node;
 	ASSERT(vp != NULL);
 
-	iovec_t iovec;
-	uio_t uio;
-	uio.uio_iov = &iovec;
-	uio.uio_iovcnt = 1;
-	uio.uio_segflg = UIO_SYSSPACE;
-	uio.uio_fmode = 0;
-	uio.uio_llimit = RLIM64_INFINITY;
+	if ( iovcnt <= 0 || iovcnt > IOV_MAX )
+	    return INVERT_SIGN(EINVAL);
 
-	iovec.iov_base = buf;
-	iovec.iov_len = size;
-	uio.uio_resid = iovec.iov_len;
-	uio.uio_loffset = offset;
+	iovec_t uio_iovs[iovcnt];
+	uio_t uio;
+	if ( setup_uio(&uio, uio_iovs, iov, iovcnt, offset) < 0 )
+	    return INVERT_SIGN(EINVAL);
 
 	cred_t *cred = &s_cred;
 
-	/*flags can't be checked here because flag can't be
-	  represented by inode, so do test skiping by specifying valid
+	/*vnode is held by open, and zfs_read does ZFS_ENTER itself.
+	  flags can't be checked here because flag can't be
+	  represented by node, so do test skiping by specifying valid
 	  flag*/
-	error = VOP_READ(vp, &uio, O_RDONLY, cred, NULL);
-
-	ZFS_EXIT(zfsvfs);
+	int error = VOP_READ(vp, &uio, O_RDONLY, cred, NULL);
 
 	if ( uio.uio_loffset - offset >=0 && error == 0 ) 
 	    return uio.uio_loffset - offset; //readed bytes
@@ -390,47 +535,25 @@ static ssize_t zfs_pread(struct LowLevelFilesystemPublicInterface* this_,
 	return INVERT_SIGN(error);
 }
 
-static ssize_t zfs_pwrite(struct LowLevelFilesystemPublicInterface* this_,
-			  ino_t inode, const void *buf, size_t size, off_t offset){
-	struct ZfsFilesystem* zfs = (struct ZfsFilesystem*)this_;
-
-	vfs_t *vfs = zfs->vfs;
-	zfsvfs_t *zfsvfs = vfs->vfs_data;
-
-	ZFS_ENTER(zfsvfs);
-	znode_t *znode;
-
-	int error = zfs_zget(zfsvfs, inode, &znode, B_TRUE);
-	if(error) {
-	    ZFS_EXIT(zfsvfs);
-	    /* If the inode we are trying to get was recently deleted
-	       dnode_hold_impl will return EEXIST instead of ENOENT */
-	    return error == EEXIST ? INVERT_SIGN(ENOENT) : INVERT_SIGN(error);
-	}
-	ASSERT(znode != NULL);
-	vnode_t *vp = ZTOV(znode);
+static ssize_t zfs_pwritev(struct LowLevelFilesystemPublicInterface* this_,
+			   void *node, const struct iovec *iov, int iovcnt, off_t offset){
+	vnode_t *vp = (vnode_t *)node;
 	ASSERT(vp != NULL);
 
-	iovec_t iovec;
-	uio_t uio;
-	uio.uio_iov = &iovec;
-	uio.uio_iovcnt = 1;
-	uio.uio_segflg = UIO_SYSSPACE;
-	uio.uio_fmode = 0;
-	uio.uio_llimit = RLIM64_INFINITY;
+	if ( iovcnt <= 0 || iovcnt > IOV_MAX )
+	    return INVERT_SIGN(EINVAL);
 
-	iovec.iov_base = (void *) buf;
-	iovec.iov_len = size;
-	uio.uio_resid = iovec.iov_len;
-	uio.uio_loffset = offset;
+	iovec_t uio_iovs[iovcnt];
+	uio_t uio;
+	if ( setup_uio(&uio, uio_iovs, iov, iovcnt, offset) < 0 )
+	    return INVERT_SIGN(EINVAL);
 
 	cred_t *cred = &s_cred;
-	/*flags can't be checked here because flag can't be
-	  represented by inode, so do test skiping by specifying valid
+	/*vnode is held by open, and zfs_write does ZFS_ENTER itself.
+	  flags can't be checked here because flag can't be
+	  represented by node, so do test skiping by specifying valid
 	  flag*/
-	error = VOP_WRITE(vp, &uio, O_WRONLY, cred, NULL);
-
-	ZFS_EXIT(zfsvfs);
+	int error = VOP_WRITE(vp, &uio, O_WRONLY, cred, NULL);
 
 	if(!error) {
 	    /* When not using direct_io, we must always write 'size' bytes */
@@ -443,34 +566,442 @@ static ssize_t zfs_pwrite(struct LowLevelFilesystemPublicInterface* this_,
 	return INVERT_SIGN(error);
 }
 
+/*cache buffers lent by read_borrow, they are held together with range
+  lock, so data can't be changed by writers until read_return*/
+struct ReadLoan{
+	rl_t       *rl;
+	dmu_buf_t **dbp;
+	int         numbufs;
+};
 
-static int zfs_getdents(struct LowLevelFilesystemPublicInterface* this_, 
-			ino_t inode, void *buf, unsigned int count, off_t offset,
-			int *lastcall_workaround){
-	struct ZfsFilesystem* zfs = (struct ZfsFilesystem*)this_;
+static ssize_t zfs_read_borrow(struct LowLevelFilesystemPublicInterface* this_,
+			       void *node, size_t size, off_t offset,
+			       struct iovec *iov, int *iovcnt, void **loan){
+	vnode_t *vp = (vnode_t *)node;
+	ASSERT(vp != NULL);
+	znode_t *zp = VTOZ(vp);
+	zfsvfs_t *zfsvfs = zp->z_zfsvfs;
+	struct ReadLoan *rloan;
+	uint64_t end, limit;
+	int i, error;
+
+	*loan = NULL;
+	if ( offset < 0 || *iovcnt <= 0 )
+	    return INVERT_SIGN(EINVAL);
+	if ( vp->v_type == VDIR )
+	    return INVERT_SIGN(EISDIR);
 
-	vfs_t *vfs = zfs->vfs;
-	zfsvfs_t *zfsvfs = vfs->vfs_data;
+	ZFS_ENTER(zfsvfs);
+	ZFS_VERIFY_ZP(zp);
+
+	rloan = kmem_alloc(sizeof(struct ReadLoan), KM_SLEEP);
+	rloan->rl = zfs_range_lock(zp, offset, size, RL_READER);
+
+	/*lent range is limited by end of file and by count of
+	  iovecs, every iovec points into single block*/
+	end = MIN(offset + size, zp->z_phys->zp_size);
+	if ( offset < end && zp->z_blksz ){
+	    limit = (offset / zp->z_blksz + *iovcnt) * zp->z_blksz;
+	    end = MIN(end, limit);
+	}
+	if ( offset >= end ){
+	    zfs_range_unlock(rloan->rl);
+	    kmem_free(rloan, sizeof(struct ReadLoan));
+	    ZFS_EXIT(zfsvfs);
+	    *iovcnt = 0;
+	    return 0;
+	}
+
+	error = dmu_buf_hold_array_by_bonus(zp->z_dbuf, offset, end - offset,
+					    TRUE, rloan, &rloan->numbufs, &rloan->dbp);
+	if ( error ){
+	    zfs_range_unlock(rloan->rl);
+	    kmem_free(rloan, sizeof(struct ReadLoan));
+	    ZFS_EXIT(zfsvfs);
+	    /* convert checksum errors into IO errors */
+	    return INVERT_SIGN(error == ECKSUM ? EIO : error);
+	}
+	ASSERT(rloan->numbufs <= *iovcnt);
+
+	for ( i=0; i < rloan->numbufs; i++ ){
+	    dmu_buf_t *db = rloan->dbp[i];
+	    uint64_t start = MAX(offset, db->db_offset);
+	    uint64_t stop = MIN(end, db->db_offset + db->db_size);
+	    iov[i].iov_base = (char *)db->db_data + (start - db->db_offset);
+	    iov[i].iov_len = stop - start;
+	}
+	*iovcnt = rloan->numbufs;
+	*loan = rloan;
+
+	ZFS_ACCESSTIME_STAMP(zfsvfs, zp);
+	ZFS_EXIT(zfsvfs);
+	return end - offset;
+}
+
+static void zfs_read_return(struct LowLevelFilesystemPublicInterface* this_,
+			    void *loan){
+	struct ReadLoan *rloan = (struct ReadLoan *)loan;
+	if ( rloan == NULL )
+	    return;
+	dmu_buf_rele_array(rloan->dbp, rloan->numbufs, rloan);
+	zfs_range_unlock(rloan->rl);
+	kmem_free(rloan, sizeof(struct ReadLoan));
+}
+
+/*buffers lent by write_loan: whole records of range are arc buffers
+  loaned by dmu, they become file data without copying; unaligned head
+  and tail of range are plain memory, that is copied by zfs_write*/
+struct WriteLoan{
+	vnode_t    *vp;
+	off_t       offset;
+	iovec_t    *iovs;       /*segments of range, one per iovec*/
+	int         iovcnt;
+	int         first_buf;  /*index of first segment backed by arc buffer*/
+	arc_buf_t **bufs;       /*NULL items are consumed by zfs_write*/
+	int         nbufs;
+};
+
+/*@return length of range segment starting at pos, it's whole record
+  if pos is aligned, or a part of record up to next record boundary*/
+static uint64_t write_loan_segment(uint64_t pos, uint64_t end, uint64_t blksz){
+	if ( P2PHASE(pos, blksz) == 0 && end - pos >= blksz )
+	    return blksz;
+	return MIN(end, P2ROUNDUP(pos + 1, blksz)) - pos;
+}
+
+static void write_loan_free(struct WriteLoan *wloan){
+	int i;
+	for ( i=0; i < wloan->iovcnt; i++ ){
+	    int b = i - wloan->first_buf;
+	    if ( b >= 0 && b < wloan->nbufs ){
+		if ( wloan->bufs[b] != NULL )
+		    dmu_return_arcbuf(wloan->bufs[b]);
+	    }
+	    else
+		kmem_free(wloan->iovs[i].iov_base, wloan->iovs[i].iov_len);
+	}
+	if ( wloan->nbufs )
+	    kmem_free(wloan->bufs, wloan->nbufs * sizeof(arc_buf_t *));
+	kmem_free(wloan->iovs, wloan->iovcnt * sizeof(iovec_t));
+	kmem_free(wloan, sizeof(struct WriteLoan));
+}
+
+static ssize_t zfs_write_loan(struct LowLevelFilesystemPublicInterface* this_,
+			      void *node, size_t size, off_t offset,
+			      struct iovec *iov, int *iovcnt, void **loan){
+	vnode_t *vp = (vnode_t *)node;
+	ASSERT(vp != NULL);
+	znode_t *zp = VTOZ(vp);
+	zfsvfs_t *zfsvfs = zp->z_zfsvfs;
+	struct WriteLoan *wloan;
+	uint64_t blksz = zfsvfs->z_max_blksz;
+	uint64_t pos, len, end;
+	int i, n;
+
+	*loan = NULL;
+	if ( offset < 0 || *iovcnt <= 0 || size > SSIZE_MAX )
+	    return INVERT_SIGN(EINVAL);
+	if ( vp->v_type == VDIR )
+	    return INVERT_SIGN(EISDIR);
+	if ( size == 0 ){
+	    *iovcnt = 0;
+	    return 0;
+	}
 
 	ZFS_ENTER(zfsvfs);
-	znode_t *znode;
+	ZFS_VERIFY_ZP(zp);
+
+	/*range is limited by count of iovecs, every iovec is single
+	  segment*/
+	end = offset + size;
+	for ( pos=offset, n=0; pos < end && n < *iovcnt; n++ )
+	    pos += write_loan_segment(pos, end, blksz);
+	end = pos;
+
+	wloan = kmem_zalloc(sizeof(struct WriteLoan), KM_SLEEP);
+	wloan->vp = vp;
+	wloan->offset = offset;
+	wloan->iovcnt = n;
+	wloan->iovs = kmem_alloc(n * sizeof(iovec_t), KM_SLEEP);
+	wloan->first_buf = -1;
+	for ( pos=offset, i=0; i < n; i++, pos += len ){
+	    len = write_loan_segment(pos, end, blksz);
+	    if ( len == blksz && P2PHASE(pos, blksz) == 0 && wloan->first_buf < 0 ){
+		wloan->first_buf = i;
+		wloan->nbufs = (P2ALIGN(end, blksz) - pos) / blksz;
+		wloan->bufs = kmem_alloc(wloan->nbufs * sizeof(arc_buf_t *), KM_SLEEP);
+	    }
+	    if ( wloan->first_buf >= 0 && i - wloan->first_buf < wloan->nbufs ){
+		arc_buf_t *abuf = dmu_request_arcbuf(zp->z_dbuf, blksz);
+		wloan->bufs[i - wloan->first_buf] = abuf;
+		wloan->iovs[i].iov_base = abuf->b_data;
+	    }
+	    else
+		wloan->iovs[i].iov_base = kmem_alloc(len, KM_SLEEP);
+	    wloan->iovs[i].iov_len = len;
+	    iov[i].iov_base = wloan->iovs[i].iov_base;
+	    iov[i].iov_len = len;
+	}
+	*iovcnt = n;
+	*loan = wloan;
 
-	int error = zfs_zget(zfsvfs, inode, &znode, B_TRUE);
-	if(error) {
+	ZFS_EXIT(zfsvfs);
+	return end - offset;
+}
+
+static ssize_t zfs_write_commit(struct LowLevelFilesystemPublicInterface* this_,
+				void *loan, size_t size){
+	struct WriteLoan *wloan = (struct WriteLoan *)loan;
+	if ( wloan == NULL )
+	    return 0;
+
+	off_t offset = wloan->offset;
+	iovec_t uio_iovs[wloan->iovcnt];
+	xuio_t xuio;
+	uio_t *uio = &xuio.xu_uio;
+	ssize_t total = setup_uio(uio, uio_iovs, wloan->iovs, wloan->iovcnt, offset);
+	int error = 0;
+
+	/*caller can fill only beginning of lent range*/
+	if ( size < total )
+	    uio->uio_resid = size;
+	/*only head segment can precede first loaned buffer*/
+	uio->uio_extflg = UIO_XUIO;
+	xuio.xu_nbufs = wloan->nbufs;
+	xuio.xu_bufs = wloan->bufs;
+	xuio.xu_offset = offset + (wloan->first_buf > 0 ? wloan->iovs[0].iov_len : 0);
+	xuio.xu_blksz = wloan->nbufs ? wloan->iovs[wloan->first_buf].iov_len : 0;
+
+	if ( uio->uio_resid > 0 ){
+	    cred_t *cred = &s_cred;
+	    /*vnode is held by open, zfs_write does ZFS_ENTER itself and
+	      takes away loaned buffers of whole records*/
+	    error = VOP_WRITE(wloan->vp, uio, O_WRONLY, cred, NULL);
+	}
+	if ( !error )
+	    VERIFY(uio->uio_resid == 0);
+
+	/*buffers that are not taken by zfs_write are returned here*/
+	write_loan_free(wloan);
+
+	if ( uio->uio_loffset - offset >= 0 && error == 0 )
+	    return uio->uio_loffset - offset; //wrote bytes
+	return INVERT_SIGN(error);
+}
+
+static void zfs_write_abort(struct LowLevelFilesystemPublicInterface* this_,
+			    void *loan){
+	struct WriteLoan *wloan = (struct WriteLoan *)loan;
+	if ( wloan == NULL )
+	    return;
+	write_loan_free(wloan);
+}
+
+/*cached block is hole if it was never written, or was freed and not
+  written again; block is stable while its range is read locked*/
+static boolean_t copy_range_is_hole(dmu_buf_t *db){
+	dmu_buf_impl_t *dbi = (dmu_buf_impl_t *)db;
+	return dbi->db_last_dirty == NULL && 
+	    (dbi->db_blkptr == NULL || BP_IS_HOLE(dbi->db_blkptr));
+}
+
+/*copy bytes between scattered buffers
+ *@return copied bytes*/
+static size_t copy_range_iovs(const struct iovec *dst, int dstcnt, 
+			      const struct iovec *src, int srccnt, size_t size){
+	size_t done = 0, doff = 0, soff = 0, len;
+	int d = 0, s = 0;
+	while ( done < size && d < dstcnt && s < srccnt ){
+	    len = MIN(size - done, MIN(dst[d].iov_len - doff, src[s].iov_len - soff));
+	    memcpy((char *)dst[d].iov_base + doff, (char *)src[s].iov_base + soff, len);
+	    done += len;
+	    if ( (doff += len) == dst[d].iov_len ){ ++d; doff = 0; }
+	    if ( (soff += len) == src[s].iov_len ){ ++s; soff = 0; }
+	}
+	return done;
+}
+
+static int zfs_fallocate(struct LowLevelFilesystemPublicInterface* this_, 
+			 void *node, int mode, off_t offset, off_t length);
+
+/*source records are borrowed from cache and copied straight into
+  buffers lent for destination, so data crosses memory once and whole
+  records of destination are assigned without more copying; runs of
+  source holes become holes of destination*/
+static ssize_t zfs_copy_range(struct LowLevelFilesystemPublicInterface* this_,
+			      void *src_node, off_t src_offset,
+			      void *dst_node, off_t dst_offset, size_t size){
+	vnode_t *src_vp = (vnode_t *)src_node;
+	vnode_t *dst_vp = (vnode_t *)dst_node;
+	struct iovec siov[COPY_RANGE_IOV_COUNT];
+	struct iovec diov[COPY_RANGE_IOV_COUNT];
+	size_t done = 0;
+	ssize_t ret = 0;
+
+	ASSERT(src_vp != NULL && dst_vp != NULL);
+	/*ends of both ranges must be valid offsets, so that offset+done
+	  can't overflow below*/
+	if ( src_offset < 0 || dst_offset < 0 || size > SSIZE_MAX ||
+	     (uint64_t)src_offset + size > MAXOFFSET_T ||
+	     (uint64_t)dst_offset + size > MAXOFFSET_T )
+	    return INVERT_SIGN(EINVAL);
+	if ( src_vp->v_type == VDIR || dst_vp->v_type == VDIR )
+	    return INVERT_SIGN(EISDIR);
+	/*overlapping ranges of the same file*/
+	if ( src_vp == dst_vp && src_offset < dst_offset + size && 
+	     dst_offset < src_offset + size )
+	    return INVERT_SIGN(EINVAL);
+
+	while ( done < size ){
+	    int scnt = COPY_RANGE_IOV_COUNT, dcnt = COPY_RANGE_IOV_COUNT;
+	    void *rloan, *wloan;
+	    struct ReadLoan *rl;
+	    size_t run = 0;
+	    boolean_t hole;
+	    int i;
+
+	    ret = zfs_read_borrow(this_, src_vp, size - done, src_offset + done,
+				  siov, &scnt, &rloan);
+	    if ( ret <= 0 )
+		break; //end of source file, or error
+	    rl = (struct ReadLoan *)rloan;
+	    /*leading run of holes or of data records*/
+	    hole = copy_range_is_hole(rl->dbp[0]);
+	    for ( i=0; i < scnt && copy_range_is_hole(rl->dbp[i]) == hole; i++ )
+		run += siov[i].iov_len;
+
+	    if ( hole ){
+		zfs_read_return(this_, rloan);
+		/*free destination range, then extend it if it's beyond end*/
+		ret = zfs_fallocate(this_, dst_vp, FALLOC_FL_PUNCH_HOLE|FALLOC_FL_KEEP_SIZE,
+				    dst_offset + done, run);
+		if ( ret == 0 )
+		    ret = zfs_fallocate(this_, dst_vp, 0, dst_offset + done, run);
+		if ( ret < 0 )
+		    break;
+		done += run;
+		continue;
+	    }
+
+	    ret = zfs_write_loan(this_, dst_vp, run, dst_offset + done, 
+				 diov, &dcnt, &wloan);
+	    if ( ret <= 0 ){
+		zfs_read_return(this_, rloan);
+		break;
+	    }
+	    run = copy_range_iovs(diov, dcnt, siov, i, ret);
+	    zfs_read_return(this_, rloan);
+	    ret = zfs_write_commit(this_, wloan, run);
+	    if ( ret < 0 )
+		break;
+	    done += ret;
+	    if ( ret < run )
+		break;
+	}
+	/*error is returned only if nothing was copied*/
+	if ( ret < 0 && done == 0 )
+	    return ret;
+	return done;
+}
+
+static ssize_t zfs_pread(struct LowLevelFilesystemPublicInterface* this_,
+			 void *node, void *buf, size_t size, off_t offset){
+	struct iovec iov = { buf, size };
+	return zfs_preadv(this_, node, &iov, 1, offset);
+}
+
+static ssize_t zfs_pwrite(struct LowLevelFilesystemPublicInterface* this_,
+			  void *node, const void *buf, size_t size, off_t offset){
+	struct iovec iov = { (void *)buf, size };
+	return zfs_pwritev(this_, node, &iov, 1, offset);
+}
+
+
+static void fsync_latency_add(uint64_t *histogram, hrtime_t start){
+	uint64_t usec = (gethrtime() - start) / 1000;
+	int bucket = 0;
+	while ( usec && bucket < FSYNC_LATENCY_BUCKETS-1 ){
+	    usec >>= 1;
+	    ++bucket;
+	}
+	atomic_inc_64(&s_fsync_stats.calls);
+	atomic_inc_64(&histogram[bucket]);
+}
+
+/*@param all push log records of all files, or only of given file*/
+static int fsync_log_write(zfsvfs_t *zfsvfs, vnode_t *vp, int datasync, 
+			   boolean_t all){
+	if ( !all )
+	    return VOP_FSYNC(vp, datasync ? FDSYNC : FSYNC, &s_cred, NULL);
+
+	ZFS_ENTER(zfsvfs);
+	zil_commit(zfsvfs->z_log, UINT64_MAX, 0);
+	ZFS_EXIT(zfsvfs);
+	return 0;
+}
+
+static int zfs_fsync(struct LowLevelFilesystemPublicInterface* this_, 
+		     void *node, int datasync){
+	struct ZfsFilesystem* zfs = (struct ZfsFilesystem*)this_;
+	zfsvfs_t *zfsvfs = zfs->vfs->vfs_data;
+	vnode_t *vp = (vnode_t *)node;
+	hrtime_t start = gethrtime();
+	uint64_t batch;
+	int error = 0;
+	ASSERT(vp != NULL);
+
+	if ( zrt_fsync_txg_wait ){
+	    ZFS_ENTER(zfsvfs);
+	    txg_wait_synced(dmu_objset_pool(zfsvfs->z_os), 0);
 	    ZFS_EXIT(zfsvfs);
-	    /* If the inode we are trying to get was recently deleted
-	       dnode_hold_impl will return EEXIST instead of ENOENT */
-	    return error == EEXIST ? INVERT_SIGN(ENOENT) : INVERT_SIGN(error);
+	    fsync_latency_add(s_fsync_stats.txg_latency, start);
+	    return 0;
 	}
-	ASSERT(znode != NULL);
-	vnode_t *vp = ZTOV(znode);
+
+	mutex_enter(&zfs->fsync_lock);
+	/*log write that is in progress now may not contain records of
+	  this file, so wait for the next one*/
+	batch = zfs->fsync_started + 1;
+	++zfs->fsync_waiting;
+	while ( zfs->fsync_completed < batch ){
+	    if ( zfs->fsync_active ){
+		cv_wait(&zfs->fsync_cv, &zfs->fsync_lock);
+		continue;
+	    }
+	    /*become leader of log write, if somebody else is waiting
+	      too then write records of all files at once*/
+	    boolean_t all = zfs->fsync_waiting > 1;
+	    zfs->fsync_active = B_TRUE;
+	    zfs->fsync_started = batch;
+	    mutex_exit(&zfs->fsync_lock);
+
+	    error = fsync_log_write(zfsvfs, vp, datasync, all);
+
+	    mutex_enter(&zfs->fsync_lock);
+	    zfs->fsync_active = B_FALSE;
+	    zfs->fsync_completed = batch;
+	    cv_broadcast(&zfs->fsync_cv);
+	    atomic_inc_64(&s_fsync_stats.commits);
+	}
+	--zfs->fsync_waiting;
+	mutex_exit(&zfs->fsync_lock);
+
+	fsync_latency_add(s_fsync_stats.zil_latency, start);
+	return INVERT_SIGN(error);
+}
+
+void zfs_filesystem_fsync_stats(struct FsyncStats *stats){
+	*stats = s_fsync_stats;
+}
+
+static int zfs_getdents(struct LowLevelFilesystemPublicInterface* this_, 
+			void *node, void *buf, unsigned int count, off_t *cookie){
+	vnode_t *vp = (vnode_t *)node;
 	ASSERT(vp != NULL);
 
 	if(vp->v_type != VDIR)
 	    return INVERT_SIGN(ENOTDIR);
 
-	ZFS_ENTER(zfsvfs);
-
 	cred_t *cred = &s_cred;
 
 	iovec_t iovec;
@@ -483,30 +1014,58 @@ static int zfs_getdents(struct LowLevelFilesystemPublicInterface* this_,
 
 	int eofp = 0;
 
-	int outbuf_off = 0;
-	int outbuf_resid = count;
-	off_t next = offset;
-	
 	iovec.iov_base = buf;
 	iovec.iov_len = count;
 	uio.uio_resid = iovec.iov_len;
-	uio.uio_loffset = next;
+	/*zfs directory offset is serialized zap cursor, so reading
+	  resumes exactly from the entry where previous call stopped*/
+	uio.uio_loffset = *cookie;
 
-	error = VOP_READDIR(vp, &uio, cred, &eofp, NULL, 0);
-	*lastcall_workaround = eofp;
-	if(error)
-	    goto out;
+	int error = VOP_READDIR(vp, &uio, cred, &eofp, NULL, 0);
+	if ( error )
+	    return INVERT_SIGN(error);
 
- out:
-	ZFS_EXIT(zfsvfs);
+	*cookie = uio.uio_loffset;
+	return (char*)iovec.iov_base - (char*)buf;
+}
 
-	if ( uio.uio_loffset > 0 )
-	    return iovec.iov_base - buf;
-	else
-	    return INVERT_SIGN(error);
+static int zfs_getdents_plus(struct LowLevelFilesystemPublicInterface* this_, 
+			     void *node, void *buf, unsigned int count, off_t *cookie,
+			     struct stat *stats, int stats_count){
+	struct ZfsFilesystem* zfs = (struct ZfsFilesystem*)this_;
+	zfsvfs_t *zfsvfs = zfs->vfs->vfs_data;
+	size_t min_reclen = this_->dirent_engine->adjusted_dirent_size(1);
+	unsigned long d_ino, d_type;
+	int cursor=0, index=0;
+	int len;
+
+	/*every entry takes at least min_reclen bytes, limit buffer
+	  to be sure that all returned entries have own stats item*/
+	if ( count > stats_count*min_reclen )
+	    count = stats_count*min_reclen;
+	if ( (len=zfs_getdents(this_, node, buf, count, cookie)) <= 0 )
+	    return len;
+
+	ZFS_ENTER(zfsvfs);
+	while( this_->dirent_engine->get_next_item_from_dirent_buf(buf, len, &cursor,
+								  &d_ino, &d_type) != NULL ){
+	    znode_t *znode;
+	    ASSERT(index < stats_count);
+	    memset(&stats[index], 0, sizeof(struct stat));
+	    /*entry could be removed after readdir, or it's .zfs control
+	      dir without znode; leave it's attributes empty*/
+	    if ( zfs_zget(zfsvfs, d_ino, &znode, B_FALSE) == 0 ){
+		internal_stat(ZTOV(znode), &stats[index]);
+		VN_RELE(ZTOV(znode));
+	    }
+	    ++index;
+	}
+	ZFS_EXIT(zfsvfs);
+	return len;
 }
 
-static int zfs_opendir(struct LowLevelFilesystemPublicInterface* this_, ino_t inode)
+static int zfs_opendir(struct LowLevelFilesystemPublicInterface* this_, ino_t inode,
+		       void **node)
 {
 	struct ZfsFilesystem* zfs = (struct ZfsFilesystem*)this_;
 
@@ -550,54 +1109,38 @@ static int zfs_opendir(struct LowLevelFilesystemPublicInterface* this_, ino_t in
 out:
 	if(error)
 		VN_RELE(vp);
+	else
+		*node = vp; /*keep hold until close*/
 	ZFS_EXIT(zfsvfs);
 
 	return INVERT_SIGN(error);
 }
 
 
-static int zfs_close(struct LowLevelFilesystemPublicInterface* this_, ino_t inode, int fflags){
-	struct ZfsFilesystem* zfs = (struct ZfsFilesystem*)this_;
-
-	vfs_t *vfs = zfs->vfs;
-	zfsvfs_t *zfsvfs = vfs->vfs_data;
-
-	ZFS_ENTER(zfsvfs);
-	ZFS_ENTER(zfsvfs);
-	znode_t *znode;
-
-	int error = zfs_zget(zfsvfs, inode, &znode, B_TRUE);
-	if(error) {
-	    ZFS_EXIT(zfsvfs);
-	    /* If the inode we are trying to get was recently deleted
-	       dnode_hold_impl will return EEXIST instead of ENOENT */
-	    return INVERT_SIGN(error == EEXIST ? ENOENT : error);
-	}
-	ASSERT(znode != NULL);
-	vnode_t *vp = ZTOV(znode);
+static int zfs_close(struct LowLevelFilesystemPublicInterface* this_, void *node, int fflags){
+	vnode_t *vp = (vnode_t *)node;
 	ASSERT(vp != NULL);
 
-
 	int mode, flags;
 	get_zfs_flags_from_standard_open_flags_mode( fflags, &flags, &mode );
 
 	cred_t *cred = &s_cred;
-	VOP_CLOSE(vp, flags, 1, (offset_t) 0, cred, NULL);
+	int error = VOP_CLOSE(vp, flags, 1, (offset_t) 0, cred, NULL);
 
 	VERIFY(error == 0);
 
+	/*release hold obtained by open*/
 	VN_RELE(vp);
 
-	ZFS_EXIT(zfsvfs);
-
 	return INVERT_SIGN(error);
 }
 static int zfs_open(struct LowLevelFilesystemPublicInterface* this_, 
-		    ino_t parent_inode, const char* name, int fflags, uint32_t createmode){
+		    ino_t parent_inode, const char* name, int fflags, uint32_t createmode,
+		    void **node){
 	struct ZfsFilesystem* zfs = (struct ZfsFilesystem*)this_;
 
 	if ( fflags & O_DIRECTORY )
-	    return zfs_opendir(this_, parent_inode);
+	    return zfs_opendir(this_, parent_inode, node);
 	else{
 	    if(name && strlen(name) >= MAXNAMELEN)
 		return INVERT_SIGN(ENAMETOOLONG);
@@ -711,13 +1254,17 @@ static int zfs_open(struct LowLevelFilesystemPublicInterface* this_,
 		ASSERT(vp->v_count > 0);
 		VN_RELE(vp);
 	    }
+	    else
+		*node = vp; /*keep hold until close*/
 
 	    ZFS_EXIT(zfsvfs);
 
-	    if (flags & FCREAT)
+	    if (error)
+		return INVERT_SIGN(error);
+	    else if (flags & FCREAT)
 		return VTOZ(vp)->z_id;
 	    else
-		return INVERT_SIGN(error);
+		return 0;
 	}
 }
 
@@ -1034,33 +1581,38 @@ static int zfs_rename(struct LowLevelFilesystemPublicInterface* this_,
 	return INVERT_SIGN(error);
 }
 static int zfs_ftruncate_size(struct LowLevelFilesystemPublicInterface* this_, 
-			      ino_t inode, off_t length){
+			      ino_t inode, void *node, off_t length){
 	struct ZfsFilesystem* zfs = (struct ZfsFilesystem*)this_;
 	vfs_t *vfs = zfs->vfs;
 	zfsvfs_t *zfsvfs = vfs->vfs_data;
+	vnode_t *vp = (vnode_t *)node;
+	boolean_t release = B_FALSE;
+	int error;
 
 	ZFS_ENTER(zfsvfs);
-	ZFS_ENTER(zfsvfs);
-	znode_t *znode;
 
-	int error = zfs_zget(zfsvfs, inode, &znode, B_TRUE);
-	if(error) {
-	    ZFS_EXIT(zfsvfs);
-	    /* If the inode we are trying to get was recently deleted
-	       dnode_hold_impl will return EEXIST instead of ENOENT */
-	    return INVERT_SIGN(error == EEXIST ? ENOENT : error);
+	/*get vnode by inode if file is not opened*/
+	if ( vp == NULL ){
+	    znode_t *znode;
+
+	    error = zfs_zget(zfsvfs, inode, &znode, B_TRUE);
+	    if(error) {
+		ZFS_EXIT(zfsvfs);
+		/* If the inode we are trying to get was recently deleted
+		   dnode_hold_impl will return EEXIST instead of ENOENT */
+		return INVERT_SIGN(error == EEXIST ? ENOENT : error);
+	    }
+	    ASSERT(znode != NULL);
+	    vp = ZTOV(znode);
+	    release = B_TRUE;
 	}
-	ASSERT(znode != NULL);
-	vnode_t *vp = ZTOV(znode);
 	ASSERT(vp != NULL);
 
 	cred_t *cred = &s_cred;
-	boolean_t release;
 	int flags = FWRITE; 
 	/*Flags did checked on toplevelfs, and real flags checking
 	 *will be skipped, we just set valid flag*/
 	{
-	    release = B_FALSE;
 
 	    /*
 	     * Special treatment for ftruncate().
@@ -1112,9 +1664,94 @@ static int zfs_ftruncate_size(struct LowLevelFilesystemPublicInterface* this_,
 	return INVERT_SIGN(error);
 }
 
+static int zfs_fallocate(struct LowLevelFilesystemPublicInterface* this_, 
+			 void *node, int mode, off_t offset, off_t length){
+	struct ZfsFilesystem* zfs = (struct ZfsFilesystem*)this_;
+	zfsvfs_t *zfsvfs = zfs->vfs->vfs_data;
+	vnode_t *vp = (vnode_t *)node;
+	cred_t *cred = &s_cred;
+	flock64_t bf;
+	uint64_t size;
+	int error = 0;
+
+	ASSERT(vp != NULL);
+	if ( offset < 0 || length <= 0 || offset + length < offset )
+	    return INVERT_SIGN(EINVAL);
+	if ( mode != 0 && mode != FALLOC_FL_KEEP_SIZE &&
+	     mode != (FALLOC_FL_PUNCH_HOLE|FALLOC_FL_KEEP_SIZE) )
+	    return INVERT_SIGN(EOPNOTSUPP);
+	if ( vp->v_type != VREG )
+	    return INVERT_SIGN(ENODEV);
+
+	ZFS_ENTER(zfsvfs);
+	size = VTOZ(vp)->z_phys->zp_size;
+
+	bf.l_whence = 0; /* beginning of file */
+	bf.l_type = F_WRLCK;
+	if ( mode & FALLOC_FL_PUNCH_HOLE ){
+	    /*zfs_freesp extends file if range goes beyond end, but punched
+	      file must keep its size*/
+	    if ( (uint64_t)offset < size ){
+		bf.l_start = offset;
+		bf.l_len = MIN((uint64_t)length, size - offset);
+		error = VOP_SPACE(vp, F_FREESP, &bf, FWRITE, 0, cred, NULL);
+	    }
+	}
+	else if ( mode == 0 && (uint64_t)(offset + length) > size ){
+	    /*blocks can't be reserved for copy-on-write, only size is set*/
+	    bf.l_start = offset + length;
+	    bf.l_len = 0;
+	    error = VOP_SPACE(vp, F_FREESP, &bf, FWRITE, 0, cred, NULL);
+	}
+
+	ZFS_EXIT(zfsvfs);
+	return INVERT_SIGN(error);
+}
+
+/*same as zfs_holey of vnops, that is not built*/
+static off_t zfs_seek_data(struct LowLevelFilesystemPublicInterface* this_, 
+			   void *node, off_t offset, int whence){
+	struct ZfsFilesystem* zfs = (struct ZfsFilesystem*)this_;
+	zfsvfs_t *zfsvfs = zfs->vfs->vfs_data;
+	vnode_t *vp = (vnode_t *)node;
+	znode_t *zp;
+	uint64_t noff = offset;
+	uint64_t file_sz;
+	boolean_t hole = whence == SEEK_HOLE ? B_TRUE : B_FALSE;
+	int error;
+
+	ASSERT(vp != NULL);
+	if ( offset < 0 || (whence != SEEK_DATA && whence != SEEK_HOLE) )
+	    return INVERT_SIGN(EINVAL);
+
+	ZFS_ENTER(zfsvfs);
+	zp = VTOZ(vp);
+	file_sz = zp->z_phys->zp_size;
+	if ( noff >= file_sz ){
+	    ZFS_EXIT(zfsvfs);
+	    return INVERT_SIGN(ENXIO);
+	}
+
+	error = dmu_offset_next(zfsvfs->z_os, zp->z_id, hole, &noff);
+	ZFS_EXIT(zfsvfs);
+
+	/* end of file? */
+	if ( error == ESRCH || noff > file_sz ){
+	    /*
+	     * Handle the virtual hole at the end of file.
+	     */
+	    return hole ? (off_t)file_sz : INVERT_SIGN(ENXIO);
+	}
+	if ( error )
+	    return INVERT_SIGN(error);
+	/*block containing offset is data or hole as a whole*/
+	return noff < (uint64_t)offset ? offset : (off_t)noff;
+}
+
 
 static struct LowLevelFilesystemPublicInterface s_zfs_filesystem_interface = {
     zfs_lookup,
+    zfs_lookup_path,
     zfs_readlink,
     zfs_symlink,
     NULL, //chown
@@ -1124,16 +1761,29 @@ static struct LowLevelFilesystemPublicInterface s_zfs_filesystem_interface = {
     zfs_access,
     zfs_mkdir,
     zfs_rmdir,
+    zfs_create_batch,
+    zfs_unlink_batch,
     zfs_pread,
     zfs_pwrite,
+    zfs_preadv,
+    zfs_pwritev,
+    zfs_read_borrow,
+    zfs_read_return,
+    zfs_write_loan,
+    zfs_write_commit,
+    zfs_write_abort,
     zfs_getdents,
-    NULL, //fsync
+    zfs_getdents_plus,
+    zfs_fsync,
     zfs_close,
     zfs_open,
     zfs_unlink,
     zfs_link,
     zfs_rename,
     zfs_ftruncate_size,
+    zfs_fallocate,
+    zfs_seek_data,
+    zfs_copy_range,
     NULL
 };
 
@@ -1145,5 +1795,11 @@ CONSTRUCT_L(ZFS_FILESYSTEM) (vfs_t *vfs,
 	this_->public_ = s_zfs_filesystem_interface;
 	this_->public_.dirent_engine = dirent_engine;
 	this_->vfs = vfs;
+	mutex_init(&this_->fsync_lock, NULL, MUTEX_DEFAULT, NULL);
+	cv_init(&this_->fsync_cv, NULL, CV_DEFAULT, NULL);
+	this_->fsync_active = B_FALSE;
+	this_->fsync_waiting = 0;
+	this_->fsync_started = 0;
+	this_->fsync_completed = 0;
 	return &this_->public_;
 }
@@ -27,12 +27,31 @@
 /*name of constructor*/
 #define ZFS_FILESYSTEM zfs_filesystem_construct 
 
+#define FSYNC_LATENCY_BUCKETS 32
+
+/*fsync statistics of all zfs filesystems. Latency histogram bucket i
+ *counts calls that took [2^(i-1), 2^i) microseconds, bucket 0 counts
+ *calls faster than 1 microsecond*/
+struct FsyncStats{
+    uint64_t zil_latency[FSYNC_LATENCY_BUCKETS]; /*fsync by zil commit*/
+    uint64_t txg_latency[FSYNC_LATENCY_BUCKETS]; /*fsync by txg sync wait*/
+    uint64_t calls;
+    uint64_t commits;   /*zil log writes; calls-commits were coalesced*/
+};
+
+/*if nonzero then fsync waits for txg sync instead of zil commit, it's
+  to compare latencies given by zil with txg_latency histogram*/
+extern int zrt_fsync_txg_wait;
+
 struct DirentEnginePublicInterface;
 
 struct LowLevelFilesystemPublicInterface* 
 zfs_filesystem_construct(vfs_t *vfs,
 			 struct DirentEnginePublicInterface* dirent_engine);
 
+/*copy current fsync statistics*/
+void zfs_filesystem_fsync_stats(struct FsyncStats *stats);
+
 
 
 #endif //__ZFS_FILESYSTEM_H__
@@ -16,6 +16,11 @@
  * limitations under the License.
  */
 
+#include <errno.h>
+#include <string.h>
+#include <limits.h> //PATH_MAX
+
+#include "zrtlog.h"
 #include "zfs_filesystem.h"
 #include "zfs_toplevel_filesystem.h"
 #include "open_file_description.h"
@@ -23,8 +28,54 @@
 #include "handle_allocator.h"
 #include "dirent_engine.h"
 #include "cached_lookup.h"
+#include "cached_attr.h"
+#include "mem_filesystem.h"
+#include "hybrid_mounts.h"
+#include "zfs_mounts.h"
+
+/*caches of last constructed mount, for statistics*/
+static struct CachedLookupPublicInterface* s_cached_lookup;
+static struct CachedAttrPublicInterface*   s_cached_attr;
+/*memory filesystem of last constructed scratch mount*/
+static struct LowLevelFilesystemPublicInterface* s_mem_lowlevel_fs;
+
+/*create caches for lowlevel fs and toplevel fs using them*/
+static struct MountsPublicInterface* 
+toplevel_construct(struct LowLevelFilesystemPublicInterface* lowlevel_fs,
+		   struct CachedLookupPublicInterface** cached_lookup,
+		   struct CachedAttrPublicInterface** cached_attr){
+    *cached_lookup = CONSTRUCT_L(CACHED_LOOKUP)( lowlevel_fs );
+    *cached_attr = CONSTRUCT_L(CACHED_ATTR)( lowlevel_fs );
 
-extern vfs_t*  s_vfs;
+    /*create filesystem implementation of much top level, which can
+     accept paths, this interface purely can be used inside of ZRT*/
+    return CONSTRUCT_L(ZFS_TOPLEVEL_FILESYSTEM)( INSTANCE_L(HANDLE_ALLOCATOR)(),
+						 INSTANCE_L(OPEN_FILES_POOL)(),
+						 *cached_lookup,
+						 *cached_attr,
+						 lowlevel_fs);
+}
+
+/*create directory and all missing parents, existing are ignored*/
+static int mkdir_path(struct MountsPublicInterface* mounts, const char *path){
+    char dir[PATH_MAX];
+    size_t len = strlen(path);
+    size_t i;
+    if ( len >= sizeof(dir) )
+	return -1;
+    memcpy(dir, path, len+1);
+    for ( i=1; i <= len; i++ ){
+	if ( dir[i] != '/' && dir[i] != '\0' )
+	    continue;
+	if ( dir[i-1] == '/' )
+	    continue;
+	dir[i] = '\0';
+	if ( mounts->mkdir(mounts, dir, 0777) != 0 && errno != EEXIST )
+	    return -1;
+	dir[i] = path[i];
+    }
+    return 0;
+}
 
 struct MountsPublicInterface* zfs_mounts_construct(vfs_t *vfs){
     assert(vfs);
@@ -34,18 +85,58 @@ struct MountsPublicInterface* zfs_mounts_construct(vfs_t *vfs){
     /*create filesystem that driven by inodes, this fs is used by toplevelfs,
      and only toplevelfs must provide inodes*/
     struct LowLevelFilesystemPublicInterface* zfs_lowlevel_fs = 
-	CONSTRUCT_L(ZFS_FILESYSTEM)( s_vfs, dirent_engine );
+	CONSTRUCT_L(ZFS_FILESYSTEM)( vfs, dirent_engine );
 
-    struct CachedLookupPublicInterface* zfs_cached_lookup =
-	CONSTRUCT_L(CACHED_LOOKUP)( zfs_lowlevel_fs );
+    return toplevel_construct(zfs_lowlevel_fs, &s_cached_lookup, &s_cached_attr);
+}
 
-    /*create filesystem implementation of much top level, which can
-     accept paths, this interface purely can be used inside of ZRT*/
-    struct MountsPublicInterface* toplevel_fs = 
-	CONSTRUCT_L(ZFS_TOPLEVEL_FILESYSTEM)( INSTANCE_L(HANDLE_ALLOCATOR)(),
-					      INSTANCE_L(OPEN_FILES_POOL)(),
-					      zfs_cached_lookup,
-					      zfs_lowlevel_fs);
-    return toplevel_fs;
+struct MountsPublicInterface* zfs_scratch_mounts_construct(vfs_t *vfs,
+							   const char **prefixes, int count,
+							   size_t mem_limit){
+    struct CachedLookupPublicInterface* mem_cached_lookup;
+    struct CachedAttrPublicInterface* mem_cached_attr;
+    int i;
+    assert(vfs);
+    struct DirentEnginePublicInterface* dirent_engine = 
+	INSTANCE_L(DIRENT_ENGINE)();
+
+    struct LowLevelFilesystemPublicInterface* zfs_lowlevel_fs = 
+	CONSTRUCT_L(ZFS_FILESYSTEM)( vfs, dirent_engine );
+    struct MountsPublicInterface* zfs_toplevel_fs =
+	toplevel_construct(zfs_lowlevel_fs, &s_cached_lookup, &s_cached_attr);
+
+    /*files that don't fit into memory are spilled into zfs*/
+    struct LowLevelFilesystemPublicInterface* mem_lowlevel_fs = 
+	CONSTRUCT_L(MEM_FILESYSTEM)( mem_limit, zfs_lowlevel_fs, dirent_engine );
+    struct MountsPublicInterface* mem_toplevel_fs =
+	toplevel_construct(mem_lowlevel_fs, &mem_cached_lookup, &mem_cached_attr);
+
+    /*spill directory is created through toplevel, so its caches stay
+      valid; prefixes exist in zfs too, to be listed with their parents*/
+    zfs_toplevel_fs->mkdir(zfs_toplevel_fs, "/" MEM_SPILL_DIR, 0700);
+    for ( i=0; i < count; i++ ){
+	if ( mkdir_path(zfs_toplevel_fs, prefixes[i]) != 0 ||
+	     mkdir_path(mem_toplevel_fs, prefixes[i]) != 0 ){
+	    ZRT_LOG(L_ERROR, "scratch prefix %s can't be created, errno=%d",
+		    prefixes[i], errno);
+	}
+    }
+    s_mem_lowlevel_fs = mem_lowlevel_fs;
+    return CONSTRUCT_L(HYBRID_MOUNTS)( INSTANCE_L(HANDLE_ALLOCATOR)(),
+				       zfs_toplevel_fs, mem_toplevel_fs,
+				       prefixes, count );
 }
 
+void zfs_mounts_cache_stats(struct CachedLookupStats* lookup_stats,
+			    struct CachedAttrStats* attr_stats){
+    assert(s_cached_lookup != NULL);
+    s_cached_lookup->stats(s_cached_lookup, lookup_stats);
+    s_cached_attr->stats(s_cached_attr, attr_stats);
+}
+
+int zfs_mounts_scratch_stats(struct MemFilesystemStats* stats){
+    if ( s_mem_lowlevel_fs == NULL )
+	return -1;
+    mem_filesystem_stats(s_mem_lowlevel_fs, stats);
+    return 0;
+}
@@ -26,4 +26,25 @@
 
 struct MountsPublicInterface* zfs_mounts_construct(vfs_t *vfs);
 
+/*construct mounts keeping files residing under scratch prefixes in
+ *memory filesystem, limited by mem_limit bytes of data and spilling
+ *into zfs; all other paths are served by zfs. Prefix directories are
+ *created by constructor*/
+struct MountsPublicInterface* zfs_scratch_mounts_construct(vfs_t *vfs,
+							   const char **prefixes, int count,
+							   size_t mem_limit);
+
+struct CachedLookupStats;
+struct CachedAttrStats;
+struct MemFilesystemStats;
+
+/*get statistics of dentries and attributes caches of last constructed
+ *mount*/
+void zfs_mounts_cache_stats(struct CachedLookupStats* lookup_stats,
+			    struct CachedAttrStats* attr_stats);
+
+/*get statistics of memory filesystem of last constructed scratch mount
+ *@return 0 if ok, -1 if scratch mount was not constructed*/
+int zfs_mounts_scratch_stats(struct MemFilesystemStats* stats);
+
 #endif //__ZFS_MOUNTS_H__
@@ -22,6 +22,7 @@
 #include <fcntl.h>
 #include <stdarg.h>
 #include <errno.h>
+#include <string.h>
 
 #include "zrtlog.h"
 #include "zrt_helper_macros.h"
@@ -33,8 +34,8 @@
 #include "handle_allocator.h" //struct HandleAllocator, struct HandleItem
 #include "path_utils.h"
 #include "open_file_description.h" //struct OpenFilesPool, struct OpenFileDescription
-#include "dirent_engine.h"
 #include "cached_lookup.h"
+#include "cached_attr.h"
 
 #define GET_DESCRIPTOR_ENTRY_CHECK(fs, fd, entry_p)	\
     entry_p = (fs)->handle_allocator->entry( (fd) );	\
@@ -67,6 +68,7 @@ struct ZfsTopLevelFs{
     struct HandleAllocator* handle_allocator;
     struct OpenFilesPool*   open_files_pool;
     struct CachedLookupPublicInterface* cached_lookup;
+    struct CachedAttrPublicInterface*   cached_attr;
     struct LowLevelFilesystemPublicInterface* lowlevelfs;
     struct MountSpecificPublicInterface* mount_specific_interface;
 };
@@ -79,9 +81,31 @@ static const char* name_from_path( const char* path ){
     return path_component_backward(&temp_cursor, path, &reslen);
 }
 
-static int is_dir( struct LowLevelFilesystemPublicInterface* this_, ino_t inode ){
+/*drop cached dentry of last path component and attributes of parent
+ *directory, it's must be done by any operation that creates, removes or
+ *renames name in directory*/
+static void forget_path_name( struct ZfsTopLevelFs* fs, int parent_inode, const char* path ){
+    int reslen;
+    int temp_cursor;
+    const char* name;
+    INIT_TEMP_CURSOR(&temp_cursor);
+    if ( (name = path_component_backward(&temp_cursor, path, &reslen)) != NULL ){
+	name = strndupa(name, reslen);
+	fs->cached_lookup->forget_name(fs->cached_lookup, parent_inode, name);
+    }
+    fs->cached_attr->forget(fs->cached_attr, parent_inode);
+}
+
+/*drop cached attributes of inode, it's must be done by any operation
+ *that changes attributes or removes inode*/
+static void forget_attr( struct ZfsTopLevelFs* fs, int inode ){
+    if ( inode >= 0 )
+	fs->cached_attr->forget(fs->cached_attr, inode);
+}
+
+static int is_dir( struct ZfsTopLevelFs* fs, ino_t inode ){
     struct stat st;
-    int ret = this_->stat( this_, inode, &st );
+    int ret = fs->cached_attr->stat( fs->cached_attr, inode, &st );
     assert( ret == 0 );
     if ( S_ISDIR(st.st_mode) )
 	return 1;
@@ -129,7 +153,9 @@ static int toplevel_symlink(struct MountsPublicInterface* this_,
 	return -1;
     }
 
-    if ( (ret=fs->lowlevelfs->symlink(fs->lowlevelfs, oldpath, new_inode_parent, name)) < 0 ){
+    ret=fs->lowlevelfs->symlink(fs->lowlevelfs, oldpath, new_inode_parent, name);
+    forget_path_name(fs, new_inode_parent, newpath);
+    if ( ret < 0 ){
 	SET_ERRNO(-ret);
 	return -1;
     }
@@ -147,7 +173,9 @@ static int toplevel_chown(struct MountsPublicInterface* this_, const char* path,
     CHECK_FUNC_ENSURE_EXIST(fs, chown);
     GET_INODE_ENSURE_EXIST(fs, path, &inode);
 
-    if ( (ret=fs->lowlevelfs->chown(fs->lowlevelfs, inode, owner, group)) < 0 ){
+    ret=fs->lowlevelfs->chown(fs->lowlevelfs, inode, owner, group);
+    forget_attr(fs, inode);
+    if ( ret < 0 ){
 	SET_ERRNO(-ret);
 	return -1;
     }
@@ -163,7 +191,9 @@ static int toplevel_chmod(struct MountsPublicInterface* this_, const char* path,
     CHECK_FUNC_ENSURE_EXIST(fs, chmod);
     GET_INODE_ENSURE_EXIST(fs, path, &inode);
 
-    if ( (ret=fs->lowlevelfs->chmod(fs->lowlevelfs, inode, mode)) < 0 ){
+    ret=fs->lowlevelfs->chmod(fs->lowlevelfs, inode, mode);
+    forget_attr(fs, inode);
+    if ( ret < 0 ){
 	SET_ERRNO(-ret);
 	return -1;
     }
@@ -196,7 +226,7 @@ static int toplevel_stat(struct MountsPublicInterface* this_, const char* path,
     CHECK_FUNC_ENSURE_EXIST(fs, stat);
     GET_INODE_ENSURE_EXIST(fs, path, &inode);
 
-    if ( (ret=fs->lowlevelfs->stat(fs->lowlevelfs, inode, buf)) < 0 ){
+    if ( (ret=fs->cached_attr->stat(fs->cached_attr, inode, buf)) < 0 ){
 	SET_ERRNO(-ret);
 	return -1;
     }
@@ -241,7 +271,9 @@ static int toplevel_mkdir(struct MountsPublicInterface* this_, const char* path,
 	return -1;
     }
 
-    if ( (ret = fs->lowlevelfs->mkdir(fs->lowlevelfs, parent_inode, name, mode)) < 0 ){
+    ret = fs->lowlevelfs->mkdir(fs->lowlevelfs, parent_inode, name, mode);
+    forget_path_name(fs, parent_inode, path);
+    if ( ret < 0 ){
 	SET_ERRNO(-ret);
 	return -1;
     }
@@ -264,14 +296,76 @@ static int toplevel_rmdir(struct MountsPublicInterface* this_, const char* path)
 	return -1;
     }
 
+    int inode = fs->cached_lookup->inode_by_path(fs->cached_lookup, path);
     if ( (ret = fs->lowlevelfs->rmdir(fs->lowlevelfs, parent_inode, name)) < 0 ){
 	SET_ERRNO(-ret);
 	return -1;
     }
+    forget_path_name(fs, parent_inode, path);
+    forget_attr(fs, inode);
+    if ( inode >= 0 )
+	fs->cached_lookup->forget_dir(fs->cached_lookup, inode);
+
+    return ret;
+}
 
+/*names are components of directory dirpath*/
+static int check_batch_names(const char **names, int count){
+    int i;
+    for ( i=0; i < count; i++ ){
+	if ( names[i] == NULL || strchr(names[i], '/') != NULL )
+	    return -1;
+    }
+    return 0;
+}
+
+static int toplevel_dir_batch(struct ZfsTopLevelFs* fs, const char* dirpath,
+			      const char **names, int count, uint32_t mode, int *errors,
+			      int create){
+    int inode;
+    int i, ret;
+
+    GET_INODE_ENSURE_EXIST(fs, dirpath, &inode);
+
+    if ( count < 0 || check_batch_names(names, count) != 0 ){
+	SET_ERRNO(EINVAL);
+	return -1;
+    }
+
+    if ( create )
+	ret = fs->lowlevelfs->create_batch(fs->lowlevelfs, inode, names, count, mode, errors);
+    else
+	ret = fs->lowlevelfs->unlink_batch(fs->lowlevelfs, inode, names, count, errors);
+    if ( ret < 0 ){
+	SET_ERRNO(-ret);
+	return -1;
+    }
+    for ( i=0; i < count; i++ ){
+	if ( errors[i] == 0 )
+	    fs->cached_lookup->forget_name(fs->cached_lookup, inode, names[i]);
+    }
+    /*inodes of removed names are not known here*/
+    if ( create )
+	forget_attr(fs, inode);
+    else
+	fs->cached_attr->forget_all(fs->cached_attr);
     return ret;
 }
 
+static int toplevel_create_batch(struct MountsPublicInterface* this_, const char* dirpath,
+				 const char **names, int count, uint32_t mode, int *errors){
+    struct ZfsTopLevelFs* fs = (struct ZfsTopLevelFs*)this_;
+    CHECK_FUNC_ENSURE_EXIST(fs, create_batch);
+    return toplevel_dir_batch(fs, dirpath, names, count, mode, errors, 1);
+}
+
+static int toplevel_unlink_batch(struct MountsPublicInterface* this_, const char* dirpath,
+				 const char **names, int count, int *errors){
+    struct ZfsTopLevelFs* fs = (struct ZfsTopLevelFs*)this_;
+    CHECK_FUNC_ENSURE_EXIST(fs, unlink_batch);
+    return toplevel_dir_batch(fs, dirpath, names, count, 0, errors, 0);
+}
+
 static ssize_t toplevel_read(struct MountsPublicInterface* this_, int fd, void *buf, size_t nbytes){
     int ret;
     struct ZfsTopLevelFs* fs = (struct ZfsTopLevelFs*)this_;
@@ -287,7 +381,7 @@ static ssize_t toplevel_read(struct MountsPublicInterface* this_, int fd, void *
         return -1;
     }
 
-    if ( (ret=fs->lowlevelfs->pread(fs->lowlevelfs, entry->inode, buf, nbytes, ofd->offset)) >= 0 ){
+    if ( (ret=fs->lowlevelfs->pread(fs->lowlevelfs, entry->node, buf, nbytes, ofd->offset)) >= 0 ){
 	/*update resulted offset*/
 	int ret2 = fs->open_files_pool->set_offset(entry->open_file_description_id, ofd->offset+ret );
 	assert(ret2==0);
@@ -315,7 +409,9 @@ static ssize_t toplevel_write(struct MountsPublicInterface* this_, int fd, const
         return -1;
     }
 
-    if ( (ret=fs->lowlevelfs->pwrite(fs->lowlevelfs, entry->inode, buf, nbytes, ofd->offset)) >= 0 ){
+    ret=fs->lowlevelfs->pwrite(fs->lowlevelfs, entry->node, buf, nbytes, ofd->offset);
+    forget_attr(fs, entry->inode);
+    if ( ret >= 0 ){
 	/*update resulted offset*/
 	int ret2 = fs->open_files_pool->set_offset(entry->open_file_description_id, ofd->offset+ret );
 	assert(ret2==0);
@@ -345,12 +441,9 @@ toplevel_pread(struct MountsPublicInterface* this_,
         return -1;
     }
 
-    if ( (ret=fs->lowlevelfs->pread(fs->lowlevelfs, entry->inode, buf, nbytes, offset)) >= 0 ){
-	/*update resulted offset*/
-	int ret2 = fs->open_files_pool->set_offset(entry->open_file_description_id, offset+ret );
-	assert(ret2==0);
-    }
-    else if ( ret < 0 ){
+    /*file offset is not changed by pread, so concurrent calls for the
+      same descriptor are not interfere*/
+    if ( (ret=fs->lowlevelfs->pread(fs->lowlevelfs, entry->node, buf, nbytes, offset)) < 0 ){
 	SET_ERRNO(-ret);
 	return -1;
     }
@@ -375,19 +468,168 @@ toplevel_pwrite(struct MountsPublicInterface* this_,
         return -1;
     }
 
-    if ( (ret=fs->lowlevelfs->pwrite(fs->lowlevelfs, entry->inode, buf, nbytes, offset)) >= 0 ){
-	/*update resulted offset*/
-	int ret2 = fs->open_files_pool->set_offset(entry->open_file_description_id, offset+ret );
-	assert(ret2==0);
+    /*file offset is not changed by pwrite, so concurrent calls for the
+      same descriptor are not interfere*/
+    ret=fs->lowlevelfs->pwrite(fs->lowlevelfs, entry->node, buf, nbytes, offset);
+    forget_attr(fs, entry->inode);
+    if ( ret < 0 ){
+	SET_ERRNO(-ret);
+	return -1;
     }
-    else if ( ret < 0 ){
+    
+    return ret;
+}
+
+static ssize_t 
+toplevel_preadv(struct MountsPublicInterface* this_, 
+		int fd, const struct iovec *iov, int iovcnt, off_t offset){
+    ssize_t ret;
+    struct ZfsTopLevelFs* fs = (struct ZfsTopLevelFs*)this_;
+    const struct HandleItem* entry;
+    const struct OpenFileDescription* ofd = fs->handle_allocator->ofd(fd);
+
+    CHECK_FUNC_ENSURE_EXIST(fs, preadv);
+
+    GET_DESCRIPTOR_ENTRY_CHECK(fs, fd, entry);
+
+    if ( !CHECK_FLAG(ofd->flags, O_RDONLY) && !CHECK_FLAG(ofd->flags, O_RDWR) ){
+	SET_ERRNO(EINVAL);
+        return -1;
+    }
+
+    /*all buffers are filled by single lowlevel call*/
+    if ( (ret=fs->lowlevelfs->preadv(fs->lowlevelfs, entry->node, iov, iovcnt, offset)) < 0 ){
+	SET_ERRNO(-ret);
+	return -1;
+    }
+    
+    return ret;
+}
+
+static ssize_t 
+toplevel_pwritev(struct MountsPublicInterface* this_, 
+		 int fd, const struct iovec *iov, int iovcnt, off_t offset){
+    ssize_t ret;
+    struct ZfsTopLevelFs* fs = (struct ZfsTopLevelFs*)this_;
+    const struct HandleItem* entry;
+    const struct OpenFileDescription* ofd = fs->handle_allocator->ofd(fd);
+
+    CHECK_FUNC_ENSURE_EXIST(fs, pwritev);
+
+    GET_DESCRIPTOR_ENTRY_CHECK(fs, fd, entry);
+
+    if ( !CHECK_FLAG(ofd->flags, O_WRONLY) && !CHECK_FLAG(ofd->flags, O_RDWR) ){
+	SET_ERRNO(EINVAL);
+        return -1;
+    }
+
+    /*all buffers are written by single lowlevel call*/
+    ret=fs->lowlevelfs->pwritev(fs->lowlevelfs, entry->node, iov, iovcnt, offset);
+    forget_attr(fs, entry->inode);
+    if ( ret < 0 ){
+	SET_ERRNO(-ret);
+	return -1;
+    }
+    
+    return ret;
+}
+
+static ssize_t 
+toplevel_read_borrow(struct MountsPublicInterface* this_, int fd, size_t nbytes, off_t offset,
+		     struct iovec *iov, int *iovcnt, void **loan){
+    ssize_t ret;
+    struct ZfsTopLevelFs* fs = (struct ZfsTopLevelFs*)this_;
+    const struct HandleItem* entry;
+    const struct OpenFileDescription* ofd = fs->handle_allocator->ofd(fd);
+
+    CHECK_FUNC_ENSURE_EXIST(fs, read_borrow);
+
+    GET_DESCRIPTOR_ENTRY_CHECK(fs, fd, entry);
+
+    if ( !CHECK_FLAG(ofd->flags, O_RDONLY) && !CHECK_FLAG(ofd->flags, O_RDWR) ){
+	SET_ERRNO(EINVAL);
+        return -1;
+    }
+
+    if ( (ret=fs->lowlevelfs->read_borrow(fs->lowlevelfs, entry->node, nbytes, offset,
+					  iov, iovcnt, loan)) < 0 ){
+	SET_ERRNO(-ret);
+	return -1;
+    }
+    
+    return ret;
+}
+
+static void toplevel_read_return(struct MountsPublicInterface* this_, void *loan){
+    struct ZfsTopLevelFs* fs = (struct ZfsTopLevelFs*)this_;
+    fs->lowlevelfs->read_return(fs->lowlevelfs, loan);
+}
+
+/*loan of lowlevel fs and inode, which attributes are changed by commit*/
+struct TopLevelWriteLoan{
+    void* loan;
+    ino_t inode;
+};
+
+static ssize_t 
+toplevel_write_loan(struct MountsPublicInterface* this_, int fd, size_t nbytes, off_t offset,
+		    struct iovec *iov, int *iovcnt, void **loan){
+    ssize_t ret;
+    struct ZfsTopLevelFs* fs = (struct ZfsTopLevelFs*)this_;
+    const struct HandleItem* entry;
+    const struct OpenFileDescription* ofd = fs->handle_allocator->ofd(fd);
+    struct TopLevelWriteLoan* wloan;
+
+    CHECK_FUNC_ENSURE_EXIST(fs, write_loan);
+
+    GET_DESCRIPTOR_ENTRY_CHECK(fs, fd, entry);
+
+    if ( !CHECK_FLAG(ofd->flags, O_WRONLY) && !CHECK_FLAG(ofd->flags, O_RDWR) ){
+	SET_ERRNO(EINVAL);
+        return -1;
+    }
+
+    if ( (wloan = malloc(sizeof(struct TopLevelWriteLoan))) == NULL ){
+	SET_ERRNO(ENOMEM);
+	return -1;
+    }
+    if ( (ret=fs->lowlevelfs->write_loan(fs->lowlevelfs, entry->node, nbytes, offset,
+					 iov, iovcnt, &wloan->loan)) < 0 ){
+	free(wloan);
 	SET_ERRNO(-ret);
 	return -1;
     }
+    wloan->inode = entry->inode;
+    *loan = wloan;
     
     return ret;
 }
 
+static ssize_t 
+toplevel_write_commit(struct MountsPublicInterface* this_, void *loan, size_t nbytes){
+    ssize_t ret;
+    struct ZfsTopLevelFs* fs = (struct ZfsTopLevelFs*)this_;
+    struct TopLevelWriteLoan* wloan = (struct TopLevelWriteLoan*)loan;
+    ino_t inode = wloan->inode;
+
+    ret=fs->lowlevelfs->write_commit(fs->lowlevelfs, wloan->loan, nbytes);
+    free(wloan);
+    forget_attr(fs, inode);
+    if ( ret < 0 ){
+	SET_ERRNO(-ret);
+	return -1;
+    }
+    
+    return ret;
+}
+
+static void toplevel_write_abort(struct MountsPublicInterface* this_, void *loan){
+    struct ZfsTopLevelFs* fs = (struct ZfsTopLevelFs*)this_;
+    struct TopLevelWriteLoan* wloan = (struct TopLevelWriteLoan*)loan;
+    fs->lowlevelfs->write_abort(fs->lowlevelfs, wloan->loan);
+    free(wloan);
+}
+
 static int toplevel_fchown(struct MountsPublicInterface* this_, int fd, uid_t owner, gid_t group){
     int ret;
     struct ZfsTopLevelFs* fs = (struct ZfsTopLevelFs*)this_;
@@ -396,7 +638,9 @@ static int toplevel_fchown(struct MountsPublicInterface* this_, int fd, uid_t ow
     CHECK_FUNC_ENSURE_EXIST(fs, chown);
     GET_DESCRIPTOR_ENTRY_CHECK(fs, fd, entry);
 
-    if ( (ret=fs->lowlevelfs->chown( fs->lowlevelfs, entry->inode, owner, group)) < 0 ){
+    ret=fs->lowlevelfs->chown( fs->lowlevelfs, entry->inode, owner, group);
+    forget_attr(fs, entry->inode);
+    if ( ret < 0 ){
 	SET_ERRNO(-ret);
 	return -1;
     }
@@ -412,7 +656,9 @@ static int toplevel_fchmod(struct MountsPublicInterface* this_, int fd, uint32_t
     CHECK_FUNC_ENSURE_EXIST(fs, chmod);
     GET_DESCRIPTOR_ENTRY_CHECK(fs, fd, entry);
 
-    if ( (ret=fs->lowlevelfs->chmod( fs->lowlevelfs, entry->inode, mode)) < 0 ){
+    ret=fs->lowlevelfs->chmod( fs->lowlevelfs, entry->inode, mode);
+    forget_attr(fs, entry->inode);
+    if ( ret < 0 ){
 	SET_ERRNO(-ret);
 	return -1;
     }
@@ -429,7 +675,7 @@ static int toplevel_fstat(struct MountsPublicInterface* this_, int fd, struct st
     CHECK_FUNC_ENSURE_EXIST(fs, stat);
     GET_DESCRIPTOR_ENTRY_CHECK(fs, fd, entry);
 
-    if ( (ret=fs->lowlevelfs->stat( fs->lowlevelfs, entry->inode, buf)) < 0 ){
+    if ( (ret=fs->cached_attr->stat( fs->cached_attr, entry->inode, buf)) < 0 ){
 	SET_ERRNO(-ret);
 	return -1;
     }
@@ -446,58 +692,61 @@ static int toplevel_getdents(struct MountsPublicInterface* this_, int fd, void *
     CHECK_FUNC_ENSURE_EXIST(fs, getdents);
     GET_DESCRIPTOR_ENTRY_CHECK(fs, fd, entry);
 
-    ssize_t readed=0;
+    /*directory offset is a cookie of next entry returned by previous call*/
+    off_t cookie = ofd->offset;
+    if ( (ret=fs->lowlevelfs->getdents(fs->lowlevelfs, entry->node, buf, count, 
+				       &cookie)) < 0 ){
+	SET_ERRNO(-ret);
+	return -1;
+    }
 
-    /*workaround for zfs, when calling getdents with nonexist offset
-     pos it wrongly returns last dir component, so just save flag of
-     directory end and do not call getdents if it already 1*/
-    int enddir_workaround = ofd->channel_sequential_offset; 
+    int ret2 = fs->open_files_pool->set_offset( entry->open_file_description_id, cookie );
+    assert( ret2 == 0 );
+    return ret;
+}
 
-    if ( enddir_workaround == 0 ){
-	/*For ZFS pass offset that is item index but not a byte offset,
-	  so zfs item offset it's items count in getdents buffer*/
-	if ( (readed=fs->lowlevelfs
-	      ->getdents(fs->lowlevelfs, entry->inode, (DIRENT*)buf, count, ofd->offset,
-			 &enddir_workaround )) < 0 ){
-	    SET_ERRNO(-readed);
-	}
+static int toplevel_getdents_plus(struct MountsPublicInterface* this_, int fd, void *buf, 
+				  unsigned int count, struct stat *stats, int stats_count){
+    int ret;
+    struct ZfsTopLevelFs* fs = (struct ZfsTopLevelFs*)this_;
+    const struct HandleItem* entry;
+    const struct OpenFileDescription* ofd = fs->handle_allocator->ofd(fd);
 
-	if ( (ret=readed) > 0 ){
-#ifndef __native_client__
-	    int cursor=0;
-	    unsigned long d_ino, d_type;
-	    int zfs_readdir_offset=0;
-	    struct DirentEnginePublicInterface *dirent_engine = INSTANCE_L(DIRENT_ENGINE)();
-	    while( NULL != dirent_engine->get_next_item_from_dirent_buf( (char*)buf, readed, 
-									 &cursor, &d_ino, &d_type) )
-		++zfs_readdir_offset;
-	    readed = zfs_readdir_offset;
-#endif //__native_client__
-	    int ret2;
-	    ret2 = fs->open_files_pool->set_offset( entry->open_file_description_id, 
-						    ofd->offset + readed );
-	    assert( ret2 == 0 );
-	}
+    CHECK_FUNC_ENSURE_EXIST(fs, getdents_plus);
+    GET_DESCRIPTOR_ENTRY_CHECK(fs, fd, entry);
 
-	/*save enddir flag for workaround*/
-	fs->open_files_pool->set_offset_sequential_channel(entry->open_file_description_id, 
-							   enddir_workaround);
+    off_t cookie = ofd->offset;
+    if ( (ret=fs->lowlevelfs->getdents_plus(fs->lowlevelfs, entry->node, buf, count, 
+					    &cookie, stats, stats_count)) < 0 ){
+	SET_ERRNO(-ret);
+	return -1;
     }
-    else
-	ret = 0;
 
+    int ret2 = fs->open_files_pool->set_offset( entry->open_file_description_id, cookie );
+    assert( ret2 == 0 );
     return ret;
 }
 
-static int toplevel_fsync(struct MountsPublicInterface* this_, int fd){
+static int toplevel_sync_fd(struct ZfsTopLevelFs* fs, int fd, int datasync){
     int ret;
-    struct ZfsTopLevelFs* fs = (struct ZfsTopLevelFs*)this_;
     const struct HandleItem* entry;
 
+    CHECK_FUNC_ENSURE_EXIST(fs, fsync);
     GET_DESCRIPTOR_ENTRY_CHECK(fs, fd, entry);
 
-    errno=ENOSYS;
-    return -1;
+    if ( (ret=fs->lowlevelfs->fsync(fs->lowlevelfs, entry->node, datasync)) < 0 ){
+	SET_ERRNO(-ret);
+	return -1;
+    }
+    return 0;
+}
+
+static int toplevel_fsync(struct MountsPublicInterface* this_, int fd){
+    return toplevel_sync_fd((struct ZfsTopLevelFs*)this_, fd, 0);
+}
+
+static int toplevel_fdatasync(struct MountsPublicInterface* this_, int fd){
+    return toplevel_sync_fd((struct ZfsTopLevelFs*)this_, fd, 1);
 }
 
 static int toplevel_close(struct MountsPublicInterface* this_, int fd){
@@ -509,7 +758,7 @@ static int toplevel_close(struct MountsPublicInterface* this_, int fd){
     CHECK_FUNC_ENSURE_EXIST(fs, close);
     GET_DESCRIPTOR_ENTRY_CHECK(fs, fd, entry);
 
-    if ( (ret=fs->lowlevelfs->close( fs->lowlevelfs, entry->inode, ofd->flags)) <0 ){
+    if ( (ret=fs->lowlevelfs->close( fs->lowlevelfs, entry->node, ofd->flags)) <0 ){
 	SET_ERRNO(-ret);
 	return -1;
     }
@@ -525,33 +774,43 @@ static off_t toplevel_lseek(struct MountsPublicInterface* this_, int fd, off_t o
     int ret;
     struct ZfsTopLevelFs* fs = (struct ZfsTopLevelFs*)this_;
     const struct HandleItem* entry;
-    const struct OpenFileDescription* ofd = fs->open_files_pool->ofd(fd);
+    const struct OpenFileDescription* ofd = fs->handle_allocator->ofd(fd);
     struct stat st;
 
     CHECK_FUNC_ENSURE_EXIST(fs, stat);
     GET_DESCRIPTOR_ENTRY_CHECK(fs, fd, entry);
 
-    ret = fs->lowlevelfs->stat( fs->lowlevelfs, entry->inode, &st );
+    ret = fs->cached_attr->stat( fs->cached_attr, entry->inode, &st );
+    if ( ret==0 && S_ISREG(st.st_mode) && (whence == SEEK_DATA || whence == SEEK_HOLE) ){
+	CHECK_FUNC_ENSURE_EXIST(fs, seek_data);
+	off_t found = fs->lowlevelfs->seek_data( fs->lowlevelfs, entry->node, 
+						 offset, whence );
+	if ( found < 0 ){
+	    SET_ERRNO(-found);
+	    return -1;
+	}
+	ret = fs->open_files_pool->set_offset(entry->open_file_description_id, found);
+	assert( ret == 0 );
+	return found;
+    }
     if ( ret!=0 || !S_ISDIR(st.st_mode) ){
 	SET_ERRNO(EBADF);
 	return -1;
     }
 
+    /*directory offset is opaque cookie, so only telldir (SEEK_CUR with 0)
+      and seekdir/rewinddir (SEEK_SET to value from telldir or 0) are
+      meaningful*/
     off_t next = ofd->offset;
-    ssize_t len;
     switch (whence) {
     case SEEK_SET:
 	next = offset;
 	break;
     case SEEK_CUR:
-	next += offset;
-	break;
-    case SEEK_END:
-	len = st.st_size;
-	if (len == -1) {
+	if ( offset != 0 ){
+	    SET_ERRNO(EINVAL);
 	    return -1;
 	}
-	next = (size_t)len + offset;
 	break;
     default:
 	SET_ERRNO(EINVAL);
@@ -571,13 +830,21 @@ static off_t toplevel_lseek(struct MountsPublicInterface* this_, int fd, off_t o
 static int toplevel_open(struct MountsPublicInterface* this_, const char* path, int oflag, uint32_t mode){
     int ret=-1;
     struct ZfsTopLevelFs* fs = (struct ZfsTopLevelFs*)this_;
-    int parent_inode;
+    int parent_inode, path_inode;
     int inode=0;
     const char* name;
+    void* node=NULL;
     struct stat st;
 
     CHECK_FUNC_ENSURE_EXIST(fs, open);
-    GET_PARENT_ENSURE_EXIST(fs, path, &parent_inode);
+
+    /*parent and file are resolved by single walk through path*/
+    path_inode = fs->cached_lookup->inode_and_parent_by_path(fs->cached_lookup, path, 
+							     &parent_inode);
+    if ( parent_inode == -2 ){
+	SET_ERRNO(ENOENT);
+	return -1;
+    }
 
     if ( CHECK_FLAG(oflag, O_CREAT) ){
 	name = name_from_path( path);
@@ -586,29 +853,39 @@ static int toplevel_open(struct MountsPublicInterface* this_, const char* path,
 	    return -1;
 	}
 	/*create file by name in directory with parent_inode*/
-	ret=fs->lowlevelfs->open(fs->lowlevelfs, parent_inode, name, oflag, mode);
+	ret=fs->lowlevelfs->open(fs->lowlevelfs, parent_inode, name, oflag, mode, &node);
+	forget_path_name(fs, parent_inode, path);
     }
     else{
 	/*open file directly by inode*/
-	GET_INODE_ENSURE_EXIST(fs, path, &inode);
+	if ( (inode=path_inode) == -2 ){
+	    SET_ERRNO(ENOENT);
+	    return -1;
+	}
 	name=NULL;
-	ret=fs->lowlevelfs->open(fs->lowlevelfs, inode, name, oflag, mode);
+	ret=fs->lowlevelfs->open(fs->lowlevelfs, inode, name, oflag, mode, &node);
     }
 
     if ( ret >= 0 ){
-	if ( inode <= 0 ){
-	    GET_INODE_ENSURE_EXIST(fs, path, &inode);
-	}
+	/*for created file an inode is returned by open*/
+	if ( inode <= 0 )
+	    inode = ret;
+	/*truncated or just created file, which inode number can be
+	  reused, has no valid cached attributes*/
+	if ( CHECK_FLAG(oflag, O_CREAT) || CHECK_FLAG(oflag, O_TRUNC) )
+	    forget_attr(fs, inode);
 	int open_file_description_id = fs->open_files_pool->getnew_ofd(oflag);
 
 	/*ask for file descriptor in handle allocator*/
 	ret = fs->handle_allocator->allocate_handle( this_, 
 						     inode,
+						     node,
 						     open_file_description_id);
 	if ( ret < 0 ){
 	    /*it's hipotetical but possible case if amount of open files 
 	      are exceeded an maximum value.*/
 	    fs->open_files_pool->release_ofd(open_file_description_id);
+	    fs->lowlevelfs->close(fs->lowlevelfs, node, oflag);
 	    SET_ERRNO(ENFILE);
 	    return -1;
 	}
@@ -651,7 +928,7 @@ static int toplevel_remove(struct MountsPublicInterface* this_, const char* path
 	return -1;
     }
 
-    if ( (ret=fs->lowlevelfs->stat( fs->lowlevelfs, inode, &st )) < 0 ){
+    if ( (ret=fs->cached_attr->stat( fs->cached_attr, inode, &st )) < 0 ){
 	SET_ERRNO(ENOSYS);
 	return -1;
     }
@@ -661,6 +938,7 @@ static int toplevel_remove(struct MountsPublicInterface* this_, const char* path
 	    SET_ERRNO(-ret);
 	    return -1;
 	}
+	fs->cached_lookup->forget_dir(fs->cached_lookup, inode);
     }
     else{
 	if ( (ret=fs->lowlevelfs->unlink( fs->lowlevelfs, parent_inode, name )) <= 0 ){
@@ -668,6 +946,8 @@ static int toplevel_remove(struct MountsPublicInterface* this_, const char* path
 	    return -1;
 	}
     }
+    forget_path_name(fs, parent_inode, path);
+    forget_attr(fs, inode);
     return ret;
 }
 
@@ -685,10 +965,14 @@ static int toplevel_unlink(struct MountsPublicInterface* this_, const char* path
 	return -1;
     }
 
+    /*links count of unlinked inode is changed, or inode is removed*/
+    int inode = fs->cached_lookup->inode_by_path(fs->cached_lookup, path);
     if ( (ret=fs->lowlevelfs->unlink( fs->lowlevelfs, parent_inode, name )) < 0 ){
 	SET_ERRNO(-ret);
 	return -1;
     }
+    forget_path_name(fs, parent_inode, path);
+    forget_attr(fs, inode);
 
     return ret;
 }
@@ -721,7 +1005,7 @@ static int toplevel_ftruncate_size(struct MountsPublicInterface* this_, int fd,
     CHECK_FUNC_ENSURE_EXIST(fs, ftruncate_size);
     GET_DESCRIPTOR_ENTRY_CHECK(fs, fd, entry);
 
-    if ( is_dir(fs->lowlevelfs, entry->inode) ){
+    if ( is_dir(fs, entry->inode) ){
 	SET_ERRNO(EISDIR);
 	return -1;
     }
@@ -735,7 +1019,9 @@ static int toplevel_ftruncate_size(struct MountsPublicInterface* this_, int fd,
 	return -1;
     }
 
-    if ( (ret=fs->lowlevelfs->ftruncate_size( fs->lowlevelfs, entry->inode, length )) >= 0 ){
+    ret=fs->lowlevelfs->ftruncate_size( fs->lowlevelfs, entry->inode, entry->node, length );
+    forget_attr(fs, entry->inode);
+    if ( ret >= 0 ){
 	/*in according to docs: if doing file size reducing then
 	  offset should not be changed, but on ubuntu linux
 	  an offset can't be setted up to beyond of file bounds and
@@ -770,7 +1056,7 @@ int toplevel_truncate_size(struct MountsPublicInterface* this_, const char* path
     CHECK_FUNC_ENSURE_EXIST(fs, ftruncate_size);
     GET_INODE_ENSURE_EXIST(fs, path, &inode);
 
-    ret=fs->lowlevelfs->stat( fs->lowlevelfs, inode, &st);
+    ret=fs->cached_attr->stat( fs->cached_attr, inode, &st);
     assert(ret==0);
 
     if ( S_ISDIR(st.st_mode) ){
@@ -778,13 +1064,87 @@ int toplevel_truncate_size(struct MountsPublicInterface* this_, const char* path
 	return -1;
     }
 
-    if ( (ret=fs->lowlevelfs->ftruncate_size( fs->lowlevelfs, inode, length )) < 0 ){
+    ret=fs->lowlevelfs->ftruncate_size( fs->lowlevelfs, inode, NULL, length );
+    forget_attr(fs, inode);
+    if ( ret < 0 ){
 	SET_ERRNO(-ret);
     }
 
     return ret;
 }
 
+static int toplevel_fallocate(struct MountsPublicInterface* this_, int fd, int mode, 
+			      off_t offset, off_t length){
+    int ret;
+    struct ZfsTopLevelFs* fs = (struct ZfsTopLevelFs*)this_;
+    const struct OpenFileDescription* ofd = fs->handle_allocator->ofd(fd);
+    const struct HandleItem* entry;
+
+    CHECK_FUNC_ENSURE_EXIST(fs, fallocate);
+    GET_DESCRIPTOR_ENTRY_CHECK(fs, fd, entry);
+
+    if ( is_dir(fs, entry->inode) ){
+	SET_ERRNO(EISDIR);
+	return -1;
+    }
+    int flags = ofd->flags & O_ACCMODE;
+    /*check if file was not opened for writing*/
+    if ( flags!=O_WRONLY && flags!=O_RDWR ){
+	SET_ERRNO(EBADF);
+	return -1;
+    }
+
+    ret=fs->lowlevelfs->fallocate( fs->lowlevelfs, entry->node, mode, offset, length );
+    forget_attr(fs, entry->inode);
+    if ( ret < 0 ){
+	SET_ERRNO(-ret);
+	return -1;
+    }
+    return 0;
+}
+
+static ssize_t toplevel_copy_range(struct MountsPublicInterface* this_, int fd_in, 
+				   off_t offset_in, int fd_out, off_t offset_out, size_t size){
+    ssize_t ret;
+    struct ZfsTopLevelFs* fs = (struct ZfsTopLevelFs*)this_;
+    const struct HandleItem* entry;
+    const struct HandleItem* out_entry;
+
+    CHECK_FUNC_ENSURE_EXIST(fs, copy_range);
+    GET_DESCRIPTOR_ENTRY_CHECK(fs, fd_in, entry);
+    out_entry = fs->handle_allocator->entry(fd_out);
+    if ( out_entry == NULL ){
+	SET_ERRNO(EBADF);
+	return -1;
+    }
+    if ( out_entry->mount_fs != this_ ){
+	SET_ERRNO(EXDEV);
+	return -1;
+    }
+
+    int flags = fs->handle_allocator->ofd(fd_in)->flags & O_ACCMODE;
+    int out_flags = fs->handle_allocator->ofd(fd_out)->flags;
+    /*source must be readable, destination writable and not appending*/
+    if ( flags==O_WRONLY || (out_flags & O_ACCMODE)==O_RDONLY || 
+	 CHECK_FLAG(out_flags, O_APPEND) ){
+	SET_ERRNO(EBADF);
+	return -1;
+    }
+    if ( is_dir(fs, entry->inode) || is_dir(fs, out_entry->inode) ){
+	SET_ERRNO(EISDIR);
+	return -1;
+    }
+
+    ret=fs->lowlevelfs->copy_range( fs->lowlevelfs, entry->node, offset_in,
+				    out_entry->node, offset_out, size );
+    forget_attr(fs, out_entry->inode);
+    if ( ret < 0 ){
+	SET_ERRNO(-ret);
+	return -1;
+    }
+    return ret;
+}
+
 static int toplevel_isatty(struct MountsPublicInterface* this_, int fd){
     return -1;
 }
@@ -813,7 +1173,10 @@ static int toplevel_link(struct MountsPublicInterface* this_, const char* oldpat
 	return -1;
     }
 
-    if ( (ret=fs->lowlevelfs->link( fs->lowlevelfs, old_inode, new_parent_inode, name )) < 0 ){
+    ret=fs->lowlevelfs->link( fs->lowlevelfs, old_inode, new_parent_inode, name );
+    forget_path_name(fs, new_parent_inode, newpath);
+    forget_attr(fs, old_inode);
+    if ( ret < 0 ){
 	SET_ERRNO(-ret);
 	return -1;
     }
@@ -840,12 +1203,22 @@ static int toplevel_rename(struct MountsPublicInterface* this_, const char* oldp
 	return -1;
     }
 
+    /*directory replaced by rename is removed*/
+    int replaced_inode = fs->cached_lookup->inode_by_path(fs->cached_lookup, newpath);
+
     if ( (ret=fs->lowlevelfs->rename( fs->lowlevelfs, 
 				      old_parent_inode, oldname,
 				      new_parent_inode, newname )) < 0 ){
 	SET_ERRNO(-ret);
 	return -1;
     }
+    forget_path_name(fs, old_parent_inode, oldpath);
+    forget_path_name(fs, new_parent_inode, newpath);
+    forget_attr(fs, old_inode);
+    forget_attr(fs, replaced_inode);
+    if ( replaced_inode >= 0 && replaced_inode != old_inode && 
+	 is_dir(fs, old_inode) )
+	fs->cached_lookup->forget_dir(fs->cached_lookup, replaced_inode);
 
     return ret;
 }
@@ -861,15 +1234,26 @@ static struct MountsPublicInterface KTopLevelMountWraper = {
     //toplevel_mknod,
     toplevel_mkdir,
     toplevel_rmdir,
+    toplevel_create_batch,
+    toplevel_unlink_batch,
     toplevel_read,
     toplevel_write,
     toplevel_pread,
     toplevel_pwrite,
+    toplevel_preadv,
+    toplevel_pwritev,
+    toplevel_read_borrow,
+    toplevel_read_return,
+    toplevel_write_loan,
+    toplevel_write_commit,
+    toplevel_write_abort,
     toplevel_fchown,
     toplevel_fchmod,
     toplevel_fstat,
     toplevel_getdents,
+    toplevel_getdents_plus,
     toplevel_fsync,
+    toplevel_fdatasync,
     toplevel_close,
     toplevel_lseek,
     toplevel_open,
@@ -881,6 +1265,8 @@ static struct MountsPublicInterface KTopLevelMountWraper = {
     toplevel_access,
     toplevel_ftruncate_size,
     toplevel_truncate_size,
+    toplevel_fallocate,
+    toplevel_copy_range,
     toplevel_isatty,
     toplevel_dup,
     toplevel_dup2,
@@ -892,6 +1278,7 @@ struct MountsPublicInterface*
 CONSTRUCT_L(ZFS_TOPLEVEL_FILESYSTEM)( struct HandleAllocator* handle_allocator,
 				   struct OpenFilesPool* open_files_pool,
 				   struct CachedLookupPublicInterface* cached_lookup,
+				   struct CachedAttrPublicInterface* cached_attr,
 				   struct LowLevelFilesystemPublicInterface* lowlevelfs){
     /*use malloc and not new, because it's external c object*/
     struct ZfsTopLevelFs* this_ = (struct ZfsTopLevelFs*)malloc( sizeof(struct ZfsTopLevelFs) );
@@ -902,6 +1289,7 @@ CONSTRUCT_L(ZFS_TOPLEVEL_FILESYSTEM)( struct HandleAllocator* handle_allocator,
     this_->handle_allocator = handle_allocator; /*use existing handle allocator*/
     this_->open_files_pool = open_files_pool; /*use existing open files pool*/
     this_->cached_lookup = cached_lookup;
+    this_->cached_attr = cached_attr;
     this_->lowlevelfs = lowlevelfs;
     return (struct MountsPublicInterface*)this_;
 }
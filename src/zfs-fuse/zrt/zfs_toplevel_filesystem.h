@@ -27,6 +27,7 @@
 #define ZFS_TOPLEVEL_FILESYSTEM zfs_toplevel_filesystem_construct
 
 struct CachedLookupPublicInterface;
+struct CachedAttrPublicInterface;
 struct HandleAllocator;
 struct OpenFilesPool;
 
@@ -34,6 +35,7 @@ struct MountsPublicInterface*
 zfs_toplevel_filesystem_construct( struct HandleAllocator* handle_allocator,
                                    struct OpenFilesPool* open_files_pool,
                                    struct CachedLookupPublicInterface* cached_lookup,
+                                   struct CachedAttrPublicInterface* cached_attr,
                                    struct LowLevelFilesystemPublicInterface* lowlevelfs);
     
 
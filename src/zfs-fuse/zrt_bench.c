@@ -0,0 +1,460 @@
+/*
+ * Benchmark of zrt filesystem stack
+ *
+ * Copyright (c) 2014, LiteStack, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this_ file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Runs workloads against file backed pool through MountsPublicInterface,
+ * without fuse. Every workload is run by all threads at once, each thread
+ * works in own directory. For every workload single line of JSON is
+ * printed: ops/s and latency percentiles of single operation.
+ *
+ * Usage: zrt-bench [-f vdev_file] [-v vdev_mb] [-t threads] [-n files]
+ *                  [-o io_ops] [-b io_size] [-z file_size] [-w workloads]
+ * Workloads are comma separated, in order of running; by default:
+ *   create,stat,open,getdents,seqwrite,seqread,randwrite,randread,unlink
+ * create makes files used by next workloads, unlink removes them; read
+ * workloads use file made by write workloads, or write it themselves
+ * before measuring if it's missing or shorter than file_size.
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <getopt.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "util.h"
+#include "storage.h"
+#include "zfs_mounts.h"
+#include "mounts_interface.h"
+
+#define BENCH_POOL_NAME   "zrtbench"
+#define BENCH_MOUNTDIR    "/zrtbench"
+#define BENCH_WORKLOADS   "create,stat,open,getdents,seqwrite,seqread,randwrite,randread,unlink"
+#define BENCH_GETDENTS_BUF 4096
+
+struct BenchWorkload{
+    const char *name;
+    /*run ops of workload for one thread, latency of every op is
+      stored; @return count of done ops*/
+    int (*run)(int thread, uint64_t *latency);
+    /*max ops of workload for one thread*/
+    int (*max_ops)();
+    /*prepare workload for one thread before it's measured, or NULL*/
+    void (*setup)(int thread);
+};
+
+struct BenchThread{
+    int        thread;
+    const struct BenchWorkload *workload;
+    uint64_t  *latency;
+    int        ops;
+};
+
+static struct MountsPublicInterface* s_fs;
+static int    s_files = 1000;       /*files per thread*/
+static int    s_io_ops = 10000;     /*read/write ops per thread*/
+static size_t s_io_size = 4096;
+static off_t  s_file_size = 64<<20; /*size of file used for i/o per thread*/
+static volatile int s_errors;
+static pthread_barrier_t s_barrier;
+
+#define BENCH_CHECK(cond, thread, fmt, ...)				\
+    if ( !(cond) ){							\
+	fprintf(stderr, "thread %d: " fmt ", errno=%d\n", thread, ##__VA_ARGS__, errno); \
+	__sync_add_and_fetch(&s_errors, 1);				\
+    }
+
+static uint64_t now_ns(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec*1000000000ULL + ts.tv_nsec;
+}
+
+/*start of measured op, latency is stored by BENCH_OP_END*/
+#define BENCH_OP_START(start) start = now_ns()
+#define BENCH_OP_END(latency, ops, start) latency[ops++] = now_ns() - start
+
+static void file_path(char *path, size_t size, int thread, int i){
+    snprintf(path, size, "/bench%d/file%d", thread, i);
+}
+
+static void io_path(char *path, size_t size, int thread){
+    snprintf(path, size, "/bench%d/io", thread);
+}
+
+static int files_ops(){
+    return s_files;
+}
+
+static int io_ops(){
+    return s_io_ops;
+}
+
+static int seq_ops(){
+    return s_file_size / s_io_size;
+}
+
+static int getdents_ops(){
+    /*directory is listed whole, every getdents call is an op*/
+    return (s_files+2) + 1;
+}
+
+static int bench_create(int thread, uint64_t *latency){
+    char path[64];
+    uint64_t start;
+    int i, fd, ops = 0;
+    for ( i=0; i < s_files; i++ ){
+	file_path(path, sizeof(path), thread, i);
+	BENCH_OP_START(start);
+	fd = s_fs->open(s_fs, path, O_CREAT|O_EXCL|O_WRONLY, 0644);
+	if ( fd >= 0 ) s_fs->close(s_fs, fd);
+	BENCH_OP_END(latency, ops, start);
+	BENCH_CHECK(fd >= 0, thread, "create %s", path);
+    }
+    return ops;
+}
+
+static int bench_stat(int thread, uint64_t *latency){
+    char path[64];
+    struct stat st;
+    uint64_t start;
+    int i, ret, ops = 0;
+    for ( i=0; i < s_files; i++ ){
+	file_path(path, sizeof(path), thread, i);
+	BENCH_OP_START(start);
+	ret = s_fs->stat(s_fs, path, &st);
+	BENCH_OP_END(latency, ops, start);
+	BENCH_CHECK(ret == 0, thread, "stat %s", path);
+    }
+    return ops;
+}
+
+static int bench_open(int thread, uint64_t *latency){
+    char path[64];
+    uint64_t start;
+    int i, fd, ops = 0;
+    for ( i=0; i < s_files; i++ ){
+	file_path(path, sizeof(path), thread, i);
+	BENCH_OP_START(start);
+	fd = s_fs->open(s_fs, path, O_RDONLY, 0);
+	if ( fd >= 0 ) s_fs->close(s_fs, fd);
+	BENCH_OP_END(latency, ops, start);
+	BENCH_CHECK(fd >= 0, thread, "open %s", path);
+    }
+    return ops;
+}
+
+static int bench_getdents(int thread, uint64_t *latency){
+    char path[64];
+    char buf[BENCH_GETDENTS_BUF];
+    uint64_t start;
+    int fd, ret, ops = 0;
+    snprintf(path, sizeof(path), "/bench%d", thread);
+    fd = s_fs->open(s_fs, path, O_RDONLY|O_DIRECTORY, 0);
+    BENCH_CHECK(fd >= 0, thread, "open %s", path);
+    if ( fd < 0 ) return 0;
+    do{
+	BENCH_OP_START(start);
+	ret = s_fs->getdents(s_fs, fd, buf, sizeof(buf));
+	BENCH_OP_END(latency, ops, start);
+	BENCH_CHECK(ret >= 0, thread, "getdents %s", path);
+    }while( ret > 0 && ops < getdents_ops() );
+    s_fs->close(s_fs, fd);
+    return ops;
+}
+
+static int bench_io(int thread, uint64_t *latency, int write, int random){
+    char path[64];
+    char *buf = malloc(s_io_size);
+    uint64_t start;
+    unsigned int seed = thread;
+    off_t blocks = s_file_size / s_io_size;
+    off_t offset;
+    ssize_t ret;
+    int fd, i, count, ops = 0;
+
+    io_path(path, sizeof(path), thread);
+    fd = s_fs->open(s_fs, path, write ? O_CREAT|O_RDWR : O_RDONLY, 0644);
+    BENCH_CHECK(fd >= 0, thread, "open %s", path);
+    if ( fd < 0 ){
+	free(buf);
+	return 0;
+    }
+    memset(buf, thread+1, s_io_size);
+    count = random ? s_io_ops : blocks;
+    for ( i=0; i < count; i++ ){
+	offset = (random ? rand_r(&seed) % blocks : i) * s_io_size;
+	BENCH_OP_START(start);
+	if ( write )
+	    ret = s_fs->pwrite(s_fs, fd, buf, s_io_size, offset);
+	else
+	    ret = s_fs->pread(s_fs, fd, buf, s_io_size, offset);
+	BENCH_OP_END(latency, ops, start);
+	BENCH_CHECK(ret == s_io_size, thread, "%s %s offset=%lld ret=%d",
+		    write ? "pwrite" : "pread", path, (long long)offset, (int)ret);
+    }
+    s_fs->close(s_fs, fd);
+    free(buf);
+    return ops;
+}
+
+/*read workloads need whole file, write it if not made by seqwrite*/
+static void bench_io_setup(int thread){
+    char path[64];
+    char *buf;
+    struct stat st;
+    off_t offset;
+    ssize_t ret;
+    int fd;
+
+    io_path(path, sizeof(path), thread);
+    fd = s_fs->open(s_fs, path, O_CREAT|O_RDWR, 0644);
+    BENCH_CHECK(fd >= 0, thread, "open %s", path);
+    if ( fd < 0 )
+	return;
+    if ( s_fs->fstat(s_fs, fd, &st) == 0 && st.st_size >= s_file_size ){
+	s_fs->close(s_fs, fd);
+	return;
+    }
+    buf = malloc(s_io_size);
+    memset(buf, thread+1, s_io_size);
+    for ( offset=0; offset + (off_t)s_io_size <= s_file_size; offset += s_io_size ){
+	ret = s_fs->pwrite(s_fs, fd, buf, s_io_size, offset);
+	BENCH_CHECK(ret == s_io_size, thread, "prefill %s offset=%lld ret=%d",
+		    path, (long long)offset, (int)ret);
+	if ( ret != s_io_size )
+	    break;
+    }
+    s_fs->close(s_fs, fd);
+    free(buf);
+}
+
+static int bench_seqwrite(int thread, uint64_t *latency){
+    return bench_io(thread, latency, 1, 0);
+}
+
+static int bench_seqread(int thread, uint64_t *latency){
+    return bench_io(thread, latency, 0, 0);
+}
+
+static int bench_randwrite(int thread, uint64_t *latency){
+    return bench_io(thread, latency, 1, 1);
+}
+
+static int bench_randread(int thread, uint64_t *latency){
+    return bench_io(thread, latency, 0, 1);
+}
+
+static int bench_unlink(int thread, uint64_t *latency){
+    char path[64];
+    uint64_t start;
+    int i, ret, ops = 0;
+    for ( i=0; i < s_files; i++ ){
+	file_path(path, sizeof(path), thread, i);
+	BENCH_OP_START(start);
+	ret = s_fs->unlink(s_fs, path);
+	BENCH_OP_END(latency, ops, start);
+	BENCH_CHECK(ret == 0, thread, "unlink %s", path);
+    }
+    return ops;
+}
+
+static const struct BenchWorkload s_workloads[] = {
+    { "create",    bench_create,    files_ops,    NULL },
+    { "stat",      bench_stat,      files_ops,    NULL },
+    { "open",      bench_open,      files_ops,    NULL },
+    { "getdents",  bench_getdents,  getdents_ops, NULL },
+    { "seqwrite",  bench_seqwrite,  seq_ops,      NULL },
+    { "seqread",   bench_seqread,   seq_ops,      bench_io_setup },
+    { "randwrite", bench_randwrite, io_ops,       NULL },
+    { "randread",  bench_randread,  io_ops,       bench_io_setup },
+    { "unlink",    bench_unlink,    files_ops,    NULL },
+    { NULL, NULL, NULL, NULL }
+};
+
+static const struct BenchWorkload* find_workload(const char *name){
+    int i;
+    for ( i=0; s_workloads[i].name; i++ )
+	if ( !strcmp(s_workloads[i].name, name) )
+	    return &s_workloads[i];
+    return NULL;
+}
+
+static void* bench_thread(void* arg){
+    struct BenchThread *bt = (struct BenchThread *)arg;
+    if ( bt->workload->setup != NULL )
+	bt->workload->setup(bt->thread);
+    /*all threads start workload at once, setup is not measured*/
+    pthread_barrier_wait(&s_barrier);
+    bt->ops = bt->workload->run(bt->thread, bt->latency);
+    return NULL;
+}
+
+static int compare_latency(const void *a, const void *b){
+    uint64_t la = *(const uint64_t*)a, lb = *(const uint64_t*)b;
+    return la < lb ? -1 : la > lb;
+}
+
+/*@param permille of sorted latencies*/
+static double percentile_us(const uint64_t *sorted, int count, int permille){
+    int index;
+    if ( count == 0 )
+	return 0;
+    index = (int)(((uint64_t)count * permille + 999) / 1000) - 1;
+    if ( index < 0 ) index = 0;
+    return sorted[index] / 1000.0;
+}
+
+static void run_workload(const struct BenchWorkload *workload, int threads){
+    struct BenchThread *bt = calloc(threads, sizeof(struct BenchThread));
+    pthread_t *tids = malloc(sizeof(pthread_t)*threads);
+    int max_ops = workload->max_ops();
+    uint64_t *all;
+    uint64_t start, elapsed;
+    int errors = s_errors;
+    int i, total = 0;
+
+    for ( i=0; i < threads; i++ ){
+	bt[i].thread = i;
+	bt[i].workload = workload;
+	bt[i].latency = malloc(sizeof(uint64_t)*(max_ops > 0 ? max_ops : 1));
+    }
+    VERIFY(pthread_barrier_init(&s_barrier, NULL, threads+1) == 0);
+    for ( i=0; i < threads; i++ )
+	VERIFY(pthread_create(&tids[i], NULL, bench_thread, &bt[i]) == 0);
+    pthread_barrier_wait(&s_barrier);
+    start = now_ns();
+    for ( i=0; i < threads; i++ )
+	pthread_join(tids[i], NULL);
+    elapsed = now_ns() - start;
+    pthread_barrier_destroy(&s_barrier);
+
+    for ( i=0; i < threads; i++ )
+	total += bt[i].ops;
+    all = malloc(sizeof(uint64_t)*(total > 0 ? total : 1));
+    for ( total=0, i=0; i < threads; i++ ){
+	memcpy(all+total, bt[i].latency, sizeof(uint64_t)*bt[i].ops);
+	total += bt[i].ops;
+	free(bt[i].latency);
+    }
+    qsort(all, total, sizeof(uint64_t), compare_latency);
+
+    printf("{\"workload\":\"%s\",\"threads\":%d,\"ops\":%d,\"seconds\":%.6f,"
+	   "\"ops_per_sec\":%.1f,\"p50_us\":%.3f,\"p99_us\":%.3f,\"p999_us\":%.3f,"
+	   "\"max_us\":%.3f,\"errors\":%d}\n",
+	   workload->name, threads, total, elapsed/1e9,
+	   elapsed ? total/(elapsed/1e9) : 0.0,
+	   percentile_us(all, total, 500), percentile_us(all, total, 990),
+	   percentile_us(all, total, 999), percentile_us(all, total, 1000),
+	   s_errors - errors);
+    fflush(stdout);
+    free(all);
+    free(tids);
+    free(bt);
+}
+
+static void usage(){
+    fprintf(stderr, "Usage: zrt-bench [-f vdev_file] [-v vdev_mb] [-t threads] [-n files]\n"
+	    "                 [-o io_ops] [-b io_size] [-z file_size] [-w workloads]\n"
+	    "workloads: " BENCH_WORKLOADS "\n");
+    exit(2);
+}
+
+int main(int argc, char *argv[])
+{
+    char *vdev_path = "/tmp/zrt-bench.img";
+    char *workloads = strdup(BENCH_WORKLOADS);
+    char *name, *saveptr;
+    off_t vdev_size = 1024LL<<20;
+    int threads = 4;
+    int c, i, fd;
+    char dir[64];
+
+    while ((c = getopt(argc, argv, "f:v:t:n:o:b:z:w:")) != -1) {
+	switch (c) {
+	case 'f': vdev_path = optarg; break;
+	case 'v': vdev_size = atoll(optarg)<<20; break;
+	case 't': threads = atoi(optarg); break;
+	case 'n': s_files = atoi(optarg); break;
+	case 'o': s_io_ops = atoi(optarg); break;
+	case 'b': s_io_size = atoi(optarg); break;
+	case 'z': s_file_size = atoll(optarg); break;
+	case 'w': free(workloads); workloads = strdup(optarg); break;
+	default: usage();
+	}
+    }
+    if ( threads <= 0 || s_files < 0 || s_io_ops < 0 || s_io_size <= 0 ||
+	 s_file_size < (off_t)s_io_size || vdev_size <= 0 )
+	usage();
+    /*workload names are checked before pool is created*/
+    char *check = strdup(workloads);
+    for ( name = strtok_r(check, ",", &saveptr); name != NULL;
+	  name = strtok_r(NULL, ",", &saveptr) ){
+	if ( find_workload(name) == NULL )
+	    usage();
+    }
+    free(check);
+
+    fd = open(vdev_path, O_CREAT|O_TRUNC|O_WRONLY, 0644);
+    if ( fd < 0 || ftruncate(fd, vdev_size) != 0 ){
+	perror(vdev_path);
+	return 1;
+    }
+    close(fd);
+
+    if ( do_init() != 0 ){
+	do_exit();
+	return 1;
+    }
+
+    vfs_t *vfs = create_storage(vdev_path, BENCH_POOL_NAME, BENCH_MOUNTDIR);
+    if ( vfs == NULL ){
+	fprintf(stderr, "can't create pool on %s\n", vdev_path);
+	do_exit();
+	return 1;
+    }
+    s_fs = CONSTRUCT_L(ZFS_MOUNTS)(vfs);
+    for ( i=0; i < threads; i++ ){
+	snprintf(dir, sizeof(dir), "/bench%d", i);
+	if ( s_fs->mkdir(s_fs, dir, 0755) < 0 ){
+	    fprintf(stderr, "mkdir %s failed, errno=%d\n", dir, errno);
+	    return 1;
+	}
+    }
+
+    for ( name = strtok_r(workloads, ",", &saveptr); name != NULL;
+	  name = strtok_r(NULL, ",", &saveptr) )
+	run_workload(find_workload(name), threads);
+    free(workloads);
+
+    do_umount(vfs, B_FALSE);
+    do_exit();
+    unlink(vdev_path);
+
+    if ( s_errors ){
+	fprintf(stderr, "Benchmark failed: %d errors\n", s_errors);
+	return 1;
+    }
+    return 0;
+}
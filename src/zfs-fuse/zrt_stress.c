@@ -0,0 +1,854 @@
+/*
+ * Concurrent stress test of zrt filesystem stack
+ *
+ * Copyright (c) 2014, LiteStack, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this_ file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Runs concurrent open/write/read/readdir/unlink workers against single
+ * pool through MountsPublicInterface, the same way as multithreaded fuse
+ * loop does. Every worker uses own directory and also shared directory,
+ * where names are created and removed by all workers at the same time.
+ * With cache file given, pool gets it as L2ARC device after the workers
+ * are done, then it's exported and imported again, and data read back
+ * must be served by L2ARC rebuilt from the device.
+ * Exit code is 0 if no errors detected.
+ *
+ * Usage: zrt-stress [-f vdev_file] [-c cache_file] [-t threads] [-n iterations]
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <getopt.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include <sys/arc.h> //arc_stat_get
+#include <sys/txg.h> //txg_wait_synced
+#include <sys/zfs_vfsops.h> //zfsvfs_t
+
+#include "util.h"
+#include "storage.h"
+#include "new_zpool_util.h"
+#include "zfs_mounts.h"
+#include "cached_lookup.h"
+#include "cached_attr.h"
+#include "mem_filesystem.h"
+#include "zfs_filesystem.h"
+#include "mounts_interface.h"
+#include "dirent_engine.h"
+
+#define STRESS_POOL_NAME     "zrtstress"
+#define STRESS_MOUNTDIR      "/zrtstress"
+#define STRESS_VDEV_SIZE     (1ULL<<30) /*sparse, holds l2arc check files*/
+#define STRESS_FILE_SIZE     (64<<10)
+#define STRESS_SHARED_NAMES  64
+#define STRESS_LOAN_SIZE     (2*(128<<10)+200) /*unaligned range with whole record*/
+#define STRESS_LOAN_OFFSET   100
+#define STRESS_BATCH_NAMES   200 /*more than one transaction group*/
+#define STRESS_RECORD_SIZE   (128<<10) /*default recordsize of fresh pool*/
+#define STRESS_SCRATCH_DIR   "/tmp"
+#define STRESS_SCRATCH_LIMIT (1<<20) /*small, so big scratch files are spilled*/
+#define STRESS_CACHE_SIZE    (192ULL<<20) /*more than arc holds, see l2arc_fill*/
+#define STRESS_CACHE_FILES   64 /*per round, one record each*/
+#define STRESS_CACHE_ROUNDS  64 /*at most, until cache device wraps*/
+#define STRESS_CACHE_TIMEOUT 60 /*seconds to wait for l2arc feed or rebuild*/
+
+extern uint64_t l2arc_log_secs;
+extern uint64_t l2arc_headroom;
+
+static struct MountsPublicInterface* s_fs;
+static int s_iterations = 1000;
+static volatile int s_errors;
+
+#define STRESS_CHECK(cond, worker, fmt, ...)				\
+    if ( !(cond) ){							\
+	fprintf(stderr, "worker %d: " fmt ", errno=%d\n", worker, ##__VA_ARGS__, errno); \
+	__sync_add_and_fetch(&s_errors, 1);				\
+    }
+
+static void fill_pattern(char *buf, size_t size, int worker, int iteration){
+    size_t i;
+    for ( i=0; i < size; i++ )
+	buf[i] = (char)(worker*31 + iteration*7 + i);
+}
+
+static int count_dir_items(int worker, const char *path){
+    char buf[4096];
+    int fd, len, cursor, count=0;
+    unsigned long d_ino, d_type;
+    struct DirentEnginePublicInterface *dirent_engine = INSTANCE_L(DIRENT_ENGINE)();
+
+    fd = s_fs->open(s_fs, path, O_RDONLY|O_DIRECTORY, 0);
+    STRESS_CHECK(fd >= 0, worker, "opendir %s", path);
+    if ( fd < 0 ) return -1;
+    while( (len=s_fs->getdents(s_fs, fd, buf, sizeof(buf))) > 0 ){
+	cursor=0;
+	while( dirent_engine->get_next_item_from_dirent_buf(buf, len, &cursor,
+							    &d_ino, &d_type) != NULL )
+	    ++count;
+    }
+    STRESS_CHECK(len == 0, worker, "getdents %s", path);
+    STRESS_CHECK(s_fs->close(s_fs, fd) == 0, worker, "closedir %s", path);
+    return count;
+}
+
+/*count entries left in opened directory starting from current position*/
+static int count_rest_items(int fd, char *buf, int bufsize){
+    int len, cursor, count=0;
+    unsigned long d_ino, d_type;
+    struct DirentEnginePublicInterface *dirent_engine = INSTANCE_L(DIRENT_ENGINE)();
+
+    while( (len=s_fs->getdents(s_fs, fd, buf, bufsize)) > 0 ){
+	cursor=0;
+	while( dirent_engine->get_next_item_from_dirent_buf(buf, len, &cursor,
+							    &d_ino, &d_type) != NULL )
+	    ++count;
+    }
+    return len < 0 ? -1 : count;
+}
+
+/*read directory by small portions, then check that seek to saved
+  position (telldir/seekdir) and rewind give the same entries count*/
+static void check_dir_seek(int worker, const char *path, int expected){
+    char buf[128];
+    int fd, first, rest, rest2;
+    off_t pos;
+
+    fd = s_fs->open(s_fs, path, O_RDONLY|O_DIRECTORY, 0);
+    STRESS_CHECK(fd >= 0, worker, "opendir %s", path);
+    if ( fd < 0 ) return;
+    first = count_rest_items(fd, buf, sizeof(buf));
+    STRESS_CHECK(first == expected, worker, "readdir %s items=%d", path, first);
+
+    STRESS_CHECK(s_fs->lseek(s_fs, fd, 0, SEEK_SET) == 0, worker, "rewinddir %s", path);
+    STRESS_CHECK(s_fs->getdents(s_fs, fd, buf, sizeof(buf)) > 0, worker, "getdents %s", path);
+    pos = s_fs->lseek(s_fs, fd, 0, SEEK_CUR);
+    rest = count_rest_items(fd, buf, sizeof(buf));
+    STRESS_CHECK(s_fs->lseek(s_fs, fd, pos, SEEK_SET) == pos, worker, "seekdir %s", path);
+    rest2 = count_rest_items(fd, buf, sizeof(buf));
+    STRESS_CHECK(rest >= 0 && rest == rest2 && rest < expected, worker,
+		 "seekdir %s rest=%d rest2=%d", path, rest, rest2);
+    STRESS_CHECK(s_fs->close(s_fs, fd) == 0, worker, "closedir %s", path);
+}
+
+/*attributes returned by getdents_plus must match written files*/
+static void check_dir_stats(int worker, const char *path){
+    char buf[4096];
+    struct stat stats[32];
+    int fd, len, cursor, index;
+    unsigned long d_ino, d_type;
+    const char *name;
+    struct DirentEnginePublicInterface *dirent_engine = INSTANCE_L(DIRENT_ENGINE)();
+
+    fd = s_fs->open(s_fs, path, O_RDONLY|O_DIRECTORY, 0);
+    STRESS_CHECK(fd >= 0, worker, "opendir %s", path);
+    if ( fd < 0 ) return;
+    while( (len=s_fs->getdents_plus(s_fs, fd, buf, sizeof(buf), stats, 32)) > 0 ){
+	cursor=0;
+	index=0;
+	while( (name=dirent_engine->get_next_item_from_dirent_buf(buf, len, &cursor,
+								  &d_ino, &d_type)) != NULL ){
+	    STRESS_CHECK(index < 32 && stats[index].st_ino != 0, worker, 
+			 "getdents_plus %s/%s no stat", path, name);
+	    if ( index < 32 && S_ISREG(stats[index].st_mode) )
+		STRESS_CHECK(stats[index].st_size == STRESS_FILE_SIZE, worker,
+			     "getdents_plus %s/%s size=%lld", path, name,
+			     (long long)stats[index].st_size);
+	    ++index;
+	}
+    }
+    STRESS_CHECK(len == 0, worker, "getdents_plus %s", path);
+    STRESS_CHECK(s_fs->close(s_fs, fd) == 0, worker, "closedir %s", path);
+}
+
+/*data lent from cache buffers must be the same as written*/
+static void check_read_borrow(int worker, int fd, const char *path, const char *expected){
+    struct iovec iov[16];
+    void *loan;
+    int i, iovcnt;
+    ssize_t ret;
+    off_t offset=0;
+
+    while ( offset < STRESS_FILE_SIZE ){
+	iovcnt = 16;
+	ret = s_fs->read_borrow(s_fs, fd, STRESS_FILE_SIZE-offset, offset, iov, &iovcnt, &loan);
+	STRESS_CHECK(ret > 0, worker, "read_borrow %s ret=%d", path, (int)ret);
+	if ( ret <= 0 ) return;
+	for ( i=0; i < iovcnt; i++ ){
+	    STRESS_CHECK(!memcmp(iov[i].iov_base, expected+offset, iov[i].iov_len), worker,
+			 "read_borrow mismatch %s", path);
+	    offset += iov[i].iov_len;
+	}
+	s_fs->read_return(s_fs, loan);
+    }
+    STRESS_CHECK(offset == STRESS_FILE_SIZE, worker, "read_borrow %s size=%d", path, (int)offset);
+}
+
+/*data written through lent buffers must be read back, range has
+  unaligned head and tail and whole record between them*/
+static void check_write_loan(int worker, const char *dir, int iteration){
+    struct iovec iov[16];
+    char path[96];
+    char *wbuf = malloc(STRESS_LOAN_SIZE);
+    char *rbuf = malloc(STRESS_LOAN_SIZE);
+    void *loan;
+    int i, fd, iovcnt=16;
+    ssize_t ret;
+    size_t pos=0;
+
+    snprintf(path, sizeof(path), "%s/loan", dir);
+    fd = s_fs->open(s_fs, path, O_CREAT|O_RDWR, 0644);
+    STRESS_CHECK(fd >= 0, worker, "open %s", path);
+    if ( fd >= 0 ){
+	fill_pattern(wbuf, STRESS_LOAN_SIZE, worker, iteration);
+	ret = s_fs->write_loan(s_fs, fd, STRESS_LOAN_SIZE, STRESS_LOAN_OFFSET, 
+			       iov, &iovcnt, &loan);
+	STRESS_CHECK(ret == STRESS_LOAN_SIZE, worker, "write_loan %s ret=%d", path, (int)ret);
+	if ( ret > 0 ){
+	    for ( i=0; i < iovcnt; i++ ){
+		memcpy(iov[i].iov_base, wbuf+pos, iov[i].iov_len);
+		pos += iov[i].iov_len;
+	    }
+	    ret = s_fs->write_commit(s_fs, loan, pos);
+	    STRESS_CHECK(ret == STRESS_LOAN_SIZE, worker, "write_commit %s ret=%d", path, (int)ret);
+	}
+	ret = s_fs->pread(s_fs, fd, rbuf, STRESS_LOAN_SIZE, STRESS_LOAN_OFFSET);
+	STRESS_CHECK(ret == STRESS_LOAN_SIZE && !memcmp(wbuf, rbuf, STRESS_LOAN_SIZE), worker,
+		     "write_loan mismatch %s", path);
+	STRESS_CHECK(s_fs->close(s_fs, fd) == 0, worker, "close %s", path);
+	STRESS_CHECK(s_fs->unlink(s_fs, path) == 0, worker, "unlink %s", path);
+    }
+    free(wbuf);
+    free(rbuf);
+}
+
+/*names created by batch are visible in directory until removed by
+  batch; name repeated in batch is created once*/
+static void check_dir_batch(int worker, const char *dir, int expected_items){
+    char buf[STRESS_BATCH_NAMES][16];
+    const char *names[STRESS_BATCH_NAMES+1];
+    int errors[STRESS_BATCH_NAMES+1];
+    int i, ret, items;
+
+    for ( i=0; i < STRESS_BATCH_NAMES; i++ ){
+	snprintf(buf[i], sizeof(buf[i]), "batch%d", i);
+	names[i] = buf[i];
+    }
+    names[STRESS_BATCH_NAMES] = names[0];
+    ret = s_fs->create_batch(s_fs, dir, names, STRESS_BATCH_NAMES+1, 0644, errors);
+    STRESS_CHECK(ret == STRESS_BATCH_NAMES && errors[STRESS_BATCH_NAMES] == EEXIST,
+		 worker, "create_batch %s ret=%d", dir, ret);
+    items = count_dir_items(worker, dir);
+    STRESS_CHECK(items == expected_items+STRESS_BATCH_NAMES, worker,
+		 "create_batch %s items=%d", dir, items);
+    ret = s_fs->unlink_batch(s_fs, dir, names, STRESS_BATCH_NAMES+1, errors);
+    STRESS_CHECK(ret == STRESS_BATCH_NAMES && errors[STRESS_BATCH_NAMES] == ENOENT,
+		 worker, "unlink_batch %s ret=%d", dir, ret);
+    items = count_dir_items(worker, dir);
+    STRESS_CHECK(items == expected_items, worker, "unlink_batch %s items=%d", dir, items);
+}
+
+/*deep path is resolved by single walk, both by canonical path and by
+  path with redundant separators*/
+static void check_deep_path(int worker, const char *dir){
+    char path[160], file[192];
+    int fd, depth;
+
+    snprintf(path, sizeof(path), "%s", dir);
+    for ( depth=0; depth < 4; depth++ ){
+	strncat(path, "/d", sizeof(path)-strlen(path)-1);
+	STRESS_CHECK(s_fs->mkdir(s_fs, path, 0755) == 0, worker, "mkdir %s", path);
+    }
+    snprintf(file, sizeof(file), "%s/file", path);
+    fd = s_fs->open(s_fs, file, O_CREAT|O_WRONLY, 0644);
+    STRESS_CHECK(fd >= 0, worker, "open %s", file);
+    if ( fd >= 0 ) s_fs->close(s_fs, fd);
+    snprintf(file, sizeof(file), "%s//d/./d/d//d/file", dir);
+    fd = s_fs->open(s_fs, file, O_RDONLY, 0);
+    STRESS_CHECK(fd >= 0, worker, "open %s", file);
+    if ( fd >= 0 ) s_fs->close(s_fs, fd);
+    snprintf(file, sizeof(file), "%s/d/nonexistent/file", dir);
+    fd = s_fs->open(s_fs, file, O_CREAT|O_WRONLY, 0644);
+    STRESS_CHECK(fd == -1 && errno == ENOENT, worker, "open %s", file);
+
+    snprintf(file, sizeof(file), "%s/file", path);
+    STRESS_CHECK(s_fs->unlink(s_fs, file) == 0, worker, "unlink %s", file);
+    for ( depth=0; depth < 4; depth++ ){
+	STRESS_CHECK(s_fs->rmdir(s_fs, path) == 0, worker, "rmdir %s", path);
+	path[strlen(path)-2] = '\0';
+    }
+}
+
+/*cached attributes are dropped by every operation changing them*/
+static void check_attr_cache(int worker, const char *dir){
+    char path[96], link[96];
+    struct stat st;
+    int fd;
+
+    snprintf(path, sizeof(path), "%s/attr", dir);
+    snprintf(link, sizeof(link), "%s/attr.link", dir);
+    fd = s_fs->open(s_fs, path, O_CREAT|O_TRUNC|O_RDWR, 0644);
+    STRESS_CHECK(fd >= 0, worker, "open %s", path);
+    if ( fd < 0 ) return;
+    STRESS_CHECK(s_fs->stat(s_fs, path, &st) == 0 && st.st_size == 0 && st.st_nlink == 1,
+		 worker, "stat %s", path);
+    STRESS_CHECK(s_fs->pwrite(s_fs, fd, path, 10, 0) == 10, worker, "pwrite %s", path);
+    STRESS_CHECK(s_fs->stat(s_fs, path, &st) == 0 && st.st_size == 10,
+		 worker, "stat after write %s size=%lld", path, (long long)st.st_size);
+    STRESS_CHECK(s_fs->fchmod(s_fs, fd, 0600) == 0, worker, "fchmod %s", path);
+    STRESS_CHECK(s_fs->stat(s_fs, path, &st) == 0 && (st.st_mode & 0777) == 0600,
+		 worker, "stat after fchmod %s mode=%o", path, st.st_mode);
+    STRESS_CHECK(s_fs->link(s_fs, path, link) == 0, worker, "link %s", link);
+    STRESS_CHECK(s_fs->fstat(s_fs, fd, &st) == 0 && st.st_nlink == 2,
+		 worker, "fstat after link %s nlink=%d", path, (int)st.st_nlink);
+    STRESS_CHECK(s_fs->unlink(s_fs, link) == 0, worker, "unlink %s", link);
+    STRESS_CHECK(s_fs->fstat(s_fs, fd, &st) == 0 && st.st_nlink == 1,
+		 worker, "fstat after unlink %s nlink=%d", path, (int)st.st_nlink);
+    STRESS_CHECK(s_fs->truncate_size(s_fs, path, 3) == 0, worker, "truncate %s", path);
+    STRESS_CHECK(s_fs->fstat(s_fs, fd, &st) == 0 && st.st_size == 3,
+		 worker, "fstat after truncate %s size=%lld", path, (long long)st.st_size);
+    STRESS_CHECK(s_fs->close(s_fs, fd) == 0, worker, "close %s", path);
+    STRESS_CHECK(s_fs->unlink(s_fs, path) == 0, worker, "unlink %s", path);
+    STRESS_CHECK(s_fs->stat(s_fs, path, &st) == -1 && errno == ENOENT,
+		 worker, "stat removed %s", path);
+}
+
+/*copy of file made inside of filesystem has the same data*/
+static void check_copy_range(int worker, int fd, const char *path, size_t size){
+    char copy[96];
+    char *buf = malloc(size);
+    char *cbuf = malloc(size);
+    ssize_t ret;
+    int cfd;
+
+    snprintf(copy, sizeof(copy), "%s.copy", path);
+    cfd = s_fs->open(s_fs, copy, O_CREAT|O_TRUNC|O_RDWR, 0644);
+    STRESS_CHECK(cfd >= 0, worker, "open %s", copy);
+    if ( cfd >= 0 ){
+	/*unaligned destination, so records are copied by parts*/
+	ret = s_fs->copy_range(s_fs, fd, 0, cfd, 100, size);
+	STRESS_CHECK(ret == size, worker, "copy_range %s ret=%d", copy, (int)ret);
+	ret = s_fs->copy_range(s_fs, fd, size, cfd, 100+size, size);
+	STRESS_CHECK(ret == 0, worker, "copy_range at end %s ret=%d", copy, (int)ret);
+	STRESS_CHECK(s_fs->pread(s_fs, fd, buf, size, 0) == size &&
+		     s_fs->pread(s_fs, cfd, cbuf, size, 100) == size &&
+		     !memcmp(buf, cbuf, size), worker, "copy_range mismatch %s", copy);
+	ret = s_fs->copy_range(s_fs, fd, 0, fd, 100, size);
+	STRESS_CHECK(ret == -1 && errno == EINVAL, worker, "copy_range overlapped %s", path);
+	STRESS_CHECK(s_fs->close(s_fs, cfd) == 0, worker, "close %s", copy);
+	STRESS_CHECK(s_fs->unlink(s_fs, copy) == 0, worker, "unlink %s", copy);
+    }
+    free(buf);
+    free(cbuf);
+}
+
+/*punched record is freed and reads as zeros, and is found as hole*/
+static void check_holes(int worker, const char *dir){
+    char path[96];
+    char *buf = malloc(STRESS_RECORD_SIZE);
+    struct stat st;
+    off_t off;
+    int fd, ret, i;
+
+    snprintf(path, sizeof(path), "%s/holes", dir);
+    fd = s_fs->open(s_fs, path, O_CREAT|O_TRUNC|O_RDWR, 0644);
+    STRESS_CHECK(fd >= 0, worker, "open %s", path);
+    if ( fd < 0 ){
+	free(buf);
+	return;
+    }
+    memset(buf, 'h', STRESS_RECORD_SIZE);
+    for ( i=0; i < 3; i++ ){
+	ret = s_fs->pwrite(s_fs, fd, buf, STRESS_RECORD_SIZE, i*STRESS_RECORD_SIZE);
+	STRESS_CHECK(ret == STRESS_RECORD_SIZE, worker, "pwrite %s ret=%d", path, ret);
+    }
+    ret = s_fs->fallocate(s_fs, fd, FALLOC_FL_PUNCH_HOLE|FALLOC_FL_KEEP_SIZE,
+			  STRESS_RECORD_SIZE, STRESS_RECORD_SIZE);
+    STRESS_CHECK(ret == 0, worker, "punch hole %s errno=%d", path, errno);
+    STRESS_CHECK(s_fs->fstat(s_fs, fd, &st) == 0 && st.st_size == 3*STRESS_RECORD_SIZE,
+		 worker, "fstat punched %s size=%lld", path, (long long)st.st_size);
+    ret = s_fs->pread(s_fs, fd, buf, STRESS_RECORD_SIZE, STRESS_RECORD_SIZE);
+    STRESS_CHECK(ret == STRESS_RECORD_SIZE && buf[0] == 0 && buf[STRESS_RECORD_SIZE-1] == 0,
+		 worker, "pread punched %s ret=%d", path, ret);
+    off = s_fs->lseek(s_fs, fd, 0, SEEK_HOLE);
+    STRESS_CHECK(off == STRESS_RECORD_SIZE, worker, "SEEK_HOLE %s off=%lld", 
+		 path, (long long)off);
+    off = s_fs->lseek(s_fs, fd, STRESS_RECORD_SIZE, SEEK_DATA);
+    STRESS_CHECK(off == 2*STRESS_RECORD_SIZE, worker, "SEEK_DATA %s off=%lld", 
+		 path, (long long)off);
+    off = s_fs->lseek(s_fs, fd, 2*STRESS_RECORD_SIZE, SEEK_HOLE);
+    STRESS_CHECK(off == 3*STRESS_RECORD_SIZE, worker, "SEEK_HOLE at end %s off=%lld", 
+		 path, (long long)off);
+    off = s_fs->lseek(s_fs, fd, 3*STRESS_RECORD_SIZE, SEEK_DATA);
+    STRESS_CHECK(off == -1 && errno == ENXIO, worker, "SEEK_DATA beyond end %s", path);
+    /*allocation extends file, keeping size doesn't*/
+    ret = s_fs->fallocate(s_fs, fd, FALLOC_FL_KEEP_SIZE, 0, 4*STRESS_RECORD_SIZE);
+    STRESS_CHECK(ret == 0 && s_fs->fstat(s_fs, fd, &st) == 0 && 
+		 st.st_size == 3*STRESS_RECORD_SIZE, worker, "fallocate keep size %s", path);
+    ret = s_fs->fallocate(s_fs, fd, 0, 0, 4*STRESS_RECORD_SIZE);
+    STRESS_CHECK(ret == 0 && s_fs->fstat(s_fs, fd, &st) == 0 && 
+		 st.st_size == 4*STRESS_RECORD_SIZE, worker, "fallocate %s size=%lld",
+		 path, (long long)st.st_size);
+    check_copy_range(worker, fd, path, 4*STRESS_RECORD_SIZE);
+    STRESS_CHECK(s_fs->close(s_fs, fd) == 0, worker, "close %s", path);
+    STRESS_CHECK(s_fs->unlink(s_fs, path) == 0, worker, "unlink %s", path);
+    free(buf);
+}
+
+/*scratch files are kept in memory, file growing beyond memory limit
+  is spilled into zfs and must keep its data*/
+static void check_scratch(int worker, int iteration){
+    char path[96], newpath[96];
+    char *wbuf = malloc(STRESS_SCRATCH_LIMIT);
+    char *rbuf = malloc(STRESS_SCRATCH_LIMIT);
+    size_t size = iteration % 32 == 15 ? STRESS_SCRATCH_LIMIT : STRESS_FILE_SIZE;
+    struct stat st;
+    int fd, ret;
+
+    snprintf(path, sizeof(path), STRESS_SCRATCH_DIR "/scratch%d", worker);
+    snprintf(newpath, sizeof(newpath), STRESS_SCRATCH_DIR "/scratch%d.renamed", worker);
+    fd = s_fs->open(s_fs, path, O_CREAT|O_TRUNC|O_RDWR, 0600);
+    STRESS_CHECK(fd >= 0, worker, "open %s", path);
+    if ( fd >= 0 ){
+	fill_pattern(wbuf, size, worker, iteration);
+	/*two writes, second one can exceed limit and spill first part*/
+	ret = s_fs->pwrite(s_fs, fd, wbuf, size/2, 0);
+	STRESS_CHECK(ret == size/2, worker, "pwrite %s ret=%d", path, ret);
+	ret = s_fs->pwrite(s_fs, fd, wbuf+size/2, size-size/2, size/2);
+	STRESS_CHECK(ret == size-size/2, worker, "pwrite %s ret=%d", path, ret);
+	ret = s_fs->pread(s_fs, fd, rbuf, size, 0);
+	STRESS_CHECK(ret == size && !memcmp(wbuf, rbuf, size), worker,
+		     "pread %s ret=%d", path, ret);
+	STRESS_CHECK(s_fs->fstat(s_fs, fd, &st) == 0 && st.st_size == size,
+		     worker, "fstat %s size=%lld", path, (long long)st.st_size);
+	STRESS_CHECK(s_fs->fsync(s_fs, fd) == 0, worker, "fsync %s", path);
+	STRESS_CHECK(s_fs->close(s_fs, fd) == 0, worker, "close %s", path);
+    }
+    STRESS_CHECK(s_fs->rename(s_fs, path, newpath) == 0, worker, "rename %s", newpath);
+    STRESS_CHECK(s_fs->rename(s_fs, newpath, "/shared/scratch") == -1 && errno == EXDEV,
+		 worker, "rename %s out of scratch", newpath);
+    STRESS_CHECK(s_fs->stat(s_fs, newpath, &st) == 0 && st.st_size == size,
+		 worker, "stat %s size=%lld", newpath, (long long)st.st_size);
+    STRESS_CHECK(s_fs->unlink(s_fs, newpath) == 0, worker, "unlink %s", newpath);
+    STRESS_CHECK(s_fs->stat(s_fs, newpath, &st) == -1 && errno == ENOENT,
+		 worker, "stat removed %s", newpath);
+    free(wbuf);
+    free(rbuf);
+}
+
+static void* stress_worker(void* arg){
+    int worker = (int)(intptr_t)arg;
+    char dir[64], path[96], shared[96];
+    char *wbuf = malloc(STRESS_FILE_SIZE);
+    char *rbuf = malloc(STRESS_FILE_SIZE);
+    struct stat st;
+    struct iovec iov[2];
+    int i, fd, ret, items;
+
+    snprintf(dir, sizeof(dir), "/worker%d", worker);
+    STRESS_CHECK(s_fs->mkdir(s_fs, dir, 0755) >= 0, worker, "mkdir %s", dir);
+
+    for ( i=0; i < s_iterations; i++ ){
+	/*private file: write, read back and verify*/
+	snprintf(path, sizeof(path), "%s/file%d", dir, i % 16);
+	fd = s_fs->open(s_fs, path, O_CREAT|O_RDWR, 0644);
+	STRESS_CHECK(fd >= 0, worker, "open %s", path);
+	if ( fd >= 0 ){
+	    fill_pattern(wbuf, STRESS_FILE_SIZE, worker, i);
+	    ret = s_fs->pwrite(s_fs, fd, wbuf, STRESS_FILE_SIZE, 0);
+	    STRESS_CHECK(ret == STRESS_FILE_SIZE, worker, "pwrite %s ret=%d", path, ret);
+	    ret = s_fs->pread(s_fs, fd, rbuf, STRESS_FILE_SIZE, 0);
+	    STRESS_CHECK(ret == STRESS_FILE_SIZE, worker, "pread %s ret=%d", path, ret);
+	    STRESS_CHECK(!memcmp(wbuf, rbuf, STRESS_FILE_SIZE), worker, "data mismatch %s", path);
+	    /*scattered write of the same data, then gathered read back*/
+	    iov[0].iov_base = wbuf+STRESS_FILE_SIZE/2; iov[0].iov_len = STRESS_FILE_SIZE/2;
+	    iov[1].iov_base = wbuf;                    iov[1].iov_len = STRESS_FILE_SIZE/2;
+	    ret = s_fs->pwritev(s_fs, fd, iov, 2, STRESS_FILE_SIZE);
+	    STRESS_CHECK(ret == STRESS_FILE_SIZE, worker, "pwritev %s ret=%d", path, ret);
+	    iov[0].iov_base = rbuf+STRESS_FILE_SIZE/2; iov[0].iov_len = STRESS_FILE_SIZE/2;
+	    iov[1].iov_base = rbuf;                    iov[1].iov_len = STRESS_FILE_SIZE/2;
+	    memset(rbuf, 0, STRESS_FILE_SIZE);
+	    ret = s_fs->preadv(s_fs, fd, iov, 2, STRESS_FILE_SIZE);
+	    STRESS_CHECK(ret == STRESS_FILE_SIZE, worker, "preadv %s ret=%d", path, ret);
+	    STRESS_CHECK(!memcmp(wbuf, rbuf, STRESS_FILE_SIZE), worker, "preadv mismatch %s", path);
+	    STRESS_CHECK(s_fs->ftruncate_size(s_fs, fd, STRESS_FILE_SIZE) == 0, worker,
+			 "ftruncate %s", path);
+	    check_read_borrow(worker, fd, path, wbuf);
+	    STRESS_CHECK(s_fs->fstat(s_fs, fd, &st) == 0 && st.st_size == STRESS_FILE_SIZE,
+			 worker, "fstat %s", path);
+	    if ( i % 4 == 0 )
+		STRESS_CHECK((i % 8 ? s_fs->fdatasync(s_fs, fd) : s_fs->fsync(s_fs, fd)) == 0,
+			     worker, "fsync %s", path);
+	    STRESS_CHECK(s_fs->close(s_fs, fd) == 0, worker, "close %s", path);
+	}
+
+	/*shared directory: names are created and removed concurrently, so
+	  only unexpected errors are counted*/
+	snprintf(shared, sizeof(shared), "/shared/name%d", (worker*7+i) % STRESS_SHARED_NAMES);
+	fd = s_fs->open(s_fs, shared, O_CREAT|O_WRONLY, 0644);
+	STRESS_CHECK(fd >= 0, worker, "open %s", shared);
+	if ( fd >= 0 )
+	    STRESS_CHECK(s_fs->close(s_fs, fd) == 0, worker, "close %s", shared);
+	if ( i % 3 == 0 ){
+	    ret = s_fs->unlink(s_fs, shared);
+	    STRESS_CHECK(ret == 0 || errno == ENOENT, worker, "unlink %s", shared);
+	}
+
+	if ( i % 16 == 15 ){
+	    /*all private files exist, plus '.' and '..'*/
+	    items = count_dir_items(worker, dir);
+	    STRESS_CHECK(items == 16+2, worker, "readdir %s items=%d", dir, items);
+	    check_dir_seek(worker, dir, 16+2);
+	    check_dir_stats(worker, dir);
+	    check_write_loan(worker, dir, i);
+	    check_dir_batch(worker, dir, 16+2);
+	    check_deep_path(worker, dir);
+	    check_attr_cache(worker, dir);
+	    check_scratch(worker, i);
+	    check_holes(worker, dir);
+	    items = count_dir_items(worker, "/shared");
+	    STRESS_CHECK(items >= 2 && items <= STRESS_SHARED_NAMES+2, worker,
+			 "readdir /shared items=%d", items);
+	}
+    }
+
+    /*cleanup, and check that removed names are not visible anymore*/
+    for ( i=0; i < 16 && i < s_iterations; i++ ){
+	snprintf(path, sizeof(path), "%s/file%d", dir, i);
+	STRESS_CHECK(s_fs->unlink(s_fs, path) == 0, worker, "unlink %s", path);
+	STRESS_CHECK(s_fs->stat(s_fs, path, &st) == -1 && errno == ENOENT,
+		     worker, "stat removed %s", path);
+    }
+    STRESS_CHECK(s_fs->rmdir(s_fs, dir) == 0, worker, "rmdir %s", dir);
+
+    free(wbuf);
+    free(rbuf);
+    return NULL;
+}
+
+static void print_fsync_stats(){
+    struct FsyncStats stats;
+    int i;
+    zfs_filesystem_fsync_stats(&stats);
+    printf("fsync calls=%llu, zil log writes=%llu\n", 
+	   (unsigned long long)stats.calls, (unsigned long long)stats.commits);
+    for ( i=0; i < FSYNC_LATENCY_BUCKETS; i++ )
+	if ( stats.zil_latency[i] )
+	    printf("  <%llu usec: %llu\n", 1ULL<<i, (unsigned long long)stats.zil_latency[i]);
+}
+
+static void print_cache_stats(){
+    struct CachedLookupStats lookup;
+    struct CachedAttrStats attr;
+    zfs_mounts_cache_stats(&lookup, &attr);
+    printf("dentries hits=%llu, negative hits=%llu, misses=%llu, evictions=%llu\n",
+	   (unsigned long long)lookup.hits, (unsigned long long)lookup.negative_hits,
+	   (unsigned long long)lookup.misses, (unsigned long long)lookup.evictions);
+    printf("attributes hits=%llu, misses=%llu, invalidations=%llu, evictions=%llu\n",
+	   (unsigned long long)attr.hits, (unsigned long long)attr.misses,
+	   (unsigned long long)attr.invalidations, (unsigned long long)attr.evictions);
+}
+
+static void print_scratch_stats(){
+    struct MemFilesystemStats stats;
+    if ( zfs_mounts_scratch_stats(&stats) != 0 )
+	return;
+    printf("scratch memory used=%llu of %llu, spilled files=%llu, spilled bytes=%llu\n",
+	   (unsigned long long)stats.mem_used, (unsigned long long)stats.mem_limit,
+	   (unsigned long long)stats.spilled_files, (unsigned long long)stats.spilled_bytes);
+}
+
+/*wait until arc statistic reaches value
+ *@return 0 if ok, -1 if timed out*/
+static int wait_arc_stat(const char *name, uint64_t value){
+    int i;
+    for ( i=0; i < STRESS_CACHE_TIMEOUT*10; i++ ){
+	if ( arc_stat_get(name) >= value )
+	    return 0;
+	usleep(100000);
+    }
+    return -1;
+}
+
+/*write files [first, first+count) of l2arc check, or only read them
+ *back, and verify data*/
+static void l2arc_files(int first, int count, int write){
+    char path[64];
+    char *wbuf = malloc(STRESS_RECORD_SIZE);
+    char *rbuf = malloc(STRESS_RECORD_SIZE);
+    int i, fd, ret;
+
+    for ( i=first; i < first+count; i++ ){
+	snprintf(path, sizeof(path), "/l2arc/file%d", i);
+	fd = s_fs->open(s_fs, path, write ? O_CREAT|O_TRUNC|O_RDWR : O_RDONLY, 0644);
+	STRESS_CHECK(fd >= 0, 0, "open %s", path);
+	if ( fd < 0 ) continue;
+	fill_pattern(wbuf, STRESS_RECORD_SIZE, i, 0);
+	if ( write ){
+	    ret = s_fs->pwrite(s_fs, fd, wbuf, STRESS_RECORD_SIZE, 0);
+	    STRESS_CHECK(ret == STRESS_RECORD_SIZE, 0, "pwrite %s ret=%d", path, ret);
+	}
+	ret = s_fs->pread(s_fs, fd, rbuf, STRESS_RECORD_SIZE, 0);
+	STRESS_CHECK(ret == STRESS_RECORD_SIZE && !memcmp(wbuf, rbuf, STRESS_RECORD_SIZE),
+		     0, "l2arc data mismatch %s ret=%d", path, ret);
+	STRESS_CHECK(s_fs->close(s_fs, fd) == 0, 0, "close %s", path);
+    }
+    free(wbuf);
+    free(rbuf);
+}
+
+/*wait until two feeds in a row leave arc statistic unchanged
+ *@return 0 if ok, -1 if timed out*/
+static int wait_l2arc_idle(const char *name){
+    uint64_t value, feeds;
+    int i;
+
+    for ( i=0; i < STRESS_CACHE_TIMEOUT; i++ ){
+	value = arc_stat_get(name);
+	feeds = arc_stat_get("l2_feeds");
+	if ( wait_arc_stat("l2_feeds", feeds+2) != 0 )
+	    break;
+	if ( arc_stat_get(name) == value )
+	    return 0;
+    }
+    fprintf(stderr, "l2arc not idle, %s=%llu\n", name,
+	    (unsigned long long)arc_stat_get(name));
+    return -1;
+}
+
+/*write rounds of new files of l2arc check, each one fed before the next,
+ *until feed has written more than cache device holds, so it wrapped at
+ *least once.  Cache device is bigger than arc, otherwise buffers still in
+ *arc would be evicted from device by the wrapped feed and fed again, with
+ *no end
+ *@param files number of files written so far, updated
+ *@return 0 if ok, -1 if failed*/
+static int l2arc_fill(zfsvfs_t *zfsvfs, int *files){
+    uint64_t written = arc_stat_get("l2_write_bytes");
+    int round;
+
+    for ( round=0; round < STRESS_CACHE_ROUNDS; round++ ){
+	if ( arc_stat_get("l2_write_bytes") - written > STRESS_CACHE_SIZE+STRESS_CACHE_SIZE/8 )
+	    return 0;
+	l2arc_files(*files, STRESS_CACHE_FILES, 1);
+	*files += STRESS_CACHE_FILES;
+	/*buffers are fed only when synced*/
+	txg_wait_synced(dmu_objset_pool(zfsvfs->z_os), 0);
+	if ( wait_l2arc_idle("l2_writes_sent") != 0 )
+	    return -1;
+    }
+    fprintf(stderr, "l2arc not wrapped, l2_write_bytes=%llu\n",
+	    (unsigned long long)(arc_stat_get("l2_write_bytes") - written));
+    return -1;
+}
+
+/*Add cache device to pool and fill it past its end, then export pool and
+ *import it again: buffers left on device must be restored from its log
+ *blocks and serve reads of the same data, and the ones written over must
+ *not be.  Feed must go on evicting restored buffers after import.
+ *@return vfs of imported pool, or NULL if failed*/
+static vfs_t* check_l2arc_rebuild(vfs_t *vfs, char *vdev_path, char *cache_path){
+    char *argv[] = { "cache", cache_path };
+    zpool_handle_t *zhp;
+    nvlist_t *nvroot;
+    zfsvfs_t *zfsvfs = vfs->vfs_data;
+    uint64_t rebuilds, aborts, cksum_bad, io_errors, hits;
+    int fd, files = 0, imported;
+
+    fd = open(cache_path, O_CREAT|O_TRUNC|O_WRONLY, 0644);
+    if ( fd < 0 || ftruncate(fd, STRESS_CACHE_SIZE) != 0 ){
+	perror(cache_path);
+	++s_errors;
+	return vfs;
+    }
+    close(fd);
+
+    /*log blocks written only when full or at device end, so they span
+      regions of device which next sweep partly writes over, and feed
+      reaching new buffers behind the ones left by workers*/
+    l2arc_log_secs = 3600;
+    l2arc_headroom = 1024;
+    zhp = zpool_open(g_zfs, STRESS_POOL_NAME);
+    nvroot = zhp != NULL ? make_root_vdev(zhp, B_FALSE, B_FALSE, B_FALSE, B_FALSE,
+					  2, argv) : NULL;
+    if ( nvroot == NULL || zpool_add(zhp, nvroot) != 0 ){
+	fprintf(stderr, "can't add cache device %s\n", cache_path);
+	++s_errors;
+	nvlist_free(nvroot);
+	if ( zhp != NULL ) zpool_close(zhp);
+	return vfs;
+    }
+    nvlist_free(nvroot);
+
+    STRESS_CHECK(s_fs->mkdir(s_fs, "/l2arc", 0755) >= 0, 0, "mkdir /l2arc");
+    if ( l2arc_fill(zfsvfs, &files) != 0 ){
+	++s_errors;
+	zpool_close(zhp);
+	return vfs;
+    }
+    /*log the pending entries, device header is updated by the feed
+      following a log block write*/
+    l2arc_log_secs = 0;
+    if ( wait_l2arc_idle("l2_log_blk_writes") != 0 ){
+	++s_errors;
+	zpool_close(zhp);
+	return vfs;
+    }
+    l2arc_log_secs = 3600;
+
+    rebuilds = arc_stat_get("l2_rebuild_success");
+    aborts = arc_stat_get("l2_rebuild_abort");
+    do_umount(vfs, B_FALSE);
+    if ( zpool_export(zhp, B_FALSE) != 0 ){
+	fprintf(stderr, "can't export pool %s\n", STRESS_POOL_NAME);
+	++s_errors;
+	zpool_close(zhp);
+	return NULL;
+    }
+    zpool_close(zhp);
+    vfs = open_storage(vdev_path, STRESS_POOL_NAME, STRESS_MOUNTDIR, B_FALSE);
+    if ( vfs == NULL ){
+	fprintf(stderr, "can't import pool from %s\n", vdev_path);
+	++s_errors;
+	return NULL;
+    }
+    zfsvfs = vfs->vfs_data;
+    s_fs = zfs_mounts_construct(vfs);
+
+    STRESS_CHECK(wait_arc_stat("l2_rebuild_success", rebuilds+1) == 0, 0,
+		 "l2arc not rebuilt, l2_rebuild_abort=%llu, l2_dev_hdr_errors=%llu",
+		 (unsigned long long)arc_stat_get("l2_rebuild_abort"),
+		 (unsigned long long)arc_stat_get("l2_dev_hdr_errors"));
+    STRESS_CHECK(arc_stat_get("l2_rebuild_abort") == aborts, 0,
+		 "l2arc rebuild aborted, l2_rebuild_abort=%llu",
+		 (unsigned long long)arc_stat_get("l2_rebuild_abort"));
+    STRESS_CHECK(arc_stat_get("l2_rebuild_bufs") >= STRESS_CACHE_FILES, 0,
+		 "l2arc rebuilt l2_rebuild_bufs=%llu",
+		 (unsigned long long)arc_stat_get("l2_rebuild_bufs"));
+    printf("l2arc rebuilt log blocks=%llu, buffers=%llu, present=%llu\n",
+	   (unsigned long long)arc_stat_get("l2_rebuild_log_blks"),
+	   (unsigned long long)arc_stat_get("l2_rebuild_bufs"),
+	   (unsigned long long)arc_stat_get("l2_rebuild_bufs_present"));
+
+    /*arc was flushed by export, so newest data comes from rebuilt buffers,
+      and oldest one, written over on device, from pool without l2arc
+      checksum errors*/
+    cksum_bad = arc_stat_get("l2_cksum_bad");
+    io_errors = arc_stat_get("l2_io_error");
+    hits = arc_stat_get("l2_hits");
+    l2arc_files(files-STRESS_CACHE_FILES, STRESS_CACHE_FILES, 0);
+    STRESS_CHECK(arc_stat_get("l2_hits") >= hits+STRESS_CACHE_FILES, 0,
+		 "l2arc reads l2_hits=%llu",
+		 (unsigned long long)(arc_stat_get("l2_hits")-hits));
+    l2arc_files(0, files-STRESS_CACHE_FILES, 0);
+
+    /*wrap device again, over restored buffers which must get evicted*/
+    imported = files;
+    STRESS_CHECK(l2arc_fill(zfsvfs, &files) == 0, 0, "l2arc fill after import");
+    l2arc_files(0, files, 0);
+    STRESS_CHECK(arc_stat_get("l2_cksum_bad") == cksum_bad &&
+		 arc_stat_get("l2_io_error") == io_errors, 0,
+		 "l2arc stale buffers, l2_cksum_bad=%llu, l2_io_error=%llu",
+		 (unsigned long long)(arc_stat_get("l2_cksum_bad")-cksum_bad),
+		 (unsigned long long)(arc_stat_get("l2_io_error")-io_errors));
+    printf("l2arc files written=%d, after import=%d, hits=%llu\n",
+	   files, files-imported, (unsigned long long)(arc_stat_get("l2_hits")-hits));
+    return vfs;
+}
+
+static void usage(){
+    fprintf(stderr, "Usage: zrt-stress [-f vdev_file] [-c cache_file] [-t threads] "
+	    "[-n iterations]\n");
+    exit(2);
+}
+
+int main(int argc, char *argv[])
+{
+    char *vdev_path = "/tmp/zrt-stress.img";
+    char *cache_path = NULL;
+    int threads = 8;
+    int c, i, fd;
+    pthread_t *tids;
+
+    while ((c = getopt(argc, argv, "f:c:t:n:")) != -1) {
+	switch (c) {
+	case 'f': vdev_path = optarg; break;
+	case 'c': cache_path = optarg; break;
+	case 't': threads = atoi(optarg); break;
+	case 'n': s_iterations = atoi(optarg); break;
+	default: usage();
+	}
+    }
+    if ( threads <= 0 || s_iterations <= 0 )
+	usage();
+
+    fd = open(vdev_path, O_CREAT|O_TRUNC|O_WRONLY, 0644);
+    if ( fd < 0 || ftruncate(fd, STRESS_VDEV_SIZE) != 0 ){
+	perror(vdev_path);
+	return 1;
+    }
+    close(fd);
+
+    if ( do_init() != 0 ){
+	do_exit();
+	return 1;
+    }
+
+    vfs_t *vfs = create_storage(vdev_path, STRESS_POOL_NAME, STRESS_MOUNTDIR);
+    if ( vfs == NULL ){
+	fprintf(stderr, "can't create pool on %s\n", vdev_path);
+	do_exit();
+	return 1;
+    }
+    const char *scratch[] = { STRESS_SCRATCH_DIR };
+    s_fs = zfs_scratch_mounts_construct(vfs, scratch, 1, STRESS_SCRATCH_LIMIT);
+    if ( s_fs->mkdir(s_fs, "/shared", 0755) < 0 ){
+	fprintf(stderr, "mkdir /shared failed, errno=%d\n", errno);
+	return 1;
+    }
+
+    tids = malloc(sizeof(pthread_t)*threads);
+    for ( i=0; i < threads; i++ )
+	VERIFY(pthread_create(&tids[i], NULL, stress_worker, (void*)(intptr_t)i) == 0);
+    for ( i=0; i < threads; i++ )
+	pthread_join(tids[i], NULL);
+    free(tids);
+    print_fsync_stats();
+    print_cache_stats();
+    print_scratch_stats();
+    if ( cache_path != NULL )
+	vfs = check_l2arc_rebuild(vfs, vdev_path, cache_path);
+
+    if ( vfs != NULL )
+	do_umount(vfs, B_FALSE);
+    do_exit();
+    unlink(vdev_path);
+    if ( cache_path != NULL )
+	unlink(cache_path);
+
+    if ( s_errors ){
+	fprintf(stderr, "Test failed: %d errors\n", s_errors);
+	return 1;
+    }
+    printf("Test successful\n");
+    return 0;
+}